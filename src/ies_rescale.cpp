@@ -67,24 +67,214 @@
 
 #include <stdlib.h>
 #include <iostream>
-#include <cstdarg>
+#include <type_traits>
 #include <string>
 #include <cmath>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
+#include <cstdio>
 #include <cassert>
-#include <iterator>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <charconv>
+#include <mutex>
+
+#if defined(_WIN32)
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#	include <io.h>
+#	include <fcntl.h>
+#	include <sys/stat.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
 
 #include "ies_rescale.h"
+#include "ies_rescale_simd.h"
+#include "ies_rescale_photometry.h"
 
 namespace ies_rescale {
 
+	// Cursor over the raw IESNA-format data that the parsing functions advance through without copying it
+	struct ie_cursor {
+		const char* p;		// Current position
+		const char* end;	// End of the data
+	};
+
 	// Forward declarations
-	static auto ie_populate_array(memstream& file_stream, const std::size_t size) -> std::vector<float>;
-	static auto ie_populate_list(memstream& file_stream, const std::string_view format, ...) -> bool;
-	static auto ie_read_tilt(memstream& file_stream) -> std::optional<IE_Data::Lamp::Tilt>;
-	static auto ie_get_line(memstream& file_stream) -> std::string;
+	static auto ie_populate_array(ie_cursor& cursor, float* values, const std::size_t size) -> bool;
+	template <typename... Values>
+	static auto ie_populate_list(ie_cursor& cursor, Values&... values) -> bool;
+	static auto ie_read_tilt(ie_cursor& cursor) -> std::optional<IE_Data::Lamp::Tilt>;
+	static auto ie_get_line(ie_cursor& cursor) -> std::string_view;
+	static auto ie_parse_int(const char* first, const char* last, int& value) -> const char*;
+	static auto ie_parse_float(const char* first, const char* last, float& value) -> const char*;
+
+	mapped_file::mapped_file(mapped_file&& other) noexcept
+		: data_(other.data_)
+		, size_(other.size_)
+		, mapped_(other.mapped_)
+		, fallback_(std::move(other.fallback_)) {
+		// Moving a vector keeps its storage, so data_ remains valid in the fallback case as well
+		other.data_ = nullptr;
+		other.size_ = 0;
+		other.mapped_ = false;
+	}
+
+	mapped_file::~mapped_file() {
+		release();
+	}
+
+	auto mapped_file::operator=(mapped_file&& other) noexcept -> mapped_file& {
+		if (this != &other) {
+			release();
+
+			data_ = other.data_;
+			size_ = other.size_;
+			mapped_ = other.mapped_;
+			fallback_ = std::move(other.fallback_);
+
+			other.data_ = nullptr;
+			other.size_ = 0;
+			other.mapped_ = false;
+		}
+
+		return *this;
+	}
+
+	void mapped_file::release() {
+		if (mapped_ && data_) {
+#if defined(_WIN32)
+			UnmapViewOfFile(data_);
+#else
+			munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+		}
+
+		data_ = nullptr;
+		size_ = 0;
+		mapped_ = false;
+		fallback_.clear();
+	}
+
+	auto mapped_file::open(const std::string_view file_name) -> std::optional<mapped_file> {
+		auto file = mapped_file{};
+
+#if defined(_WIN32)
+		const auto handle = CreateFileA(std::string{ file_name }.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (handle == INVALID_HANDLE_VALUE) {
+			return {};
+		}
+
+		auto file_size = LARGE_INTEGER{};
+		if (!GetFileSizeEx(handle, &file_size)) {
+			CloseHandle(handle);
+			return {};
+		}
+
+		if (file_size.QuadPart > 0) {
+			// The view keeps the mapping alive, so both handles can be closed right away
+			const auto mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping) {
+				const auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(mapping);
+
+				if (view) {
+					file.data_ = static_cast<const uint8_t*>(view);
+					file.size_ = static_cast<std::size_t>(file_size.QuadPart);
+					file.mapped_ = true;
+				}
+			}
+
+			if (!file.mapped_) {
+				// Fall back to reading the file into an owned buffer
+				file.fallback_.resize(static_cast<std::size_t>(file_size.QuadPart));
+
+				auto offset = std::size_t{ 0 };
+				while (offset < file.fallback_.size()) {
+					const auto chunk = static_cast<DWORD>(std::min<std::size_t>(file.fallback_.size() - offset, 1u << 30));
+					auto bytes_read = DWORD{ 0 };
+					if (!ReadFile(handle, file.fallback_.data() + offset, chunk, &bytes_read, nullptr) || bytes_read == 0) {
+						break;
+					}
+					offset += bytes_read;
+				}
+
+				file.fallback_.resize(offset);
+				file.data_ = file.fallback_.data();
+				file.size_ = file.fallback_.size();
+			}
+		}
+
+		CloseHandle(handle);
+#else
+		const auto fd = ::open(std::string{ file_name }.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return {};
+		}
+
+		struct stat file_stat {};
+		if (fstat(fd, &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) {
+			::close(fd);
+			return {};
+		}
+
+		if (S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+			const auto size = static_cast<std::size_t>(file_stat.st_size);
+			const auto view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED) {
+				// The file is parsed front to back exactly once
+				madvise(view, size, MADV_SEQUENTIAL);
+
+				file.data_ = static_cast<const uint8_t*>(view);
+				file.size_ = size;
+				file.mapped_ = true;
+			}
+		}
+
+		if (!file.mapped_) {
+			// Fall back to reading the file into an owned buffer (which also handles non-regular files that report a size of 0)
+			auto capacity = std::max<std::size_t>(S_ISREG(file_stat.st_mode) ? static_cast<std::size_t>(file_stat.st_size) : 0, 4096);
+			file.fallback_.resize(capacity);
+
+			auto offset = std::size_t{ 0 };
+			for (; ; ) {
+				if (offset == file.fallback_.size()) {
+					file.fallback_.resize(file.fallback_.size() * 2);
+				}
+
+				const auto bytes_read = ::read(fd, file.fallback_.data() + offset, file.fallback_.size() - offset);
+				if (bytes_read < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					::close(fd);
+					return {};
+				}
+				if (bytes_read == 0) {
+					break;
+				}
+				offset += static_cast<std::size_t>(bytes_read);
+			}
+
+			file.fallback_.resize(offset);
+			file.data_ = file.fallback_.data();
+			file.size_ = file.fallback_.size();
+		}
+
+		::close(fd);
+#endif
+
+		return std::optional<mapped_file>{ std::move(file) };
+	}
 
 	/*
 	 *************************************************************************
@@ -135,40 +325,13 @@ namespace ies_rescale {
 	 */
 
 	auto read_file_to_stream(const std::string_view fname) -> std::optional<memstream> {
-		auto file_data = std::vector<uint8_t>{};
-		{
-			// Open the IES file
-			auto file = std::ifstream{ std::string{fname}, std::ios::binary };
-			if (!file || !file.is_open()) {
-				return {};
-			}
-
-			// Stop eating new lines in binary mode
-			file.unsetf(std::ios::skipws);
-
-			// Get the file size
-			auto fileSize = std::streampos{};
-
-			file.seekg(0, std::ios::end);
-			fileSize = file.tellg();
-			file.seekg(0, std::ios::beg);
-
-			// Reserve capacity
-			file_data.reserve(fileSize);
-
-			// Read the data
-			file_data.insert(
-				file_data.begin(),
-				std::istream_iterator<uint8_t>(file),
-				std::istream_iterator<uint8_t>()
-			);
-		}
-
-		if (file_data.empty()) {
+		// Map the IES file, so that the stream can read directly from the file's pages without any intermediate copies
+		auto file = mapped_file::open(fname);
+		if (!file || file->empty()) {
 			return {};
 		}
 
-		return std::optional<memstream>{ file_data };
+		return std::optional<memstream>{ std::move(*file) };
 	}
 
 	auto convert_stream_to_data(memstream& file_stream, const std::string_view ies_file_name) -> std::optional<IE_Data> {
@@ -178,8 +341,12 @@ namespace ies_rescale {
 		// Save file name (optional)
 		data.file.name = ies_file_name;
 
+		// Parse the unread part of the stream in place
+		const auto unread = file_stream.unread();
+		auto cursor = ie_cursor{ unread.data(), unread.data() + unread.size() };
+
 		// Read the first line
-		auto text_buffer = ie_get_line(file_stream);
+		auto text_buffer = ie_get_line(cursor);
 		if (text_buffer.empty()) {
 			return {};
 		}
@@ -202,12 +369,12 @@ namespace ies_rescale {
 				// File is presumably LM-63-1986 format
 				data.file.format = IE_Data::File::Format::IESNA_86;
 
-				file_stream.rewind(); // First line is a label line or "TILT="
+				cursor.p = unread.data(); // First line is a label line or "TILT="
 			}
 
 			// Read label lines
 			while (true) {
-				text_buffer = ie_get_line(file_stream);
+				text_buffer = ie_get_line(cursor);
 				if (text_buffer.empty()) {
 					return {};
 				}
@@ -218,11 +385,11 @@ namespace ies_rescale {
 				}
 
 				// Instantiate a new label
-				data.labels.push_back(text_buffer);
+				data.labels.emplace_back(text_buffer);
 			}
 		}
 
-		auto tilt_str = std::string{};               // TILT line parameter
+		auto tilt_str = std::string_view{};          // TILT line parameter
 
 		{
 			tilt_str = text_buffer.substr(5);  // Point to TILT line parameter
@@ -242,7 +409,10 @@ namespace ies_rescale {
 					}
 					else {
 						// Read the TILT data from the TILT data file
-						auto tilt = ie_read_tilt(*tilt_stream);
+						const auto tilt_unread = tilt_stream->unread();
+						auto tilt_cursor = ie_cursor{ tilt_unread.data(), tilt_unread.data() + tilt_unread.size() };
+
+						auto tilt = ie_read_tilt(tilt_cursor);
 						if (!tilt) {
 							return {};
 						}
@@ -252,7 +422,7 @@ namespace ies_rescale {
 				}
 				else {
 					// Read the TILT data from the IESNA data file
-					auto tilt = ie_read_tilt(file_stream);
+					auto tilt = ie_read_tilt(cursor);
 					if (!tilt) {
 						return {};
 					}
@@ -264,15 +434,14 @@ namespace ies_rescale {
 
 		{
 			// Read in next two lines
-			const char str[] = "%d%f%f%d%d%d%d%f%f%f";
 			if (
 				!ie_populate_list(
-					file_stream, str,
-					&(data.lamp.num_lamps), &(data.lamp.lumens_lamp),
-					&(data.lamp.multiplier), &(data.photo.num_vert_angles),
-					&(data.photo.num_horz_angles), &(data.photo.gonio_type),
-					&(data.units), &(data.dim.width), &(data.dim.length),
-					&(data.dim.height)
+					cursor,
+					data.lamp.num_lamps, data.lamp.lumens_lamp,
+					data.lamp.multiplier, data.photo.num_vert_angles,
+					data.photo.num_horz_angles, data.photo.gonio_type,
+					data.units, data.dim.width, data.dim.length,
+					data.dim.height
 				)
 			) {
 				return {};
@@ -281,177 +450,276 @@ namespace ies_rescale {
 		}
 
 		{
-			const char str[] = "%f%f%f";
-			if (!ie_populate_list(file_stream, str, &(data.elec.ball_factor), &(data.elec.blp_factor), &(data.elec.input_watts))) {
+			if (!ie_populate_list(cursor, data.elec.ball_factor, data.elec.blp_factor, data.elec.input_watts)) {
 				return {};
 			}
 		}
 
+		if (data.photo.num_vert_angles <= 0 || data.photo.num_horz_angles <= 0) {
+			return {};
+		}
+
 		{
 			// Read in vertical angles array
-			data.photo.vert_angles = ie_populate_array(file_stream, data.photo.num_vert_angles);
-			if (data.photo.vert_angles.empty()) {
+			data.photo.vert_angles.resize(data.photo.num_vert_angles);
+			if (!ie_populate_array(cursor, data.photo.vert_angles.data(), data.photo.vert_angles.size())) {
 				return {};
 			}
 			// Read in horizontal angles array
-			data.photo.horz_angles = ie_populate_array(file_stream, data.photo.num_horz_angles);
-			if (data.photo.horz_angles.empty()) {
+			data.photo.horz_angles.resize(data.photo.num_horz_angles);
+			if (!ie_populate_array(cursor, data.photo.horz_angles.data(), data.photo.horz_angles.size())) {
 				return {};
 			}
 		}
 
 		{
-			// Allocate space for the candela values array pointers
-			data.photo.candelas = std::vector<std::vector<float>>(data.photo.num_horz_angles);
+			// Allocate space for all the candela values at once
+			data.photo.candelas = candela_matrix(data.photo.num_horz_angles, data.photo.num_vert_angles);
 
 			// Read in candela values arrays
 			for (int i = 0; i < data.photo.num_horz_angles; i++) {
 				// Read in candela values
-				data.photo.candelas[i] = ie_populate_array(file_stream, data.photo.num_vert_angles);
-				if (data.photo.candelas[i].empty()) {
+				const auto row = data.photo.candelas.row(i);
+				if (!ie_populate_array(cursor, row.data(), row.size())) {
 					return {};
 				}
 			}
 		}
 
+		// Leave the stream positioned right after the parsed data
+		file_stream.consume(static_cast<std::size_t>(cursor.p - unread.data()));
+
 		return std::optional<IE_Data>{std::move(data)};
 	}
 
 
-	auto convert_data_to_buffer(const IE_Data& data) -> std::optional<std::vector<uint8_t>> {
+	// Formats the IESNA-format output into a fixed-size buffer, handing it over to the sink each time it fills up
+	class ie_writer {
+	public:
+		static constexpr auto buffer_size = std::size_t{ 64 * 1024 };
 
-		auto buffer = std::vector<uint8_t>{};
+		explicit ie_writer(ies_sink& sink) : sink_(sink), buffer_(new char[buffer_size]) {}
 
-		auto append_vector = [&buffer](const std::vector<uint8_t>& v) {
-			buffer.insert(std::end(buffer), std::begin(v), std::end(v));
-			};
+		void append(const std::string_view s, const std::string_view s_end = "\n") {
+			append_chars(s);
+			append_chars(s_end);
+		}
 
-		auto append_string = [&append_vector](const std::string& s, const std::string s_end = "\n") {
-			const auto s_final = s + s_end;
-			const auto v = std::vector<uint8_t>(s_final.begin(), s_final.end());
-			append_vector(v);
-			};
+		void append_int(const int i, const std::string_view s_end = "\n") {
+			// Large enough for any int
+			auto* p = reserve(16);
+			const auto [p_end, ec] = std::to_chars(p, p + 16, i);
+			size_ += static_cast<std::size_t>(p_end - p);
+			append_chars(s_end);
+		}
 
-		auto append_int = [&append_vector](const int i, const std::string s_end = "\n") {
-			const auto s_final = std::to_string(i) + s_end;
-			const auto v = std::vector<uint8_t>(s_final.begin(), s_final.end());
-			append_vector(v);
-			};
+		void append_float(const float f, const std::string_view s_end = "\n", const int precision = 2) {
+			// Large enough for any float in the fixed notation
+			auto* p = reserve(64);
+			auto length = std::size_t{ 0 };
+#if defined(__cpp_lib_to_chars)
+			const auto [p_end, ec] = std::to_chars(p, p + 64, f, std::chars_format::fixed, precision);
+			length = static_cast<std::size_t>(p_end - p);
+#else
+			// The standard library lacks the floating point std::to_chars overloads (e.g. older libc++), so fall back to snprintf(), which produces the same digits.
+			length = static_cast<std::size_t>(std::max(std::snprintf(p, 64, "%.*f", precision, static_cast<double>(f)), 0));
+#endif
+
+			if (std::memchr(p, '.', length) != nullptr) {
+				// Remove trailing zeros
+				while (p[length - 1] == '0') {
+					--length;
+				}
+				// Remove trailing decimal point if it's the last character
+				if (p[length - 1] == '.') {
+					--length;
+				}
+			}
 
-		auto append_float = [&append_vector](const float f, const std::string s_end = "\n", const std::streamsize precision = 2) {
+			size_ += length;
+			append_chars(s_end);
+		}
 
-			auto oss = std::ostringstream{};
-			oss << std::fixed << std::setprecision(precision) << f;
-			auto s = oss.str();
-			// Remove trailing zeros
-			s.erase(s.find_last_not_of('0') + 1, std::string::npos);
-			// Remove trailing decimal point if it's the last character
-			if (s.back() == '.') {
-				s.pop_back();
+		//! Hand the remaining output over to the sink
+		auto finish() -> bool {
+			flush();
+			return ok_ && sink_.flush();
+		}
+
+	private:
+		void append_chars(const std::string_view s) {
+			if (s.size() > buffer_size - size_) {
+				flush();
+
+				// Too large to be buffered at all (e.g. a huge label), so write it directly
+				if (s.size() > buffer_size) {
+					ok_ = ok_ && sink_.write(s.data(), s.size());
+					return;
+				}
 			}
 
-			const auto s_final = s + s_end;
-			const auto v = std::vector<uint8_t>(s_final.begin(), s_final.end());
-			append_vector(v);
-			};
+			std::memcpy(buffer_.get() + size_, s.data(), s.size());
+			size_ += s.size();
+		}
 
-		// Output the format string
-		{
-			auto format = std::string{};
+		// Make sure there's room for at least the specified number of bytes at the end of the buffer
+		auto reserve(const std::size_t size) -> char* {
+			if (size > buffer_size - size_) {
+				flush();
+			}
+			return buffer_.get() + size_;
+		}
 
-			switch (data.file.format) {
-			case IE_Data::File::Format::IESNA_95:
-				format = "IESNA:LM-63-1995";
-				break;
+		void flush() {
+			if (size_ > 0) {
+				// Once a write has failed, the rest of the output is dropped
+				ok_ = ok_ && sink_.write(buffer_.get(), size_);
+				size_ = 0;
+			}
+		}
 
-			case IE_Data::File::Format::IESNA_02:
-				format = "IESNA:LM-63-2002";
-				break;
+		ies_sink& sink_;
+		std::unique_ptr<char[]> buffer_;
+		std::size_t size_ = 0;
+		bool ok_ = true;
+	};
 
-			case IE_Data::File::Format::IESNA_91:
-				format = "IESNA91";
-				break;
+	static auto ie_format_string(const IE_Data::File::Format format) -> std::string_view {
+		switch (format) {
+		case IE_Data::File::Format::IESNA_95:
+			return "IESNA:LM-63-1995";
 
-			case IE_Data::File::Format::IESNA_86:
-				format = "IESNA86";
-				break;
+		case IE_Data::File::Format::IESNA_02:
+			return "IESNA:LM-63-2002";
 
-			default:
-				return {};
+		case IE_Data::File::Format::IESNA_91:
+			return "IESNA91";
+
+		case IE_Data::File::Format::IESNA_86:
+			return "IESNA86";
+
+		default:
+			return {};
+		}
+	}
+
+	auto buffer_sink::write(const char* data, const std::size_t size) -> bool {
+		buffer_.insert(std::end(buffer_), data, data + size);
+		return true;
+	}
+
+	auto ostream_sink::write(const char* data, const std::size_t size) -> bool {
+		return static_cast<bool>(stream_.write(data, static_cast<std::streamsize>(size)));
+	}
+
+	auto ostream_sink::flush() -> bool {
+		return static_cast<bool>(stream_.flush());
+	}
+
+	auto fd_sink::write(const char* data, const std::size_t size) -> bool {
+		auto written = std::size_t{ 0 };
+		while (written < size) {
+#if defined(_WIN32)
+			const auto chunk = static_cast<unsigned int>(std::min<std::size_t>(size - written, 1u << 30));
+			const auto result = ::_write(fd_, data + written, chunk);
+#else
+			const auto result = ::write(fd_, data + written, size - written);
+#endif
+			if (result < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
 			}
 
-			append_string(format);
+			// write(2) may write fewer bytes than requested (e.g. for pipes), in which case the rest is written next
+			written += static_cast<std::size_t>(result);
 		}
 
+		return true;
+	}
+
+	auto write_ies(const IE_Data& data, ies_sink& sink) -> bool {
+
+		// Output the format string
+		const auto format = ie_format_string(data.file.format);
+		if (format.empty()) {
+			return false;
+		}
+
+		auto writer = ie_writer{ sink };
+		writer.append(format);
+
 		// Output the labels
 		for (const auto& label : data.labels) {
-			append_string(label);
+			writer.append(label);
 		}
 
 		// Output the tilt data
 		if (data.lamp.tilt_fname == "NONE") {
-			append_string("TILT=" + data.lamp.tilt_fname);
+			writer.append("TILT=", "");
+			writer.append(data.lamp.tilt_fname);
 		}
 		else {
 			// Otherwise, we always embed (i.e. INCLUDE) the TILT data in the output .ies file
-			append_string("TILT=INCLUDE");
-			append_int((int)data.lamp.tilt.orientation);
-			append_int(data.lamp.tilt.num_pairs);
+			writer.append("TILT=INCLUDE");
+			writer.append_int((int)data.lamp.tilt.orientation);
+			writer.append_int(data.lamp.tilt.num_pairs);
 
 			for (int i = 0; i < (int)data.lamp.tilt.angles.size(); ++i) {
 				const auto angle = data.lamp.tilt.angles[i];
 				if (i < (int)data.lamp.tilt.angles.size() - 1)
-					append_float(angle, " ");
+					writer.append_float(angle, " ");
 				else
-					append_float(angle, "\n");
+					writer.append_float(angle, "\n");
 			}
 
 			for (int i = 0; i < (int)data.lamp.tilt.mult_factors.size(); ++i) {
 				const auto mult_factor = data.lamp.tilt.mult_factors[i];
 				if (i < (int)data.lamp.tilt.mult_factors.size() - 1)
-					append_float(mult_factor, " ");
+					writer.append_float(mult_factor, " ");
 				else
-					append_float(mult_factor, "\n");
+					writer.append_float(mult_factor, "\n");
 			}
 		}
 
 		{
 			// Output lamp parameters
-			append_int(data.lamp.num_lamps, " ");
-			append_float(data.lamp.lumens_lamp, " ");
-			append_float(data.lamp.multiplier, " ");
-			append_int(data.photo.num_vert_angles, " ");
-			append_int(data.photo.num_horz_angles, " ");
-			append_int(data.photo.gonio_type, " ");
-			append_int(data.units, " ");
-			append_float(data.dim.width, " ");
-			append_float(data.dim.length, " ");
-			append_float(data.dim.height, "\n");
+			writer.append_int(data.lamp.num_lamps, " ");
+			writer.append_float(data.lamp.lumens_lamp, " ");
+			writer.append_float(data.lamp.multiplier, " ");
+			writer.append_int(data.photo.num_vert_angles, " ");
+			writer.append_int(data.photo.num_horz_angles, " ");
+			writer.append_int(data.photo.gonio_type, " ");
+			writer.append_int(data.units, " ");
+			writer.append_float(data.dim.width, " ");
+			writer.append_float(data.dim.length, " ");
+			writer.append_float(data.dim.height, "\n");
 		}
 
 		{
 			// Output elec parameters
-			append_float(data.elec.ball_factor, " ");
-			append_float(data.elec.blp_factor, " ");
-			append_float(data.elec.input_watts, "\n");
+			writer.append_float(data.elec.ball_factor, " ");
+			writer.append_float(data.elec.blp_factor, " ");
+			writer.append_float(data.elec.input_watts, "\n");
 		}
 
 		// Output vertical angles
 		for (int i = 0; i < data.photo.num_vert_angles; ++i) {
 			const float angle = data.photo.vert_angles[i];
 			if (i < data.photo.num_vert_angles - 1)
-				append_float(angle, " ");
+				writer.append_float(angle, " ");
 			else
-				append_float(angle, "\n");
+				writer.append_float(angle, "\n");
 		}
 
 		// Output horizontal angles
 		for (int i = 0; i < data.photo.num_horz_angles; ++i) {
 			const float angle = data.photo.horz_angles[i];
 			if (i < data.photo.num_horz_angles - 1)
-				append_float(angle, " ");
+				writer.append_float(angle, " ");
 			else
-				append_float(angle, "\n");
+				writer.append_float(angle, "\n");
 		}
 
 		// Output candela values arrays
@@ -460,12 +728,39 @@ namespace ies_rescale {
 			for (int j = 0; j < data.photo.num_vert_angles; ++j) {
 				const float candela = data.photo.candelas[i][j];
 				if (j < data.photo.num_vert_angles - 1)
-					append_float(candela, " ");
+					writer.append_float(candela, " ");
 				else
-					append_float(candela, "\n");
+					writer.append_float(candela, "\n");
 			}
 		}
 
+		return writer.finish();
+	}
+
+	auto convert_data_to_buffer(const IE_Data& data) -> std::optional<std::vector<uint8_t>> {
+
+		auto buffer = std::vector<uint8_t>{};
+
+		{
+			// Pre-size the output: the label lines plus about 8 characters per number (e.g. "1234.56 ")
+			auto estimated_size = std::size_t{ 256 };
+			for (const auto& label : data.labels) {
+				estimated_size += label.size() + 1;
+			}
+
+			const auto num_values =
+				data.lamp.tilt.angles.size() + data.lamp.tilt.mult_factors.size()
+				+ data.photo.vert_angles.size() + data.photo.horz_angles.size()
+				+ data.photo.candelas.values().size();
+
+			buffer.reserve(estimated_size + num_values * 8);
+		}
+
+		auto sink = buffer_sink{ buffer };
+		if (!write_ies(data, sink)) {
+			return {};
+		}
+
 		return std::optional<std::vector<uint8_t>>{std::move(buffer)};
 	}
 
@@ -485,6 +780,268 @@ namespace ies_rescale {
 		return true;
 	}
 
+	auto write_ies_to_file(const IE_Data& data, const std::string_view file_name) -> bool {
+		const auto fname = std::string{ file_name };
+#if defined(_WIN32)
+		const auto fd = ::_open(fname.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		const auto fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+		if (fd < 0) {
+			std::cerr << "Could not open file " << file_name << "\n";
+			return false;
+		}
+
+		auto sink = fd_sink{ fd };
+		const auto written = write_ies(data, sink);
+#if defined(_WIN32)
+		const auto closed = ::_close(fd) == 0;
+#else
+		const auto closed = ::close(fd) == 0;
+#endif
+		if (!written || !closed) {
+			std::cerr << "Could not write to file " << file_name << "\n";
+			return false;
+		}
+
+		return true;
+	}
+
+
+	auto hash_bytes(const void* data, const std::size_t size, const uint64_t seed) -> uint64_t {
+		// MurmurHash64A by Austin Appleby (public domain)
+		constexpr auto m = uint64_t{ 0xc6a4a7935bd1e995ull };
+		constexpr auto r = 47;
+
+		auto h = seed ^ (size * m);
+
+		const auto* p = static_cast<const uint8_t*>(data);
+		const auto* const p_end = p + (size & ~std::size_t{ 7 });
+		for (; p != p_end; p += 8) {
+			auto k = uint64_t{ 0 };
+			std::memcpy(&k, p, sizeof(k));
+
+			k *= m;
+			k ^= k >> r;
+			k *= m;
+
+			h ^= k;
+			h *= m;
+		}
+
+		switch (size & 7) {
+		case 7: h ^= uint64_t(p[6]) << 48; [[fallthrough]];
+		case 6: h ^= uint64_t(p[5]) << 40; [[fallthrough]];
+		case 5: h ^= uint64_t(p[4]) << 32; [[fallthrough]];
+		case 4: h ^= uint64_t(p[3]) << 24; [[fallthrough]];
+		case 3: h ^= uint64_t(p[2]) << 16; [[fallthrough]];
+		case 2: h ^= uint64_t(p[1]) << 8; [[fallthrough]];
+		case 1: h ^= uint64_t(p[0]);
+			h *= m;
+		};
+
+		h ^= h >> r;
+		h *= m;
+		h ^= h >> r;
+
+		return h;
+	}
+
+
+	// The cone angle independent part of the rescale tables
+	struct rescale_angle_basis {
+		std::vector<double> vert_angles_orig;		// The vertical angles mirrored into the bottom hemisphere
+		std::vector<double> projected_on_y_orig;	// The projections of a unit candela value onto the Y-axis
+		std::vector<double> projected_on_x_orig;	// The projections of a unit candela value onto the X-axis
+		std::vector<char> is_top_hemisphere;		// Whether the vertical angles lie in the top hemisphere
+		std::vector<char> is_angle_almost_90;		// Whether the vertical angles are (close to) horizontal
+	};
+
+	constexpr auto PI = 3.14159265358979323846;
+
+	template <typename T>
+	static auto degrees_to_radians(const T degrees) -> T {
+		return degrees * (T)(PI / 180.0);
+	}
+
+	template <typename T>
+	static auto radians_to_degrees(const T radians) -> T {
+		return radians * (T)(180.0 / PI);
+	}
+
+	//! Compute the cone angle independent part of the per-vertical-angle rescale tables.
+	//! The tables are only computed once per vertical angle, so they're computed in double precision (which also makes the 180 degree cone angle an exact identity).
+	//! \param[in]		vert_angles					The vertical angles of the IES data to rescale
+	//! \return			rescale_angle_basis
+	static auto make_rescale_angle_basis(const std::vector<float>& vert_angles) -> rescale_angle_basis {
+
+		static const auto horizontal_threshold_angle_rad = degrees_to_radians(90. + 1.);
+		static const auto threshold_projected_on_y = std::abs(std::cos(horizontal_threshold_angle_rad));
+
+		const auto size = vert_angles.size();
+
+		auto basis = rescale_angle_basis{};
+		basis.vert_angles_orig.resize(size);
+		basis.projected_on_y_orig.resize(size);
+		basis.projected_on_x_orig.resize(size);
+		basis.is_top_hemisphere.resize(size);
+		basis.is_angle_almost_90.resize(size);
+
+		for (auto j = std::size_t{ 0 }; j < size; ++j) {
+			const auto vert_angle = double{ vert_angles[j] };
+
+			const auto is_top_hemisphere = vert_angle > 90.;
+
+			// The projections below are those of a unit candela value; the actual ones are proportional to the candela value.
+			const auto vert_angle_orig = is_top_hemisphere ? 180. - vert_angle : vert_angle;
+			const auto vert_angle_orig_rad = degrees_to_radians(vert_angle_orig);
+
+			basis.vert_angles_orig[j] = vert_angle_orig;
+			basis.projected_on_y_orig[j] = std::cos(vert_angle_orig_rad);
+			basis.projected_on_x_orig[j] = std::sin(vert_angle_orig_rad);
+			basis.is_top_hemisphere[j] = is_top_hemisphere;
+
+			// Detect the 90 (or close to it) degree vertical angle case
+			basis.is_angle_almost_90[j] = std::abs(basis.projected_on_y_orig[j]) <= threshold_projected_on_y;
+		}
+
+		return basis;
+	}
+
+	//! Compute the per-vertical-angle rescale tables for the specified cone angle.
+	//! Both the rescaled angle and the ratio between the rescaled and the original candela values only depend on the vertical angle,
+	//! so a profile can be rescaled by computing them once per vertical angle rather than once per candela value.
+	//! \param[in]		basis						The cone angle independent part of the tables
+	//! \param[in]		rescale_cone_angle			The new cone in degrees to rescale the vertical angles to
+	//! \param[in]		preserve_intensity			The flag indicating whether to preserve the intensity values of the original IES data
+	//! \param[out]	scaled_vert_angles			The rescaled vertical angles
+	//! \param[out]	candela_scales				The ratios between the rescaled and the original candela values
+	static void fill_rescale_angle_table(const rescale_angle_basis& basis, const float rescale_cone_angle, const bool preserve_intensity, float* scaled_vert_angles, float* candela_scales) {
+
+		// Calculate the uniform scale factor that will be applied to all horizontal projected values.
+		// Note, #rescale_cone_angle values of/close to 0 will cause the emission profile to be 'squashed' into a single vertical line.
+		const auto projected_x_scale = std::sin(degrees_to_radians(double{ rescale_cone_angle } * .5));
+		assert((projected_x_scale >= 0. && projected_x_scale <= 1.) && "Invalid projected x scale");
+
+		for (auto j = std::size_t{ 0 }; j < basis.vert_angles_orig.size(); ++j) {
+			const auto vert_angle_orig = basis.vert_angles_orig[j];
+			const auto projected_on_y_orig = basis.projected_on_y_orig[j];
+			const auto projected_on_x_orig = basis.projected_on_x_orig[j];
+			const auto is_angle_almost_90 = basis.is_angle_almost_90[j] != 0;
+
+			auto scaled_angle = double{ 0. };
+			auto candela_scale = double{ 1. };
+
+			if (!preserve_intensity) {
+				// Uniformly shift/scale the projected X-axis candela values towards the center of the emission profile (i.e. Y-axis).
+				// This will naturally cause the foreshortening of all candela values, but will preserve the overall emission profile shape in a more 'natural' way if you will
+				// (hence this is the default mode).
+				const auto projected_on_x_scaled = projected_on_x_orig * projected_x_scale;
+				const auto scaled_angle_rad = std::atan(projected_on_x_scaled / projected_on_y_orig);
+
+				scaled_angle = is_angle_almost_90 ? vert_angle_orig : radians_to_degrees(scaled_angle_rad);
+				candela_scale = std::sqrt(projected_on_y_orig * projected_on_y_orig + projected_on_x_scaled * projected_on_x_scaled);
+			}
+			else {
+				// Similarly, shift/scale the projected X-axis candela values towards the center of the emission profile,
+				// but use the original candela value as the hypotenuse, so that the original emission intensity values are preserved (except for the values on/close to the horizontal X-axis,
+				// as doing so will produce emission profiles with 'inflated waist' that always stays the same width regardless of the specified #rescale_cone_angle value).
+				// This causes the profile to be sort of 'funneled' into the new cone angle (as if you're closing an umbrella),
+				// which can result in sharp features in the IES profile becoming ever more sliver-like with smaller #rescale_cone_angle values.
+				// This will better preserve the overall amount of light emitted by the luminaire, but will cause the emission profile to appear distorted in the shape of a teardrop.
+				const auto projected_on_x_scaled = projected_on_x_orig * projected_x_scale;
+				const auto scaled_angle_rad = std::asin(projected_on_x_scaled);
+
+				// We can't allow the near-horizontal angles to be shifted/rotated into either hemisphere as in the case of double-sided emitters it'll cause gaps in the center of the emission profile.
+				scaled_angle = is_angle_almost_90 ? vert_angle_orig : radians_to_degrees(scaled_angle_rad);
+				candela_scale = is_angle_almost_90 ? projected_on_x_scaled : 1.;
+			}
+
+			scaled_vert_angles[j] = static_cast<float>(basis.is_top_hemisphere[j] ? 180. - scaled_angle : scaled_angle);
+			candela_scales[j] = static_cast<float>(candela_scale);
+		}
+	}
+
+	//! Compute the per-vertical-angle rescale tables.
+	//! \param[in]		vert_angles					The vertical angles of the IES data to rescale
+	//! \param[in]		rescale_cone_angle			The new cone in degrees to rescale the vertical angles to
+	//! \param[in]		preserve_intensity			The flag indicating whether to preserve the intensity values of the original IES data
+	//! \return			rescale_angle_table
+	static auto make_rescale_angle_table(const std::vector<float>& vert_angles, const float rescale_cone_angle, const bool preserve_intensity) -> rescale_angle_table {
+		auto table = rescale_angle_table{};
+		table.vert_angles = vert_angles;
+		table.rescale_cone_angle = rescale_cone_angle;
+		table.preserve_intensity = preserve_intensity;
+		table.scaled_vert_angles.resize(vert_angles.size());
+		table.candela_scales.resize(vert_angles.size());
+
+		fill_rescale_angle_table(make_rescale_angle_basis(vert_angles), rescale_cone_angle, preserve_intensity, table.scaled_vert_angles.data(), table.candela_scales.data());
+
+		return table;
+	}
+
+
+	rescale_table_cache::rescale_table_cache(const std::size_t max_entries)
+		: max_entries_(std::max<std::size_t>(max_entries, 1)) {
+	}
+
+	auto rescale_table_cache::global() -> rescale_table_cache& {
+		static auto cache = rescale_table_cache{};
+		return cache;
+	}
+
+	auto rescale_table_cache::get(const std::vector<float>& vert_angles, const float rescale_cone_angle, const bool preserve_intensity) -> std::shared_ptr<const rescale_angle_table> {
+		auto key = hash_bytes(vert_angles.data(), vert_angles.size() * sizeof(float));
+		key = hash_bytes(&rescale_cone_angle, sizeof(rescale_cone_angle), key);
+		key = hash_bytes(&preserve_intensity, sizeof(preserve_intensity), key);
+
+		// Different inputs may share the same hash, so the candidates are compared against the full key
+		auto find = [&]() -> std::shared_ptr<const rescale_angle_table> {
+			const auto [first, last] = entries_.equal_range(key);
+			for (auto it = first; it != last; ++it) {
+				const auto& table = *it->second;
+				if (table.rescale_cone_angle == rescale_cone_angle && table.preserve_intensity == preserve_intensity && table.vert_angles == vert_angles) {
+					return it->second;
+				}
+			}
+			return {};
+			};
+
+		{
+			const auto lock = std::shared_lock<std::shared_mutex>{ mutex_ };
+			if (auto table = find()) {
+				return table;
+			}
+		}
+
+		// Compute the table outside of the lock, so that the other threads aren't blocked in the meantime
+		auto table = std::make_shared<const rescale_angle_table>(make_rescale_angle_table(vert_angles, rescale_cone_angle, preserve_intensity));
+
+		const auto lock = std::unique_lock<std::shared_mutex>{ mutex_ };
+		if (auto existing = find()) {
+			// Another thread got there first
+			return existing;
+		}
+
+		if (entries_.size() >= max_entries_) {
+			// Catalogs typically share a handful of vertical grids, so simply start over rather than tracking the usage of each entry
+			entries_.clear();
+		}
+
+		entries_.emplace(key, table);
+		return table;
+	}
+
+	auto rescale_table_cache::size() const -> std::size_t {
+		const auto lock = std::shared_lock<std::shared_mutex>{ mutex_ };
+		return entries_.size();
+	}
+
+	void rescale_table_cache::clear() {
+		const auto lock = std::unique_lock<std::shared_mutex>{ mutex_ };
+		entries_.clear();
+	}
+
 
 	//! Rescale the vertical angles (and associated candela values) originally defined in the [0 : 180] degrees range (i.e. a hemisphere)
 	//! into the new cone angle in the [0 : rescale_cone_angle] range.
@@ -496,107 +1053,249 @@ namespace ies_rescale {
 	//! \return			std::optional<IE_Data>
 	//!         A rescaled IES data on success or an empty object on failure
 	auto rescale_ies_data(const IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity) -> std::optional<IE_Data> {
+		return rescale_ies_data(data, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten, rescale_table_cache::global());
+	}
 
-		// Make sure the rescale cone angle is valid.
-		if (rescale_cone_angle < 0.f || rescale_cone_angle > 180.f) {
+	auto rescale_ies_data(const IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity, rescale_table_cache& cache) -> std::optional<IE_Data> {
+		return rescale_ies_data(data, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten, cache);
+	}
+
+	auto rescale_ies_data(const IE_Data& data, const float rescale_cone_angle, const rescale_mode mode) -> std::optional<IE_Data> {
+		return rescale_ies_data(data, rescale_cone_angle, mode, rescale_table_cache::global());
+	}
+
+	auto rescale_ies_data(const IE_Data& data, const float rescale_cone_angle, const rescale_mode mode, rescale_table_cache& cache) -> std::optional<IE_Data> {
+		// Make a copy of the input data, that will eventually be rescaled.
+		auto scaled_data = data;
+		if (!rescale_ies_data_inplace(scaled_data, rescale_cone_angle, mode, cache)) {
 			return {};
 		}
 
-		constexpr auto PI = 3.14159265358979323846;
+		return std::optional<IE_Data>{ std::move(scaled_data) };
+	}
 
-		auto degrees_to_radians = [&PI](const auto degrees) -> decltype(degrees) {
-			return degrees * (decltype(degrees))(PI / 180.0);
-			};
+	auto rescale_ies_data(IE_Data&& data, const float rescale_cone_angle, const bool preserve_intensity) -> std::optional<IE_Data> {
+		return rescale_ies_data(std::move(data), rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten);
+	}
 
-		auto radians_to_degrees = [&PI](const auto radians) -> decltype(radians) {
-			return radians * (decltype(radians))(180.0 / PI);
-			};
+	auto rescale_ies_data(IE_Data&& data, const float rescale_cone_angle, const rescale_mode mode) -> std::optional<IE_Data> {
+		if (!rescale_ies_data_inplace(data, rescale_cone_angle, mode)) {
+			return {};
+		}
 
-		static const auto horizontal_threshold_angle_rad = degrees_to_radians(90.f + 1.f);
-		static const auto threshold_projected_on_y = std::abs(std::cos(horizontal_threshold_angle_rad));
+		return std::optional<IE_Data>{ std::move(data) };
+	}
 
-		// Calculate the uniform scale factor that will be applied to all horizontal projected values.
-		// Note, #rescale_cone_angle values of/close to 0 will cause the emission profile to be 'squashed' into a single vertical line.
-		const auto projected_x_scale = std::sin(degrees_to_radians(rescale_cone_angle * .5f));
-		assert((projected_x_scale >= 0.f && projected_x_scale <= 1.f) && "Invalid projected x scale");
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity) -> bool {
+		return rescale_ies_data_inplace(data, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten, rescale_table_cache::global());
+	}
 
-		// Make a copy of the input data, that will eventually be rescaled.
-		auto scaled_data = data;
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity, rescale_table_cache& cache) -> bool {
+		return rescale_ies_data_inplace(data, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten, cache);
+	}
 
-		// Rescale all output candela value arrays.
-		for (auto i = 0; i < data.photo.num_horz_angles; ++i) {
-			const auto horz_angle = data.photo.horz_angles[i];
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const rescale_mode mode) -> bool {
+		return rescale_ies_data_inplace(data, rescale_cone_angle, mode, rescale_table_cache::global());
+	}
 
-			for (int j = 0; j < data.photo.num_vert_angles; ++j) {
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const rescale_mode mode, rescale_table_cache& cache) -> bool {
 
-				const auto candela = data.photo.candelas[i][j];
+		// Make sure the rescale cone angle is valid.
+		if (!(rescale_cone_angle >= 0.f && rescale_cone_angle <= 180.f)) {
+			return false;
+		}
 
-				if (candela <= 0.f) {
-					// If the candela value is 0, there's no need to rescale it.
-					continue;
+		const auto num_vert_angles = static_cast<std::size_t>(data.photo.num_vert_angles);
+		const auto num_horz_angles = static_cast<std::size_t>(data.photo.num_horz_angles);
+		if (data.photo.vert_angles.size() != num_vert_angles || data.photo.candelas.num_rows() != num_horz_angles || data.photo.candelas.num_cols() != num_vert_angles) {
+			return false;
+		}
+
+		// Keep track of the vertical angles that have at least one non-zero candela value, since only those get rescaled.
+		// The flags are kept per thread, so that rescaling doesn't allocate once they have grown to the largest profile's size.
+		thread_local auto rescaled_columns = std::vector<uint32_t>{};
+		rescaled_columns.assign(num_vert_angles, 0);
+
+		// Preserving the flux takes the weights of the flux integral over the original grid, which are set up front so that nothing can fail
+		// once the data has been modified: the vertical angles have to be in ascending order for their weights not to depend on the candela values.
+		const auto preserve_flux = mode == rescale_mode::preserve_flux;
+		auto horz_weights = std::vector<double>{};
+		auto original_vert_weights = std::vector<float>{};
+		if (preserve_flux) {
+			const auto& vert_angles = data.photo.vert_angles;
+			if (rescale_cone_angle == 0.f || !std::is_sorted(vert_angles.begin(), vert_angles.end())) {
+				return false;
+			}
+
+			auto horz = detail::flux_horz_weights(data.photo.gonio_type, data.photo.horz_angles, integration_rule::simpson);
+			auto vert = detail::flux_vert_weights(data.photo.gonio_type, vert_angles, rescaled_columns, integration_rule::simpson);
+			if (!horz || !vert) {
+				return false;
+			}
+
+			horz_weights = std::move(*horz);
+			original_vert_weights = std::move(*vert);
+		}
+
+		// Get the per-vertical-angle tables, which are shared by all the profiles with the same vertical angles.
+		const auto table = cache.get(data.photo.vert_angles, rescale_cone_angle, mode == rescale_mode::preserve_intensity);
+
+		// The flux integral is a weighted sum of the columns of the grid, whose horizontally weighted sums are accumulated along the way.
+		// Rescaling multiplies each column by its candela scale, so the rescaled flux follows from the same sums.
+		thread_local auto column_sums = std::vector<float>{};
+		if (preserve_flux) {
+			column_sums.assign(num_vert_angles, 0.f);
+		}
+
+		// Rescale all candela value arrays in place.
+		const auto rescale_row = detail::get_rescale_row_kernel();
+		for (auto i = std::size_t{ 0 }; i < num_horz_angles; ++i) {
+			const auto candelas = data.photo.candelas.row(i);
+			if (preserve_flux) {
+				const auto horz_weight = static_cast<float>(horz_weights[i]);
+				for (auto j = std::size_t{ 0 }; j < num_vert_angles; ++j) {
+					column_sums[j] += horz_weight * candelas[j];
 				}
+			}
+
+			rescale_row(candelas.data(), candelas.data(), table->candela_scales.data(), rescaled_columns.data(), num_vert_angles);
+		}
+
+		for (auto j = std::size_t{ 0 }; j < num_vert_angles; ++j) {
+			if (rescaled_columns[j]) {
+				data.photo.vert_angles[j] = table->scaled_vert_angles[j];
+			}
+		}
 
-				const auto vert_angle = data.photo.vert_angles[j];
+		if (preserve_flux) {
+			// The rescaled columns keep their order, so their weights are defined (the columns without intensity don't count, whatever their angles)
+			const auto rescaled_vert_weights = detail::flux_vert_weights(data.photo.gonio_type, data.photo.vert_angles, rescaled_columns, integration_rule::simpson);
+			assert(rescaled_vert_weights && "The rescaled vertical angles are out of order");
+
+			auto original_flux = 0.0;
+			auto rescaled_flux = 0.0;
+			for (auto j = std::size_t{ 0 }; rescaled_vert_weights && j < num_vert_angles; ++j) {
+				const auto scale = rescaled_columns[j] ? table->candela_scales[j] : 1.f;
+				original_flux += double{ original_vert_weights[j] } * column_sums[j];
+				rescaled_flux += double{ (*rescaled_vert_weights)[j] } * column_sums[j] * scale;
+			}
 
-				const auto is_top_hemisphere = vert_angle > 90.f;
+			// A profile without any flux (or with all of it folded into a line) has nothing to normalize
+			if (original_flux > 0.0 && rescaled_flux > 0.0) {
+				data.lamp.multiplier = static_cast<float>(data.lamp.multiplier * (original_flux / rescaled_flux));
+			}
+		}
 
-				//if (is_top_hemisphere) {
-				//	int n = 0;
-				//}
+		return true;
+	}
 
-				const auto vert_angle_orig = is_top_hemisphere ? 180.f - vert_angle : vert_angle;
-				const auto vert_angle_orig_rad = degrees_to_radians(vert_angle_orig);
-				const auto candela_projected_on_y_orig = candela * std::cos(vert_angle_orig_rad);
-				const auto candela_projected_on_x_orig = candela * std::sin(vert_angle_orig_rad);
 
-				// Detect the 90 (or close to it) degree vertical angle case
-				const auto is_angle_almost_90 = std::abs(std::cos(vert_angle_orig_rad)) <= threshold_projected_on_y;
+	auto rescale_batch::make_data(const std::size_t k) const -> IE_Data {
+		auto data = header_;
 
-				auto scaled_angle = float{ 0.f };
-				auto scaled_candela = float{ 0.f };
+		const auto angles = vert_angles(k);
+		data.photo.vert_angles.assign(angles.begin(), angles.end());
 
-				if (!preserve_intensity) {
-					// Uniformly shift/scale the projected X-axis candela values towards the center of the emission profile (i.e. Y-axis).
-					// This will naturally cause the foreshortening of all candela values, but will preserve the overall emission profile shape in a more 'natural' way if you will
-					// (hence this is the default mode).
-					const auto candela_projected_on_x_scaled = candela_projected_on_x_orig * projected_x_scale;
-					const auto scaled_angle_rad = std::atan(candela_projected_on_x_scaled / candela_projected_on_y_orig);
+		const auto values = candelas(k);
+		data.photo.candelas = candela_matrix(values.num_rows(), values.num_cols());
+		std::copy(values.values().begin(), values.values().end(), data.photo.candelas.data());
 
-					scaled_angle = is_angle_almost_90 ? vert_angle_orig : radians_to_degrees(scaled_angle_rad);
-					scaled_candela = std::sqrt(candela_projected_on_y_orig * candela_projected_on_y_orig + candela_projected_on_x_scaled * candela_projected_on_x_scaled);
-				}
-				else {
-					// Similarly, shift/scale the projected X-axis candela values towards the center of the emission profile,
-					// but use the original candela value as the hypotenuse, so that the original emission intensity values are preserved (except for the values on/close to the horizontal X-axis,
-					// as doing so will produce emission profiles with 'inflated waist' that always stays the same width regardless of the specified #rescale_cone_angle value).
-					// This causes the profile to be sort of 'funneled' into the new cone angle (as if you're closing an umbrella),
-					// which can result in sharp features in the IES profile becoming ever more sliver-like with smaller #rescale_cone_angle values.
-					// This will better preserve the overall amount of light emitted by the luminaire, but will cause the emission profile to appear distorted in the shape of a teardrop.
-					const auto candela_projected_on_x_scaled = candela_projected_on_x_orig * projected_x_scale;
-					const auto scaled_angle_rad = std::asin(candela_projected_on_x_scaled / candela);
-
-					// We can't allow the near-horizontal angles to be shifted/rotated into either hemisphere as in the case of double-sided emitters it'll cause gaps in the center of the emission profile.
-					scaled_angle = is_angle_almost_90 ? vert_angle_orig : radians_to_degrees(scaled_angle_rad);
-					scaled_candela = is_angle_almost_90 ? candela_projected_on_x_scaled : candela;
-				}
+		return data;
+	}
 
-				scaled_data.photo.vert_angles[j] = (is_top_hemisphere ? 180.f - scaled_angle : scaled_angle);
-				scaled_data.photo.candelas[i][j] = scaled_candela;
+	auto rescale_ies_data_batch(const IE_Data& data, const array_view<const float> rescale_cone_angles, const bool preserve_intensity) -> std::optional<rescale_batch> {
 
+		// Make sure all the rescale cone angles are valid.
+		for (const auto rescale_cone_angle : rescale_cone_angles) {
+			if (!(rescale_cone_angle >= 0.f && rescale_cone_angle <= 180.f)) {
+				return {};
 			}
 		}
 
-		return std::optional<IE_Data>{scaled_data};
+		const auto num_vert_angles = static_cast<std::size_t>(data.photo.num_vert_angles);
+		const auto num_horz_angles = static_cast<std::size_t>(data.photo.num_horz_angles);
+		if (data.photo.vert_angles.size() != num_vert_angles || data.photo.candelas.num_rows() != num_horz_angles || data.photo.candelas.num_cols() != num_vert_angles) {
+			return {};
+		}
+
+		auto batch = rescale_batch{};
+
+		// Copy everything but the candela values, which are stored in the arena
+		{
+			auto& header = batch.header_;
+			header.file = data.file;
+			header.labels = data.labels;
+			header.lamp = data.lamp;
+			header.units = data.units;
+			header.dim = data.dim;
+			header.elec = data.elec;
+			header.photo.gonio_type = data.photo.gonio_type;
+			header.photo.num_vert_angles = data.photo.num_vert_angles;
+			header.photo.num_horz_angles = data.photo.num_horz_angles;
+			header.photo.vert_angles = data.photo.vert_angles;
+			header.photo.horz_angles = data.photo.horz_angles;
+		}
+
+		batch.cone_angles_.assign(rescale_cone_angles.begin(), rescale_cone_angles.end());
+
+		// Keep every block aligned to the arena's alignment, so that each rescaled grid starts on its own cache line
+		constexpr auto block_floats = candela_matrix::alignment / sizeof(float);
+		auto align = [block_floats](const std::size_t count) {
+			return (count + block_floats - 1) / block_floats * block_floats;
+			};
+
+		batch.candelas_offset_ = align(num_vert_angles);
+		batch.stride_ = batch.candelas_offset_ + align(num_horz_angles * num_vert_angles);
+		batch.arena_.resize(batch.stride_ * batch.cone_angles_.size());
+
+		// The trigonometry of the vertical angles is shared by all cone angles, and so are the flags of the vertical angles that get rescaled
+		// (i.e. the ones that have at least one non-zero candela value).
+		const auto basis = make_rescale_angle_basis(data.photo.vert_angles);
+		auto rescaled_columns = std::vector<uint32_t>(num_vert_angles, 0);
+		auto scaled_vert_angles = std::vector<float>(num_vert_angles);
+		auto candela_scales = std::vector<float>(num_vert_angles);
+
+		const auto rescale_row = detail::get_rescale_row_kernel();
+
+		for (auto k = std::size_t{ 0 }; k < batch.cone_angles_.size(); ++k) {
+			fill_rescale_angle_table(basis, batch.cone_angles_[k], preserve_intensity, scaled_vert_angles.data(), candela_scales.data());
+
+			auto* const block = batch.arena_.data() + k * batch.stride_;
+			auto* const out_candelas = block + batch.candelas_offset_;
+
+			for (auto i = std::size_t{ 0 }; i < num_horz_angles; ++i) {
+				rescale_row(data.photo.candelas.row(i).data(), out_candelas + i * num_vert_angles, candela_scales.data(), rescaled_columns.data(), num_vert_angles);
+			}
+
+			auto* const out_vert_angles = block;
+			for (auto j = std::size_t{ 0 }; j < num_vert_angles; ++j) {
+				out_vert_angles[j] = rescaled_columns[j] ? scaled_vert_angles[j] : data.photo.vert_angles[j];
+			}
+		}
+
+		return std::optional<rescale_batch>{ std::move(batch) };
 	}
 
 
-	//! Read TILT data from a memstream contacting IESNA-format data into a photometric data structure.
-	//! \param[in]		mem_stream								The memory stream initialized with the content of an IES profile file
+	//! Read TILT data from the IESNA-format data into a photometric data structure.
+	//! \param[in,out]	cursor									The cursor over the content of an IES profile (or a TILT data) file
 	//! \return			std::optional<IE_Data::Lamp::Tilt>		The read TILT data on success or an empty object of failure
 	//! Note: the file can be either part of a full IESNA-format data file or a separate TILT data file that was specified in the parent IESNA-format file on the "TILT=" line.
-	static auto ie_read_tilt(memstream& mem_stream) -> std::optional<IE_Data::Lamp::Tilt> {
+	static auto ie_read_tilt(ie_cursor& cursor) -> std::optional<IE_Data::Lamp::Tilt> {
+
+		// Convert the leading integer value of a line (e.g. "13 // # of tilt angles")
+		auto parse_line_int = [](const std::string_view line, int& value) {
+			auto first = line.data();
+			const auto last = line.data() + line.size();
+			while (first != last && isspace(*first) != 0) {
+				++first;
+			}
+
+			return ie_parse_int(first, last, value) != nullptr;
+			};
+
 		// Read the lamp-to-luminaire geometry line
-		auto value_buffer = ie_get_line(mem_stream);
+		auto value_buffer = ie_get_line(cursor);
 		if (value_buffer.empty()) {
 			return {};
 		}
@@ -605,10 +1304,15 @@ namespace ies_rescale {
 
 		{
 			// Get the lamp-to-luminaire geometry value
-			tilt.orientation = (IE_Data::Lamp::Tilt::Orientation)std::stoi(value_buffer);
+			auto orientation = int{ 0 };
+			if (!parse_line_int(value_buffer, orientation)) {
+				return {};
+			}
+
+			tilt.orientation = (IE_Data::Lamp::Tilt::Orientation)orientation;
 
 			// Read the number of angle-multiplying factor pairs line
-			value_buffer = ie_get_line(mem_stream);
+			value_buffer = ie_get_line(cursor);
 			if (value_buffer.empty()) {
 				return {};
 			}
@@ -616,269 +1320,244 @@ namespace ies_rescale {
 
 		{
 			// Get the number of angle-multiplying factor pairs value
-			tilt.num_pairs = std::stoi(value_buffer);
+			if (!parse_line_int(value_buffer, tilt.num_pairs)) {
+				return {};
+			}
 
 			if (tilt.num_pairs > 0) {
 				// Read in the angle values
-				tilt.angles = ie_populate_array(mem_stream, tilt.num_pairs);
-				if (tilt.angles.empty()) {
+				tilt.angles.resize(tilt.num_pairs);
+				if (!ie_populate_array(cursor, tilt.angles.data(), tilt.angles.size())) {
 					return {};
 				}
 
 				// Read in the multiplying factor values
-				tilt.mult_factors = ie_populate_array(mem_stream, tilt.num_pairs);
-				if (tilt.mult_factors.empty()) {
+				tilt.mult_factors.resize(tilt.num_pairs);
+				if (!ie_populate_array(cursor, tilt.mult_factors.data(), tilt.mult_factors.size())) {
 					return {};
 				}
 			}
 		}
 
-		return std::optional<IE_Data::Lamp::Tilt>{ tilt };
+		return std::optional<IE_Data::Lamp::Tilt>{ std::move(tilt) };
 	}
 
 
-	//! Read in one or more lines from a memstream contacting IESNA-format data and convert their substrings to a list of floating point and/or integer values.
-	//! \param[in]		mem_stream			The memory stream initialized with the content of an IES profile file
-	//! \param[in]		format				The format string containing the following specifiers:
-	//!									%d - read in integer value
-	//!									%f - read in floating point value
-	//! \param[out]	...					A pointer to a variable of the appropriate type must follow the format parameter in the same order (similar to "scanf").
-	//! \return
-	//!         A boolean value indicating success or failure
-	static auto ie_populate_list(memstream& mem_stream, const std::string_view format, ...) -> bool {
-
-		// Todo: rewrite this function as a variadic template function to avoid the archaic and error-prone va_list stuff.
-
-		// Read in the first line
-		auto buffer = ie_get_line(mem_stream);
-		if (buffer.empty()) {
-			return false;
+	//! Tokenizer over the numeric values that start on the next line of the IESNA-format data and may continue on the following lines.
+	//! The values are converted directly from the underlying data, and whatever follows the last requested value on its line is skipped.
+	class ie_value_reader {
+	public:
+		ie_value_reader(ie_cursor& cursor)
+			: cursor_(cursor) {
 		}
 
-		auto p_buffer = &buffer[0];
-		for (; ; ) {   // Skip over leading delimiters
-			const auto c = *p_buffer;
-			if (c == '\0') {      // End of current line?
+		//! Read in the first line and skip over its leading delimiters
+		//! \return	true if the line contains at least one non-delimiter character, false otherwise
+		auto begin() -> bool {
+			if (!next_line()) {
 				return false;
 			}
-			else if (isspace(c) != 0) {
-				++p_buffer;
-			}
-			else {
-				break;
-			}
-		}
-
-		va_list p_args;         // Variable list argument pointer
-		va_start(p_args, format);       // Set up for optional arguments
-		const auto* p_format = format.data();  // Format string pointer
 
-		for (; ; ) {
-			if (*p_format != '%') {          // Check format specifier delimiter
-				va_end(p_args);   // Clean up
-				return false;
+			while (p_ != line_end_ && isspace(*p_) != 0) {
+				++p_;
 			}
 
-			// Get and validate format specifier
-			const auto type = *(p_format + 1);
-			switch (type) {
-			case 'd':
-			case 'D':
-			{
-				auto itemp = int{ 0 };
-				auto iss = std::istringstream{ p_buffer };
-				iss >> itemp;
-				if (iss.fail()) {
-					assert(false && "failed to parse the current substring to its integer point value");
-					va_end(p_args);   // Clean up
-					return false;
-				}
-
-				*(va_arg(p_args, int*)) = itemp;
+			return p_ != line_end_;
+		}
 
-				for (; ; ) {    // Advance buffer pointer past the substring
-					const auto c = *p_buffer;
-					if ((isdigit(c) != 0) || c == '-') {
-						++p_buffer;
-					}
-					else {
-						break;
-					}
-				}
-				break;
-			}
-			case 'f':
-			case 'F':
-			{
-				auto ftemp = float{ 0.f };
-				auto iss = std::istringstream{ p_buffer };
-				iss >> ftemp;
-				if (iss.fail()) {
+		//! Convert the current substring and advance past it
+		//! \param[out]	value				The converted value
+		//! \return	true on success, false otherwise
+		template <typename T>
+		auto read(T& value) -> bool {
+			if constexpr (std::is_floating_point_v<T>) {
+				const auto p_end = ie_parse_float(p_, line_end_, value);
+				if (!p_end) {
 					assert(false && "failed to parse the current substring to its floating point value");
-					va_end(p_args);   // Clean up
 					return false;
 				}
 
-				*(va_arg(p_args, float*)) = ftemp;
-
-				for (; ; ) {    // Advance buffer pointer past the substring
-					const auto c = *p_buffer;
-					if ((isdigit(c) != 0) || c == '.' || c == '-') {
-						++p_buffer;
-					}
-					else {
-						break;
-					}
-				}
-				break;
+				p_ = p_end;
 			}
-			default:
-				va_end(p_args);   // Clean up
-				return false;
-			}
-
-			// Point to next format specifier
+			else {
+				// Integers and enumerations (e.g. the photometric goniometer type)
+				auto itemp = int{ 0 };
+				const auto p_end = ie_parse_int(p_, line_end_, itemp);
+				if (!p_end) {
+					assert(false && "failed to parse the current substring to its integer point value");
+					return false;
+				}
 
-			++p_format;             // Skip over format specifier delimiter
-			if (*p_format == '\0') { // End of format string ?
-				va_end(p_args);   // Clean up
-				return false;
+				value = static_cast<T>(itemp);
+				p_ = p_end;
 			}
 
-			++p_format;             // Skip over format specifier parameter
-			if (*p_format == '\0') { // End of format string ?
-				break;
-			}
+			return true;
+		}
 
-			for (; ; ) {        // Skip over delimiters
-				const auto c = *p_buffer;
-				if (c == '\0') {   // End of current line?
-					// Get next line
-					buffer = ie_get_line(mem_stream);
-					if (buffer.empty()) {
-						va_end(p_args);   // Clean up
+		//! Skip over the delimiters following the current substring, reading in the next line(s) when the end of the current one is reached
+		//! \return	true if there's another substring to convert, false otherwise
+		auto skip_delimiters() -> bool {
+			for (; ; ) {
+				if (p_ == line_end_) {   // End of current line?
+					if (!next_line()) {
 						return false;
 					}
-
-					p_buffer = &buffer[0];
 				}
-				else if ((isspace(c) != 0) || c == ',') {
-					++p_buffer;
+				else if ((isspace(*p_) != 0) || *p_ == ',') {
+					++p_;
 				}
 				else {
-					break;
+					return true;
 				}
 			}
 		}
 
-		va_end(p_args);   // Clean up
-		return true;
+	private:
+		auto next_line() -> bool {
+			const auto line = ie_get_line(cursor_);
+			p_ = line.data();
+			line_end_ = line.data() + line.size();
+			return !line.empty();
+		}
+
+		ie_cursor& cursor_;
+		const char* p_ = nullptr;			// Current position within the current line
+		const char* line_end_ = nullptr;	// End of the current line
+	};
+
+
+	//! Read in one or more lines from the IESNA-format data and convert their substrings to a list of floating point and/or integer values.
+	//! \param[in,out]	cursor				The cursor over the content of an IES profile file
+	//! \param[out]	values				The variables to read the values into, in the order they appear in the data.
+	//!									Floating point variables are read in as floating point values, while integer and enumeration variables are read in as integer values.
+	//! \return
+	//!         A boolean value indicating success or failure
+	template <typename... Values>
+	static auto ie_populate_list(ie_cursor& cursor, Values&... values) -> bool {
+		auto reader = ie_value_reader{ cursor };
+		if (!reader.begin()) {
+			return false;
+		}
+
+		// Convert the values one by one, skipping over the delimiters in between (but not after the last one)
+		auto index = std::size_t{ 0 };
+		return (... && (reader.read(values) && (++index == sizeof...(Values) || reader.skip_delimiters())));
 	}
 
 
 	//! Read in one or more lines from an IESNA-format data file and convert their substrings to an array of floating point numbers.
-	//! \param[in]		mem_stream			The memory stream initialized with the content of an IES profile file
+	//! \param[in,out]	cursor				The cursor over the content of an IES profile file
+	//! \param[out]	values				The array to populate
 	//! \param[in]		size				The number of floats to read in
 	//! \return
-	//!         A populated array of floats on success, an empty array on failure
-	static auto ie_populate_array(memstream& mem_stream, const std::size_t size) -> std::vector<float> {
-		auto buffer = std::string{};
-
-		// Read in the first line 
-		buffer = ie_get_line(mem_stream);
-		if (buffer.empty()) {
-			return {};
+	//!         true if the array was populated, false otherwise
+	static auto ie_populate_array(ie_cursor& cursor, float* values, const std::size_t size) -> bool {
+		auto reader = ie_value_reader{ cursor };
+		if (!reader.begin()) {
+			return false;
 		}
 
-		auto p_buffer = &buffer[0];
-		auto c = char{};
-		for (; ; ) {  // Skip over leading delimiters
-			c = *p_buffer;
-
-			if (c == '\0') {     // End of current line?
-				return {};
-			}
-			else if ((isspace(c) != 0)) {
-				p_buffer++;
+		for (auto i = size_t{ 0 }; ; ) {   // Parse the array elements
+			if (!reader.read(values[i++])) {
+				return false;
 			}
-			else {
+
+			if (i == size) {     // All substrings converted ?
 				break;
 			}
-		}
-
-		auto array = std::vector<float>(size, 0.f);
-
-		for (auto i = size_t{ 0 }; ; ) {   // Parse the array elements
 
-			// Convert the current substring to its floating point value
-			float ftemp;          // Temporary floating point variable
-			std::istringstream iss(p_buffer);
-			iss >> ftemp;
-			if (iss.fail()) {
-				assert(false && "failed to parse the current substring to its floating point value");
-				return {};
+			if (!reader.skip_delimiters()) {
+				return false;
 			}
+		}
 
-			array[i++] = ftemp;
+		return true;
+	}
 
-			if (i == array.size()) {     // All substrings converted ?
-				break;
-			}
 
-			for (; ; ) {        // Advance buffer pointer past the substring
+	//! Convert the substring at the beginning of the [first : last) range to an integer value without allocating any memory.
+	//! \param[in]		first				The beginning of the substring
+	//! \param[in]		last				The end of the character range
+	//! \param[out]	value				The converted value
+	//! \return
+	//!         A pointer to the first character past the converted substring on success or \c nullptr on failure
+	static auto ie_parse_int(const char* first, const char* last, int& value) -> const char* {
+		// Unlike the stream extraction, std::from_chars doesn't accept an explicit plus sign
+		if (first != last && *first == '+') {
+			++first;
+		}
 
-				c = *p_buffer;
-				if ((isdigit(c) != 0) || c == '.' || c == '-') {
-					p_buffer++;
-				}
-				else {
-					break;
-				}
-			}
+		const auto [p_end, ec] = std::from_chars(first, last, value);
+		return ec == std::errc{} ? p_end : nullptr;
+	}
 
-			for (; ; ) {        // Skip over delimiters
-				if (c == '\0') {   // End of current line?
-					// Get next line
-					buffer = ie_get_line(mem_stream);
-					if (buffer.empty()) {
-						return {};
-					}
 
-					p_buffer = &buffer[0];
-				}
-				else if ((isspace(c) != 0) || c == ',') {
-					p_buffer++;
-				}
-				else {
-					break;
-				}
+	//! Convert the substring at the beginning of the [first : last) range to a floating point value without allocating any memory.
+	//! \param[in]		first				The beginning of the substring
+	//! \param[in]		last				The end of the character range
+	//! \param[out]	value				The converted value
+	//! \return
+	//!         A pointer to the first character past the converted substring on success or \c nullptr on failure
+	static auto ie_parse_float(const char* first, const char* last, float& value) -> const char* {
+		// Unlike the stream extraction, std::from_chars doesn't accept an explicit plus sign
+		if (first != last && *first == '+') {
+			++first;
+		}
 
-				c = *p_buffer;        // Get next delimiter
+#if defined(__cpp_lib_to_chars)
+		const auto [p_end, ec] = std::from_chars(first, last, value);
+		return ec == std::errc{} ? p_end : nullptr;
+#else
+		// The standard library lacks the floating point std::from_chars overloads (e.g. older libc++), so fall back to strtof().
+		// The number is copied into a small null-terminated buffer first, since the input range isn't guaranteed to be null-terminated.
+		char number[64];
+		auto length = std::size_t{ 0 };
+		while (first + length != last && length < sizeof(number) - 1) {
+			const auto c = first[length];
+			if ((isdigit(c) == 0) && c != '.' && c != '-' && c != '+' && c != 'e' && c != 'E') {
+				break;
 			}
+			number[length++] = c;
 		}
+		number[length] = '\0';
 
-		return array;
+		auto p_end = static_cast<char*>(nullptr);
+		errno = 0;
+		value = std::strtof(number, &p_end);
+		if (p_end == number || errno == ERANGE) {
+			return nullptr;
+		}
+
+		return first + (p_end - number);
+#endif
 	}
 
 
-	//! Get a line from the memstream and stores it in the provided buffer
-	//! \param[in]	mem_stream			The memory stream initialized with the content of an IES profile file
+	//! Get the next line from the IESNA-format data without copying it
+	//! \param[in,out]	cursor			The cursor over the content of an IES profile file
 	//! \return
-	//!         A string containing the read line on success or an empty string on failure
-	//!         \c nullptr on failure
-	static auto ie_get_line(memstream& mem_stream) -> std::string {
-		auto buffer = std::string{};
-		std::getline(mem_stream, buffer);
+	//!         A view of the line (without the line terminator) on success or an empty view on failure
+	static auto ie_get_line(ie_cursor& cursor) -> std::string_view {
+		if (cursor.p == cursor.end) {
+			return {};
+		}
 
-		if (!buffer.empty() && buffer.back() == 0x0D) {
-			buffer.pop_back();
+		const auto line_begin = cursor.p;
+		auto line_end = static_cast<const char*>(std::memchr(line_begin, '\n', cursor.end - line_begin));
+		if (line_end) {
+			cursor.p = line_end + 1;
+		}
+		else {
+			line_end = cursor.end;
+			cursor.p = cursor.end;
 		}
 
-		if (buffer.size()) {
-			return buffer;
+		if (line_end != line_begin && *(line_end - 1) == 0x0D) {
+			--line_end;
 		}
 
-		return "";
+		return std::string_view{ line_begin, static_cast<std::size_t>(line_end - line_begin) };
 	}
 
 } // namespace ies_rescale
\ No newline at end of file
@@ -111,13 +111,57 @@
 #include <optional>
 #include <streambuf>
 #include <istream>
+#include <ostream>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 
 namespace ies_rescale {
 
+	//! Read-only view of a file's content.
+	//! The file is memory-mapped whenever the platform allows it, so that its bytes can be handed over to the parser without being copied;
+	//! otherwise (e.g. for pipes or file systems that don't support mapping) the content is read into an owned buffer instead.
+	class mapped_file {
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file(mapped_file&& other) noexcept;
+		~mapped_file();
+
+		auto operator=(const mapped_file&) -> mapped_file& = delete;
+		auto operator=(mapped_file&& other) noexcept -> mapped_file&;
+
+		//! Open the specified file and map (or read) its content.
+		//! \param[in]		file_name					The name of the file to open
+		//! \return			std::optional<mapped_file>	The file content on success or an empty object on failure
+		static auto open(const std::string_view file_name) -> std::optional<mapped_file>;
+
+		auto data() const -> const uint8_t* { return data_; }
+		auto size() const -> std::size_t { return size_; }
+		auto empty() const -> bool { return size_ == 0; }
+		auto is_mapped() const -> bool { return mapped_; }
+
+	private:
+		void release();
+
+		const uint8_t* data_ = nullptr;		// Pointer to either the mapped view or fallback_.data()
+		std::size_t size_ = 0;				// Size of the file content in bytes
+		bool mapped_ = false;				// Whether data_ points to a mapped view that needs to be unmapped
+		std::vector<uint8_t> fallback_;		// Owned content when the file couldn't be mapped
+	};
+
 	namespace detail {
 		class membuf : public std::streambuf {
 		private:
-			std::vector<uint8_t> buffer_;
+			std::vector<uint8_t> buffer_;	// Owned data (only used when constructed from a vector)
+			mapped_file mapping_;			// Owned file mapping (only used when constructed from a mapped file)
+			const char* begin_ = nullptr;	// Beginning of the data, which can reside in either of the above or in a borrowed buffer
+			const char* end_ = nullptr;		// End of the data
 
 		protected:
 			membuf() {
@@ -125,13 +169,46 @@ namespace ies_rescale {
 			}
 
 			membuf(const std::vector<uint8_t>& buf)
-				: buffer_(buf) {
+				: buffer_(buf)
+				, begin_(reinterpret_cast<const char*>(buffer_.data()))
+				, end_(begin_ + buffer_.size()) {
+				reset();
+			}
+
+			membuf(std::vector<uint8_t>&& buf)
+				: buffer_(std::move(buf))
+				, begin_(reinterpret_cast<const char*>(buffer_.data()))
+				, end_(begin_ + buffer_.size()) {
+				reset();
+			}
+
+			membuf(const char* data, const std::size_t size)
+				: begin_(data)
+				, end_(data + size) {
+				reset();
+			}
+
+			membuf(mapped_file&& mapping)
+				: mapping_(std::move(mapping))
+				, begin_(reinterpret_cast<const char*>(mapping_.data()))
+				, end_(begin_ + mapping_.size()) {
 				reset();
 			}
 
+			//! The part of the data that hasn't been read yet
+			auto unread() const -> std::string_view {
+				return std::string_view{ this->gptr(), static_cast<std::size_t>(this->egptr() - this->gptr()) };
+			}
+
+			//! Advance the read position by the specified number of bytes
+			void consume(const std::size_t count) {
+				this->setg(this->eback(), this->gptr() + std::min(count, static_cast<std::size_t>(this->egptr() - this->gptr())), this->egptr());
+			}
+
 			void reset() {
-				auto p = reinterpret_cast<char*>(buffer_.data());
-				this->setg(p, p, p + buffer_.size());
+				// The get area is never written to, so it's safe to cast away the constness of the (possibly read-only mapped) data.
+				auto p = const_cast<char*>(begin_);
+				this->setg(p, p, const_cast<char*>(end_));
 			}
 
 			auto underflow() -> int_type override {
@@ -155,9 +232,230 @@ namespace ies_rescale {
 			, std::istream(static_cast<std::streambuf*>(this))
 		{}
 
+		//! Construct a stream that takes over the ownership of the buffer without copying it.
+		memstream(std::vector<uint8_t>&& buffer)
+			: membuf(std::move(buffer))
+			, std::istream(static_cast<std::streambuf*>(this))
+		{}
+
+		//! Construct a stream that borrows the specified data without copying it.
+		//! Note: the data must outlive the stream (and any parsing performed on it).
+		explicit memstream(const std::string_view data)
+			: membuf(data.data(), data.size())
+			, std::istream(static_cast<std::streambuf*>(this))
+		{}
+
+		//! Construct a stream that borrows the specified bytes without copying them.
+		//! Note: the data must outlive the stream (and any parsing performed on it).
+		memstream(const void* data, const std::size_t size)
+			: membuf(static_cast<const char*>(data), size)
+			, std::istream(static_cast<std::streambuf*>(this))
+		{}
+
+		//! Construct a stream that takes over the ownership of a file mapping and reads directly from it without copying.
+		memstream(mapped_file&& mapping)
+			: membuf(std::move(mapping))
+			, std::istream(static_cast<std::streambuf*>(this))
+		{}
+
 		void rewind() {
 			this->reset();
 		}
+
+		//! The part of the data that hasn't been read yet, which allows parsing the data in place
+		auto unread() const -> std::string_view {
+			return membuf::unread();
+		}
+
+		//! Advance the read position by the specified number of bytes
+		void consume(const std::size_t count) {
+			membuf::consume(count);
+		}
+	};
+
+	namespace detail {
+		//! Allocator that aligns its allocations to the specified number of bytes (e.g. to a cache line, which also suits any SIMD register width)
+		template <typename T, std::size_t Alignment>
+		struct aligned_allocator {
+			using value_type = T;
+
+			template <typename U>
+			struct rebind {
+				using other = aligned_allocator<U, Alignment>;
+			};
+
+			aligned_allocator() = default;
+
+			template <typename U>
+			aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+			auto allocate(const std::size_t n) -> T* {
+				return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{ Alignment }));
+			}
+
+			void deallocate(T* p, const std::size_t) {
+				::operator delete(p, std::align_val_t{ Alignment });
+			}
+
+			template <typename U>
+			bool operator==(const aligned_allocator<U, Alignment>&) const {
+				return true;
+			}
+
+			template <typename U>
+			bool operator!=(const aligned_allocator<U, Alignment>&) const {
+				return false;
+			}
+		};
+	}
+
+	//! Non-owning view of a contiguous range of values (a C++17 stand-in for std::span)
+	template <typename T>
+	class array_view {
+	public:
+		array_view() = default;
+
+		array_view(T* data, const std::size_t size)
+			: data_(data)
+			, size_(size)
+		{}
+
+		template <typename Container>
+		array_view(Container& container)
+			: data_(container.data())
+			, size_(container.size())
+		{}
+
+		auto data() const -> T* { return data_; }
+		auto size() const -> std::size_t { return size_; }
+		auto empty() const -> bool { return size_ == 0; }
+
+		auto begin() const -> T* { return data_; }
+		auto end() const -> T* { return data_ + size_; }
+
+		auto operator[](const std::size_t i) const -> T& {
+			assert(i < size_ && "Index out of range");
+			return data_[i];
+		}
+
+	private:
+		T* data_ = nullptr;
+		std::size_t size_ = 0;
+	};
+
+	//! Candela values of all horizontal planes stored row-major (i.e. one row of vertical angle values per horizontal angle) in a single allocation.
+	//! The storage is aligned to 64 bytes and contiguous across rows, so the whole grid can be traversed (and vectorized) as one flat array,
+	//! while the row accessors keep the familiar candelas[horz][vert] indexing working.
+	class candela_matrix {
+	public:
+		static constexpr std::size_t alignment = 64;
+
+		candela_matrix() = default;
+
+		candela_matrix(const std::size_t num_rows, const std::size_t num_cols, const float value = 0.f)
+			: values_(num_rows * num_cols, value)
+			, num_rows_(num_rows)
+			, num_cols_(num_cols)
+		{}
+
+		//! Construct the matrix from an array of rows, all of which are expected to have the same size
+		candela_matrix(const std::vector<std::vector<float>>& rows)
+			: candela_matrix(rows.size(), rows.empty() ? 0 : rows.front().size()) {
+			for (auto i = std::size_t{ 0 }; i < num_rows_; ++i) {
+				assert(rows[i].size() == num_cols_ && "All rows must have the same size");
+				std::copy_n(rows[i].begin(), std::min(rows[i].size(), num_cols_), values_.begin() + i * num_cols_);
+			}
+		}
+
+		auto num_rows() const -> std::size_t { return num_rows_; }
+		auto num_cols() const -> std::size_t { return num_cols_; }
+
+		//! The number of rows, matching the semantics of the former std::vector<std::vector<float>> storage
+		auto size() const -> std::size_t { return num_rows_; }
+		auto empty() const -> bool { return values_.empty(); }
+
+		auto data() -> float* { return values_.data(); }
+		auto data() const -> const float* { return values_.data(); }
+
+		//! All the values of the matrix as a single flat array
+		auto values() -> array_view<float> { return array_view<float>{ values_.data(), values_.size() }; }
+		auto values() const -> array_view<const float> { return array_view<const float>{ values_.data(), values_.size() }; }
+
+		auto row(const std::size_t i) -> array_view<float> {
+			assert(i < num_rows_ && "Row index out of range");
+			return array_view<float>{ values_.data() + i * num_cols_, num_cols_ };
+		}
+
+		auto row(const std::size_t i) const -> array_view<const float> {
+			assert(i < num_rows_ && "Row index out of range");
+			return array_view<const float>{ values_.data() + i * num_cols_, num_cols_ };
+		}
+
+		auto operator[](const std::size_t i) -> array_view<float> { return row(i); }
+		auto operator[](const std::size_t i) const -> array_view<const float> { return row(i); }
+
+		//! Copy the values into an array of rows (i.e. the layout used by the earlier versions of the library)
+		auto to_vectors() const -> std::vector<std::vector<float>> {
+			auto rows = std::vector<std::vector<float>>(num_rows_);
+			for (auto i = std::size_t{ 0 }; i < num_rows_; ++i) {
+				const auto r = row(i);
+				rows[i].assign(r.begin(), r.end());
+			}
+			return rows;
+		}
+
+		bool operator==(const candela_matrix& other) const {
+			return
+				num_rows_ == other.num_rows_
+				&& num_cols_ == other.num_cols_
+				&& values_ == other.values_
+				;
+		}
+
+		bool operator!=(const candela_matrix& other) const {
+			return !(*this == other);
+		}
+
+	private:
+		std::vector<float, detail::aligned_allocator<float, alignment>> values_;
+		std::size_t num_rows_ = 0;
+		std::size_t num_cols_ = 0;
+	};
+
+	//! Non-owning view of a row-major grid of candela values
+	class candela_matrix_view {
+	public:
+		candela_matrix_view() = default;
+
+		candela_matrix_view(const float* data, const std::size_t num_rows, const std::size_t num_cols)
+			: data_(data)
+			, num_rows_(num_rows)
+			, num_cols_(num_cols)
+		{}
+
+		candela_matrix_view(const candela_matrix& matrix)
+			: candela_matrix_view(matrix.data(), matrix.num_rows(), matrix.num_cols())
+		{}
+
+		auto num_rows() const -> std::size_t { return num_rows_; }
+		auto num_cols() const -> std::size_t { return num_cols_; }
+		auto size() const -> std::size_t { return num_rows_; }
+		auto empty() const -> bool { return num_rows_ * num_cols_ == 0; }
+		auto data() const -> const float* { return data_; }
+
+		auto values() const -> array_view<const float> { return array_view<const float>{ data_, num_rows_ * num_cols_ }; }
+
+		auto row(const std::size_t i) const -> array_view<const float> {
+			assert(i < num_rows_ && "Row index out of range");
+			return array_view<const float>{ data_ + i * num_cols_, num_cols_ };
+		}
+
+		auto operator[](const std::size_t i) const -> array_view<const float> { return row(i); }
+
+	private:
+		const float* data_ = nullptr;
+		std::size_t num_rows_ = 0;
+		std::size_t num_cols_ = 0;
 	};
 
 	// IESNA Standard File data
@@ -286,7 +584,7 @@ namespace ies_rescale {
 			std::vector<float> vert_angles;         // Vertical angles array
 			std::vector<float> horz_angles;         // Horizontal angles array
 
-			std::vector<std::vector<float>> candelas;           // Candela values array pointers array
+			candela_matrix candelas;				// Candela values array (num_horz_angles rows of num_vert_angles values)
 
 			bool operator==(const Photo& other) const {
 				return
@@ -322,11 +620,197 @@ namespace ies_rescale {
 	}; // struct IE_Data
 
 
+	//! Per-vertical-angle tables used to rescale the profiles sharing the same vertical angles
+	struct rescale_angle_table {
+		std::vector<float> vert_angles;			// The vertical angles the tables were computed for
+		float rescale_cone_angle;				// The cone angle the tables were computed for
+		bool preserve_intensity;				// The rescale mode the tables were computed for
+
+		std::vector<float> scaled_vert_angles;	// The rescaled vertical angles
+		std::vector<float> candela_scales;		// The ratios between the rescaled and the original candela values
+	};
+
+	//! Thread-safe cache of the rescale tables, keyed by the vertical angles, the rescale cone angle and the rescale mode.
+	//! Catalogs tend to use a handful of vertical angle grids, so rescaling a whole catalog only computes each table once.
+	class rescale_table_cache {
+	public:
+		explicit rescale_table_cache(const std::size_t max_entries = 256);
+
+		//! The process-wide cache used by rescale_ies_data() unless a cache is specified explicitly
+		static auto global() -> rescale_table_cache&;
+
+		//! Get the tables for the specified parameters, computing (and caching) them if necessary
+		auto get(const std::vector<float>& vert_angles, const float rescale_cone_angle, const bool preserve_intensity) -> std::shared_ptr<const rescale_angle_table>;
+
+		auto size() const -> std::size_t;
+		void clear();
+
+	private:
+		mutable std::shared_mutex mutex_;
+		std::unordered_multimap<uint64_t, std::shared_ptr<const rescale_angle_table>> entries_;
+		std::size_t max_entries_;
+	};
+
+	//! SIMD instruction sets the rescale kernels can use
+	enum class simd_level {
+		scalar,		// The portable reference implementation
+		sse4_2,		// SSE4.2 (4-wide)
+		avx2,		// AVX2 and FMA (8-wide)
+		avx512,		// AVX-512F (16-wide)
+	};
+
+	//! The best SIMD level supported by both the build and the CPU (detected at runtime)
+	auto supported_simd_level() -> simd_level;
+
+	//! The SIMD level currently used by the rescale kernels (the supported one by default)
+	auto active_simd_level() -> simd_level;
+
+	//! Override the SIMD level used by the rescale kernels (e.g. to compare a vectorized path against the scalar reference one)
+	//! \param[in]		level			The requested SIMD level
+	//! \return			simd_level		The level actually set, i.e. the requested level clamped to the supported one
+	auto set_simd_level(const simd_level level) -> simd_level;
+
+	//! The results of rescaling a profile to several cone angles at once.
+	//! The rescaled vertical angles and candela values of all cone angles are stored in a single arena, while everything else is shared with the source profile.
+	class rescale_batch {
+	public:
+		//! The number of rescaled profiles (i.e. cone angles)
+		auto size() const -> std::size_t { return cone_angles_.size(); }
+		auto empty() const -> bool { return cone_angles_.empty(); }
+
+		auto cone_angle(const std::size_t k) const -> float { return cone_angles_[k]; }
+
+		//! The rescaled vertical angles for the k-th cone angle
+		auto vert_angles(const std::size_t k) const -> array_view<const float> {
+			assert(k < size() && "Cone angle index out of range");
+			return array_view<const float>{ arena_.data() + k * stride_, header_.photo.vert_angles.size() };
+		}
+
+		//! The rescaled candela values for the k-th cone angle
+		auto candelas(const std::size_t k) const -> candela_matrix_view {
+			assert(k < size() && "Cone angle index out of range");
+			return candela_matrix_view{ arena_.data() + k * stride_ + candelas_offset_, header_.photo.horz_angles.size(), header_.photo.vert_angles.size() };
+		}
+
+		//! Make a standalone copy of the rescaled IES data for the k-th cone angle
+		auto make_data(const std::size_t k) const -> IE_Data;
+
+	private:
+		friend auto rescale_ies_data_batch(const IE_Data& data, const array_view<const float> rescale_cone_angles, const bool preserve_intensity) -> std::optional<rescale_batch>;
+
+		IE_Data header_;					// The source profile without its candela values
+		std::vector<float> cone_angles_;	// The rescale cone angles
+		std::vector<float, detail::aligned_allocator<float, candela_matrix::alignment>> arena_;	// The rescaled vertical angles and candela values of all cone angles
+		std::size_t stride_ = 0;			// The number of floats per cone angle
+		std::size_t candelas_offset_ = 0;	// The offset of the candela values within a cone angle's block
+	};
+
+	//! Destination of the IESNA-format output of write_ies().
+	//! The writer formats the profile into a fixed-size buffer and hands it over to the sink each time it fills up, so a sink only ever sees a few large writes.
+	class ies_sink {
+	public:
+		virtual ~ies_sink() = default;
+
+		//! Write the specified bytes
+		//! \return			true on success, false on failure (in which case the writer stops and reports the failure)
+		virtual auto write(const char* data, const std::size_t size) -> bool = 0;
+
+		//! Called once all the output has been written
+		virtual auto flush() -> bool { return true; }
+	};
+
+	//! Sink appending the output to a byte buffer
+	class buffer_sink : public ies_sink {
+	public:
+		explicit buffer_sink(std::vector<uint8_t>& buffer) : buffer_(buffer) {}
+
+		auto write(const char* data, const std::size_t size) -> bool override;
+
+	private:
+		std::vector<uint8_t>& buffer_;
+	};
+
+	//! Sink writing the output to a standard output stream
+	class ostream_sink : public ies_sink {
+	public:
+		explicit ostream_sink(std::ostream& stream) : stream_(stream) {}
+
+		auto write(const char* data, const std::size_t size) -> bool override;
+		auto flush() -> bool override;
+
+	private:
+		std::ostream& stream_;
+	};
+
+	//! Sink writing the output straight to a file descriptor with write(2), bypassing any user-space buffering.
+	//! The descriptor is not owned by the sink, i.e. it is not closed when the sink is destroyed.
+	class fd_sink : public ies_sink {
+	public:
+		explicit fd_sink(const int fd) : fd_(fd) {}
+
+		auto write(const char* data, const std::size_t size) -> bool override;
+
+	private:
+		int fd_;
+	};
+
+	//! Write the IES data in the IESNA format to the specified sink.
+	//! Unlike convert_data_to_buffer(), the output is never materialized as a whole: the peak memory is bounded by the writer's buffer, whatever the size of the profile.
+	//! \param[in]		data			The IES data to write
+	//! \param[in]		sink			The destination of the output
+	//! \return			true on success, false on failure (e.g. unsupported format or failed write)
+	auto write_ies(const IE_Data& data, ies_sink& sink) -> bool;
+
+	//! Write the IES data in the IESNA format to the specified file (created or truncated)
+	auto write_ies_to_file(const IE_Data& data, const std::string_view file_name) -> bool;
+
+	//! Compute a 64-bit non-cryptographic hash of the specified bytes
+	auto hash_bytes(const void* data, const std::size_t size, const uint64_t seed = 0) -> uint64_t;
+
 	auto read_file_to_stream(const std::string_view file_name) -> std::optional<memstream>;
 	auto convert_stream_to_data(memstream& file_stream, const std::string_view ies_file_name = "") -> std::optional<IE_Data>;
 	auto convert_data_to_buffer(const IE_Data& data) ->std::optional<std::vector<uint8_t>>;
 	auto write_buffer_to_file(const std::vector<uint8_t>& buffer, const std::string_view file_name) -> bool;
 	auto rescale_ies_data(const IE_Data& in_data, const float rescale_angle, const bool preserve_intensity = false) -> std::optional<IE_Data>;
+	auto rescale_ies_data(const IE_Data& in_data, const float rescale_angle, const bool preserve_intensity, rescale_table_cache& cache) -> std::optional<IE_Data>;
+
+	//! How the candela values are fitted into the new cone
+	enum class rescale_mode {
+		foreshorten,			// Scale the horizontal projections of the candela values, which preserves the shape of the profile best (preserve_intensity = false)
+		preserve_intensity,		// Keep the candela values, 'funneling' the profile into the new cone (preserve_intensity = true)
+		preserve_flux,			// Foreshorten, then scale the lamp multiplier so that the profile keeps its total flux (as integrated by luminous_flux())
+	};
+
+	auto rescale_ies_data(const IE_Data& in_data, const float rescale_angle, const rescale_mode mode) -> std::optional<IE_Data>;
+	auto rescale_ies_data(const IE_Data& in_data, const float rescale_angle, const rescale_mode mode, rescale_table_cache& cache) -> std::optional<IE_Data>;
+
+	//! Rescale IES data that is no longer needed afterwards, reusing its storage for the result instead of copying it.
+	auto rescale_ies_data(IE_Data&& in_data, const float rescale_angle, const bool preserve_intensity = false) -> std::optional<IE_Data>;
+	auto rescale_ies_data(IE_Data&& in_data, const float rescale_angle, const rescale_mode mode) -> std::optional<IE_Data>;
+
+	//! Rescale the IES data in place, without allocating any memory (other than for the rescale tables, if they aren't cached yet).
+	//! \param[in,out]	data						The IES data to rescale
+	//! \param[in]		rescale_cone_angle			The new cone in degrees to rescale the vertical angles to
+	//! \param[in]		preserve_intensity			The flag indicating whether to preserve the intensity values of the original IES data
+	//! \return			true on success, false on failure (in which case the data is left unchanged)
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity = false) -> bool;
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const bool preserve_intensity, rescale_table_cache& cache) -> bool;
+
+	//! Rescale the IES data in place with the specified mode.
+	//! With rescale_mode::preserve_flux, the flux of the original and the rescaled profiles is integrated in the same pass as the rescale, from the weighted
+	//! sums of the columns of the grid, and the ratio of the two is folded into the lamp multiplier (setting up the weights of the integral allocates memory).
+	//! That mode fails for a cone angle of 0, which leaves no solid angle to emit the flux into, and for profiles whose vertical angles aren't in ascending
+	//! order (e.g. profiles that were already rescaled).
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const rescale_mode mode) -> bool;
+	auto rescale_ies_data_inplace(IE_Data& data, const float rescale_cone_angle, const rescale_mode mode, rescale_table_cache& cache) -> bool;
+
+	//! Rescale the IES data to several cone angles in one pass, sharing the cone angle independent work between them.
+	//! \param[in]		data						The IES data to rescale
+	//! \param[in]		rescale_cone_angles			The cone angles in degrees to rescale the vertical angles to
+	//! \param[in]		preserve_intensity			The flag indicating whether to preserve the intensity values of the original IES data
+	//! \return			std::optional<rescale_batch>
+	//!         The rescaled IES data for all cone angles on success or an empty object on failure (e.g. if any of the cone angles is invalid)
+	auto rescale_ies_data_batch(const IE_Data& data, const array_view<const float> rescale_cone_angles, const bool preserve_intensity = false) -> std::optional<rescale_batch>;
 
 } // namespace ies_rescale
 
@@ -0,0 +1,329 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+#include <type_traits>
+
+#include "ies_rescale_archive.h"
+#include "ies_rescale_layout.h"
+#include "ies_rescale_batch.h"
+#include "ies_rescale_loader.h"
+
+namespace fs = std::filesystem;
+
+namespace ies_rescale {
+
+	static_assert(std::is_trivially_copyable<archive_header>::value && std::is_trivially_copyable<archive_entry>::value
+		&& std::is_trivially_copyable<archive_hash_entry>::value, "The archive structures are copied as raw bytes");
+	static_assert(sizeof(archive_header) % alignof(uint64_t) == 0 && sizeof(archive_entry) % alignof(uint64_t) == 0
+		&& sizeof(archive_hash_entry) % alignof(uint64_t) == 0, "The archive structures must not need any tail padding");
+
+	auto profile_archive::open(const std::string_view file_name) -> std::optional<profile_archive> {
+		auto file = mapped_file::open(file_name);
+		if (!file) {
+			return {};
+		}
+
+		const auto size = file->size();
+		if (size < sizeof(archive_header)) {
+			return {};
+		}
+
+		auto header = archive_header{};
+		std::memcpy(&header, file->data(), sizeof(header));
+
+		if (header.magic != archive_header::magic_value || header.version != archive_header::current_version
+			|| header.header_size != sizeof(archive_header) || header.file_size != size) {
+			return {};
+		}
+
+		// Only the sections are checked here: the entries are checked as they are accessed
+		auto section_fits = [size](const uint64_t offset, const uint64_t bytes) {
+			return detail::section_fits(offset, bytes, size, sizeof(archive_header), alignof(uint64_t));
+		};
+
+		if (!section_fits(header.entries_offset, uint64_t{ header.num_entries } * sizeof(archive_entry))
+			|| !section_fits(header.hash_index_offset, uint64_t{ header.num_entries } * sizeof(archive_hash_entry))
+			|| !section_fits(header.names_offset, header.names_size)) {
+			return {};
+		}
+
+		return profile_archive{ std::move(*file), header };
+	}
+
+	auto profile_archive::entry(const std::size_t i) const -> archive_entry {
+		assert(i < size() && "Entry index out of range");
+
+		auto entry = archive_entry{};
+		std::memcpy(&entry, file_.data() + header_.entries_offset + i * sizeof(archive_entry), sizeof(entry));
+		return entry;
+	}
+
+	auto profile_archive::hash_entry(const std::size_t i) const -> archive_hash_entry {
+		auto entry = archive_hash_entry{};
+		std::memcpy(&entry, file_.data() + header_.hash_index_offset + i * sizeof(archive_hash_entry), sizeof(entry));
+		return entry;
+	}
+
+	auto profile_archive::name(const std::size_t i) const -> std::string_view {
+		const auto e = entry(i);
+		if (!detail::range_fits(e.name_offset, e.name_size, header_.names_size)) {
+			return {};
+		}
+
+		return std::string_view{ reinterpret_cast<const char*>(file_.data() + header_.names_offset + e.name_offset), e.name_size };
+	}
+
+	auto profile_archive::find(const std::string_view name) const -> std::optional<std::size_t> {
+		// Binary search over the entries, which are sorted by name
+		auto first = std::size_t{ 0 };
+		auto count = size();
+		while (count > 0) {
+			const auto step = count / 2;
+			if (this->name(first + step) < name) {
+				first += step + 1;
+				count -= step + 1;
+			}
+			else {
+				count = step;
+			}
+		}
+
+		if (first < size() && this->name(first) == name) {
+			return first;
+		}
+
+		return {};
+	}
+
+	auto profile_archive::find_by_hash(const uint64_t content_hash) const -> std::optional<std::size_t> {
+		auto first = std::size_t{ 0 };
+		auto count = size();
+		while (count > 0) {
+			const auto step = count / 2;
+			if (hash_entry(first + step).content_hash < content_hash) {
+				first += step + 1;
+				count -= step + 1;
+			}
+			else {
+				count = step;
+			}
+		}
+
+		if (first < size()) {
+			const auto e = hash_entry(first);
+			if (e.content_hash == content_hash && e.entry < size()) {
+				return std::size_t{ e.entry };
+			}
+		}
+
+		return {};
+	}
+
+	auto profile_archive::profile(const std::size_t i) const -> std::optional<binary_profile_view> {
+		const auto e = entry(i);
+		if (!detail::range_fits(e.profile_offset, e.profile_size, file_.size())) {
+			return {};
+		}
+
+		return binary_profile_view::from_bytes(file_.data() + e.profile_offset, e.profile_size);
+	}
+
+	auto profile_archive::profile(const std::string_view name) const -> std::optional<binary_profile_view> {
+		const auto i = find(name);
+		if (!i) {
+			return {};
+		}
+
+		return profile(*i);
+	}
+
+	auto archive_builder::add(const std::string_view name, const IE_Data& data) -> bool {
+		auto binary = convert_data_to_binary(data);
+		if (!binary) {
+			return false;
+		}
+
+		return add_binary(name, std::move(*binary));
+	}
+
+	auto archive_builder::add_binary(const std::string_view name, std::vector<uint8_t>&& binary) -> bool {
+		if (!binary_profile_view::from_bytes(binary.data(), binary.size()) || !names_.emplace(name).second) {
+			return false;
+		}
+
+		profiles_.push_back({ std::string{ name }, std::move(binary) });
+		return true;
+	}
+
+	auto archive_builder::build_index(std::vector<std::size_t>& order) const -> std::vector<uint8_t> {
+		const auto num_entries = profiles_.size();
+
+		// The entries are sorted by name (as raw bytes, like std::string_view compares them)
+		order.resize(num_entries);
+		std::iota(order.begin(), order.end(), std::size_t{ 0 });
+		std::sort(order.begin(), order.end(), [this](const std::size_t a, const std::size_t b) { return profiles_[a].name < profiles_[b].name; });
+
+		auto header = archive_header{};
+		header.magic = archive_header::magic_value;
+		header.version = archive_header::current_version;
+		header.header_size = static_cast<uint16_t>(sizeof(archive_header));
+		header.num_entries = static_cast<uint32_t>(num_entries);
+
+		auto names_size = std::size_t{ 0 };
+		for (const auto& profile : profiles_) {
+			names_size += profile.name.size();
+		}
+		header.names_size = static_cast<uint32_t>(names_size);
+
+		header.entries_offset = sizeof(archive_header);
+		header.hash_index_offset = header.entries_offset + num_entries * sizeof(archive_entry);
+		header.names_offset = header.hash_index_offset + num_entries * sizeof(archive_hash_entry);
+
+		auto entries = std::vector<archive_entry>(num_entries);
+		auto hash_index = std::vector<archive_hash_entry>(num_entries);
+		auto profile_offset = detail::align_section(header.names_offset + names_size);
+		const auto index_size = profile_offset;
+		auto name_offset = uint32_t{ 0 };
+
+		for (auto i = std::size_t{ 0 }; i < num_entries; ++i) {
+			const auto& profile = profiles_[order[i]];
+
+			auto& entry = entries[i];
+			entry.profile_offset = profile_offset;
+			entry.profile_size = profile.binary.size();
+			entry.content_hash = hash_bytes(profile.binary.data(), profile.binary.size());
+			entry.name_offset = name_offset;
+			entry.name_size = static_cast<uint32_t>(profile.name.size());
+
+			hash_index[i] = archive_hash_entry{ entry.content_hash, static_cast<uint32_t>(i), 0 };
+
+			name_offset += entry.name_size;
+			profile_offset = detail::align_section(profile_offset + profile.binary.size());
+		}
+
+		std::sort(hash_index.begin(), hash_index.end(), [](const archive_hash_entry& a, const archive_hash_entry& b) {
+			return a.content_hash != b.content_hash ? a.content_hash < b.content_hash : a.entry < b.entry;
+		});
+
+		// The last profile isn't padded
+		header.file_size = num_entries > 0 ? entries.back().profile_offset + entries.back().profile_size : index_size;
+
+		auto buffer = std::vector<uint8_t>(index_size, 0);
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		if (num_entries > 0) {
+			std::memcpy(buffer.data() + header.entries_offset, entries.data(), num_entries * sizeof(archive_entry));
+			std::memcpy(buffer.data() + header.hash_index_offset, hash_index.data(), num_entries * sizeof(archive_hash_entry));
+		}
+
+		auto* names = buffer.data() + header.names_offset;
+		for (auto i = std::size_t{ 0 }; i < num_entries; ++i) {
+			const auto& name = profiles_[order[i]].name;
+			std::memcpy(names + entries[i].name_offset, name.data(), name.size());
+		}
+
+		return buffer;
+	}
+
+	auto archive_builder::build() const -> std::vector<uint8_t> {
+		auto order = std::vector<std::size_t>{};
+		auto buffer = build_index(order);
+
+		// The profiles follow in the order of the entries, each one starting at an aligned offset
+		for (const auto i : order) {
+			buffer.resize(detail::align_section(buffer.size()), 0);
+			buffer.insert(buffer.end(), profiles_[i].binary.begin(), profiles_[i].binary.end());
+		}
+
+		return buffer;
+	}
+
+	auto archive_builder::write(const std::string_view file_name) const -> bool {
+		auto order = std::vector<std::size_t>{};
+		const auto index = build_index(order);
+
+		auto file = std::ofstream(std::string{ file_name }, std::ios::binary);
+		if (!file || !file.is_open()) {
+			std::cerr << "Could not open file " << file_name << "\n";
+			return false;
+		}
+
+		// Write the profiles straight from the builder rather than assembling the whole archive in memory first
+		static constexpr char padding[detail::section_alignment] = {};
+		file.write(reinterpret_cast<const char*>(index.data()), index.size());
+
+		auto offset = index.size();
+		for (const auto i : order) {
+			const auto aligned_offset = detail::align_section(offset);
+			file.write(padding, aligned_offset - offset);
+			file.write(reinterpret_cast<const char*>(profiles_[i].binary.data()), profiles_[i].binary.size());
+			offset = aligned_offset + profiles_[i].binary.size();
+		}
+
+		if (!file.flush()) {
+			std::cerr << "Could not write to file " << file_name << "\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	auto create_profile_archive(const std::string_view input_dir, const std::string_view archive_file_name, const bool recursive) -> std::optional<std::size_t> {
+		auto ec = std::error_code{};
+		if (!fs::is_directory(fs::path{ input_dir }, ec)) {
+			std::cerr << "Could not read directory " << input_dir << "\n";
+			return {};
+		}
+
+		const auto files = find_ies_files(input_dir, recursive);
+
+		// The profiles are converted to the binary format as they are loaded, so that only one copy of each is kept
+		auto binaries = std::vector<std::optional<std::vector<uint8_t>>>(files.size());
+		bulk_load_profiles(files, [&binaries](const std::size_t index, std::optional<IE_Data>&& data) {
+			if (data) {
+				binaries[index] = convert_data_to_binary(*data);
+			}
+		});
+
+		auto builder = archive_builder{};
+		for (auto i = std::size_t{ 0 }; i < files.size(); ++i) {
+			if (binaries[i]) {
+				const auto name = fs::path{ files[i] }.lexically_relative(fs::path{ input_dir }).generic_string();
+				builder.add_binary(name, std::move(*binaries[i]));
+			}
+		}
+
+		if (!builder.write(archive_file_name)) {
+			return {};
+		}
+
+		return builder.size();
+	}
+
+} // namespace ies_rescale
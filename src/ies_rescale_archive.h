@@ -0,0 +1,171 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_ARCHIVE_H
+#define IES_RESCALE_ARCHIVE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+#include "ies_rescale_binary.h"
+
+namespace ies_rescale {
+
+	//! The layout of a profile archive: a single file holding many profiles in the binary format, so that a whole catalog can be opened at once.
+	//! A file starts with this header, followed by the entries (sorted by name), the hash index (sorted by content hash), the names
+	//! and finally the binary profiles, each aligned to candela_matrix::alignment. The byte order is the native one, as in binary_header.
+	struct archive_header {
+		static constexpr uint32_t magic_value = 0x41534549;	// "IESA" in little-endian order
+		static constexpr uint16_t current_version = 1;
+
+		uint32_t magic;
+		uint16_t version;
+		uint16_t header_size;
+		uint64_t file_size;
+
+		uint32_t num_entries;
+		uint32_t names_size;				// The size of all the names in bytes
+
+		uint64_t entries_offset;			// The offsets of the sections from the beginning of the file
+		uint64_t hash_index_offset;
+		uint64_t names_offset;
+
+		uint64_t reserved[2];
+	};
+
+	//! An entry of a profile archive, describing one profile
+	struct archive_entry {
+		uint64_t profile_offset;			// The offset of the binary profile from the beginning of the file
+		uint64_t profile_size;
+		uint64_t content_hash;				// hash_bytes() of the binary profile
+		uint32_t name_offset;				// The offset of the name from the beginning of the names
+		uint32_t name_size;
+	};
+
+	//! An entry of the hash index of a profile archive
+	struct archive_hash_entry {
+		uint64_t content_hash;
+		uint32_t entry;						// The index of the archive entry
+		uint32_t reserved;
+	};
+
+	//! A profile archive, mapped into memory.
+	//! Opening an archive only validates its header: the lookups are binary searches over the indices,
+	//! and only the profile being fetched is validated and read, so the cost of a lookup doesn't depend on the other entries.
+	class profile_archive {
+	public:
+		//! Map the specified archive file and validate its header
+		//! \param[in]		file_name							The name of the archive file
+		//! \return			std::optional<profile_archive>		The archive on success or an empty object on failure
+		static auto open(const std::string_view file_name) -> std::optional<profile_archive>;
+
+		//! The number of profiles in the archive
+		auto size() const -> std::size_t { return header_.num_entries; }
+
+		//! The name of the profile at the specified index
+		auto name(const std::size_t i) const -> std::string_view;
+
+		//! The content hash of the profile at the specified index
+		auto content_hash(const std::size_t i) const -> uint64_t { return entry(i).content_hash; }
+
+		//! Find a profile by name in O(log n)
+		//! \return			std::optional<std::size_t>		The index of the profile or an empty object if there's no profile with that name
+		auto find(const std::string_view name) const -> std::optional<std::size_t>;
+
+		//! Find a profile by content hash in O(log n) (if several profiles have the same content, the one with the lowest index is returned)
+		//! \return			std::optional<std::size_t>		The index of the profile or an empty object if there's no profile with that hash
+		auto find_by_hash(const uint64_t content_hash) const -> std::optional<std::size_t>;
+
+		//! Get a view of the profile at the specified index, reading the values in place.
+		//! Note: the view refers to the archive mapping, which must outlive it.
+		//! \return			std::optional<binary_profile_view>		The view on success or an empty object if the profile is corrupted
+		auto profile(const std::size_t i) const -> std::optional<binary_profile_view>;
+
+		//! Find a profile by name and get a view of it
+		auto profile(const std::string_view name) const -> std::optional<binary_profile_view>;
+
+	private:
+		profile_archive(mapped_file&& file, const archive_header& header)
+			: file_(std::move(file))
+			, header_(header)
+		{}
+
+		auto entry(const std::size_t i) const -> archive_entry;
+		auto hash_entry(const std::size_t i) const -> archive_hash_entry;
+
+		mapped_file file_;					// The archive content, which the views returned by profile() point into
+		archive_header header_ = {};
+	};
+
+	//! Builds profile archives
+	class archive_builder {
+	public:
+		//! Add a profile to the archive
+		//! \param[in]		name			The name of the profile, unique within the archive
+		//! \param[in]		data			The IES data
+		//! \return			true on success, false on failure (i.e. if the name is already used or the data is inconsistent)
+		auto add(const std::string_view name, const IE_Data& data) -> bool;
+
+		//! Add a profile in the binary format to the archive
+		auto add_binary(const std::string_view name, std::vector<uint8_t>&& binary) -> bool;
+
+		//! The number of profiles added so far
+		auto size() const -> std::size_t { return profiles_.size(); }
+
+		//! Serialize the archive
+		auto build() const -> std::vector<uint8_t>;
+
+		//! Write the archive to the specified file (created or truncated)
+		auto write(const std::string_view file_name) const -> bool;
+
+	private:
+		struct pending_profile {
+			std::string name;
+			std::vector<uint8_t> binary;
+		};
+
+		//! Lay out the archive, returning everything that precedes the profiles (header, indices and names, padded to the first profile)
+		//! along with the order of the profiles in the file
+		auto build_index(std::vector<std::size_t>& order) const -> std::vector<uint8_t>;
+
+		std::vector<pending_profile> profiles_;
+		std::unordered_set<std::string> names_;
+	};
+
+	//! Build an archive of all the IES profiles in a directory, named after their paths relative to the directory (with '/' separators).
+	//! The files are loaded with bulk_load_profiles(), and the ones that can't be read or parsed are skipped.
+	//! \param[in]		input_dir					The directory holding the IES profiles
+	//! \param[in]		archive_file_name			The name of the archive file to write
+	//! \param[in]		recursive					The flag indicating whether to also archive the profiles in the subdirectories
+	//! \return			std::optional<std::size_t>	The number of archived profiles on success or an empty object on failure
+	auto create_profile_archive(const std::string_view input_dir, const std::string_view archive_file_name, const bool recursive = true) -> std::optional<std::size_t>;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_ARCHIVE_H
@@ -0,0 +1,224 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+#include <thread>
+#include <limits>
+#include <cstring>
+#include <type_traits>
+
+#include "ies_rescale_atlas.h"
+#include "ies_rescale_layout.h"
+#include "ies_rescale_batch.h"
+
+namespace ies_rescale {
+
+	// The index is read and written with memcpy, and its sections follow each other without padding
+	static_assert(std::is_trivially_copyable<atlas_index_header>::value && std::is_trivially_copyable<atlas_index_entry>::value
+		, "The atlas index structures must be trivially copyable");
+	static_assert(sizeof(atlas_index_header) % alignof(uint32_t) == 0 && sizeof(atlas_index_entry) % alignof(uint32_t) == 0
+		, "The atlas index structures must keep the sections aligned");
+
+	auto atlas_index::find(const std::string_view name) const -> std::optional<std::size_t> {
+		const auto it = std::lower_bound(sorted_layers_.begin(), sorted_layers_.end(), name, [this](const uint32_t layer, const std::string_view value) {
+			return names_[layer] < value;
+		});
+
+		if (it != sorted_layers_.end() && names_[*it] == name) {
+			return std::size_t{ *it };
+		}
+
+		return {};
+	}
+
+	void atlas_index::set_names(std::vector<std::string> names) {
+		names_ = std::move(names);
+
+		sorted_layers_.resize(names_.size());
+		std::iota(sorted_layers_.begin(), sorted_layers_.end(), uint32_t{ 0 });
+		std::sort(sorted_layers_.begin(), sorted_layers_.end(), [this](const uint32_t lhs, const uint32_t rhs) {
+			return names_[lhs] < names_[rhs];
+		});
+	}
+
+	auto build_profile_atlas(const std::vector<IE_Data>& profiles, const std::vector<std::string>& names, const texture_options& options) -> std::optional<profile_atlas> {
+		if (profiles.size() != names.size() || options.width == 0 || options.height == 0 || profiles.size() > std::numeric_limits<uint32_t>::max()) {
+			return {};
+		}
+
+		auto unique_names = std::unordered_set<std::string_view>{};
+		for (const auto& name : names) {
+			if (!unique_names.insert(name).second) {
+				return {};
+			}
+		}
+
+		auto atlas = profile_atlas{};
+		atlas.index.width = options.width;
+		atlas.index.height = options.height;
+		atlas.index.format = options.format;
+		atlas.index.set_names(names);
+		atlas.index.scales.assign(profiles.size(), 0.f);
+		atlas.texels.assign(profiles.size() * atlas.layer_size(), 0);
+
+		// Every profile is baked on a single thread, as a library has many more profiles than a profile has rows
+		auto layer_options = options;
+		layer_options.normalize = true;
+		layer_options.num_threads = 1;
+
+		auto bake = [&](const std::size_t layer) {
+			const auto texture = bake_texture(profiles[layer], layer_options);
+			if (texture) {
+				atlas.index.scales[layer] = texture->scale;
+				std::memcpy(atlas.texels.data() + layer * atlas.layer_size(), texture->texels.data(), texture->texels.size());
+			}
+		};
+
+		const auto threads = std::clamp<std::size_t>(options.num_threads > 0 ? options.num_threads : std::size_t{ std::thread::hardware_concurrency() }, 1, std::max<std::size_t>(profiles.size(), 1));
+		if (threads == 1) {
+			for (auto layer = std::size_t{ 0 }; layer < profiles.size(); ++layer) {
+				bake(layer);
+			}
+			return atlas;
+		}
+
+		auto pool = work_stealing_pool{ threads };
+		for (auto layer = std::size_t{ 0 }; layer < profiles.size(); ++layer) {
+			pool.submit([&bake, layer] {
+				bake(layer);
+			});
+		}
+		pool.wait();
+
+		return atlas;
+	}
+
+	auto convert_atlas_index_to_buffer(const atlas_index& index) -> std::vector<uint8_t> {
+		auto header = atlas_index_header{};
+		header.magic = atlas_index_header::magic_value;
+		header.version = atlas_index_header::current_version;
+		header.header_size = static_cast<uint16_t>(sizeof(atlas_index_header));
+		header.width = static_cast<uint32_t>(index.width);
+		header.height = static_cast<uint32_t>(index.height);
+		header.format = static_cast<uint32_t>(index.format);
+		header.num_layers = static_cast<uint32_t>(index.num_layers());
+
+		// The entries are sorted by name, so that the names can be binary searched straight from the file
+		auto entries = std::vector<atlas_index_entry>{};
+		entries.reserve(index.num_layers());
+		auto names = std::string{};
+		for (const auto layer : index.sorted_layers()) {
+			entries.push_back({ layer, static_cast<uint32_t>(names.size()), static_cast<uint32_t>(index.names()[layer].size()) });
+			names += index.names()[layer];
+		}
+		header.names_size = static_cast<uint32_t>(names.size());
+
+		const auto scales_size = index.num_layers() * sizeof(float);
+		const auto entries_size = entries.size() * sizeof(atlas_index_entry);
+
+		auto buffer = std::vector<uint8_t>(sizeof(header) + scales_size + entries_size + names.size());
+		auto* out = buffer.data();
+		std::memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+		std::memcpy(out, index.scales.data(), scales_size);
+		out += scales_size;
+		std::memcpy(out, entries.data(), entries_size);
+		out += entries_size;
+		std::memcpy(out, names.data(), names.size());
+
+		return buffer;
+	}
+
+	auto convert_buffer_to_atlas_index(const void* data, const std::size_t size) -> std::optional<atlas_index> {
+		if (size < sizeof(atlas_index_header)) {
+			return {};
+		}
+
+		const auto* bytes = static_cast<const uint8_t*>(data);
+
+		auto header = atlas_index_header{};
+		std::memcpy(&header, bytes, sizeof(header));
+
+		if (header.magic != atlas_index_header::magic_value || header.version != atlas_index_header::current_version
+			|| header.header_size != sizeof(atlas_index_header) || header.format > static_cast<uint32_t>(texel_format::unorm8)) {
+			return {};
+		}
+
+		const auto scales_size = uint64_t{ header.num_layers } * sizeof(float);
+		const auto entries_size = uint64_t{ header.num_layers } * sizeof(atlas_index_entry);
+		if (sizeof(header) + scales_size + entries_size + header.names_size != size) {
+			return {};
+		}
+
+		auto index = atlas_index{};
+		index.width = header.width;
+		index.height = header.height;
+		index.format = static_cast<texel_format>(header.format);
+		index.scales.resize(header.num_layers);
+		auto layer_names = std::vector<std::string>(header.num_layers);
+
+		std::memcpy(index.scales.data(), bytes + sizeof(header), scales_size);
+
+		const auto* entries = bytes + sizeof(header) + scales_size;
+		const auto* names = reinterpret_cast<const char*>(entries + entries_size);
+		auto assigned = std::vector<bool>(header.num_layers, false);
+		for (auto i = std::size_t{ 0 }; i < header.num_layers; ++i) {
+			auto entry = atlas_index_entry{};
+			std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+
+			// Every layer must be named exactly once
+			if (entry.layer >= header.num_layers || assigned[entry.layer]
+				|| !detail::range_fits(entry.name_offset, entry.name_size, header.names_size)) {
+				return {};
+			}
+
+			assigned[entry.layer] = true;
+			layer_names[entry.layer].assign(names + entry.name_offset, entry.name_size);
+		}
+
+		// Don't trust the order in the file, as find() relies on it
+		index.set_names(std::move(layer_names));
+
+		return index;
+	}
+
+	auto read_atlas_index(const std::string_view file_name) -> std::optional<atlas_index> {
+		auto file = mapped_file::open(file_name);
+		if (!file) {
+			return {};
+		}
+
+		return convert_buffer_to_atlas_index(file->data(), file->size());
+	}
+
+	auto write_profile_atlas(const profile_atlas& atlas, const std::string_view texels_file_name, const std::string_view index_file_name) -> bool {
+		if (!write_buffer_to_file(atlas.texels, texels_file_name)) {
+			return false;
+		}
+
+		return write_buffer_to_file(convert_atlas_index_to_buffer(atlas.index), index_file_name);
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,123 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_ATLAS_H
+#define IES_RESCALE_ATLAS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+#include "ies_rescale_texture.h"
+
+namespace ies_rescale {
+
+	//! The layout of an atlas index file: this header, followed by the scales of the layers (in layer order),
+	//! the name entries (sorted by name) and finally the names. The byte order is the native one, as in binary_header.
+	struct atlas_index_header {
+		static constexpr uint32_t magic_value = 0x58534549;	// "IESX" in little-endian order
+		static constexpr uint16_t current_version = 1;
+
+		uint32_t magic;
+		uint16_t version;
+		uint16_t header_size;
+		uint32_t width;
+		uint32_t height;
+		uint32_t format;					// texel_format
+		uint32_t num_layers;
+		uint32_t names_size;				// The size of all the names in bytes
+		uint32_t reserved;
+	};
+
+	//! A name entry of an atlas index file
+	struct atlas_index_entry {
+		uint32_t layer;
+		uint32_t name_offset;				// The offset of the name from the beginning of the names
+		uint32_t name_size;
+	};
+
+	//! What a runtime needs to know about the layers of a profile atlas
+	//! The names are only set through set_names(), which keeps the lookup by name in sync with them.
+	class atlas_index {
+	public:
+		std::size_t width = 0;
+		std::size_t height = 0;
+		texel_format format = texel_format::float32;
+		std::vector<float> scales;			// The intensity in candelas a texel value of 1 stands for in every layer (0 for the profiles that couldn't be baked)
+
+		auto num_layers() const -> std::size_t { return names_.size(); }
+
+		//! The names of the layers
+		auto names() const -> const std::vector<std::string>& { return names_; }
+
+		//! Set the names of the layers, in layer order
+		void set_names(std::vector<std::string> names);
+
+		//! The layers sorted by name
+		auto sorted_layers() const -> const std::vector<uint32_t>& { return sorted_layers_; }
+
+		//! Find a layer by name in O(log n)
+		auto find(const std::string_view name) const -> std::optional<std::size_t>;
+
+	private:
+		std::vector<std::string> names_;
+		std::vector<uint32_t> sorted_layers_;
+	};
+
+	//! A library of profiles baked to the same resolution, as the layers of a single array texture
+	struct profile_atlas {
+		atlas_index index;
+		std::vector<uint8_t> texels;		// The layers one after the other, each one laid out as a baked_texture
+
+		auto layer_size() const -> std::size_t { return index.width * index.height * texel_size(index.format); }
+		auto layer(const std::size_t i) const -> const uint8_t* { return texels.data() + i * layer_size(); }
+	};
+
+	//! Bake a library of profiles into an atlas, baking the profiles in parallel.
+	//! Every layer is normalized by the peak intensity of its profile, which the index records as the scale of the layer,
+	//! so all the profiles use the full range of the texel format. The profiles that can't be baked get an empty layer with a scale of 0.
+	//! \param[in]		profiles						The IES data of the profiles
+	//! \param[in]		names							The names of the profiles (as many as the profiles)
+	//! \param[in]		options							The bake parameters of all the layers (options.normalize is ignored, and options.num_threads applies to the whole library)
+	//! \return			std::optional<profile_atlas>	The atlas on success or an empty object on failure (i.e. invalid options, mismatched or duplicate names)
+	auto build_profile_atlas(const std::vector<IE_Data>& profiles, const std::vector<std::string>& names, const texture_options& options = {}) -> std::optional<profile_atlas>;
+
+	//! Serialize the index of an atlas
+	auto convert_atlas_index_to_buffer(const atlas_index& index) -> std::vector<uint8_t>;
+
+	//! Deserialize the index of an atlas
+	auto convert_buffer_to_atlas_index(const void* data, const std::size_t size) -> std::optional<atlas_index>;
+
+	//! Read an atlas index file
+	auto read_atlas_index(const std::string_view file_name) -> std::optional<atlas_index>;
+
+	//! Write an atlas: the raw texels of all the layers to one file, ready to be uploaded as an array texture, and its index to another one
+	auto write_profile_atlas(const profile_atlas& atlas, const std::string_view texels_file_name, const std::string_view index_file_name) -> bool;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_ATLAS_H
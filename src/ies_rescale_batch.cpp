@@ -0,0 +1,310 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cassert>
+#include <utility>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "ies_rescale_batch.h"
+#include "ies_rescale_pipeline.h"
+#include "ies_rescale_result_cache.h"
+
+namespace ies_rescale {
+
+	// The index of the pool worker running on the current thread, if any
+	static thread_local const work_stealing_pool* current_pool = nullptr;
+	static thread_local std::size_t current_worker = 0;
+
+	work_stealing_pool::work_stealing_pool(const std::size_t num_threads) {
+		const auto count = num_threads > 0 ? num_threads : std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+
+		queues_.reserve(count);
+		for (auto i = std::size_t{ 0 }; i < count; ++i) {
+			queues_.push_back(std::make_unique<worker_queue>());
+		}
+
+		threads_.reserve(count);
+		for (auto i = std::size_t{ 0 }; i < count; ++i) {
+			threads_.emplace_back([this, i] { run(i); });
+		}
+	}
+
+	work_stealing_pool::~work_stealing_pool() {
+		{
+			auto lock = std::lock_guard<std::mutex>{ mutex_ };
+			stop_ = true;
+		}
+		work_available_.notify_all();
+
+		for (auto& thread : threads_) {
+			thread.join();
+		}
+	}
+
+	void work_stealing_pool::submit(std::function<void()> task) {
+		const auto index = current_pool == this ? current_worker : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+		num_pending_.fetch_add(1, std::memory_order_relaxed);
+		{
+			auto& queue = *queues_[index];
+			auto lock = std::lock_guard<std::mutex>{ queue.mutex };
+			queue.tasks.push_back(std::move(task));
+		}
+		{
+			auto lock = std::lock_guard<std::mutex>{ mutex_ };
+			++num_queued_;
+		}
+		work_available_.notify_one();
+	}
+
+	void work_stealing_pool::wait() {
+		auto lock = std::unique_lock<std::mutex>{ mutex_ };
+		work_done_.wait(lock, [this] { return num_pending_.load(std::memory_order_acquire) == 0; });
+
+		if (exception_) {
+			std::rethrow_exception(std::exchange(exception_, nullptr));
+		}
+	}
+
+	auto work_stealing_pool::try_pop(const std::size_t index, std::function<void()>& task) -> bool {
+		// Take the most recently queued task of our own queue first, as its data is the most likely to still be in the cache...
+		{
+			auto& queue = *queues_[index];
+			auto lock = std::lock_guard<std::mutex>{ queue.mutex };
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				return true;
+			}
+		}
+
+		// ...and then steal the oldest task of the other workers
+		for (auto i = std::size_t{ 1 }; i < queues_.size(); ++i) {
+			auto& queue = *queues_[(index + i) % queues_.size()];
+			auto lock = std::lock_guard<std::mutex>{ queue.mutex };
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void work_stealing_pool::run(const std::size_t index) {
+		current_pool = this;
+		current_worker = index;
+
+		for (;;) {
+			{
+				auto lock = std::unique_lock<std::mutex>{ mutex_ };
+				work_available_.wait(lock, [this] { return stop_ || num_queued_ > 0; });
+				if (num_queued_ == 0) {
+					return;
+				}
+
+				// Claim one of the queued tasks, so that the pop below is guaranteed to find one
+				--num_queued_;
+			}
+
+			auto task = std::function<void()>{};
+			const auto popped = try_pop(index, task);
+			assert(popped && "A claimed task must be in one of the queues");
+			(void)popped;
+
+			try {
+				task();
+			}
+			catch (...) {
+				auto lock = std::lock_guard<std::mutex>{ mutex_ };
+				if (!exception_) {
+					exception_ = std::current_exception();
+				}
+			}
+
+			if (num_pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				auto lock = std::lock_guard<std::mutex>{ mutex_ };
+				work_done_.notify_all();
+			}
+		}
+	}
+
+	auto find_ies_files(const std::string_view dir, const bool recursive, const std::string_view exclude_suffix) -> std::vector<std::string> {
+		auto files = std::vector<std::string>{};
+
+		auto add_file = [&files, exclude_suffix](const fs::directory_entry& entry) {
+			auto ec = std::error_code{};
+			if (!entry.is_regular_file(ec)) {
+				return;
+			}
+
+			auto extension = entry.path().extension().string();
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			if (extension != ".ies") {
+				return;
+			}
+
+			const auto stem = entry.path().stem().string();
+			if (!exclude_suffix.empty() && stem.size() >= exclude_suffix.size() && std::string_view{ stem }.substr(stem.size() - exclude_suffix.size()) == exclude_suffix) {
+				return;
+			}
+
+			files.push_back(entry.path().string());
+		};
+
+		auto ec = std::error_code{};
+		const auto path = fs::path{ dir };
+		const auto options = fs::directory_options::skip_permission_denied;
+
+		if (recursive) {
+			for (auto it = fs::recursive_directory_iterator{ path, options, ec }; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+				add_file(*it);
+			}
+		}
+		else {
+			for (auto it = fs::directory_iterator{ path, options, ec }; !ec && it != fs::directory_iterator{}; it.increment(ec)) {
+				add_file(*it);
+			}
+		}
+
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+
+	auto rescale_ies_file(const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const bool preserve_intensity) -> bool {
+		return rescale_ies_file(fname_in, fname_out, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten);
+	}
+
+	auto rescale_ies_file(const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const rescale_mode mode) -> bool {
+		auto ies_stream = read_file_to_stream(fname_in);
+		if (!ies_stream) {
+			return false;
+		}
+
+		auto photo_data = convert_stream_to_data(*ies_stream, fname_in);
+		if (!photo_data) {
+			return false;
+		}
+
+		// The parsed data isn't needed afterwards, so rescale it in place
+		if (!rescale_ies_data_inplace(*photo_data, rescale_cone_angle, mode)) {
+			return false;
+		}
+
+		photo_data->file.name = fname_out;
+		return write_ies_to_file(*photo_data, fname_out);
+	}
+
+	auto make_output_file_name(const std::string_view input_fname, const std::string_view input_dir, const batch_options& options) -> std::string {
+		const auto input_file = fs::path{ input_fname };
+		const auto file_name = input_file.stem().string() + options.output_suffix + input_file.extension().string();
+
+		if (options.output_dir.empty()) {
+			return (input_file.parent_path() / file_name).string();
+		}
+
+		// Mirror the layout of the input tree under the output directory
+		auto relative_dir = input_file.parent_path().lexically_relative(fs::path{ input_dir });
+		if (relative_dir.empty() || *relative_dir.begin() == "..") {
+			relative_dir.clear();
+		}
+
+		const auto output_dir = fs::path{ options.output_dir } / relative_dir;
+		auto ec = std::error_code{};
+		fs::create_directories(output_dir, ec);
+
+		return (output_dir / file_name).string();
+	}
+
+	auto rescale_ies_files(const std::vector<std::string>& files, const std::string_view input_dir, const batch_options& options) -> batch_report {
+		const auto start_time = std::chrono::steady_clock::now();
+
+		// One flag per file rather than a shared container, so that the workers never contend on anything but the queues
+		auto failed = std::vector<uint8_t>(files.size(), 0);
+		{
+			// There's no point in having more workers than files
+			const auto num_threads = options.num_threads > 0 ? options.num_threads : std::size_t{ std::thread::hardware_concurrency() };
+			auto pool = work_stealing_pool{ std::clamp<std::size_t>(num_threads, 1, std::max<std::size_t>(files.size(), 1)) };
+
+			auto cache = std::unique_ptr<result_cache>{};
+			if (!options.cache_dir.empty()) {
+				cache = std::make_unique<result_cache>(options.cache_dir);
+			}
+
+			for (auto i = std::size_t{ 0 }; i < files.size(); ++i) {
+				pool.submit([&files, &failed, input_dir, &options, &cache, i] {
+					const auto fname_out = make_output_file_name(files[i], input_dir, options);
+					const auto rescaled = cache
+						? rescale_ies_file_cached(*cache, files[i], fname_out, options.rescale_cone_angle, options.mode)
+						: rescale_ies_file(files[i], fname_out, options.rescale_cone_angle, options.mode);
+					if (!rescaled) {
+						failed[i] = 1;
+					}
+				});
+			}
+
+			pool.wait();
+		}
+
+		auto report = batch_report{};
+		report.num_files = files.size();
+		for (auto i = std::size_t{ 0 }; i < files.size(); ++i) {
+			if (failed[i]) {
+				report.failed_files.push_back(files[i]);
+			}
+		}
+		report.num_failed = report.failed_files.size();
+		report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		return report;
+	}
+
+	auto rescale_ies_directory(const std::string_view input_dir, const batch_options& options) -> std::optional<batch_report> {
+		if (options.pipelined && !options.cache_dir.empty()) {
+			std::cerr << "The pipelined mode doesn't support a result cache\n";
+			return {};
+		}
+
+		auto ec = std::error_code{};
+		if (!fs::is_directory(fs::path{ input_dir }, ec)) {
+			std::cerr << "Could not read directory " << input_dir << "\n";
+			return {};
+		}
+
+		// Skip the outputs of a previous run written next to the inputs
+		const auto files = find_ies_files(input_dir, options.recursive, options.output_dir.empty() ? std::string_view{ options.output_suffix } : std::string_view{});
+
+		if (options.pipelined) {
+			return rescale_ies_files_pipelined(files, input_dir, options);
+		}
+
+		return rescale_ies_files(files, input_dir, options);
+	}
+
+} // namespace ies_rescale
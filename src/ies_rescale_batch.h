@@ -0,0 +1,141 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_BATCH_H
+#define IES_RESCALE_BATCH_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <cstddef>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! A fixed-size thread pool where every worker has its own task queue.
+	//! Workers take the tasks from the back of their own queue and, once it is empty, steal from the front of the other workers' queues,
+	//! so that a few slow tasks (e.g. huge profiles) don't leave the rest of the workers idle.
+	class work_stealing_pool {
+	public:
+		//! \param[in]		num_threads			The number of worker threads (0 means one per hardware thread)
+		explicit work_stealing_pool(const std::size_t num_threads = 0);
+		~work_stealing_pool();
+
+		work_stealing_pool(const work_stealing_pool&) = delete;
+		work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+		auto num_threads() const -> std::size_t { return threads_.size(); }
+
+		//! Queue a task. Tasks submitted from a worker go to that worker's own queue, the others are distributed round-robin.
+		void submit(std::function<void()> task);
+
+		//! Wait until all the submitted tasks have completed.
+		//! If any of the tasks has thrown an exception, the first one is rethrown here.
+		void wait();
+
+	private:
+		struct worker_queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void run(const std::size_t index);
+		auto try_pop(const std::size_t index, std::function<void()>& task) -> bool;
+
+		std::vector<std::unique_ptr<worker_queue>> queues_;
+		std::vector<std::thread> threads_;
+
+		std::mutex mutex_;
+		std::condition_variable work_available_;
+		std::condition_variable work_done_;
+		std::size_t num_queued_ = 0;				// The tasks waiting in the queues (guarded by mutex_)
+		std::atomic<std::size_t> num_pending_{ 0 };	// The tasks either queued or running
+		std::atomic<std::size_t> next_queue_{ 0 };
+		std::exception_ptr exception_;
+		bool stop_ = false;
+	};
+
+	//! Parameters of a batch rescale
+	struct batch_options {
+		float rescale_cone_angle = 90.f;		// The new cone in degrees to rescale the vertical angles to
+		rescale_mode mode = rescale_mode::foreshorten;	// How the candela values are fitted into the new cone
+		std::string output_dir;					// The directory to write the rescaled profiles to, mirroring the input tree (empty means next to the input files)
+		std::string output_suffix = "_rescaled";	// Appended to the stem of the output file names
+		bool recursive = true;					// Whether to walk the subdirectories of the input directory
+		std::size_t num_threads = 0;			// The number of worker threads (0 means one per hardware thread)
+		bool pipelined = false;					// Whether to run the profiles through a staged pipeline (see rescale_ies_files_pipelined()) rather than the thread pool
+		std::string cache_dir;					// The directory of a result_cache to look the results up in and store them to (empty means no caching, which the pipelined mode requires)
+	};
+
+	//! Summary of a batch rescale
+	struct batch_report {
+		std::size_t num_files = 0;				// The number of profiles processed
+		std::size_t num_failed = 0;				// The number of profiles that couldn't be read, rescaled or written
+		std::vector<std::string> failed_files;	// The input files of the failed profiles (sorted)
+		double seconds = 0.0;					// The wall-clock time of the batch
+
+		auto num_succeeded() const -> std::size_t { return num_files - num_failed; }
+		auto files_per_second() const -> double { return seconds > 0.0 ? num_files / seconds : 0.0; }
+	};
+
+	//! List the IES profiles (i.e. the *.ies files, in any letter case) in the specified directory, sorted by path.
+	//! \param[in]		dir					The directory to search
+	//! \param[in]		recursive			Whether to search the subdirectories as well
+	//! \param[in]		exclude_suffix		Skip the files whose stem ends with this suffix (e.g. the outputs of a previous batch)
+	auto find_ies_files(const std::string_view dir, const bool recursive = true, const std::string_view exclude_suffix = "") -> std::vector<std::string>;
+
+	//! Read, rescale and write out a single IES profile.
+	auto rescale_ies_file(const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const bool preserve_intensity = false) -> bool;
+	auto rescale_ies_file(const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const rescale_mode mode) -> bool;
+
+	//! Make the output file name of the specified input file, creating its directory if necessary
+	//! \param[in]		input_fname			The input file
+	//! \param[in]		input_dir			The root of the input files, used to mirror their layout under options.output_dir
+	//! \param[in]		options				The batch parameters
+	auto make_output_file_name(const std::string_view input_fname, const std::string_view input_dir, const batch_options& options) -> std::string;
+
+	//! Rescale the specified IES profiles in parallel.
+	//! \param[in]		files				The input files
+	//! \param[in]		input_dir			The root of the input files, used to mirror their layout under options.output_dir
+	//! \param[in]		options				The batch parameters
+	//! \return			batch_report		The summary of the batch
+	auto rescale_ies_files(const std::vector<std::string>& files, const std::string_view input_dir, const batch_options& options) -> batch_report;
+
+	//! Rescale all the IES profiles found in the specified directory in parallel.
+	//! \return			std::optional<batch_report>
+	//!         The summary of the batch or an empty object if the directory couldn't be read or the options combine the pipelined mode with a cache
+	auto rescale_ies_directory(const std::string_view input_dir, const batch_options& options) -> std::optional<batch_report>;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_BATCH_H
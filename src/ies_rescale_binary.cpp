@@ -0,0 +1,274 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cstring>
+#include <type_traits>
+
+#include "ies_rescale_binary.h"
+#include "ies_rescale_layout.h"
+
+namespace ies_rescale {
+
+	static_assert(std::is_trivially_copyable<binary_header>::value, "The header is copied as raw bytes");
+	static_assert(sizeof(binary_header) % alignof(uint64_t) == 0, "The header must not need any tail padding");
+
+	auto binary_profile_view::from_bytes(const void* data, const std::size_t size) -> std::optional<binary_profile_view> {
+		auto view = binary_profile_view{};
+		view.data_ = static_cast<const uint8_t*>(data);
+
+		if (data == nullptr || size < sizeof(binary_header) || reinterpret_cast<std::uintptr_t>(data) % alignof(float) != 0) {
+			return {};
+		}
+
+		// Copy the header rather than aliasing it, as the data is only guaranteed to be float-aligned
+		auto& header = view.header_;
+		std::memcpy(&header, data, sizeof(header));
+
+		if (header.magic != binary_header::magic_value || header.version != binary_header::current_version
+			|| header.header_size != sizeof(binary_header) || header.file_size != size) {
+			return {};
+		}
+
+		// Every section must lie within the data and be aligned
+		auto section_fits = [size](const uint64_t offset, const uint64_t bytes) {
+			return detail::section_fits(offset, bytes, size, sizeof(binary_header), alignof(float));
+		};
+
+		const auto num_candelas = uint64_t{ header.num_vert_angles } * header.num_horz_angles;
+		if (!section_fits(header.tilt_angles_offset, uint64_t{ header.num_tilt_angles } * sizeof(float))
+			|| !section_fits(header.tilt_mult_factors_offset, uint64_t{ header.num_tilt_mult_factors } * sizeof(float))
+			|| !section_fits(header.vert_angles_offset, uint64_t{ header.num_vert_angles } * sizeof(float))
+			|| !section_fits(header.horz_angles_offset, uint64_t{ header.num_horz_angles } * sizeof(float))
+			|| !section_fits(header.candelas_offset, num_candelas * sizeof(float))
+			|| !section_fits(header.strings_offset, header.strings_size)) {
+			return {};
+		}
+
+		// The string table: the TILT file name followed by the labels
+		const auto num_strings = uint64_t{ header.num_labels } + 1;
+		if (num_strings * sizeof(binary_string) > header.strings_size) {
+			return {};
+		}
+
+		const auto chars_size = header.strings_size - num_strings * sizeof(binary_string);
+		for (auto i = uint64_t{ 0 }; i < num_strings; ++i) {
+			auto entry = binary_string{};
+			std::memcpy(&entry, view.data_ + header.strings_offset + i * sizeof(binary_string), sizeof(entry));
+			if (!detail::range_fits(entry.offset, entry.size, chars_size)) {
+				return {};
+			}
+		}
+
+		return view;
+	}
+
+	auto binary_profile_view::string(const std::size_t i) const -> std::string_view {
+		auto entry = binary_string{};
+		std::memcpy(&entry, data_ + header_.strings_offset + i * sizeof(binary_string), sizeof(entry));
+
+		const auto* chars = reinterpret_cast<const char*>(data_ + header_.strings_offset + (std::size_t{ header_.num_labels } + 1) * sizeof(binary_string));
+		return std::string_view{ chars + entry.offset, entry.size };
+	}
+
+	auto binary_profile_view::tilt_fname() const -> std::string_view {
+		return string(0);
+	}
+
+	auto binary_profile_view::label(const std::size_t i) const -> std::string_view {
+		assert(i < num_labels() && "Label index out of range");
+		return string(i + 1);
+	}
+
+	auto binary_profile_view::to_data() const -> IE_Data {
+		auto data = IE_Data{};
+
+		data.file.format = format();
+
+		data.labels.reserve(num_labels());
+		for (auto i = std::size_t{ 0 }; i < num_labels(); ++i) {
+			data.labels.emplace_back(label(i));
+		}
+
+		data.lamp.num_lamps = header_.num_lamps;
+		data.lamp.lumens_lamp = header_.lumens_lamp;
+		data.lamp.multiplier = header_.multiplier;
+		data.lamp.tilt_fname = tilt_fname();
+		data.lamp.tilt.orientation = static_cast<IE_Data::Lamp::Tilt::Orientation>(header_.tilt_orientation);
+		data.lamp.tilt.num_pairs = header_.tilt_num_pairs;
+		data.lamp.tilt.angles.assign(tilt_angles().begin(), tilt_angles().end());
+		data.lamp.tilt.mult_factors.assign(tilt_mult_factors().begin(), tilt_mult_factors().end());
+
+		data.units = static_cast<IE_Data::Units>(header_.units);
+		data.dim = { header_.width, header_.length, header_.height };
+		data.elec = { header_.ball_factor, header_.blp_factor, header_.input_watts };
+
+		data.photo.gonio_type = gonio_type();
+		data.photo.num_vert_angles = static_cast<int>(header_.num_vert_angles);
+		data.photo.num_horz_angles = static_cast<int>(header_.num_horz_angles);
+		data.photo.vert_angles.assign(vert_angles().begin(), vert_angles().end());
+		data.photo.horz_angles.assign(horz_angles().begin(), horz_angles().end());
+
+		const auto candela_values = candelas().values();
+		data.photo.candelas = candela_matrix(header_.num_horz_angles, header_.num_vert_angles);
+		std::copy(candela_values.begin(), candela_values.end(), data.photo.candelas.data());
+
+		return data;
+	}
+
+	auto binary_profile::open(const std::string_view file_name) -> std::optional<binary_profile> {
+		auto file = mapped_file::open(file_name);
+		if (!file) {
+			return {};
+		}
+
+		const auto view = binary_profile_view::from_bytes(file->data(), file->size());
+		if (!view) {
+			return {};
+		}
+
+		return binary_profile{ std::move(*file), *view };
+	}
+
+	auto convert_data_to_binary(const IE_Data& data) -> std::optional<std::vector<uint8_t>> {
+		const auto& photo = data.photo;
+		if (photo.num_vert_angles < 0 || photo.num_horz_angles < 0
+			|| photo.vert_angles.size() != static_cast<std::size_t>(photo.num_vert_angles)
+			|| photo.horz_angles.size() != static_cast<std::size_t>(photo.num_horz_angles)
+			|| photo.candelas.num_rows() != photo.horz_angles.size()
+			|| (photo.candelas.num_cols() != photo.vert_angles.size() && !photo.candelas.empty())) {
+			return {};
+		}
+
+		auto header = binary_header{};
+		header.magic = binary_header::magic_value;
+		header.version = binary_header::current_version;
+		header.header_size = static_cast<uint16_t>(sizeof(binary_header));
+
+		header.format = data.file.format;
+		header.units = data.units;
+		header.gonio_type = photo.gonio_type;
+		header.num_lamps = data.lamp.num_lamps;
+		header.lumens_lamp = data.lamp.lumens_lamp;
+		header.multiplier = data.lamp.multiplier;
+		header.width = data.dim.width;
+		header.length = data.dim.length;
+		header.height = data.dim.height;
+		header.ball_factor = data.elec.ball_factor;
+		header.blp_factor = data.elec.blp_factor;
+		header.input_watts = data.elec.input_watts;
+
+		header.tilt_orientation = data.lamp.tilt.orientation;
+		header.tilt_num_pairs = data.lamp.tilt.num_pairs;
+		header.num_tilt_angles = static_cast<uint32_t>(data.lamp.tilt.angles.size());
+		header.num_tilt_mult_factors = static_cast<uint32_t>(data.lamp.tilt.mult_factors.size());
+		header.num_vert_angles = static_cast<uint32_t>(photo.vert_angles.size());
+		header.num_horz_angles = static_cast<uint32_t>(photo.horz_angles.size());
+		header.num_labels = static_cast<uint32_t>(data.labels.size());
+
+		// Lay out the sections, each starting at an aligned offset
+		auto offset = sizeof(binary_header);
+		auto place = [&offset](const std::size_t bytes) {
+			const auto section_offset = detail::align_section(offset);
+			offset = section_offset + bytes;
+			return section_offset;
+		};
+
+		header.tilt_angles_offset = place(data.lamp.tilt.angles.size() * sizeof(float));
+		header.tilt_mult_factors_offset = place(data.lamp.tilt.mult_factors.size() * sizeof(float));
+		header.vert_angles_offset = place(photo.vert_angles.size() * sizeof(float));
+		header.horz_angles_offset = place(photo.horz_angles.size() * sizeof(float));
+		header.candelas_offset = place(photo.vert_angles.size() * photo.horz_angles.size() * sizeof(float));
+
+		auto strings = std::vector<std::string_view>{ data.lamp.tilt_fname };
+		strings.insert(strings.end(), data.labels.begin(), data.labels.end());
+
+		auto strings_size = strings.size() * sizeof(binary_string);
+		for (const auto& s : strings) {
+			strings_size += s.size();
+		}
+		header.strings_size = static_cast<uint32_t>(strings_size);
+		header.strings_offset = place(strings_size);
+		header.file_size = offset;
+
+		auto buffer = std::vector<uint8_t>(offset, 0);
+		std::memcpy(buffer.data(), &header, sizeof(header));
+
+		auto write_floats = [&buffer](const uint64_t section_offset, const float* values, const std::size_t count) {
+			if (count > 0) {
+				std::memcpy(buffer.data() + section_offset, values, count * sizeof(float));
+			}
+		};
+
+		write_floats(header.tilt_angles_offset, data.lamp.tilt.angles.data(), data.lamp.tilt.angles.size());
+		write_floats(header.tilt_mult_factors_offset, data.lamp.tilt.mult_factors.data(), data.lamp.tilt.mult_factors.size());
+		write_floats(header.vert_angles_offset, photo.vert_angles.data(), photo.vert_angles.size());
+		write_floats(header.horz_angles_offset, photo.horz_angles.data(), photo.horz_angles.size());
+		write_floats(header.candelas_offset, photo.candelas.data(), photo.candelas.values().size());
+
+		auto* entries = buffer.data() + header.strings_offset;
+		auto* chars = entries + strings.size() * sizeof(binary_string);
+		auto chars_offset = uint32_t{ 0 };
+		for (auto i = std::size_t{ 0 }; i < strings.size(); ++i) {
+			const auto entry = binary_string{ chars_offset, static_cast<uint32_t>(strings[i].size()) };
+			std::memcpy(entries + i * sizeof(binary_string), &entry, sizeof(entry));
+			std::memcpy(chars + chars_offset, strings[i].data(), strings[i].size());
+			chars_offset += entry.size;
+		}
+
+		return std::optional<std::vector<uint8_t>>{ std::move(buffer) };
+	}
+
+	auto convert_binary_to_data(const void* data, const std::size_t size) -> std::optional<IE_Data> {
+		const auto view = binary_profile_view::from_bytes(data, size);
+		if (!view) {
+			return {};
+		}
+
+		return view->to_data();
+	}
+
+	auto convert_ies_file_to_binary(const std::string_view ies_file_name, const std::string_view binary_file_name) -> bool {
+		auto ies_stream = read_file_to_stream(ies_file_name);
+		if (!ies_stream) {
+			return false;
+		}
+
+		const auto data = convert_stream_to_data(*ies_stream, ies_file_name);
+		if (!data) {
+			return false;
+		}
+
+		const auto buffer = convert_data_to_binary(*data);
+		return buffer && write_buffer_to_file(*buffer, binary_file_name);
+	}
+
+	auto convert_binary_file_to_ies(const std::string_view binary_file_name, const std::string_view ies_file_name) -> bool {
+		const auto profile = binary_profile::open(binary_file_name);
+		if (!profile) {
+			return false;
+		}
+
+		return write_ies_to_file(profile->view().to_data(), ies_file_name);
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,164 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_BINARY_H
+#define IES_RESCALE_BINARY_H
+
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! The layout of the binary IES profile format, which can be memory-mapped and used in place without any parsing.
+	//! A file starts with this header, followed by the float arrays (each aligned to candela_matrix::alignment) and the string table:
+	//! an array of binary_string entries (the TILT file name followed by the labels) and then their characters.
+	//! All the values are stored in the native byte order, which the magic number doubles as a check of.
+	struct binary_header {
+		static constexpr uint32_t magic_value = 0x42534549;	// "IESB" in little-endian order
+		static constexpr uint16_t current_version = 1;
+
+		uint32_t magic;
+		uint16_t version;
+		uint16_t header_size;
+		uint64_t file_size;
+
+		int32_t format;
+		int32_t units;
+		int32_t gonio_type;
+		int32_t num_lamps;
+		float lumens_lamp;
+		float multiplier;
+		float width;
+		float length;
+		float height;
+		float ball_factor;
+		float blp_factor;
+		float input_watts;
+
+		int32_t tilt_orientation;
+		int32_t tilt_num_pairs;
+		uint32_t num_tilt_angles;
+		uint32_t num_tilt_mult_factors;
+		uint32_t num_vert_angles;
+		uint32_t num_horz_angles;
+		uint32_t num_labels;
+		uint32_t strings_size;				// The size of the string table in bytes (entries and characters)
+
+		uint64_t tilt_angles_offset;		// The offsets of the sections from the beginning of the file
+		uint64_t tilt_mult_factors_offset;
+		uint64_t vert_angles_offset;
+		uint64_t horz_angles_offset;
+		uint64_t candelas_offset;			// num_horz_angles rows of num_vert_angles values
+		uint64_t strings_offset;
+
+		uint64_t reserved[2];
+	};
+
+	//! An entry of the string table of a binary IES profile
+	struct binary_string {
+		uint32_t offset;	// The offset of the characters from the end of the entries
+		uint32_t size;
+	};
+
+	//! Read-only view of a binary IES profile, reading all the values in place.
+	//! Note: the view refers to the bytes it was made from, which must outlive it.
+	class binary_profile_view {
+	public:
+		//! Make a view of the specified bytes, checking that they hold a valid binary profile of the current version
+		//! \param[in]		data								The binary profile, aligned to at least 4 bytes
+		//! \param[in]		size								The size of the binary profile in bytes
+		//! \return			std::optional<binary_profile_view>	The view on success or an empty object on failure
+		static auto from_bytes(const void* data, const std::size_t size) -> std::optional<binary_profile_view>;
+
+		auto header() const -> const binary_header& { return header_; }
+
+		auto format() const -> IE_Data::File::Format { return static_cast<IE_Data::File::Format>(header_.format); }
+		auto gonio_type() const -> IE_Data::Photo::IE_Gonio_Type { return static_cast<IE_Data::Photo::IE_Gonio_Type>(header_.gonio_type); }
+
+		auto num_labels() const -> std::size_t { return header_.num_labels; }
+		auto label(const std::size_t i) const -> std::string_view;
+		auto tilt_fname() const -> std::string_view;
+
+		auto tilt_angles() const -> array_view<const float> { return floats(header_.tilt_angles_offset, header_.num_tilt_angles); }
+		auto tilt_mult_factors() const -> array_view<const float> { return floats(header_.tilt_mult_factors_offset, header_.num_tilt_mult_factors); }
+		auto vert_angles() const -> array_view<const float> { return floats(header_.vert_angles_offset, header_.num_vert_angles); }
+		auto horz_angles() const -> array_view<const float> { return floats(header_.horz_angles_offset, header_.num_horz_angles); }
+
+		auto candelas() const -> candela_matrix_view {
+			return candela_matrix_view{ reinterpret_cast<const float*>(data_ + header_.candelas_offset), header_.num_horz_angles, header_.num_vert_angles };
+		}
+
+		//! Make a standalone copy of the profile
+		auto to_data() const -> IE_Data;
+
+	private:
+		auto floats(const uint64_t offset, const uint32_t count) const -> array_view<const float> {
+			return array_view<const float>{ reinterpret_cast<const float*>(data_ + offset), count };
+		}
+
+		auto string(const std::size_t i) const -> std::string_view;
+
+		const uint8_t* data_ = nullptr;
+		binary_header header_ = {};
+	};
+
+	//! A binary IES profile file, mapped into memory
+	class binary_profile {
+	public:
+		//! Map the specified binary profile file and validate its content
+		static auto open(const std::string_view file_name) -> std::optional<binary_profile>;
+
+		auto view() const -> const binary_profile_view& { return view_; }
+
+	private:
+		binary_profile(mapped_file&& file, const binary_profile_view& view)
+			: file_(std::move(file))
+			, view_(view)
+		{}
+
+		mapped_file file_;				// Moving the mapping keeps its address, so the view remains valid
+		binary_profile_view view_;
+	};
+
+	//! Serialize the IES data in the binary format
+	//! \return			std::optional<std::vector<uint8_t>>
+	//!         The binary profile on success or an empty object on failure (i.e. if the data is inconsistent, such as the angle counts not matching the arrays)
+	auto convert_data_to_binary(const IE_Data& data) -> std::optional<std::vector<uint8_t>>;
+
+	//! Deserialize the IES data from the binary format (i.e. validate and copy it)
+	auto convert_binary_to_data(const void* data, const std::size_t size) -> std::optional<IE_Data>;
+
+	//! Convert an IESNA-format file into a binary profile file
+	auto convert_ies_file_to_binary(const std::string_view ies_file_name, const std::string_view binary_file_name) -> bool;
+
+	//! Convert a binary profile file back into an IESNA-format file
+	auto convert_binary_file_to_ies(const std::string_view binary_file_name, const std::string_view ies_file_name) -> bool;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_BINARY_H
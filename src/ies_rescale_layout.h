@@ -0,0 +1,58 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef IES_RESCALE_LAYOUT_H
+#define IES_RESCALE_LAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	// Internal helpers shared by the readers and writers of the binary formats (the binary profiles, the archives and the atlas indices)
+	namespace detail {
+		//! The alignment of the sections that hold float arrays, so that they can be used in place like the arrays of a candela_matrix
+		constexpr auto section_alignment = std::size_t{ candela_matrix::alignment };
+
+		//! Round the offset up to the next multiple of section_alignment
+		constexpr auto align_section(const std::size_t offset) -> std::size_t {
+			return (offset + section_alignment - 1) & ~(section_alignment - 1);
+		}
+
+		//! Whether the range of the specified number of bytes starting at the offset lies within the size, without overflowing
+		constexpr auto range_fits(const uint64_t offset, const uint64_t bytes, const uint64_t size) -> bool {
+			return offset <= size && bytes <= size - offset;
+		}
+
+		//! Whether a section of a file lies within the file, after the header, and starts at an offset aligned for its values
+		constexpr auto section_fits(const uint64_t offset, const uint64_t bytes, const uint64_t file_size, const uint64_t header_size, const std::size_t alignment) -> bool {
+			return offset % alignment == 0 && offset >= header_size && range_fits(offset, bytes, file_size);
+		}
+	}
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_LAYOUT_H
@@ -0,0 +1,462 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <vector>
+#include <initializer_list>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+// The io_uring backend talks to the kernel interface directly (rather than through liburing), so it doesn't add any dependency.
+// It needs the Linux 5.6 operations (openat, statx and close), whose presence the IORING_FEAT_RW_CUR_POS flag of the same release indicates.
+#if defined(__linux__) && !defined(IES_RESCALE_NO_IO_URING) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		include <linux/io_uring.h>
+#		if defined(IORING_FEAT_RW_CUR_POS)
+#			define IES_RESCALE_IO_URING
+#		endif
+#	endif
+#endif
+
+#if defined(IES_RESCALE_IO_URING)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+#include "ies_rescale_loader.h"
+#include "ies_rescale_batch.h"
+
+namespace ies_rescale {
+
+#if defined(IES_RESCALE_IO_URING)
+
+	// A minimal io_uring instance: the submission and completion rings shared with the kernel
+	class ie_uring {
+	public:
+		ie_uring() = default;
+		ie_uring(const ie_uring&) = delete;
+		ie_uring& operator=(const ie_uring&) = delete;
+
+		~ie_uring() {
+			if (sqes_ != nullptr) {
+				::munmap(sqes_, sqes_size_);
+			}
+			if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+				::munmap(cq_ring_, cq_ring_size_);
+			}
+			if (sq_ring_ != nullptr) {
+				::munmap(sq_ring_, sq_ring_size_);
+			}
+			if (fd_ >= 0) {
+				::close(fd_);
+			}
+		}
+
+		auto init(const unsigned entries) -> bool {
+			auto params = io_uring_params{};
+			fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+			if (fd_ < 0) {
+				// ENOSYS on kernels without io_uring, EPERM when it is disabled (e.g. by a seccomp policy)
+				return false;
+			}
+
+			sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+			cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			const auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (single_mmap) {
+				sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+			}
+
+			sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+			if (sq_ring_ == nullptr) {
+				return false;
+			}
+
+			cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+			if (cq_ring_ == nullptr) {
+				return false;
+			}
+
+			sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+			sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+			if (sqes_ == nullptr) {
+				return false;
+			}
+
+			auto* sq = static_cast<char*>(sq_ring_);
+			sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+			sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+			sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+			sq_entries_ = params.sq_entries;
+			sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+			auto* cq = static_cast<char*>(cq_ring_);
+			cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+			cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+			cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+			cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			return supports({ IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE });
+		}
+
+		//! Get a cleared submission queue entry (the caller makes sure the ring isn't full)
+		auto next_sqe() -> io_uring_sqe& {
+			const auto tail = sq_local_tail_++;
+			auto& sqe = sqes_[tail & sq_mask_];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sq_array_[tail & sq_mask_] = tail & sq_mask_;
+			return sqe;
+		}
+
+		auto sq_space() const -> unsigned {
+			return sq_entries_ - (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+		}
+
+		//! Submit the queued entries and wait for at least one completion
+		auto submit_and_wait() -> bool {
+			// Publish the entries to the kernel
+			__atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+			for (;;) {
+				const auto to_submit = sq_local_tail_ - sq_submitted_;
+				const auto result = ::syscall(__NR_io_uring_enter, fd_, to_submit, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (result < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					// EAGAIN/EBUSY: the kernel is short on resources or the completion ring is full, so reap the completions first
+					return errno == EAGAIN || errno == EBUSY;
+				}
+
+				sq_submitted_ += static_cast<unsigned>(result);
+				return true;
+			}
+		}
+
+		//! Call the handler for every available completion
+		template <typename Handler>
+		void reap(Handler&& handler) {
+			auto head = *cq_head_;
+			const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head) {
+				const auto& cqe = cqes_[head & cq_mask_];
+				handler(cqe.user_data, cqe.res);
+			}
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		}
+
+	private:
+		auto map(const std::size_t size, const off_t offset) -> void* {
+			auto* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+			return p == MAP_FAILED ? nullptr : p;
+		}
+
+		auto supports(const std::initializer_list<int> ops) -> bool {
+			// The probe has room for all the operations the kernel may know about
+			constexpr auto num_probe_ops = 256;
+			auto storage = std::vector<uint8_t>(sizeof(io_uring_probe) + num_probe_ops * sizeof(io_uring_probe_op), 0);
+			auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+
+			if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, num_probe_ops) < 0) {
+				return false;
+			}
+
+			return std::all_of(ops.begin(), ops.end(), [probe](const int op) {
+				return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+			});
+		}
+
+		int fd_ = -1;
+
+		void* sq_ring_ = nullptr;
+		void* cq_ring_ = nullptr;
+		io_uring_sqe* sqes_ = nullptr;
+		std::size_t sq_ring_size_ = 0;
+		std::size_t cq_ring_size_ = 0;
+		std::size_t sqes_size_ = 0;
+
+		unsigned* sq_head_ = nullptr;
+		unsigned* sq_tail_ = nullptr;
+		unsigned* sq_array_ = nullptr;
+		unsigned sq_mask_ = 0;
+		unsigned sq_entries_ = 0;
+		unsigned sq_local_tail_ = 0;	// The tail including the entries not published yet
+		unsigned sq_submitted_ = 0;		// The entries consumed by the kernel so far
+
+		unsigned* cq_head_ = nullptr;
+		unsigned* cq_tail_ = nullptr;
+		unsigned cq_mask_ = 0;
+		io_uring_cqe* cqes_ = nullptr;
+	};
+
+	// The state of one of the files in flight
+	struct ie_uring_slot {
+		std::size_t index = 0;			// The index of the file in the path list
+		int fd = -1;
+		int pending = 0;				// The number of operations in flight
+		bool failed = false;
+		bool delivered = false;			// Whether the callback has been called for the file
+		struct statx stx {};
+		std::vector<uint8_t> buffer;
+		std::size_t bytes_read = 0;
+	};
+
+	enum class ie_uring_op : uint64_t { open, statx, read, close };
+
+	auto bulk_read_io_uring(const std::vector<std::string>& paths, const bulk_read_callback& callback, const bulk_load_options& options) -> bool {
+		const auto queue_depth = std::clamp<std::size_t>(options.queue_depth, 1, 4096);
+
+		// Every file has at most two operations in flight (the open and the statx)
+		auto ring = ie_uring{};
+		if (!ring.init(static_cast<unsigned>(queue_depth * 2))) {
+			return false;
+		}
+
+		auto slots = std::vector<ie_uring_slot>(queue_depth);
+		auto free_slots = std::vector<std::size_t>{};
+		for (auto s = queue_depth; s > 0; --s) {
+			free_slots.push_back(s - 1);
+		}
+
+		auto user_data = [](const std::size_t s, const ie_uring_op op) { return (static_cast<uint64_t>(s) << 2) | static_cast<uint64_t>(op); };
+
+		auto queue_read = [&ring, &user_data](ie_uring_slot& slot, const std::size_t s) {
+			auto& sqe = ring.next_sqe();
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = slot.fd;
+			sqe.addr = reinterpret_cast<uint64_t>(slot.buffer.data() + slot.bytes_read);
+			sqe.len = static_cast<uint32_t>(std::min<std::size_t>(slot.buffer.size() - slot.bytes_read, 1u << 30));
+			sqe.off = slot.bytes_read;
+			sqe.user_data = user_data(s, ie_uring_op::read);
+			++slot.pending;
+		};
+
+		auto queue_close = [&ring, &user_data](ie_uring_slot& slot, const std::size_t s) {
+			auto& sqe = ring.next_sqe();
+			sqe.opcode = IORING_OP_CLOSE;
+			sqe.fd = slot.fd;
+			sqe.user_data = user_data(s, ie_uring_op::close);
+			++slot.pending;
+			slot.fd = -1;
+		};
+
+		// Report the file and recycle its slot once all its operations have completed
+		auto finish = [&callback, &free_slots](ie_uring_slot& slot, const std::size_t s) {
+			if (!slot.delivered) {
+				callback(slot.index, std::nullopt);
+			}
+			slot.buffer = {};
+			free_slots.push_back(s);
+		};
+
+		auto next_path = std::size_t{ 0 };
+		auto in_flight = std::size_t{ 0 };
+
+		while (next_path < paths.size() || in_flight > 0) {
+			// Start opening and sizing the next files (both operations only need the path, so they run concurrently)
+			while (next_path < paths.size() && !free_slots.empty() && ring.sq_space() >= 2) {
+				const auto s = free_slots.back();
+				free_slots.pop_back();
+
+				auto& slot = slots[s];
+				slot = ie_uring_slot{};
+				slot.index = next_path;
+				const auto* path = paths[next_path].c_str();
+
+				auto& open_sqe = ring.next_sqe();
+				open_sqe.opcode = IORING_OP_OPENAT;
+				open_sqe.fd = AT_FDCWD;
+				open_sqe.addr = reinterpret_cast<uint64_t>(path);
+				open_sqe.open_flags = O_RDONLY | O_CLOEXEC;
+				open_sqe.user_data = user_data(s, ie_uring_op::open);
+
+				auto& statx_sqe = ring.next_sqe();
+				statx_sqe.opcode = IORING_OP_STATX;
+				statx_sqe.fd = AT_FDCWD;
+				statx_sqe.addr = reinterpret_cast<uint64_t>(path);
+				statx_sqe.len = STATX_SIZE;
+				statx_sqe.off = reinterpret_cast<uint64_t>(&slot.stx);
+				statx_sqe.user_data = user_data(s, ie_uring_op::statx);
+
+				slot.pending = 2;
+				++next_path;
+				++in_flight;
+			}
+
+			if (!ring.submit_and_wait()) {
+				// The ring is unusable (which only happens on an invalid setup), so report the remaining files as failed
+				for (auto& slot : slots) {
+					if (slot.pending > 0 && !slot.delivered) {
+						callback(slot.index, std::nullopt);
+					}
+				}
+				for (; next_path < paths.size(); ++next_path) {
+					callback(next_path, std::nullopt);
+				}
+				return true;
+			}
+
+			ring.reap([&](const uint64_t data, const int32_t res) {
+				const auto s = static_cast<std::size_t>(data >> 2);
+				const auto op = static_cast<ie_uring_op>(data & 3);
+				auto& slot = slots[s];
+				--slot.pending;
+
+				switch (op) {
+				case ie_uring_op::open:
+					if (res >= 0) {
+						slot.fd = res;
+					}
+					else {
+						slot.failed = true;
+					}
+					break;
+
+				case ie_uring_op::statx:
+					// Empty files are rejected just like read_file_to_stream() does
+					if (res < 0 || slot.stx.stx_size == 0) {
+						slot.failed = true;
+					}
+					break;
+
+				case ie_uring_op::read:
+					if (res < 0 && res != -EAGAIN && res != -EINTR) {
+						slot.failed = true;
+					}
+					else if (res == 0) {
+						// The file got truncated since it was sized
+						slot.buffer.resize(slot.bytes_read);
+					}
+					else if (res > 0) {
+						slot.bytes_read += static_cast<std::size_t>(res);
+					}
+					break;
+
+				case ie_uring_op::close:
+					break;
+				}
+
+				if (slot.pending > 0) {
+					// Still waiting for the other operation of the open + statx pair
+					return;
+				}
+
+				if (op == ie_uring_op::close) {
+					finish(slot, s);
+					--in_flight;
+					return;
+				}
+
+				if (slot.failed) {
+					if (slot.fd >= 0) {
+						queue_close(slot, s);
+					}
+					else {
+						finish(slot, s);
+						--in_flight;
+					}
+					return;
+				}
+
+				if (op != ie_uring_op::read) {
+					// Both the open and the statx have completed
+					slot.buffer.resize(static_cast<std::size_t>(slot.stx.stx_size));
+				}
+
+				if (slot.bytes_read < slot.buffer.size()) {
+					// Short reads are continued from where they stopped
+					queue_read(slot, s);
+					return;
+				}
+
+				// The content is complete: the file can be closed while the content is processed
+				queue_close(slot, s);
+
+				slot.delivered = true;
+				callback(slot.index, std::move(slot.buffer));
+			});
+		}
+
+		return true;
+	}
+
+	auto io_uring_available() -> bool {
+		static const auto available = [] {
+			auto ring = ie_uring{};
+			return ring.init(2);
+		}();
+		return available;
+	}
+
+#else
+
+	auto bulk_read_io_uring(const std::vector<std::string>&, const bulk_read_callback&, const bulk_load_options&) -> bool {
+		return false;
+	}
+
+	auto io_uring_available() -> bool {
+		return false;
+	}
+
+#endif
+
+	static void bulk_load_thread_pool(const std::vector<std::string>& paths, const bulk_load_callback& callback, const bulk_load_options& options) {
+		const auto num_threads = options.num_threads > 0 ? options.num_threads : std::size_t{ std::thread::hardware_concurrency() };
+		auto pool = work_stealing_pool{ std::clamp<std::size_t>(num_threads, 1, std::max<std::size_t>(paths.size(), 1)) };
+
+		for (auto i = std::size_t{ 0 }; i < paths.size(); ++i) {
+			pool.submit([&paths, &callback, i] {
+				auto stream = read_file_to_stream(paths[i]);
+				callback(i, stream ? convert_stream_to_data(*stream, paths[i]) : std::nullopt);
+			});
+		}
+
+		pool.wait();
+	}
+
+	auto bulk_load_profiles(const std::vector<std::string>& paths, const bulk_load_callback& callback, const bulk_load_options& options) -> bulk_load_backend {
+		// Each buffer is parsed as soon as its read completes
+		const auto parse = [&paths, &callback](const std::size_t index, std::optional<std::vector<uint8_t>>&& content) {
+			if (!content) {
+				callback(index, std::nullopt);
+				return;
+			}
+
+			auto stream = memstream{ std::move(*content) };
+			callback(index, convert_stream_to_data(stream, paths[index]));
+		};
+
+		if (options.allow_io_uring && bulk_read_io_uring(paths, parse, options)) {
+			return bulk_load_backend::io_uring;
+		}
+
+		bulk_load_thread_pool(paths, callback, options);
+		return bulk_load_backend::thread_pool;
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,80 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_LOADER_H
+#define IES_RESCALE_LOADER_H
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <cstddef>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! The ways bulk_load_profiles() can read the files
+	enum class bulk_load_backend {
+		io_uring,		// Linux io_uring: the opens, size queries, reads and closes of many files are batched into a few system calls
+		thread_pool,	// read_file_to_stream() on a pool of threads
+	};
+
+	//! Parameters of a bulk load
+	struct bulk_load_options {
+		std::size_t queue_depth = 64;		// The maximum number of files in flight with the io_uring backend
+		std::size_t num_threads = 0;		// The number of threads of the thread pool backend (0 means one per hardware thread)
+		bool allow_io_uring = true;			// Whether to use the io_uring backend when it is available
+	};
+
+	//! Called for every file of a bulk load with the file's index in the path list and the parsed data (empty if the file couldn't be read or parsed).
+	//! Note: with the thread pool backend, the callback is invoked concurrently from several threads.
+	using bulk_load_callback = std::function<void(const std::size_t index, std::optional<IE_Data>&& data)>;
+
+	//! Called for every file of a bulk read with the file's index in the path list and its content (empty if the file couldn't be read).
+	using bulk_read_callback = std::function<void(const std::size_t index, std::optional<std::vector<uint8_t>>&& content)>;
+
+	//! Whether the io_uring backend can be used, i.e. it was compiled in and the kernel supports all the operations it needs
+	auto io_uring_available() -> bool;
+
+	//! Read and parse a list of IES profiles.
+	//! With the io_uring backend, the files are opened, sized, read and closed through a single submission ring, keeping up to
+	//! options.queue_depth files in flight, and each buffer is handed over to convert_stream_to_data() as soon as its read completes.
+	//! Otherwise the files are loaded with read_file_to_stream() on a thread pool.
+	//! \param[in]		paths					The files to load
+	//! \param[in]		callback				Called exactly once for every file
+	//! \param[in]		options					The load parameters
+	//! \return			bulk_load_backend		The backend that was used
+	auto bulk_load_profiles(const std::vector<std::string>& paths, const bulk_load_callback& callback, const bulk_load_options& options = {}) -> bulk_load_backend;
+
+	//! Read a list of files through io_uring without parsing them, which is the io_uring backend of bulk_load_profiles().
+	//! The callback is invoked from the calling thread, so a callback that blocks (e.g. on a full queue) holds back the further submissions.
+	//! \param[in]		paths					The files to read
+	//! \param[in]		callback				Called exactly once for every file, unless the function returns false
+	//! \param[in]		options					The read parameters (only queue_depth applies)
+	//! \return			bool					Whether the files were read, or false without calling the callback if io_uring isn't available
+	auto bulk_read_io_uring(const std::vector<std::string>& paths, const bulk_read_callback& callback, const bulk_load_options& options = {}) -> bool;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_LOADER_H
@@ -0,0 +1,463 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "ies_rescale_photometry.h"
+#include "ies_rescale_simd.h"
+
+namespace ies_rescale {
+
+	static constexpr auto ie_pi = 3.14159265358979323846;
+	static constexpr auto ie_degrees_to_radians = ie_pi / 180.0;
+
+	// A quadrature node: an angle and its value, interpolated linearly between two grid values
+	struct ie_node {
+		double angle;
+		std::size_t first;
+		std::size_t second;
+		double t;
+	};
+
+	// The weights of a composite quadrature rule over nodes at the specified angles (in radians)
+	static auto ie_quadrature_weights(const std::vector<ie_node>& nodes, const integration_rule rule) -> std::vector<double> {
+		const auto n = nodes.size();
+		auto weights = std::vector<double>(n, 0.0);
+
+		auto trapezoid = [&](const std::size_t i) {
+			const auto h = nodes[i + 1].angle - nodes[i].angle;
+			weights[i] += h / 2.0;
+			weights[i + 1] += h / 2.0;
+		};
+
+		if (n < 2) {
+			return weights;
+		}
+
+		const auto num_intervals = n - 1;
+		if (rule == integration_rule::trapezoid || num_intervals == 1) {
+			for (auto i = std::size_t{ 0 }; i < num_intervals; ++i) {
+				trapezoid(i);
+			}
+			return weights;
+		}
+
+		// Simpson's rule over pairs of intervals, which may have different widths. Its weights turn negative once an interval is over twice
+		// as wide as the other one of its pair (as is common in rescaled profiles), so such pairs fall back to the trapezoidal rule.
+		auto is_balanced = [](const double h0, const double h1) {
+			return h0 > 0.0 && h1 > 0.0 && h0 <= 2.0 * h1 && h1 <= 2.0 * h0;
+		};
+
+		const auto num_paired = num_intervals - num_intervals % 2;
+		for (auto i = std::size_t{ 0 }; i < num_paired; i += 2) {
+			const auto h0 = nodes[i + 1].angle - nodes[i].angle;
+			const auto h1 = nodes[i + 2].angle - nodes[i + 1].angle;
+			if (!is_balanced(h0, h1)) {
+				trapezoid(i);
+				trapezoid(i + 1);
+				continue;
+			}
+
+			const auto c = (h0 + h1) / 6.0;
+			weights[i] += c * (2.0 - h1 / h0);
+			weights[i + 1] += c * (h0 + h1) * (h0 + h1) / (h0 * h1);
+			weights[i + 2] += c * (2.0 - h0 / h1);
+		}
+
+		// An odd interval count leaves the last interval, which is integrated with the parabola through the last three nodes
+		if (num_paired < num_intervals) {
+			const auto h0 = nodes[n - 2].angle - nodes[n - 3].angle;
+			const auto h1 = nodes[n - 1].angle - nodes[n - 2].angle;
+			if (!is_balanced(h0, h1)) {
+				trapezoid(n - 2);
+			}
+			else {
+				weights[n - 1] += (2.0 * h1 * h1 + 3.0 * h0 * h1) / (6.0 * (h0 + h1));
+				weights[n - 2] += (h1 * h1 + 3.0 * h0 * h1) / (6.0 * h0);
+				weights[n - 3] -= h1 * h1 * h1 / (6.0 * h0 * (h0 + h1));
+			}
+		}
+
+		return weights;
+	}
+
+	// A node at an angle within the range of the grid
+	static auto ie_make_node(const array_view<const float> angles, const double angle) -> ie_node {
+		const auto begin = angles.begin();
+		const auto end = angles.end();
+		const auto upper = static_cast<std::size_t>(std::upper_bound(begin, end, static_cast<float>(angle)) - begin);
+		if (upper == 0) {
+			return { angle * ie_degrees_to_radians, 0, 0, 0.0 };
+		}
+		if (upper == angles.size()) {
+			return { angle * ie_degrees_to_radians, upper - 1, upper - 1, 0.0 };
+		}
+
+		const auto first = upper - 1;
+		const auto width = double{ angles[upper] } - angles[first];
+		const auto t = width > 0.0 ? (angle - angles[first]) / width : 0.0;
+		return { angle * ie_degrees_to_radians, first, upper, t };
+	}
+
+	// Add the weights of the integral of the values times the solid angle factor over [min_angle, max_angle] (in degrees) to the vertical weights.
+	// The values are interpolated linearly at the ends of the range, and there's no intensity outside of the range of the grid.
+	static void ie_add_vert_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> angles, double min_angle, double max_angle,
+		const integration_rule rule, std::vector<double>& weights) {
+		min_angle = std::max(min_angle, double{ angles[0] });
+		max_angle = std::min(max_angle, double{ angles[angles.size() - 1] });
+		if (!(min_angle < max_angle)) {
+			return;
+		}
+
+		auto nodes = std::vector<ie_node>{};
+		nodes.reserve(angles.size() + 2);
+		nodes.push_back(ie_make_node(angles, min_angle));
+		for (auto j = std::size_t{ 0 }; j < angles.size(); ++j) {
+			if (angles[j] > min_angle && angles[j] < max_angle) {
+				nodes.push_back({ angles[j] * ie_degrees_to_radians, j, j, 0.0 });
+			}
+		}
+		nodes.push_back(ie_make_node(angles, max_angle));
+
+		const auto node_weights = ie_quadrature_weights(nodes, rule);
+		for (auto k = std::size_t{ 0 }; k < nodes.size(); ++k) {
+			// Type C measures the vertical angles from the nadir, Types A and B from the horizontal plane
+			const auto& node = nodes[k];
+			const auto solid_angle = gonio_type == IE_Data::Photo::Type_C ? std::sin(node.angle) : std::cos(node.angle);
+			const auto weight = node_weights[k] * solid_angle;
+			weights[node.first] += weight * (1.0 - node.t);
+			weights[node.second] += weight * node.t;
+		}
+	}
+
+	// The vertical weights of a zone (the whole sphere by default), unfolding the vertical symmetry of Types A and B
+	static auto ie_vert_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> angles, const double min_angle, const double max_angle,
+		const integration_rule rule) -> std::vector<float> {
+		auto weights = std::vector<double>(angles.size(), 0.0);
+		ie_add_vert_weights(gonio_type, angles, min_angle, max_angle, rule, weights);
+		if (gonio_type != IE_Data::Photo::Type_C && angles[0] == 0.f) {
+			ie_add_vert_weights(gonio_type, angles, -max_angle, -min_angle, rule, weights);
+		}
+
+		return std::vector<float>(weights.begin(), weights.end());
+	}
+
+	static auto ie_valid_angles(const array_view<const float> angles) -> bool {
+		return !angles.empty()
+			&& std::all_of(angles.begin(), angles.end(), [](const float angle) { return std::isfinite(angle); })
+			&& std::is_sorted(angles.begin(), angles.end());
+	}
+
+	// The vertical weights over the full range of vertical angles of the goniometer type
+	static auto ie_total_vert_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> angles, const integration_rule rule) -> std::vector<float> {
+		const auto is_type_c = gonio_type == IE_Data::Photo::Type_C;
+		return ie_vert_weights(gonio_type, angles, is_type_c ? 0.0 : -90.0, is_type_c ? 180.0 : 90.0, rule);
+	}
+
+	namespace detail {
+		auto flux_horz_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> horz_angles, const integration_rule rule) -> std::optional<std::vector<double>> {
+			if (!ie_valid_angles(horz_angles)) {
+				return {};
+			}
+
+			// The horizontal symmetries are the ones candela_sampler unfolds
+			auto horz_weights = std::vector<double>(horz_angles.size(), 0.0);
+			if (horz_angles.size() == 1) {
+				horz_weights[0] = 2.0 * ie_pi;
+				return horz_weights;
+			}
+
+			const auto is_type_c = gonio_type == IE_Data::Photo::Type_C;
+			const auto horz_first = horz_angles[0];
+			const auto horz_last = horz_angles[horz_angles.size() - 1];
+			auto nodes = std::vector<ie_node>{};
+			nodes.reserve(horz_angles.size() + 1);
+			for (auto i = std::size_t{ 0 }; i < horz_angles.size(); ++i) {
+				nodes.push_back({ horz_angles[i] * ie_degrees_to_radians, i, i, 0.0 });
+			}
+
+			auto symmetry_factor = 1.0;
+			if (!is_type_c) {
+				symmetry_factor = horz_first == 0.f ? 2.0 : 1.0;
+			}
+			else if (horz_first == 0.f && horz_last == 90.f) {
+				symmetry_factor = 4.0;
+			}
+			else if ((horz_first == 0.f && horz_last == 180.f) || (horz_first == 90.f && horz_last == 270.f)) {
+				symmetry_factor = 2.0;
+			}
+			else if (horz_first == 0.f && horz_last > 180.f && horz_last < 360.f) {
+				// Close the circle with the first plane
+				nodes.push_back({ 360.0 * ie_degrees_to_radians, 0, 0, 0.0 });
+			}
+
+			const auto node_weights = ie_quadrature_weights(nodes, rule);
+			for (auto k = std::size_t{ 0 }; k < nodes.size(); ++k) {
+				horz_weights[nodes[k].first] += node_weights[k] * symmetry_factor;
+			}
+
+			return horz_weights;
+		}
+
+		auto flux_vert_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const uint32_t> has_intensity,
+			const integration_rule rule) -> std::optional<std::vector<float>> {
+			if (vert_angles.empty() || has_intensity.size() != vert_angles.size()
+				|| !std::all_of(vert_angles.begin(), vert_angles.end(), [](const float angle) { return std::isfinite(angle); })) {
+				return {};
+			}
+
+			if (std::is_sorted(vert_angles.begin(), vert_angles.end())) {
+				return ie_total_vert_weights(gonio_type, vert_angles, rule);
+			}
+
+			auto columns = std::vector<std::size_t>{};
+			auto column_angles = std::vector<float>{};
+			for (auto j = std::size_t{ 0 }; j < vert_angles.size(); ++j) {
+				if (has_intensity[j]) {
+					columns.push_back(j);
+					column_angles.push_back(vert_angles[j]);
+				}
+			}
+
+			auto weights = std::vector<float>(vert_angles.size(), 0.f);
+			if (columns.empty()) {
+				return weights;
+			}
+			if (!std::is_sorted(column_angles.begin(), column_angles.end())) {
+				return {};
+			}
+
+			const auto column_weights = ie_total_vert_weights(gonio_type, column_angles, rule);
+			for (auto k = std::size_t{ 0 }; k < columns.size(); ++k) {
+				weights[columns[k]] = column_weights[k];
+			}
+
+			return weights;
+		}
+	}
+
+	auto flux_integrator::create(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const float> horz_angles,
+		const integration_rule rule) -> std::optional<flux_integrator> {
+		if (!ie_valid_angles(vert_angles)) {
+			return {};
+		}
+
+		auto horz_weights = detail::flux_horz_weights(gonio_type, horz_angles, rule);
+		if (!horz_weights) {
+			return {};
+		}
+
+		auto integrator = flux_integrator{};
+		integrator.vert_weights_ = ie_total_vert_weights(gonio_type, vert_angles, rule);
+		integrator.horz_weights_ = std::move(*horz_weights);
+
+		return integrator;
+	}
+
+	auto flux_integrator::create(const IE_Data::Photo& photo, const integration_rule rule) -> std::optional<flux_integrator> {
+		if (photo.candelas.num_rows() != photo.horz_angles.size() || photo.candelas.num_cols() != photo.vert_angles.size()) {
+			return {};
+		}
+
+		return create(photo.gonio_type, photo.vert_angles, photo.horz_angles, rule);
+	}
+
+	auto flux_integrator::integrate_row(const std::size_t row, const float* candelas) const -> double {
+		const auto weighted_sum = detail::get_weighted_sum_kernel();
+		return horz_weights_[row] * weighted_sum(candelas, vert_weights_.data(), vert_weights_.size());
+	}
+
+	auto flux_integrator::integrate(const candela_matrix_view candelas) const -> double {
+		const auto weighted_sum = detail::get_weighted_sum_kernel();
+		const auto num_rows = std::min(candelas.num_rows(), horz_weights_.size());
+		const auto num_cols = std::min(candelas.num_cols(), vert_weights_.size());
+
+		auto flux = 0.0;
+		for (auto i = std::size_t{ 0 }; i < num_rows; ++i) {
+			flux += horz_weights_[i] * weighted_sum(candelas.row(i).data(), vert_weights_.data(), num_cols);
+		}
+
+		return flux;
+	}
+
+	// The grid a profile is integrated over. The vertical angles of the output of rescale_ies_data() aren't in ascending order,
+	// as the columns without any intensity keep their original angles, so such grids are reduced to the columns with intensity.
+	struct ie_flux_grid {
+		array_view<const float> vert_angles;
+		candela_matrix_view candelas;
+
+		std::vector<float> column_angles;
+		candela_matrix column_candelas;
+	};
+
+	static auto ie_make_flux_grid(const IE_Data::Photo& photo, ie_flux_grid& grid) -> bool {
+		const auto& vert_angles = photo.vert_angles;
+		if (photo.candelas.num_rows() != photo.horz_angles.size() || photo.candelas.num_cols() != vert_angles.size()) {
+			return false;
+		}
+
+		if (std::is_sorted(vert_angles.begin(), vert_angles.end())) {
+			grid.vert_angles = vert_angles;
+			grid.candelas = photo.candelas;
+			return true;
+		}
+
+		auto columns = std::vector<std::size_t>{};
+		for (auto j = std::size_t{ 0 }; j < vert_angles.size(); ++j) {
+			for (auto i = std::size_t{ 0 }; i < photo.candelas.num_rows(); ++i) {
+				if (photo.candelas[i][j] != 0.f) {
+					columns.push_back(j);
+					break;
+				}
+			}
+		}
+
+		// A profile without any intensity keeps a single column, which has no flux whatever its angle
+		if (columns.empty()) {
+			columns.push_back(0);
+		}
+
+		grid.column_angles.resize(columns.size());
+		grid.column_candelas = candela_matrix(photo.candelas.num_rows(), columns.size());
+		for (auto k = std::size_t{ 0 }; k < columns.size(); ++k) {
+			grid.column_angles[k] = vert_angles[columns[k]];
+			for (auto i = std::size_t{ 0 }; i < photo.candelas.num_rows(); ++i) {
+				grid.column_candelas[i][k] = photo.candelas[i][columns[k]];
+			}
+		}
+
+		grid.vert_angles = grid.column_angles;
+		grid.candelas = grid.column_candelas;
+		return true;
+	}
+
+	auto luminous_flux(const IE_Data& data, const integration_rule rule) -> std::optional<float> {
+		auto grid = ie_flux_grid{};
+		if (!ie_make_flux_grid(data.photo, grid)) {
+			return {};
+		}
+
+		const auto integrator = flux_integrator::create(data.photo.gonio_type, grid.vert_angles, data.photo.horz_angles, rule);
+		if (!integrator) {
+			return {};
+		}
+
+		return static_cast<float>(integrator->integrate(grid.candelas) * data.lamp.multiplier);
+	}
+
+	auto zonal_lumens(const IE_Data& data, const photometry_options& options) -> std::optional<std::vector<zonal_flux>> {
+		const auto& photo = data.photo;
+		if (!(options.zone_width > 0.f)) {
+			return {};
+		}
+
+		auto grid = ie_flux_grid{};
+		if (!ie_make_flux_grid(photo, grid)) {
+			return {};
+		}
+
+		const auto integrator = flux_integrator::create(photo.gonio_type, grid.vert_angles, photo.horz_angles, options.rule);
+		if (!integrator) {
+			return {};
+		}
+
+		const auto is_type_c = photo.gonio_type == IE_Data::Photo::Type_C;
+		const auto range_min = is_type_c ? 0.f : -90.f;
+		const auto range_max = is_type_c ? 180.f : 90.f;
+		const auto num_zones = static_cast<std::size_t>(std::ceil((range_max - range_min) / options.zone_width));
+
+		const auto weighted_sum = detail::get_weighted_sum_kernel();
+		const auto& horz_weights = integrator->horz_weights();
+
+		auto zones = std::vector<zonal_flux>{};
+		zones.reserve(num_zones);
+		for (auto z = std::size_t{ 0 }; z < num_zones; ++z) {
+			const auto zone_min = range_min + z * options.zone_width;
+			const auto zone_max = std::min(range_min + (z + 1) * options.zone_width, range_max);
+			const auto vert_weights = ie_vert_weights(photo.gonio_type, grid.vert_angles, zone_min, zone_max, options.rule);
+
+			auto flux = 0.0;
+			for (auto i = std::size_t{ 0 }; i < horz_weights.size(); ++i) {
+				flux += horz_weights[i] * weighted_sum(grid.candelas.row(i).data(), vert_weights.data(), vert_weights.size());
+			}
+
+			zones.push_back({ zone_min, zone_max, static_cast<float>(flux * data.lamp.multiplier) });
+		}
+
+		return zones;
+	}
+
+	auto calc_photometry(const IE_Data& data, const photometry_options& options) -> std::optional<photometric_summary> {
+		auto zones = zonal_lumens(data, options);
+		const auto total_lumens = luminous_flux(data, options.rule);
+		if (!zones || !total_lumens) {
+			return {};
+		}
+
+		auto summary = photometric_summary{};
+		summary.total_lumens = *total_lumens;
+		summary.zones = std::move(*zones);
+
+		// Absolute photometry (e.g. of LED luminaires) has no rated lamp flux, marked by -1 lumens per lamp
+		if (data.lamp.lumens_lamp > 0.f && data.lamp.num_lamps > 0) {
+			summary.lamp_lumens = data.lamp.lumens_lamp * data.lamp.num_lamps;
+			summary.efficiency = summary.total_lumens / summary.lamp_lumens;
+		}
+
+		return summary;
+	}
+
+	auto flux_ratio(const IE_Data& original, const IE_Data& modified, const integration_rule rule) -> std::optional<float> {
+		const auto original_flux = luminous_flux(original, rule);
+		const auto modified_flux = luminous_flux(modified, rule);
+		if (!original_flux || !modified_flux || !(*original_flux > 0.f)) {
+			return {};
+		}
+
+		return *modified_flux / *original_flux;
+	}
+
+	auto renormalize_flux(IE_Data& data, const float target_lumens, const integration_rule rule) -> bool {
+		const auto flux = luminous_flux(data, rule);
+		if (!flux || !(*flux > 0.f) || !std::isfinite(target_lumens)) {
+			return false;
+		}
+
+		data.lamp.multiplier *= target_lumens / *flux;
+		return true;
+	}
+
+	auto renormalize_flux(std::vector<IE_Data>& profiles, const std::vector<IE_Data>& originals, const integration_rule rule) -> std::size_t {
+		auto num_renormalized = std::size_t{ 0 };
+		for (auto i = std::size_t{ 0 }; i < std::min(profiles.size(), originals.size()); ++i) {
+			const auto target_lumens = luminous_flux(originals[i], rule);
+			if (target_lumens && renormalize_flux(profiles[i], *target_lumens, rule)) {
+				++num_renormalized;
+			}
+		}
+
+		return num_renormalized;
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,136 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_PHOTOMETRY_H
+#define IES_RESCALE_PHOTOMETRY_H
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! The quadrature rules of the flux integration
+	enum class integration_rule {
+		trapezoid,		// Exact for candela values varying linearly with the angles
+		simpson,		// Composite Simpson's rule for nonuniform grids (falling back to the trapezoidal rule where adjacent intervals differ over twofold)
+	};
+
+	namespace detail {
+		//! The horizontal weights of flux_integrator
+		auto flux_horz_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> horz_angles, const integration_rule rule) -> std::optional<std::vector<double>>;
+
+		//! The vertical weights of flux_integrator, for grids whose vertical angles may be out of order (see luminous_flux()):
+		//! those are integrated over the columns flagged in #has_intensity, and the other columns get a weight of 0.
+		auto flux_vert_weights(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const uint32_t> has_intensity,
+			const integration_rule rule) -> std::optional<std::vector<float>>;
+	}
+
+	//! Integrates candela grids into luminous flux: the grid is reduced to one weight per vertical angle and one per horizontal angle,
+	//! which include the solid angle of the goniometer type and the symmetries the angle ranges imply (as unfolded by candela_sampler),
+	//! so the flux of a grid is the weighted sum of its values. The weights only depend on the angles, so an integrator can be reused
+	//! for all the profiles (or rescaled versions of a profile) that share a grid.
+	class flux_integrator {
+	public:
+		//! Set up the weights of a grid
+		//! \param[in]		gonio_type		The goniometer type of the grid
+		//! \param[in]		vert_angles		The vertical angles of the grid (in ascending order)
+		//! \param[in]		horz_angles		The horizontal angles of the grid (in ascending order)
+		//! \param[in]		rule			The quadrature rule
+		//! \return			std::optional<flux_integrator>	The integrator on success or an empty object on failure (i.e. empty or unsorted angles)
+		static auto create(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const float> horz_angles,
+			const integration_rule rule = integration_rule::simpson) -> std::optional<flux_integrator>;
+
+		static auto create(const IE_Data::Photo& photo, const integration_rule rule = integration_rule::simpson) -> std::optional<flux_integrator>;
+
+		//! The flux of one row of candela values (i.e. the values of one horizontal angle), in lumens
+		auto integrate_row(const std::size_t row, const float* candelas) const -> double;
+
+		//! The flux of a grid of candela values (without the lamp multiplier), in lumens
+		auto integrate(const candela_matrix_view candelas) const -> double;
+
+		auto vert_weights() const -> const std::vector<float>& { return vert_weights_; }
+		auto horz_weights() const -> const std::vector<double>& { return horz_weights_; }
+
+	private:
+		flux_integrator() = default;
+
+		std::vector<float> vert_weights_;		// Per vertical angle: the quadrature weight times the solid angle factor (in radians)
+		std::vector<double> horz_weights_;		// Per horizontal angle: the quadrature weight times the symmetry factor (in radians)
+	};
+
+	//! The flux emitted into a zone of vertical angles
+	struct zonal_flux {
+		float vert_angle_min;
+		float vert_angle_max;
+		float lumens;
+	};
+
+	//! Parameters of the photometric calculations
+	struct photometry_options {
+		integration_rule rule = integration_rule::simpson;
+		float zone_width = 10.f;				// The width of the zones of the zonal lumens, in degrees
+	};
+
+	//! The calculated photometric data of a profile (after Ian Ashdown's IE_CalcData)
+	struct photometric_summary {
+		float total_lumens = 0.f;				// The flux of the luminaire, including the lamp multiplier
+		float lamp_lumens = 0.f;				// The rated flux of all the lamps (0 for absolute photometry)
+		std::optional<float> efficiency;		// The ratio of the luminaire and lamp fluxes (only for relative photometry)
+		std::vector<zonal_flux> zones;			// The zonal lumens over the full range of vertical angles of the goniometer type
+	};
+
+	//! Calculate the flux of a profile.
+	//! The vertical angles of the profiles rescale_ies_data() outputs may be out of order, as the columns without any intensity keep their original angles,
+	//! so such profiles are integrated over the columns with intensity only (here and in the other functions below).
+	//! \param[in]		data					The IES data
+	//! \param[in]		rule					The quadrature rule
+	//! \return			std::optional<float>	The flux in lumens, including the lamp multiplier, on success or an empty object on failure (i.e. invalid data)
+	auto luminous_flux(const IE_Data& data, const integration_rule rule = integration_rule::simpson) -> std::optional<float>;
+
+	//! Calculate the zonal lumens of a profile, over zones of options.zone_width degrees covering [0, 180] for Type C, and [-90, 90] for Types A and B
+	auto zonal_lumens(const IE_Data& data, const photometry_options& options = {}) -> std::optional<std::vector<zonal_flux>>;
+
+	//! Calculate the total and zonal lumens and the efficiency of a profile
+	auto calc_photometry(const IE_Data& data, const photometry_options& options = {}) -> std::optional<photometric_summary>;
+
+	//! The fraction of the flux of a profile that a modified version of it (e.g. the output of rescale_ies_data()) retains
+	auto flux_ratio(const IE_Data& original, const IE_Data& modified, const integration_rule rule = integration_rule::simpson) -> std::optional<float>;
+
+	//! Scale the lamp multiplier of a profile so that its flux matches the specified one
+	//! \param[in,out]	data					The IES data
+	//! \param[in]		target_lumens			The flux to match, in lumens
+	//! \param[in]		rule					The quadrature rule
+	//! \return			bool					True on success or false on failure (i.e. invalid data or a profile without any flux)
+	auto renormalize_flux(IE_Data& data, const float target_lumens, const integration_rule rule = integration_rule::simpson) -> bool;
+
+	//! Scale the lamp multipliers of profiles (e.g. rescaled ones) so that their fluxes match those of the respective original profiles
+	//! \return			std::size_t				The number of profiles renormalized successfully
+	auto renormalize_flux(std::vector<IE_Data>& profiles, const std::vector<IE_Data>& originals, const integration_rule rule = integration_rule::simpson) -> std::size_t;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_PHOTOMETRY_H
@@ -0,0 +1,212 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <chrono>
+#include <algorithm>
+#include <optional>
+
+#include "ies_rescale_pipeline.h"
+#include "ies_rescale_loader.h"
+
+namespace ies_rescale {
+
+	// A profile on its way through the pipeline. Only a pointer to it is passed between the stages.
+	struct pipeline_item {
+		std::size_t index = 0;				// The index of the input file
+		std::unique_ptr<memstream> stream;	// The file content (read -> parse)
+		std::optional<IE_Data> data;		// The parsed and then rescaled data (parse -> rescale -> serialize)
+		std::vector<uint8_t> buffer;		// The serialized data (serialize -> write)
+	};
+
+	using pipeline_queue = bounded_queue<std::unique_ptr<pipeline_item>>;
+
+	// Touch every page of the content, so that a memory-mapped file is faulted in on the reader threads instead of stalling the parsers
+	static void prefault(const std::string_view content) {
+		constexpr auto page_size = std::size_t{ 4096 };
+
+		auto sum = 0u;
+		for (auto i = std::size_t{ 0 }; i < content.size(); i += page_size) {
+			sum += static_cast<unsigned char>(content[i]);
+		}
+
+		// Keep the compiler from optimizing the reads away
+		static std::atomic<unsigned> sink{ 0 };
+		sink.fetch_add(sum, std::memory_order_relaxed);
+	}
+
+	auto rescale_ies_files_pipelined(const std::vector<std::string>& files, const std::string_view input_dir, const batch_options& options, const pipeline_options& stage_options) -> batch_report {
+		const auto start_time = std::chrono::steady_clock::now();
+
+		const auto half_threads = std::max<std::size_t>(std::thread::hardware_concurrency() / 2, 1);
+		const auto num_readers = std::max<std::size_t>(stage_options.num_readers, 1);
+		const auto num_parsers = stage_options.num_parsers > 0 ? stage_options.num_parsers : half_threads;
+		const auto num_rescalers = std::max<std::size_t>(stage_options.num_rescalers, 1);
+		const auto num_serializers = stage_options.num_serializers > 0 ? stage_options.num_serializers : half_threads;
+		const auto num_writers = std::max<std::size_t>(stage_options.num_writers, 1);
+
+		auto read_queue = pipeline_queue{ stage_options.queue_capacity };
+		auto parse_queue = pipeline_queue{ stage_options.queue_capacity };
+		auto rescale_queue = pipeline_queue{ stage_options.queue_capacity };
+		auto write_queue = pipeline_queue{ stage_options.queue_capacity };
+
+		// One flag per file, set by whichever stage fails on it
+		auto failed = std::vector<uint8_t>(files.size(), 0);
+		auto threads = std::vector<std::thread>{};
+
+		// Run the stage's function on every item of the input queue on the specified number of threads, handing the item over to the output queue on success.
+		// The last thread of a stage to finish closes the output queue, which lets the next stage wind down in turn.
+		auto start_stage = [&threads, &failed](const std::size_t num_threads, pipeline_queue& in, pipeline_queue& out, auto fn) {
+			auto remaining = std::make_shared<std::atomic<std::size_t>>(num_threads);
+
+			for (auto t = std::size_t{ 0 }; t < num_threads; ++t) {
+				threads.emplace_back([&in, &out, &failed, remaining, fn] {
+					auto item = std::unique_ptr<pipeline_item>{};
+					while (in.pop(item)) {
+						if (fn(*item)) {
+							out.push(std::move(item));
+						}
+						else {
+							failed[item->index] = 1;
+						}
+					}
+
+					if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+						out.close();
+					}
+				});
+			}
+		};
+
+		// Reader stage: pull the next file index and map the file
+		auto next_index = std::make_shared<std::atomic<std::size_t>>(0);
+		auto read_mapped = [&files, &failed, &read_queue, next_index] {
+			for (auto i = next_index->fetch_add(1); i < files.size(); i = next_index->fetch_add(1)) {
+				auto item = std::make_unique<pipeline_item>();
+				item->index = i;
+				// Same as read_file_to_stream(), but with the stream on the heap, so that only a pointer moves through the queues
+				auto file = mapped_file::open(files[i]);
+				if (!file || file->empty()) {
+					failed[i] = 1;
+					continue;
+				}
+
+				item->stream = std::make_unique<memstream>(std::move(*file));
+
+				prefault(item->stream->unread());
+				read_queue.push(std::move(item));
+			}
+		};
+
+		if (stage_options.allow_io_uring && io_uring_available()) {
+			// A single reader keeps up to queue_capacity files in flight through one io_uring submission ring
+			threads.emplace_back([&files, &failed, &read_queue, &stage_options, read_mapped] {
+				auto read_options = bulk_load_options{};
+				read_options.queue_depth = stage_options.queue_capacity;
+
+				const auto read = bulk_read_io_uring(files, [&failed, &read_queue](const std::size_t index, std::optional<std::vector<uint8_t>>&& content) {
+					if (!content) {
+						failed[index] = 1;
+						return;
+					}
+
+					auto item = std::make_unique<pipeline_item>();
+					item->index = index;
+					item->stream = std::make_unique<memstream>(std::move(*content));
+					read_queue.push(std::move(item));
+				}, read_options);
+
+				// The ring couldn't be set up (e.g. for lack of locked memory), so fall back to mapping the files on this thread
+				if (!read) {
+					read_mapped();
+				}
+
+				read_queue.close();
+			});
+		}
+		else {
+			auto remaining = std::make_shared<std::atomic<std::size_t>>(num_readers);
+
+			for (auto t = std::size_t{ 0 }; t < num_readers; ++t) {
+				threads.emplace_back([&read_queue, remaining, read_mapped] {
+					read_mapped();
+
+					if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+						read_queue.close();
+					}
+				});
+			}
+		}
+
+		start_stage(num_parsers, read_queue, parse_queue, [&files](pipeline_item& item) {
+			item.data = convert_stream_to_data(*item.stream, files[item.index]);
+			// The parsed data doesn't reference the file content, so release it (and its mapping) right away
+			item.stream.reset();
+			return item.data.has_value();
+		});
+
+		start_stage(num_rescalers, parse_queue, rescale_queue, [&options](pipeline_item& item) {
+			return rescale_ies_data_inplace(*item.data, options.rescale_cone_angle, options.mode);
+		});
+
+		start_stage(num_serializers, rescale_queue, write_queue, [](pipeline_item& item) {
+			auto buffer = convert_data_to_buffer(*item.data);
+			item.data.reset();
+			if (!buffer) {
+				return false;
+			}
+
+			item.buffer = std::move(*buffer);
+			return true;
+		});
+
+		// Writer stage: the last one, so the items end here
+		for (auto t = std::size_t{ 0 }; t < num_writers; ++t) {
+			threads.emplace_back([&files, &failed, &write_queue, input_dir, &options] {
+				auto item = std::unique_ptr<pipeline_item>{};
+				while (write_queue.pop(item)) {
+					const auto fname_out = make_output_file_name(files[item->index], input_dir, options);
+					if (!write_buffer_to_file(item->buffer, fname_out)) {
+						failed[item->index] = 1;
+					}
+				}
+			});
+		}
+
+		for (auto& thread : threads) {
+			thread.join();
+		}
+
+		auto report = batch_report{};
+		report.num_files = files.size();
+		for (auto i = std::size_t{ 0 }; i < files.size(); ++i) {
+			if (failed[i]) {
+				report.failed_files.push_back(files[i]);
+			}
+		}
+		report.num_failed = report.failed_files.size();
+		report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		return report;
+	}
+
+} // namespace ies_rescale
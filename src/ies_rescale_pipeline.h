@@ -0,0 +1,194 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_PIPELINE_H
+#define IES_RESCALE_PIPELINE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <cstddef>
+
+#include "ies_rescale_batch.h"
+
+namespace ies_rescale {
+
+	//! A bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's algorithm).
+	//! Every cell carries a sequence number telling whether it is ready to be written or read on the current lap, so producers and consumers
+	//! only ever contend on their own position counter. The blocking push() and pop() back off while the queue is full or empty, which is
+	//! what throttles the faster stages of a pipeline to the pace of the slower ones.
+	template <typename T>
+	class bounded_queue {
+	public:
+		//! \param[in]		capacity			The maximum number of queued values (rounded up to a power of two)
+		explicit bounded_queue(const std::size_t capacity) {
+			auto size = std::size_t{ 2 };
+			while (size < capacity) {
+				size *= 2;
+			}
+
+			cells_ = std::make_unique<cell[]>(size);
+			mask_ = size - 1;
+			for (auto i = std::size_t{ 0 }; i < size; ++i) {
+				cells_[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		bounded_queue(const bounded_queue&) = delete;
+		bounded_queue& operator=(const bounded_queue&) = delete;
+
+		auto capacity() const -> std::size_t { return mask_ + 1; }
+
+		//! Queue the value unless the queue is full (in which case the value is left untouched)
+		auto try_push(T& value) -> bool {
+			auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+			for (;;) {
+				auto& c = cells_[pos & mask_];
+				const auto sequence = c.sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+				if (diff == 0) {
+					// The cell is free on this lap: claim it
+					if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						c.value = std::move(value);
+						c.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0) {
+					// The cell still holds the value of the previous lap, i.e. the queue is full
+					return false;
+				}
+				else {
+					// Another producer claimed the cell first
+					pos = enqueue_pos_.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		//! Take the oldest value unless the queue is empty
+		auto try_pop(T& value) -> bool {
+			auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+			for (;;) {
+				auto& c = cells_[pos & mask_];
+				const auto sequence = c.sequence.load(std::memory_order_acquire);
+				const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+
+				if (diff == 0) {
+					if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						value = std::move(c.value);
+						// Make the cell available for the next lap
+						c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0) {
+					return false;
+				}
+				else {
+					pos = dequeue_pos_.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		//! Queue the value, waiting while the queue is full
+		void push(T value) {
+			for (auto attempt = 0; !try_push(value); ++attempt) {
+				back_off(attempt);
+			}
+		}
+
+		//! Take the oldest value, waiting while the queue is empty
+		//! \return			false once the queue has been closed and drained
+		auto pop(T& value) -> bool {
+			for (auto attempt = 0;; ++attempt) {
+				if (try_pop(value)) {
+					return true;
+				}
+
+				if (closed_.load(std::memory_order_acquire)) {
+					// A value may have been pushed right before the queue got closed
+					return try_pop(value);
+				}
+
+				back_off(attempt);
+			}
+		}
+
+		//! Signal the consumers that no more values will be pushed
+		void close() { closed_.store(true, std::memory_order_release); }
+
+	private:
+		// Spin briefly first, as the other side is usually just about to catch up, and then stop burning the CPU
+		static void back_off(const int attempt) {
+			if (attempt < 64) {
+				std::this_thread::yield();
+			}
+			else {
+				std::this_thread::sleep_for(std::chrono::microseconds{ 50 });
+			}
+		}
+
+		struct cell {
+			std::atomic<std::size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<cell[]> cells_;
+		std::size_t mask_ = 0;
+
+		// Keep the producer and the consumer positions on separate cache lines
+		alignas(64) std::atomic<std::size_t> enqueue_pos_{ 0 };
+		alignas(64) std::atomic<std::size_t> dequeue_pos_{ 0 };
+		alignas(64) std::atomic<bool> closed_{ false };
+	};
+
+	//! The number of threads of every stage of the pipeline, and how the files are read
+	struct pipeline_options {
+		std::size_t queue_capacity = 64;	// The capacity of the queues between the stages, which bounds the number of profiles in flight
+		std::size_t num_readers = 2;		// The reader threads mostly wait for the disk, so they don't need a core of their own (ignored with io_uring)
+		std::size_t num_parsers = 0;		// 0 means half of the hardware threads
+		std::size_t num_rescalers = 1;
+		std::size_t num_serializers = 0;	// 0 means half of the hardware threads
+		std::size_t num_writers = 2;
+		bool allow_io_uring = true;			// Whether to read the files through io_uring (see bulk_read_io_uring()) when it is available, rather than on the reader threads
+	};
+
+	//! Rescale the specified IES profiles with a staged pipeline: reading, parsing, rescaling, serializing and writing each run on their own threads,
+	//! connected by bounded queues, so that the disk latency of the reads and writes overlaps with the CPU work on the other profiles.
+	//! Where io_uring is available, the reads are submitted through a single ring (see bulk_read_io_uring()), and otherwise the reader threads map the files.
+	//! \param[in]		files				The input files
+	//! \param[in]		input_dir			The root of the input files, used to mirror their layout under options.output_dir
+	//! \param[in]		options				The batch parameters (options.num_threads is ignored in favour of #stage_options)
+	//! \param[in]		stage_options		The pipeline parameters
+	//! \return			batch_report		The summary of the batch
+	auto rescale_ies_files_pipelined(const std::vector<std::string>& files, const std::string_view input_dir, const batch_options& options, const pipeline_options& stage_options = {}) -> batch_report;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_PIPELINE_H
@@ -0,0 +1,195 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ies_rescale_profile_cache.h"
+
+namespace ies_rescale {
+
+	// Get the modification time and the size of a file with a single system call, as a cache hit costs little more than that
+	static auto ie_file_signature(const std::string& file_name, int64_t& modification_time, uint64_t& file_size) -> bool {
+#if defined(_WIN32)
+		struct _stat64 st;
+		if (::_stat64(file_name.c_str(), &st) != 0) {
+			return false;
+		}
+		modification_time = static_cast<int64_t>(st.st_mtime);
+#else
+		struct stat st;
+		if (::stat(file_name.c_str(), &st) != 0) {
+			return false;
+		}
+#	if defined(__APPLE__)
+		modification_time = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#	else
+		modification_time = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#	endif
+#endif
+		file_size = static_cast<uint64_t>(st.st_size);
+		return true;
+	}
+
+	auto memory_usage(const IE_Data& data) -> std::size_t {
+		auto size = sizeof(IE_Data) + data.file.name.capacity() + data.lamp.tilt_fname.capacity();
+
+		size += data.labels.capacity() * sizeof(std::string);
+		for (const auto& label : data.labels) {
+			size += label.capacity();
+		}
+
+		size += (data.lamp.tilt.angles.capacity() + data.lamp.tilt.mult_factors.capacity()) * sizeof(float);
+		size += (data.photo.vert_angles.capacity() + data.photo.horz_angles.capacity()) * sizeof(float);
+		size += data.photo.candelas.values().size() * sizeof(float);
+
+		return size;
+	}
+
+	auto profile_cache::parsed_key_hash::operator()(const parsed_key& key) const -> std::size_t {
+		auto h = hash_bytes(key.file_name.data(), key.file_name.size());
+		h = hash_bytes(&key.modification_time, sizeof(key.modification_time), h);
+		h = hash_bytes(&key.file_size, sizeof(key.file_size), h);
+		return static_cast<std::size_t>(h);
+	}
+
+	auto profile_cache::rescaled_key_hash::operator()(const rescaled_key& key) const -> std::size_t {
+		auto h = hash_bytes(&key.rescale_cone_angle, sizeof(key.rescale_cone_angle), key.content_hash);
+		h = hash_bytes(&key.mode, sizeof(key.mode), h);
+		h = hash_bytes(key.file_name.data(), key.file_name.size(), h);
+		return static_cast<std::size_t>(h);
+	}
+
+	profile_cache::profile_cache(const profile_cache_options& options)
+		: parsed_(options.memory_budget / 2, options.num_shards)
+		, rescaled_(options.memory_budget / 2, options.num_shards)
+	{}
+
+	auto profile_cache::load(const std::string_view file_name) -> cached_profile {
+		// A modified file gets a new key, while its previous entry ages out of the cache
+		auto key = parsed_key{ std::string{ file_name }, 0, 0 };
+		if (!ie_file_signature(key.file_name, key.modification_time, key.file_size)) {
+			parsed_misses_.fetch_add(1, std::memory_order_relaxed);
+			return {};
+		}
+
+		if (auto entry = parsed_.get(key)) {
+			// The TILT data file is read along with the profile, so a change to it makes the entry stale as well
+			auto tilt_modification_time = int64_t{ 0 };
+			auto tilt_file_size = uint64_t{ 0 };
+			if (entry.tilt_file_name.empty()
+				|| (ie_file_signature(entry.tilt_file_name, tilt_modification_time, tilt_file_size)
+					&& tilt_modification_time == entry.tilt_modification_time && tilt_file_size == entry.tilt_file_size)) {
+				parsed_hits_.fetch_add(1, std::memory_order_relaxed);
+				return entry.profile;
+			}
+
+			parsed_.erase(key);
+		}
+
+		parsed_misses_.fetch_add(1, std::memory_order_relaxed);
+
+		auto file = mapped_file::open(file_name);
+		if (!file) {
+			return {};
+		}
+
+		auto entry = parsed_entry{};
+		entry.profile.content_hash = hash_bytes(file->data(), file->size());
+
+		auto stream = memstream{ std::move(*file) };
+		auto data = convert_stream_to_data(stream, file_name);
+		if (!data) {
+			return {};
+		}
+
+		// The parse read the TILT data file (if any), whose content identifies the profile as well
+		const auto& tilt_fname = data->lamp.tilt_fname;
+		if (tilt_fname != "NONE" && tilt_fname != "INCLUDE") {
+			entry.tilt_file_name = tilt_fname;
+			auto tilt_file = mapped_file::open(tilt_fname);
+			if (!tilt_file || !ie_file_signature(entry.tilt_file_name, entry.tilt_modification_time, entry.tilt_file_size)) {
+				return {};
+			}
+			entry.profile.content_hash = hash_bytes(tilt_file->data(), tilt_file->size(), entry.profile.content_hash);
+		}
+
+		const auto charge = memory_usage(*data) + sizeof(parsed_entry) + key.file_name.capacity() + entry.tilt_file_name.capacity();
+		entry.profile.data = std::make_shared<const IE_Data>(std::move(*data));
+		return parsed_.put(std::move(key), std::move(entry), charge).profile;
+	}
+
+	auto profile_cache::rescale(const cached_profile& profile, const float rescale_cone_angle, const bool preserve_intensity) -> std::shared_ptr<const IE_Data> {
+		return rescale(profile, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten);
+	}
+
+	auto profile_cache::rescale(const cached_profile& profile, const float rescale_cone_angle, const rescale_mode mode) -> std::shared_ptr<const IE_Data> {
+		if (!profile) {
+			return {};
+		}
+
+		// The file name is part of the rescaled data, so identical files under different paths can't share their results
+		// Adding zero turns -0 into +0, which compare equal but would hash differently
+		auto key = rescaled_key{ profile.content_hash, rescale_cone_angle + 0.f, mode, profile.data->file.name };
+		if (auto scaled_data = rescaled_.get(key)) {
+			rescaled_hits_.fetch_add(1, std::memory_order_relaxed);
+			return scaled_data;
+		}
+
+		rescaled_misses_.fetch_add(1, std::memory_order_relaxed);
+
+		auto scaled_data = rescale_ies_data(*profile.data, rescale_cone_angle, mode);
+		if (!scaled_data) {
+			return {};
+		}
+
+		const auto charge = memory_usage(*scaled_data) + key.file_name.capacity();
+		return rescaled_.put(std::move(key), std::make_shared<const IE_Data>(std::move(*scaled_data)), charge);
+	}
+
+	auto profile_cache::load_rescaled(const std::string_view file_name, const float rescale_cone_angle, const bool preserve_intensity) -> std::shared_ptr<const IE_Data> {
+		return rescale(load(file_name), rescale_cone_angle, preserve_intensity);
+	}
+
+	auto profile_cache::load_rescaled(const std::string_view file_name, const float rescale_cone_angle, const rescale_mode mode) -> std::shared_ptr<const IE_Data> {
+		return rescale(load(file_name), rescale_cone_angle, mode);
+	}
+
+	auto profile_cache::stats() const -> profile_cache_stats {
+		auto stats = profile_cache_stats{};
+		stats.parsed_hits = parsed_hits_.load(std::memory_order_relaxed);
+		stats.parsed_misses = parsed_misses_.load(std::memory_order_relaxed);
+		stats.rescaled_hits = rescaled_hits_.load(std::memory_order_relaxed);
+		stats.rescaled_misses = rescaled_misses_.load(std::memory_order_relaxed);
+		stats.num_evictions = parsed_.num_evictions() + rescaled_.num_evictions();
+		stats.num_entries = parsed_.size() + rescaled_.size();
+		stats.memory_usage = parsed_.charge() + rescaled_.charge();
+		return stats;
+	}
+
+	void profile_cache::clear() {
+		parsed_.clear();
+		rescaled_.clear();
+	}
+
+} // namespace ies_rescale
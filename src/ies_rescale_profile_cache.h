@@ -0,0 +1,294 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_PROFILE_CACHE_H
+#define IES_RESCALE_PROFILE_CACHE_H
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	namespace detail {
+		//! A thread-safe LRU map bounded by the total charge (e.g. memory usage) of its values.
+		//! The keys are spread over independently locked shards, each one with its own LRU list and an equal part of the budget,
+		//! so that concurrent lookups of different keys rarely contend on the same lock.
+		template <typename Key, typename Value, typename Hash = std::hash<Key>>
+		class sharded_lru {
+		public:
+			//! \param[in]		budget				The bound of the total charge of the values
+			//! \param[in]		num_shards			The number of shards (at least 1)
+			sharded_lru(const std::size_t budget, const std::size_t num_shards) {
+				shards_.resize(std::max<std::size_t>(num_shards, 1));
+				for (auto& shard : shards_) {
+					shard = std::make_unique<lru_shard>();
+				}
+				shard_budget_ = budget / shards_.size();
+			}
+
+			sharded_lru(const sharded_lru&) = delete;
+			sharded_lru& operator=(const sharded_lru&) = delete;
+
+			//! Get the value of the key, making it the most recently used one
+			//! \return			Value				The value or a default-constructed value if the key isn't cached
+			auto get(const Key& key) -> Value {
+				auto& shard = shard_of(key);
+				const auto lock = std::lock_guard<std::mutex>{ shard.mutex };
+
+				const auto it = shard.index.find(key);
+				if (it == shard.index.end()) {
+					return {};
+				}
+
+				shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+				return it->second->value;
+			}
+
+			//! Cache a value, evicting the least recently used values of its shard as needed.
+			//! If the key is already cached (e.g. another thread computed the same value concurrently), the cached value is kept.
+			//! Values whose charge exceeds the budget of a shard are not cached.
+			//! \return			Value				The cached value of the key
+			auto put(const Key& key, Value value, const std::size_t charge) -> Value {
+				auto& shard = shard_of(key);
+				const auto lock = std::lock_guard<std::mutex>{ shard.mutex };
+
+				const auto it = shard.index.find(key);
+				if (it != shard.index.end()) {
+					shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+					return it->second->value;
+				}
+
+				if (charge > shard_budget_) {
+					return value;
+				}
+
+				while (shard.charge + charge > shard_budget_) {
+					const auto& lru = shard.entries.back();
+					shard.charge -= lru.charge;
+					shard.index.erase(lru.key);
+					shard.entries.pop_back();
+					num_evictions_.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				shard.entries.push_front(entry{ key, value, charge });
+				shard.index.emplace(key, shard.entries.begin());
+				shard.charge += charge;
+
+				return value;
+			}
+
+			//! Remove the key, if it is cached
+			void erase(const Key& key) {
+				auto& shard = shard_of(key);
+				const auto lock = std::lock_guard<std::mutex>{ shard.mutex };
+
+				const auto it = shard.index.find(key);
+				if (it != shard.index.end()) {
+					shard.charge -= it->second->charge;
+					shard.entries.erase(it->second);
+					shard.index.erase(it);
+				}
+			}
+
+			void clear() {
+				for (auto& shard : shards_) {
+					const auto lock = std::lock_guard<std::mutex>{ shard->mutex };
+					shard->index.clear();
+					shard->entries.clear();
+					shard->charge = 0;
+				}
+			}
+
+			auto size() const -> std::size_t {
+				auto size = std::size_t{ 0 };
+				for (const auto& shard : shards_) {
+					const auto lock = std::lock_guard<std::mutex>{ shard->mutex };
+					size += shard->entries.size();
+				}
+				return size;
+			}
+
+			auto charge() const -> std::size_t {
+				auto charge = std::size_t{ 0 };
+				for (const auto& shard : shards_) {
+					const auto lock = std::lock_guard<std::mutex>{ shard->mutex };
+					charge += shard->charge;
+				}
+				return charge;
+			}
+
+			auto num_evictions() const -> std::size_t { return num_evictions_.load(std::memory_order_relaxed); }
+
+		private:
+			struct entry {
+				Key key;
+				Value value;
+				std::size_t charge;
+			};
+
+			// Padded to a cache line, so that threads working on different shards don't share one
+			struct alignas(64) lru_shard {
+				mutable std::mutex mutex;
+				std::list<entry> entries;	// Most recently used first
+				std::unordered_map<Key, typename std::list<entry>::iterator, Hash> index;
+				std::size_t charge = 0;
+			};
+
+			auto shard_of(const Key& key) -> lru_shard& {
+				// Pick the shard with the high bits of the mixed hash, which the maps within the shards don't rely on
+				const auto h = static_cast<uint64_t>(Hash{}(key)) * 0x9e3779b97f4a7c15ull;
+				return *shards_[(h >> 32) % shards_.size()];
+			}
+
+			std::vector<std::unique_ptr<lru_shard>> shards_;
+			std::size_t shard_budget_ = 0;
+			std::atomic<std::size_t> num_evictions_{ 0 };
+		};
+	}
+
+	//! Estimate the memory used by IES data, including its arrays and strings
+	auto memory_usage(const IE_Data& data) -> std::size_t;
+
+	//! A parsed profile, shared by all the users of a profile_cache
+	struct cached_profile {
+		std::shared_ptr<const IE_Data> data;	// Empty if the profile couldn't be read or parsed
+		uint64_t content_hash = 0;				// hash_bytes() of the file content and of its TILT data file (if any), which identifies the profile for the rescaled results
+
+		explicit operator bool() const { return data != nullptr; }
+	};
+
+	//! Parameters of a profile cache.
+	//! Each of the two maps gets half of the memory budget, split equally between its shards, and a profile larger than the budget of a shard
+	//! is never cached: with the defaults, that is any profile over 8 MiB (about two million candela values).
+	//! Raise memory_budget or lower num_shards when caching profiles of that size.
+	struct profile_cache_options {
+		std::size_t memory_budget = std::size_t{ 256 } << 20;	// The bound of the memory used by the cached profiles, parsed and rescaled together
+		std::size_t num_shards = 16;							// The number of independently locked shards of each of the maps
+	};
+
+	//! Counters of a profile cache
+	struct profile_cache_stats {
+		std::size_t parsed_hits = 0;
+		std::size_t parsed_misses = 0;
+		std::size_t rescaled_hits = 0;
+		std::size_t rescaled_misses = 0;
+		std::size_t num_evictions = 0;
+		std::size_t num_entries = 0;			// The number of cached profiles, parsed and rescaled
+		std::size_t memory_usage = 0;			// The estimated memory used by the cached profiles
+	};
+
+	//! Thread-safe in-process cache of parsed and rescaled profiles, for long-running services that keep loading the same profiles.
+	//! - The parsed profiles are keyed by file path, modification time and size, so that a modified file is parsed again.
+	//!   A profile with TILT=<file> is parsed again when the modification time or the size of its TILT data file changes as well.
+	//! - The rescaled profiles are keyed by the content hash of their source, the cone angle and the rescale mode, and by the path of their source,
+	//!   since the file name is part of the data: identical files under different paths get rescaled separately.
+	//! Both maps are sharded LRU maps sharing the memory budget equally. The profiles are immutable and shared,
+	//! so evicting one never invalidates the pointers handed out before. Concurrent misses of the same key may compute the value
+	//! more than once, but all of them end up with the same shared value.
+	class profile_cache {
+	public:
+		explicit profile_cache(const profile_cache_options& options = {});
+
+		profile_cache(const profile_cache&) = delete;
+		profile_cache& operator=(const profile_cache&) = delete;
+
+		//! Get the parsed profile of the specified file, reading and parsing it only if it isn't cached or was modified since
+		auto load(const std::string_view file_name) -> cached_profile;
+
+		//! Get the profile rescaled with the specified parameters, rescaling it only if it isn't cached
+		//! \return			std::shared_ptr<const IE_Data>		The rescaled profile or an empty pointer on failure
+		auto rescale(const cached_profile& profile, const float rescale_cone_angle, const bool preserve_intensity = false) -> std::shared_ptr<const IE_Data>;
+		auto rescale(const cached_profile& profile, const float rescale_cone_angle, const rescale_mode mode) -> std::shared_ptr<const IE_Data>;
+
+		//! Load and rescale the specified file
+		auto load_rescaled(const std::string_view file_name, const float rescale_cone_angle, const bool preserve_intensity = false) -> std::shared_ptr<const IE_Data>;
+		auto load_rescaled(const std::string_view file_name, const float rescale_cone_angle, const rescale_mode mode) -> std::shared_ptr<const IE_Data>;
+
+		auto stats() const -> profile_cache_stats;
+		void clear();
+
+	private:
+		struct parsed_key {
+			std::string file_name;
+			int64_t modification_time;
+			uint64_t file_size;
+
+			auto operator==(const parsed_key& other) const -> bool {
+				return modification_time == other.modification_time && file_size == other.file_size && file_name == other.file_name;
+			}
+		};
+
+		struct parsed_key_hash {
+			auto operator()(const parsed_key& key) const -> std::size_t;
+		};
+
+		// A parsed profile along with the signature of its TILT data file (if any), which a hit checks on top of the key
+		struct parsed_entry {
+			cached_profile profile;
+			std::string tilt_file_name;			// Empty when the TILT data is included or absent
+			int64_t tilt_modification_time = 0;
+			uint64_t tilt_file_size = 0;
+
+			explicit operator bool() const { return static_cast<bool>(profile); }
+		};
+
+		struct rescaled_key {
+			uint64_t content_hash;
+			float rescale_cone_angle;
+			rescale_mode mode;
+			std::string file_name;
+
+			auto operator==(const rescaled_key& other) const -> bool {
+				return content_hash == other.content_hash && rescale_cone_angle == other.rescale_cone_angle && mode == other.mode
+					&& file_name == other.file_name;
+			}
+		};
+
+		struct rescaled_key_hash {
+			auto operator()(const rescaled_key& key) const -> std::size_t;
+		};
+
+		detail::sharded_lru<parsed_key, parsed_entry, parsed_key_hash> parsed_;
+		detail::sharded_lru<rescaled_key, std::shared_ptr<const IE_Data>, rescaled_key_hash> rescaled_;
+
+		std::atomic<std::size_t> parsed_hits_{ 0 };
+		std::atomic<std::size_t> parsed_misses_{ 0 };
+		std::atomic<std::size_t> rescaled_hits_{ 0 };
+		std::atomic<std::size_t> rescaled_misses_{ 0 };
+	};
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_PROFILE_CACHE_H
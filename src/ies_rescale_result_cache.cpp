@@ -0,0 +1,451 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_WIN32)
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	include <windows.h>
+#	include <process.h>
+#else
+#	include <fcntl.h>
+#	include <sys/file.h>
+#	include <unistd.h>
+#endif
+
+#include "ies_rescale_result_cache.h"
+
+#if !defined(IES_RESCALE_VERSION)
+#	define IES_RESCALE_VERSION ""
+#endif
+
+namespace fs = std::filesystem;
+
+namespace ies_rescale {
+
+	static_assert(std::is_trivially_copyable<result_cache_entry_header>::value, "The entry header is copied as raw bytes");
+
+	static constexpr auto ie_entry_extension = std::string_view{ ".iesr" };
+	static constexpr auto ie_temp_extension = std::string_view{ ".tmp" };
+
+	// Temporary files left behind by a crashed writer are removed by the eviction scans once they are this old
+	static constexpr auto ie_stale_temp_age = std::chrono::hours{ 1 };
+
+	//! An exclusive advisory lock on a file, shared by all the processes using the same cache directory
+	class ie_file_lock {
+	public:
+		explicit ie_file_lock(const std::string& file_name) {
+#if defined(_WIN32)
+			handle_ = CreateFileA(file_name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (handle_ != INVALID_HANDLE_VALUE) {
+				auto overlapped = OVERLAPPED{};
+				locked_ = LockFileEx(handle_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+			}
+#else
+			fd_ = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+			if (fd_ >= 0) {
+				auto result = 0;
+				do {
+					result = ::flock(fd_, LOCK_EX);
+				} while (result != 0 && errno == EINTR);
+				locked_ = result == 0;
+			}
+#endif
+		}
+
+		~ie_file_lock() {
+#if defined(_WIN32)
+			if (handle_ != INVALID_HANDLE_VALUE) {
+				if (locked_) {
+					auto overlapped = OVERLAPPED{};
+					UnlockFileEx(handle_, 0, MAXDWORD, MAXDWORD, &overlapped);
+				}
+				CloseHandle(handle_);
+			}
+#else
+			// Closing the descriptor releases the lock
+			if (fd_ >= 0) {
+				::close(fd_);
+			}
+#endif
+		}
+
+		ie_file_lock(const ie_file_lock&) = delete;
+		ie_file_lock& operator=(const ie_file_lock&) = delete;
+
+		auto locked() const -> bool { return locked_; }
+
+	private:
+#if defined(_WIN32)
+		HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+		int fd_ = -1;
+#endif
+		bool locked_ = false;
+	};
+
+	static auto ie_process_id() -> uint64_t {
+#if defined(_WIN32)
+		return static_cast<uint64_t>(_getpid());
+#else
+		return static_cast<uint64_t>(::getpid());
+#endif
+	}
+
+	static auto ie_has_extension(const fs::path& path, const std::string_view extension) -> bool {
+		const auto name = path.filename().string();
+		return name.size() >= extension.size() && std::string_view{ name }.substr(name.size() - extension.size()) == extension;
+	}
+
+	//! Find the name of the TILT data file referenced by the raw bytes of an IES file, if any (i.e. the TILT line parameter unless it's NONE or INCLUDE)
+	static auto ie_find_tilt_file(const void* input, const std::size_t size) -> std::optional<std::string_view> {
+		const auto* p = static_cast<const char*>(input);
+		const auto* end = p + size;
+
+		// The TILT line ends the header, and no label line can start with "TILT=", so the first such line is the one
+		while (p != end) {
+			auto line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			const auto* next = line_end ? line_end + 1 : end;
+			if (!line_end) {
+				line_end = end;
+			}
+			if (line_end != p && *(line_end - 1) == 0x0D) {
+				--line_end;
+			}
+
+			const auto line = std::string_view{ p, static_cast<std::size_t>(line_end - p) };
+			if (line.compare(0, 5, "TILT=") == 0) {
+				const auto tilt_str = line.substr(5);
+				if (tilt_str == "NONE" || tilt_str == "INCLUDE") {
+					return {};
+				}
+				return tilt_str;
+			}
+
+			p = next;
+		}
+
+		return {};
+	}
+
+	auto result_cache_key::make(const void* input, const std::size_t size, const float rescale_cone_angle, const bool preserve_intensity, const void* tilt, const std::size_t tilt_size) -> result_cache_key {
+		return make(input, size, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten, tilt, tilt_size);
+	}
+
+	auto result_cache_key::make(const void* input, const std::size_t size, const float rescale_cone_angle, const rescale_mode mode, const void* tilt, const std::size_t tilt_size) -> result_cache_key {
+		// The library version is part of the key, so that upgrading it doesn't serve results computed by an older rescaling
+		struct parameters {
+			float rescale_cone_angle;
+			uint32_t mode;						// The foreshortening and intensity preserving modes keep the values of the former preserve_intensity flag
+			char version[24];
+		};
+
+		auto params = parameters{};
+		params.rescale_cone_angle = rescale_cone_angle + 0.f;
+		params.mode = static_cast<uint32_t>(mode);
+		std::strncpy(params.version, IES_RESCALE_VERSION, sizeof(params.version) - 1);
+
+		// Two independently seeded hashes make collisions between different inputs practically impossible
+		auto key = result_cache_key{};
+		for (auto i = 0; i < 2; ++i) {
+			auto input_hash = hash_bytes(input, size, 0x9e3779b97f4a7c15ull * (i + 1));
+			if (tilt) {
+				input_hash = hash_bytes(tilt, tilt_size, input_hash);
+			}
+			key.hash[i] = hash_bytes(&params, sizeof(params), input_hash);
+		}
+
+		return key;
+	}
+
+	auto result_cache_key::to_string() const -> std::string {
+		static constexpr char digits[] = "0123456789abcdef";
+
+		auto str = std::string(32, '0');
+		for (auto i = 0; i < 32; ++i) {
+			const auto value = hash[i / 16] >> (60 - 4 * (i % 16));
+			str[i] = digits[value & 0xF];
+		}
+
+		return str;
+	}
+
+	result_cache::result_cache(const std::string_view dir, const result_cache_options& options)
+		: dir_(dir)
+		, options_(options)
+	{
+		if (options_.scan_interval == 0) {
+			options_.scan_interval = std::max<uint64_t>(options_.max_size / 8, 1);
+		}
+
+		auto ec = std::error_code{};
+		fs::create_directories(fs::path{ dir_ }, ec);
+	}
+
+	auto result_cache::entry_path(const result_cache_key& key) const -> std::string {
+		// Fan the entries out over 256 subdirectories, to keep the directories small with large caches
+		const auto name = key.to_string();
+		return (fs::path{ dir_ } / name.substr(0, 2) / (name + std::string{ ie_entry_extension })).string();
+	}
+
+	auto result_cache::get(const result_cache_key& key) -> std::optional<std::vector<uint8_t>> {
+		const auto path = entry_path(key);
+
+		auto bytes = std::optional<std::vector<uint8_t>>{};
+		{
+			const auto file = mapped_file::open(path);
+			if (!file) {
+				num_misses_.fetch_add(1, std::memory_order_relaxed);
+				return {};
+			}
+
+			auto header = result_cache_entry_header{};
+			if (file->size() >= sizeof(header)) {
+				std::memcpy(&header, file->data(), sizeof(header));
+			}
+
+			const auto* data = file->data() + sizeof(header);
+			if (header.magic == result_cache_entry_header::magic_value && header.version == result_cache_entry_header::current_version
+				&& header.header_size == sizeof(header) && header.key[0] == key.hash[0] && header.key[1] == key.hash[1]
+				&& header.size == file->size() - sizeof(header) && header.hash == hash_bytes(data, header.size)) {
+				bytes.emplace(data, data + header.size);
+			}
+		}
+
+		auto ec = std::error_code{};
+		if (!bytes) {
+			// Corrupted entries (e.g. written by a different build) are dropped, so that they get replaced
+			fs::remove(fs::path{ path }, ec);
+			num_misses_.fetch_add(1, std::memory_order_relaxed);
+			return {};
+		}
+
+		// The modification time of an entry is its last access time for the eviction
+		fs::last_write_time(fs::path{ path }, fs::file_time_type::clock::now(), ec);
+
+		num_hits_.fetch_add(1, std::memory_order_relaxed);
+		return bytes;
+	}
+
+	auto result_cache::put(const result_cache_key& key, const std::vector<uint8_t>& bytes) -> bool {
+		static auto temp_counter = std::atomic<uint64_t>{ 0 };
+
+		const auto path = fs::path{ entry_path(key) };
+		auto ec = std::error_code{};
+		fs::create_directories(path.parent_path(), ec);
+
+		// Write to a file no other writer uses, then rename it into place, which replaces any previous entry atomically
+		auto temp_path = path;
+		temp_path += "." + std::to_string(ie_process_id()) + "-" + std::to_string(temp_counter.fetch_add(1, std::memory_order_relaxed)) + std::string{ ie_temp_extension };
+
+		auto header = result_cache_entry_header{};
+		header.magic = result_cache_entry_header::magic_value;
+		header.version = result_cache_entry_header::current_version;
+		header.header_size = static_cast<uint16_t>(sizeof(header));
+		header.key[0] = key.hash[0];
+		header.key[1] = key.hash[1];
+		header.size = bytes.size();
+		header.hash = hash_bytes(bytes.data(), bytes.size());
+
+		{
+			auto file = std::ofstream(temp_path, std::ios::binary);
+			if (!file || !file.is_open()) {
+				return false;
+			}
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			if (!file.flush()) {
+				file.close();
+				fs::remove(temp_path, ec);
+				return false;
+			}
+		}
+
+		fs::rename(temp_path, path, ec);
+		if (ec) {
+			fs::remove(temp_path, ec);
+			return false;
+		}
+
+		const auto written = sizeof(header) + bytes.size();
+		if (bytes_since_scan_.fetch_add(written, std::memory_order_relaxed) + written >= options_.scan_interval) {
+			evict();
+		}
+
+		return true;
+	}
+
+	auto result_cache::evict() -> std::size_t {
+		bytes_since_scan_.store(0, std::memory_order_relaxed);
+
+		const auto lock = ie_file_lock{ (fs::path{ dir_ } / "lock").string() };
+		if (!lock.locked()) {
+			return 0;
+		}
+
+		struct entry_info {
+			fs::file_time_type last_access;
+			uint64_t size;
+			fs::path path;
+		};
+
+		auto entries = std::vector<entry_info>{};
+		auto total_size = uint64_t{ 0 };
+		const auto now = fs::file_time_type::clock::now();
+
+		auto ec = std::error_code{};
+		for (auto it = fs::recursive_directory_iterator{ fs::path{ dir_ }, fs::directory_options::skip_permission_denied, ec }; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+			auto entry_ec = std::error_code{};
+			if (!it->is_regular_file(entry_ec)) {
+				continue;
+			}
+
+			const auto last_access = it->last_write_time(entry_ec);
+			const auto size = it->file_size(entry_ec);
+			if (entry_ec) {
+				continue;
+			}
+
+			if (ie_has_extension(it->path(), ie_entry_extension)) {
+				entries.push_back({ last_access, size, it->path() });
+				total_size += size;
+			}
+			else if (ie_has_extension(it->path(), ie_temp_extension) && now - last_access > ie_stale_temp_age) {
+				fs::remove(it->path(), entry_ec);
+			}
+		}
+
+		if (total_size <= options_.max_size) {
+			return 0;
+		}
+
+		// Remove the least recently used entries down to the low watermark, so that the next scans don't immediately evict again
+		std::sort(entries.begin(), entries.end(), [](const entry_info& a, const entry_info& b) { return a.last_access < b.last_access; });
+
+		const auto low_watermark = options_.max_size / 10 * 9;
+		auto num_removed = std::size_t{ 0 };
+		for (const auto& entry : entries) {
+			if (total_size <= low_watermark) {
+				break;
+			}
+
+			auto entry_ec = std::error_code{};
+			if (fs::remove(entry.path, entry_ec)) {
+				total_size -= entry.size;
+				++num_removed;
+			}
+		}
+
+		num_evictions_.fetch_add(num_removed, std::memory_order_relaxed);
+		return num_removed;
+	}
+
+	void result_cache::clear() {
+		const auto lock = ie_file_lock{ (fs::path{ dir_ } / "lock").string() };
+
+		auto paths = std::vector<fs::path>{};
+		auto ec = std::error_code{};
+		for (auto it = fs::recursive_directory_iterator{ fs::path{ dir_ }, fs::directory_options::skip_permission_denied, ec }; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+			if (ie_has_extension(it->path(), ie_entry_extension)) {
+				paths.push_back(it->path());
+			}
+		}
+
+		for (const auto& path : paths) {
+			fs::remove(path, ec);
+		}
+
+		bytes_since_scan_.store(0, std::memory_order_relaxed);
+	}
+
+	auto rescale_ies_buffer_cached(result_cache& cache, const void* input, const std::size_t size, const float rescale_cone_angle, const bool preserve_intensity) -> std::optional<std::vector<uint8_t>> {
+		return rescale_ies_buffer_cached(cache, input, size, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten);
+	}
+
+	auto rescale_ies_buffer_cached(result_cache& cache, const void* input, const std::size_t size, const float rescale_cone_angle, const rescale_mode mode) -> std::optional<std::vector<uint8_t>> {
+		const auto rescale = [&]() -> std::optional<std::vector<uint8_t>> {
+			auto stream = memstream{ input, size };
+			auto data = convert_stream_to_data(stream);
+			if (!data || !rescale_ies_data_inplace(*data, rescale_cone_angle, mode)) {
+				return {};
+			}
+
+			return convert_data_to_buffer(*data);
+		};
+
+		// A profile reading its TILT data from a separate file depends on that file as well, so its content is part of the key
+		auto tilt_file = std::optional<mapped_file>{};
+		if (const auto tilt_fname = ie_find_tilt_file(input, size)) {
+			tilt_file = mapped_file::open(*tilt_fname);
+			if (!tilt_file) {
+				// The rescale fails on its own then, and there's nothing worth caching
+				return rescale();
+			}
+		}
+
+		const auto key = tilt_file
+			? result_cache_key::make(input, size, rescale_cone_angle, mode, tilt_file->data(), tilt_file->size())
+			: result_cache_key::make(input, size, rescale_cone_angle, mode);
+		if (auto bytes = cache.get(key)) {
+			return bytes;
+		}
+
+		auto bytes = rescale();
+		if (!bytes) {
+			return {};
+		}
+
+		// A failure to cache the result doesn't fail the rescale
+		cache.put(key, *bytes);
+		return bytes;
+	}
+
+	auto rescale_ies_file_cached(result_cache& cache, const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const bool preserve_intensity) -> bool {
+		return rescale_ies_file_cached(cache, fname_in, fname_out, rescale_cone_angle, preserve_intensity ? rescale_mode::preserve_intensity : rescale_mode::foreshorten);
+	}
+
+	auto rescale_ies_file_cached(result_cache& cache, const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const rescale_mode mode) -> bool {
+		const auto file = mapped_file::open(fname_in);
+		if (!file) {
+			std::cerr << "Could not read file " << fname_in << "\n";
+			return false;
+		}
+
+		const auto bytes = rescale_ies_buffer_cached(cache, file->data(), file->size(), rescale_cone_angle, mode);
+		return bytes && write_buffer_to_file(*bytes, fname_out);
+	}
+
+} // namespace ies_rescale
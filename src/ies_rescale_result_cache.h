@@ -0,0 +1,137 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_RESULT_CACHE_H
+#define IES_RESCALE_RESULT_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! The key of a rescaled result: a 128-bit hash of the input profile bytes, the TILT data file bytes (if any), the rescale parameters and the library version
+	struct result_cache_key {
+		uint64_t hash[2];
+
+		//! Make the key of rescaling the specified input profile (i.e. the raw bytes of the IES file)
+		//! \param[in]		tilt			The raw bytes of the TILT data file the profile references with TILT=<file>, or nullptr when its TILT is NONE or INCLUDE
+		//! \param[in]		tilt_size		The size of the TILT data file
+		static auto make(const void* input, const std::size_t size, const float rescale_cone_angle, const rescale_mode mode, const void* tilt = nullptr, const std::size_t tilt_size = 0) -> result_cache_key;
+		static auto make(const void* input, const std::size_t size, const float rescale_cone_angle, const bool preserve_intensity, const void* tilt = nullptr, const std::size_t tilt_size = 0) -> result_cache_key;
+
+		//! The key as 32 hex digits, which the entry file is named after
+		auto to_string() const -> std::string;
+
+		auto operator==(const result_cache_key& other) const -> bool { return hash[0] == other.hash[0] && hash[1] == other.hash[1]; }
+		auto operator!=(const result_cache_key& other) const -> bool { return !(*this == other); }
+	};
+
+	//! The header of a result cache entry file, followed by the cached bytes
+	struct result_cache_entry_header {
+		static constexpr uint32_t magic_value = 0x52534549;	// "IESR" in little-endian order
+		static constexpr uint16_t current_version = 1;
+
+		uint32_t magic;
+		uint16_t version;
+		uint16_t header_size;
+		uint64_t key[2];
+		uint64_t size;						// The size of the cached bytes
+		uint64_t hash;						// hash_bytes() of the cached bytes, to detect corrupted entries
+	};
+
+	//! Parameters of a result cache
+	struct result_cache_options {
+		uint64_t max_size = uint64_t{ 1 } << 30;	// The size bound of the cache in bytes (entries included)
+		uint64_t scan_interval = 0;					// The bytes written by this process between two eviction scans (0 means max_size / 8)
+	};
+
+	//! Persistent cache of rescaled profiles, stored as one file per entry in a directory that can be shared by several processes on the same host.
+	//! - Entries are written to a temporary file and renamed into place, so readers only ever see complete entries,
+	//!   and entries that fail their size or hash check are treated as misses and removed.
+	//! - Hits refresh the modification time of their entry, which eviction uses as the access time: once the entries
+	//!   exceed the size bound, the least recently used ones are removed until the cache is back under 90% of it.
+	//! - Eviction scans are serialized between processes by an advisory lock on the "lock" file of the cache directory, and each
+	//!   process only scans after writing scan_interval bytes, so the cache may temporarily exceed its bound by that much per process.
+	//! The cache is thread-safe.
+	class result_cache {
+	public:
+		//! Open (and create if necessary) the cache in the specified directory
+		explicit result_cache(const std::string_view dir, const result_cache_options& options = {});
+
+		result_cache(const result_cache&) = delete;
+		result_cache& operator=(const result_cache&) = delete;
+
+		auto dir() const -> const std::string& { return dir_; }
+
+		//! Get a cached result
+		//! \return			std::optional<std::vector<uint8_t>>		The cached bytes on a hit or an empty object on a miss
+		auto get(const result_cache_key& key) -> std::optional<std::vector<uint8_t>>;
+
+		//! Store a result, replacing any previous result with the same key
+		//! \return			true on success, false on failure (e.g. the directory isn't writable)
+		auto put(const result_cache_key& key, const std::vector<uint8_t>& bytes) -> bool;
+
+		//! Remove the least recently used entries until the cache is back under its low watermark, if it exceeds its bound
+		//! \return			std::size_t			The number of entries removed
+		auto evict() -> std::size_t;
+
+		//! Remove all the entries
+		void clear();
+
+		auto num_hits() const -> std::size_t { return num_hits_.load(std::memory_order_relaxed); }
+		auto num_misses() const -> std::size_t { return num_misses_.load(std::memory_order_relaxed); }
+		auto num_evictions() const -> std::size_t { return num_evictions_.load(std::memory_order_relaxed); }
+
+	private:
+		auto entry_path(const result_cache_key& key) const -> std::string;
+
+		std::string dir_;
+		result_cache_options options_;
+
+		std::atomic<uint64_t> bytes_since_scan_{ 0 };
+		std::atomic<std::size_t> num_hits_{ 0 };
+		std::atomic<std::size_t> num_misses_{ 0 };
+		std::atomic<std::size_t> num_evictions_{ 0 };
+	};
+
+	//! Rescale an IES profile given as the raw bytes of the file, going through the cache.
+	//! On a miss, the profile is parsed, rescaled and serialized with convert_data_to_buffer(), and the result is cached.
+	//! A profile with TILT=<file> is keyed on the content of that file as well, so editing it doesn't serve a stale result.
+	//! \return			std::optional<std::vector<uint8_t>>		The rescaled IES file content on success or an empty object on failure
+	auto rescale_ies_buffer_cached(result_cache& cache, const void* input, const std::size_t size, const float rescale_cone_angle, const bool preserve_intensity = false) -> std::optional<std::vector<uint8_t>>;
+	auto rescale_ies_buffer_cached(result_cache& cache, const void* input, const std::size_t size, const float rescale_cone_angle, const rescale_mode mode) -> std::optional<std::vector<uint8_t>>;
+
+	//! Read, rescale and write out a single IES profile, going through the cache.
+	auto rescale_ies_file_cached(result_cache& cache, const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const bool preserve_intensity = false) -> bool;
+	auto rescale_ies_file_cached(result_cache& cache, const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const rescale_mode mode) -> bool;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_RESULT_CACHE_H
@@ -0,0 +1,407 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "ies_rescale_sampler.h"
+#include "ies_rescale_simd.h"
+
+namespace ies_rescale {
+
+	using detail::sampler_axis;
+	using detail::sampler_data;
+	using detail::horz_symmetry;
+
+	// The bucket lookup is only used when the buckets take a reasonable amount of memory
+	static constexpr auto ie_max_buckets = std::size_t{ 1 } << 16;
+
+	static auto ie_make_axis(const array_view<const float> angles) -> std::optional<sampler_axis> {
+		if (angles.empty()) {
+			return {};
+		}
+
+		auto axis = sampler_axis{};
+		axis.angles.assign(angles.begin(), angles.end());
+
+		// A single angle is stretched into an interval, which the grid gets a copy of its only row or column for
+		if (axis.angles.size() == 1) {
+			axis.angles.push_back(axis.angles.front() + 1.f);
+		}
+
+		for (auto i = std::size_t{ 0 }; i < axis.angles.size(); ++i) {
+			if (!std::isfinite(axis.angles[i]) || (i > 0 && axis.angles[i] < axis.angles[i - 1])) {
+				return {};
+			}
+		}
+
+		const auto num_intervals = axis.angles.size() - 1;
+		axis.first = axis.angles.front();
+		axis.last = axis.angles.back();
+
+		auto min_width = std::numeric_limits<float>::max();
+		axis.inv_widths.resize(num_intervals);
+		for (auto i = std::size_t{ 0 }; i < num_intervals; ++i) {
+			const auto width = axis.angles[i + 1] - axis.angles[i];
+			axis.inv_widths[i] = width > 0.f ? 1.f / width : 0.f;
+			min_width = std::min(min_width, width);
+		}
+
+		const auto range = axis.last - axis.first;
+		const auto step = range / num_intervals;
+
+		auto is_uniform = step > 0.f;
+		for (auto i = std::size_t{ 0 }; is_uniform && i < axis.angles.size(); ++i) {
+			is_uniform = std::abs(axis.angles[i] - (axis.first + i * step)) <= 1e-4f * step;
+		}
+
+		if (is_uniform) {
+			axis.mode = sampler_axis::lookup::uniform;
+			axis.inv_step = 1.f / step;
+			return axis;
+		}
+
+		// The buckets are narrower than any interval, so at most one angle lies within each of them.
+		// One spare bucket covers the rounding of the bucket widths.
+		const auto num_buckets = min_width > 0.f ? static_cast<std::size_t>(std::ceil(range / min_width)) + 1 : ie_max_buckets + 1;
+		if (num_buckets > ie_max_buckets) {
+			axis.mode = sampler_axis::lookup::search;
+			return axis;
+		}
+
+		axis.mode = sampler_axis::lookup::buckets;
+		axis.inv_step = num_buckets / range;
+		axis.buckets.resize(num_buckets);
+
+		auto interval = std::size_t{ 0 };
+		for (auto b = std::size_t{ 0 }; b < num_buckets; ++b) {
+			const auto bucket_start = axis.first + b * (range / num_buckets);
+			while (interval + 1 < num_intervals && axis.angles[interval + 1] <= bucket_start) {
+				++interval;
+			}
+			axis.buckets[b] = static_cast<int32_t>(interval);
+		}
+
+		return axis;
+	}
+
+	// Find the interval of the axis holding the angle (clamped to the axis), and the position of the angle within it
+	static auto ie_find_interval(const sampler_axis& axis, float x, float& t) -> std::size_t {
+		// Written so that NaNs end up at the first angle
+		x = x > axis.first ? x : axis.first;
+		x = x < axis.last ? x : axis.last;
+
+		const auto last_interval = axis.angles.size() - 2;
+		auto i = std::size_t{ 0 };
+
+		switch (axis.mode) {
+		case sampler_axis::lookup::uniform:
+			i = std::min(static_cast<std::size_t>((x - axis.first) * axis.inv_step), last_interval);
+			break;
+
+		case sampler_axis::lookup::buckets: {
+			const auto b = std::min(static_cast<std::size_t>((x - axis.first) * axis.inv_step), axis.buckets.size() - 1);
+			i = static_cast<std::size_t>(axis.buckets[b]);
+			if (i < last_interval && x >= axis.angles[i + 1]) {
+				++i;
+			}
+			break;
+		}
+
+		case sampler_axis::lookup::search:
+			i = static_cast<std::size_t>(std::upper_bound(axis.angles.begin() + 1, axis.angles.end() - 1, x) - axis.angles.begin()) - 1;
+			break;
+		}
+
+		t = std::min(std::max((x - axis.angles[i]) * axis.inv_widths[i], 0.f), 1.f);
+		return i;
+	}
+
+	static auto ie_wrap_angle(const float angle) -> float {
+		return angle - 360.f * std::floor(angle * (1.f / 360.f));
+	}
+
+	// Map a horizontal angle onto the range of the profile
+	static auto ie_fold_horz_angle(const sampler_data& data, float h) -> float {
+		switch (data.horz_folding) {
+		case horz_symmetry::none:
+			return h;
+
+		case horz_symmetry::rotational:
+			return data.horz.first;
+
+		case horz_symmetry::mirror:
+			return std::abs(h);
+
+		case horz_symmetry::full:
+			return ie_wrap_angle(h);
+
+		case horz_symmetry::bilateral_0_180:
+			h = ie_wrap_angle(h);
+			return std::min(h, 360.f - h);
+
+		case horz_symmetry::bilateral_90_270:
+			h = ie_wrap_angle(h);
+			if (h < 90.f || h > 270.f) {
+				h = 180.f - h;
+				h = h < 0.f ? h + 360.f : h;
+			}
+			return h;
+
+		case horz_symmetry::quadrant:
+			h = ie_wrap_angle(h);
+			h = std::min(h, 360.f - h);
+			return std::min(h, 180.f - h);
+		}
+
+		return h;
+	}
+
+	static auto ie_sample(const sampler_data& data, const float vert_angle, const float horz_angle) -> float {
+		const auto v = data.vert_mirror ? std::abs(vert_angle) : vert_angle;
+		if (!(v >= data.vert.first && v <= data.vert.last)) {
+			return 0.f;
+		}
+
+		auto tv = 0.f;
+		auto th = 0.f;
+		const auto iv = ie_find_interval(data.vert, v, tv);
+		const auto ih = ie_find_interval(data.horz, ie_fold_horz_angle(data, horz_angle), th);
+
+		const auto* c = data.candelas.data() + ih * data.stride + iv;
+		const auto c0 = c[0] + (c[1] - c[0]) * tv;
+		const auto c1 = c[data.stride] + (c[data.stride + 1] - c[data.stride]) * tv;
+		return c0 + (c1 - c0) * th;
+	}
+
+#if defined(IES_RESCALE_X86)
+	IES_RESCALE_TARGET("avx2,fma")
+	static auto ie_find_interval_avx2(const sampler_axis& axis, __m256 x, __m256& t) -> __m256i {
+		// max() and min() return their second operand for NaNs, which puts them at the first angle as well
+		x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(axis.first)), _mm256_set1_ps(axis.last));
+
+		const auto last_interval = _mm256_set1_epi32(static_cast<int32_t>(axis.angles.size() - 2));
+		const auto position = _mm256_mul_ps(_mm256_sub_ps(x, _mm256_set1_ps(axis.first)), _mm256_set1_ps(axis.inv_step));
+
+		auto i = _mm256_setzero_si256();
+		if (axis.mode == sampler_axis::lookup::uniform) {
+			i = _mm256_min_epi32(_mm256_cvttps_epi32(position), last_interval);
+		}
+		else {
+			const auto b = _mm256_min_epi32(_mm256_cvttps_epi32(position), _mm256_set1_epi32(static_cast<int32_t>(axis.buckets.size() - 1)));
+			i = _mm256_i32gather_epi32(axis.buckets.data(), b, 4);
+
+			// Step into the next interval (the comparison masks are -1 where true)
+			const auto next_angle = _mm256_i32gather_ps(axis.angles.data(), _mm256_add_epi32(i, _mm256_set1_epi32(1)), 4);
+			const auto past_next = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, next_angle, _CMP_GE_OQ)), _mm256_cmpgt_epi32(last_interval, i));
+			i = _mm256_sub_epi32(i, past_next);
+		}
+
+		const auto angle = _mm256_i32gather_ps(axis.angles.data(), i, 4);
+		const auto inv_width = _mm256_i32gather_ps(axis.inv_widths.data(), i, 4);
+		t = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(x, angle), inv_width), _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+
+		return i;
+	}
+
+	IES_RESCALE_TARGET("avx2,fma")
+	static auto ie_wrap_angle_avx2(const __m256 angle) -> __m256 {
+		const auto turns = _mm256_floor_ps(_mm256_mul_ps(angle, _mm256_set1_ps(1.f / 360.f)));
+		return _mm256_sub_ps(angle, _mm256_mul_ps(turns, _mm256_set1_ps(360.f)));
+	}
+
+	IES_RESCALE_TARGET("avx2,fma")
+	static auto ie_fold_horz_angle_avx2(const sampler_data& data, __m256 h) -> __m256 {
+		const auto sign_bit = _mm256_set1_ps(-0.f);
+
+		switch (data.horz_folding) {
+		case horz_symmetry::none:
+			return h;
+
+		case horz_symmetry::rotational:
+			return _mm256_set1_ps(data.horz.first);
+
+		case horz_symmetry::mirror:
+			return _mm256_andnot_ps(sign_bit, h);
+
+		case horz_symmetry::full:
+			return ie_wrap_angle_avx2(h);
+
+		case horz_symmetry::bilateral_0_180:
+			h = ie_wrap_angle_avx2(h);
+			return _mm256_min_ps(h, _mm256_sub_ps(_mm256_set1_ps(360.f), h));
+
+		case horz_symmetry::bilateral_90_270: {
+			h = ie_wrap_angle_avx2(h);
+			const auto outside = _mm256_or_ps(_mm256_cmp_ps(h, _mm256_set1_ps(90.f), _CMP_LT_OQ), _mm256_cmp_ps(h, _mm256_set1_ps(270.f), _CMP_GT_OQ));
+			auto mirrored = _mm256_sub_ps(_mm256_set1_ps(180.f), h);
+			mirrored = _mm256_add_ps(mirrored, _mm256_and_ps(_mm256_cmp_ps(mirrored, _mm256_setzero_ps(), _CMP_LT_OQ), _mm256_set1_ps(360.f)));
+			return _mm256_blendv_ps(h, mirrored, outside);
+		}
+
+		case horz_symmetry::quadrant:
+			h = ie_wrap_angle_avx2(h);
+			h = _mm256_min_ps(h, _mm256_sub_ps(_mm256_set1_ps(360.f), h));
+			return _mm256_min_ps(h, _mm256_sub_ps(_mm256_set1_ps(180.f), h));
+		}
+
+		return h;
+	}
+
+	// Sample 8 directions per iteration, with the intervals found and the grid read through gathers
+	IES_RESCALE_TARGET("avx2,fma")
+	static void ie_sample_avx2(const sampler_data& data, const float* vert_angles, const float* horz_angles, float* candelas, const std::size_t count) {
+		const auto sign_bit = _mm256_set1_ps(-0.f);
+		const auto stride = _mm256_set1_epi32(static_cast<int32_t>(data.stride));
+		const auto one = _mm256_set1_epi32(1);
+		const auto* grid = data.candelas.data();
+
+		auto j = std::size_t{ 0 };
+		for (; j + 8 <= count; j += 8) {
+			auto v = _mm256_loadu_ps(vert_angles + j);
+			if (data.vert_mirror) {
+				v = _mm256_andnot_ps(sign_bit, v);
+			}
+			const auto inside = _mm256_and_ps(_mm256_cmp_ps(v, _mm256_set1_ps(data.vert.first), _CMP_GE_OQ), _mm256_cmp_ps(v, _mm256_set1_ps(data.vert.last), _CMP_LE_OQ));
+
+			auto tv = _mm256_setzero_ps();
+			auto th = _mm256_setzero_ps();
+			const auto iv = ie_find_interval_avx2(data.vert, v, tv);
+			const auto ih = ie_find_interval_avx2(data.horz, ie_fold_horz_angle_avx2(data, _mm256_loadu_ps(horz_angles + j)), th);
+
+			const auto i00 = _mm256_add_epi32(_mm256_mullo_epi32(ih, stride), iv);
+			const auto i10 = _mm256_add_epi32(i00, stride);
+			const auto c00 = _mm256_i32gather_ps(grid, i00, 4);
+			const auto c01 = _mm256_i32gather_ps(grid, _mm256_add_epi32(i00, one), 4);
+			const auto c10 = _mm256_i32gather_ps(grid, i10, 4);
+			const auto c11 = _mm256_i32gather_ps(grid, _mm256_add_epi32(i10, one), 4);
+
+			const auto c0 = _mm256_fmadd_ps(_mm256_sub_ps(c01, c00), tv, c00);
+			const auto c1 = _mm256_fmadd_ps(_mm256_sub_ps(c11, c10), tv, c10);
+			const auto c = _mm256_fmadd_ps(_mm256_sub_ps(c1, c0), th, c0);
+
+			_mm256_storeu_ps(candelas + j, _mm256_and_ps(c, inside));
+		}
+
+		for (; j < count; ++j) {
+			candelas[j] = ie_sample(data, vert_angles[j], horz_angles[j]);
+		}
+	}
+#endif
+
+	auto candela_sampler::create(const IE_Data::Photo& photo) -> std::optional<candela_sampler> {
+		return create(photo.gonio_type, photo.vert_angles, photo.horz_angles, photo.candelas);
+	}
+
+	auto candela_sampler::create(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const float> horz_angles,
+		const candela_matrix_view candelas) -> std::optional<candela_sampler> {
+		// The gathers index the grid with 32-bit integers
+		if (candelas.num_rows() != horz_angles.size() || candelas.num_cols() != vert_angles.size()
+			|| (horz_angles.size() + 1) * (vert_angles.size() + 1) > static_cast<std::size_t>(std::numeric_limits<int32_t>::max())) {
+			return {};
+		}
+
+		auto vert = ie_make_axis(vert_angles);
+		auto horz = ie_make_axis(horz_angles);
+		if (!vert || !horz) {
+			return {};
+		}
+
+		auto sampler = candela_sampler{};
+		auto& data = sampler.data_;
+		data.vert = std::move(*vert);
+		data.horz = std::move(*horz);
+
+		const auto is_type_c = gonio_type == IE_Data::Photo::Type_C;
+		const auto horz_first = horz_angles[0];
+		const auto horz_last = horz_angles[horz_angles.size() - 1];
+		auto wrap_row = false;
+
+		if (horz_angles.size() == 1) {
+			data.horz_folding = horz_symmetry::rotational;
+		}
+		else if (!is_type_c) {
+			data.horz_folding = horz_first == 0.f ? horz_symmetry::mirror : horz_symmetry::none;
+		}
+		else if (horz_first == 0.f && horz_last == 90.f) {
+			data.horz_folding = horz_symmetry::quadrant;
+		}
+		else if (horz_first == 0.f && horz_last == 180.f) {
+			data.horz_folding = horz_symmetry::bilateral_0_180;
+		}
+		else if (horz_first == 90.f && horz_last == 270.f) {
+			data.horz_folding = horz_symmetry::bilateral_90_270;
+		}
+		else if (horz_first == 0.f && horz_last > 180.f && horz_last <= 360.f) {
+			data.horz_folding = horz_symmetry::full;
+
+			// Close the circle if the last plane isn't the first one again (e.g. [0, 355] in 5 degree steps)
+			if (horz_last < 360.f) {
+				auto closed_angles = std::vector<float>(horz_angles.begin(), horz_angles.end());
+				closed_angles.push_back(360.f);
+				data.horz = std::move(*ie_make_axis(closed_angles));
+				wrap_row = true;
+			}
+		}
+
+		data.vert_mirror = !is_type_c && vert_angles[0] == 0.f;
+
+		// Copy the grid, repeating the single row or column of the degenerate axes, and the first row to close the circle
+		const auto num_rows = data.horz.angles.size();
+		data.stride = data.vert.angles.size();
+		data.candelas.resize(num_rows * data.stride);
+		for (auto row = std::size_t{ 0 }; row < num_rows; ++row) {
+			const auto source_row = candelas.row(row < candelas.num_rows() ? row : (wrap_row ? 0 : candelas.num_rows() - 1));
+			auto* destination = data.candelas.data() + row * data.stride;
+			std::copy(source_row.begin(), source_row.end(), destination);
+			if (source_row.size() < data.stride) {
+				destination[data.stride - 1] = source_row[source_row.size() - 1];
+			}
+		}
+
+		return sampler;
+	}
+
+	auto candela_sampler::sample(const float vert_angle, const float horz_angle) const -> float {
+		return ie_sample(data_, vert_angle, horz_angle);
+	}
+
+	void candela_sampler::sample(const array_view<const float> vert_angles, const array_view<const float> horz_angles, const array_view<float> candelas) const {
+		assert(horz_angles.size() == vert_angles.size() && candelas.size() == vert_angles.size() && "The arrays must have the same size");
+		const auto count = std::min({ vert_angles.size(), horz_angles.size(), candelas.size() });
+
+#if defined(IES_RESCALE_X86)
+		// The binary search doesn't vectorize, so those axes are sampled one direction at a time
+		if (active_simd_level() >= simd_level::avx2 && data_.vert.mode != sampler_axis::lookup::search && data_.horz.mode != sampler_axis::lookup::search) {
+			ie_sample_avx2(data_, vert_angles.data(), horz_angles.data(), candelas.data(), count);
+			return;
+		}
+#endif
+
+		for (auto j = std::size_t{ 0 }; j < count; ++j) {
+			candelas[j] = ie_sample(data_, vert_angles[j], horz_angles[j]);
+		}
+	}
+
+} // namespace ies_rescale
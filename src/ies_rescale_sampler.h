@@ -0,0 +1,117 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_SAMPLER_H
+#define IES_RESCALE_SAMPLER_H
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	namespace detail {
+		//! An angle axis of a candela_sampler, along with what's needed to find the interval holding an angle in O(1) when possible
+		struct sampler_axis {
+			enum class lookup {
+				uniform,					// Evenly spaced angles: the interval is computed directly
+				buckets,					// The axis is split into buckets no wider than the narrowest interval, each mapped to the interval it starts in
+				search,						// Binary search (e.g. with repeated angles)
+			};
+
+			std::vector<float> angles;		// At least 2 non-decreasing angles
+			std::vector<float> inv_widths;	// The inverse widths of the intervals (0 for empty intervals)
+			std::vector<int32_t> buckets;	// The interval each bucket starts in
+			float first = 0.f;
+			float last = 0.f;
+			float inv_step = 0.f;			// The inverse of the angle step or of the bucket width
+			lookup mode = lookup::search;
+		};
+
+		//! How the directions outside of the horizontal range of a profile map onto it
+		enum class horz_symmetry {
+			none,							// The angles are clamped to the range
+			rotational,						// A single horizontal angle: the profile is the same in all planes
+			mirror,							// Type A and B with the range starting at 0: symmetric about the 0 degree plane
+			full,							// Type C over the full circle: the angles wrap around
+			bilateral_0_180,				// Type C over [0, 180]: symmetric about the 0-180 degree plane
+			bilateral_90_270,				// Type C over [90, 270]: symmetric about the 90-270 degree plane
+			quadrant,						// Type C over [0, 90]: symmetric about both planes
+		};
+
+		//! Everything the sampling kernels read
+		struct sampler_data {
+			sampler_axis vert;
+			sampler_axis horz;
+			horz_symmetry horz_folding = horz_symmetry::none;
+			bool vert_mirror = false;		// Type A and B with the vertical range starting at 0: symmetric about the horizontal plane
+			std::size_t stride = 0;			// The number of values per horizontal angle
+			std::vector<float> candelas;	// One row of vertical angle values per horizontal angle
+		};
+	}
+
+	//! Evaluates the candela values of a profile in arbitrary directions, by bilinear interpolation of its grid.
+	//! The directions are given as the photometric angles of the profile's goniometer type (for Type C, the vertical angle from the nadir
+	//! and the horizontal angle around the vertical axis), and the symmetries the profile's angle ranges imply are unfolded, so that any
+	//! horizontal angle can be sampled. The directions outside of the vertical range of the profile have no intensity.
+	//! The sampler keeps its own copy of the grid, so it doesn't refer to the data it was made from. The values are returned as stored
+	//! in the grid, i.e. without applying the lamp multiplier.
+	class candela_sampler {
+	public:
+		//! Make a sampler of the specified photometric data
+		//! \return			std::optional<candela_sampler>
+		//!         The sampler on success or an empty object on failure (i.e. if the grid is empty or inconsistent, or the angles aren't sorted)
+		static auto create(const IE_Data::Photo& photo) -> std::optional<candela_sampler>;
+
+		//! Make a sampler of a grid given as views (e.g. of a binary_profile_view)
+		static auto create(const IE_Data::Photo::IE_Gonio_Type gonio_type, const array_view<const float> vert_angles, const array_view<const float> horz_angles,
+			const candela_matrix_view candelas) -> std::optional<candela_sampler>;
+
+		//! Evaluate the candela value in the specified direction
+		//! \param[in]		vert_angle			The vertical angle in degrees
+		//! \param[in]		horz_angle			The horizontal angle in degrees
+		auto sample(const float vert_angle, const float horz_angle) const -> float;
+
+		//! Evaluate the candela values in many directions at once, with the widest SIMD instruction set available (see set_simd_level())
+		//! \param[in]		vert_angles			The vertical angles in degrees
+		//! \param[in]		horz_angles			The horizontal angles in degrees (as many as the vertical angles)
+		//! \param[out]	candelas			The candela values (as many as the vertical angles)
+		void sample(const array_view<const float> vert_angles, const array_view<const float> horz_angles, const array_view<float> candelas) const;
+
+		//! The lookups the axes use, mostly for testing
+		auto vert_lookup() const -> detail::sampler_axis::lookup { return data_.vert.mode; }
+		auto horz_lookup() const -> detail::sampler_axis::lookup { return data_.horz.mode; }
+		auto horz_folding() const -> detail::horz_symmetry { return data_.horz_folding; }
+
+	private:
+		candela_sampler() = default;
+
+		detail::sampler_data data_;
+	};
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_SAMPLER_H
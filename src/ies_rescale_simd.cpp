@@ -0,0 +1,289 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <atomic>
+#include <algorithm>
+
+#include "ies_rescale.h"
+#include "ies_rescale_simd.h"
+
+namespace ies_rescale {
+
+	namespace detail {
+		void rescale_row_scalar(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size) {
+			for (auto j = std::size_t{ 0 }; j < size; ++j) {
+				const auto candela = candelas[j];
+
+				// If the candela value is 0, there's no need to rescale it.
+				if (candela > 0.f) {
+					scaled_candelas[j] = candela * scales[j];
+					rescaled[j] = ~uint32_t{ 0 };
+				}
+				else {
+					scaled_candelas[j] = candela;
+				}
+			}
+		}
+
+		auto weighted_sum_scalar(const float* values, const float* weights, const std::size_t size) -> float {
+			auto sum = 0.f;
+			for (auto j = std::size_t{ 0 }; j < size; ++j) {
+				sum += values[j] * weights[j];
+			}
+			return sum;
+		}
+
+#if defined(IES_RESCALE_X86)
+		IES_RESCALE_TARGET("sse4.2")
+		static void rescale_row_sse4_2(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size) {
+			const auto zero = _mm_setzero_ps();
+
+			auto j = std::size_t{ 0 };
+			for (; j + 4 <= size; j += 4) {
+				const auto candela = _mm_loadu_ps(candelas + j);
+				const auto is_positive = _mm_cmpgt_ps(candela, zero);
+				const auto scaled = _mm_mul_ps(candela, _mm_loadu_ps(scales + j));
+				_mm_storeu_ps(scaled_candelas + j, _mm_blendv_ps(candela, scaled, is_positive));
+
+				const auto flags = _mm_loadu_ps(reinterpret_cast<const float*>(rescaled + j));
+				_mm_storeu_ps(reinterpret_cast<float*>(rescaled + j), _mm_or_ps(flags, is_positive));
+			}
+
+			rescale_row_scalar(candelas + j, scaled_candelas + j, scales + j, rescaled + j, size - j);
+		}
+
+		IES_RESCALE_TARGET("avx2")
+		static void rescale_row_avx2(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size) {
+			const auto zero = _mm256_setzero_ps();
+
+			auto j = std::size_t{ 0 };
+			for (; j + 8 <= size; j += 8) {
+				const auto candela = _mm256_loadu_ps(candelas + j);
+				const auto is_positive = _mm256_cmp_ps(candela, zero, _CMP_GT_OQ);
+				const auto scaled = _mm256_mul_ps(candela, _mm256_loadu_ps(scales + j));
+				_mm256_storeu_ps(scaled_candelas + j, _mm256_blendv_ps(candela, scaled, is_positive));
+
+				const auto flags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rescaled + j));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(rescaled + j), _mm256_or_si256(flags, _mm256_castps_si256(is_positive)));
+			}
+
+			rescale_row_scalar(candelas + j, scaled_candelas + j, scales + j, rescaled + j, size - j);
+		}
+
+		IES_RESCALE_TARGET("avx512f")
+		static void rescale_row_avx512(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size) {
+			const auto zero = _mm512_setzero_ps();
+			const auto all_set = _mm512_set1_epi32(-1);
+
+			for (auto j = std::size_t{ 0 }; j < size; j += 16) {
+				// The tail is handled with masked loads and stores
+				const auto lanes = static_cast<__mmask16>(size - j >= 16 ? 0xFFFF : (1u << (size - j)) - 1);
+
+				const auto candela = _mm512_maskz_loadu_ps(lanes, candelas + j);
+				const auto is_positive = _mm512_mask_cmp_ps_mask(lanes, candela, zero, _CMP_GT_OQ);
+				const auto scaled = _mm512_mask_mul_ps(candela, is_positive, candela, _mm512_maskz_loadu_ps(lanes, scales + j));
+				_mm512_mask_storeu_ps(scaled_candelas + j, lanes, scaled);
+
+				_mm512_mask_storeu_epi32(rescaled + j, is_positive, all_set);
+			}
+		}
+
+		IES_RESCALE_TARGET("sse4.2")
+		static auto weighted_sum_sse4_2(const float* values, const float* weights, const std::size_t size) -> float {
+			auto sum = _mm_setzero_ps();
+
+			auto j = std::size_t{ 0 };
+			for (; j + 4 <= size; j += 4) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(values + j), _mm_loadu_ps(weights + j)));
+			}
+
+			sum = _mm_hadd_ps(sum, sum);
+			sum = _mm_hadd_ps(sum, sum);
+			return _mm_cvtss_f32(sum) + weighted_sum_scalar(values + j, weights + j, size - j);
+		}
+
+		IES_RESCALE_TARGET("avx2,fma")
+		static auto weighted_sum_avx2(const float* values, const float* weights, const std::size_t size) -> float {
+			// Two accumulators hide the latency of the FMAs
+			auto sum0 = _mm256_setzero_ps();
+			auto sum1 = _mm256_setzero_ps();
+
+			auto j = std::size_t{ 0 };
+			for (; j + 16 <= size; j += 16) {
+				sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(values + j), _mm256_loadu_ps(weights + j), sum0);
+				sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(values + j + 8), _mm256_loadu_ps(weights + j + 8), sum1);
+			}
+			if (j + 8 <= size) {
+				sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(values + j), _mm256_loadu_ps(weights + j), sum0);
+				j += 8;
+			}
+
+			const auto sum = _mm256_add_ps(sum0, sum1);
+			auto half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+			half = _mm_hadd_ps(half, half);
+			half = _mm_hadd_ps(half, half);
+			return _mm_cvtss_f32(half) + weighted_sum_scalar(values + j, weights + j, size - j);
+		}
+
+		IES_RESCALE_TARGET("avx512f")
+		static auto weighted_sum_avx512(const float* values, const float* weights, const std::size_t size) -> float {
+			auto sum = _mm512_setzero_ps();
+
+			for (auto j = std::size_t{ 0 }; j < size; j += 16) {
+				// The tail is handled with masked loads
+				const auto lanes = static_cast<__mmask16>(size - j >= 16 ? 0xFFFF : (1u << (size - j)) - 1);
+				sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(lanes, values + j), _mm512_maskz_loadu_ps(lanes, weights + j), sum);
+			}
+
+			// Reduce by halves, extracting them with an explicit (zero) pass-through: the unmasked extracts, which _mm512_reduce_add_ps
+			// and _mm512_castps512_ps256 use, start from an undefined register that trips -Wuninitialized in GCC 12
+			const auto sum_pd = _mm512_castps_pd(sum);
+			const auto low = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xFF, sum_pd, 0));
+			const auto high = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xFF, sum_pd, 1));
+			const auto half = _mm256_add_ps(low, high);
+			auto quarter = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+			quarter = _mm_hadd_ps(quarter, quarter);
+			quarter = _mm_hadd_ps(quarter, quarter);
+			return _mm_cvtss_f32(quarter);
+		}
+
+		static auto detect_simd_level() -> simd_level {
+#	if defined(_MSC_VER) && !defined(__clang__)
+			int info[4] = {};
+			__cpuid(info, 0);
+			const auto max_leaf = info[0];
+
+			__cpuid(info, 1);
+			const auto has_sse4_2 = (info[2] & (1 << 20)) != 0;
+			const auto has_osxsave = (info[2] & (1 << 27)) != 0;
+			const auto has_avx = (info[2] & (1 << 28)) != 0;
+			const auto has_fma = (info[2] & (1 << 12)) != 0;
+
+			// Make sure the OS saves the AVX (and AVX-512) registers on context switches
+			const auto xcr0 = has_osxsave ? _xgetbv(0) : 0;
+			const auto os_avx = (xcr0 & 0x6) == 0x6;
+			const auto os_avx512 = (xcr0 & 0xE6) == 0xE6;
+
+			auto has_avx2 = false;
+			auto has_avx512 = false;
+			if (max_leaf >= 7) {
+				__cpuidex(info, 7, 0);
+				has_avx2 = (info[1] & (1 << 5)) != 0;
+				has_avx512 = (info[1] & (1 << 16)) != 0;
+			}
+
+			// The AVX2 kernels use FMA, which a few CPUs (and VMs) don't report along with AVX2, and the higher levels include the lower ones
+			if (has_avx512 && has_avx2 && has_fma && os_avx512) {
+				return simd_level::avx512;
+			}
+			if (has_avx && has_avx2 && has_fma && os_avx) {
+				return simd_level::avx2;
+			}
+			if (has_sse4_2) {
+				return simd_level::sse4_2;
+			}
+#	else
+			__builtin_cpu_init();
+
+			const auto has_avx2_fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+			if (__builtin_cpu_supports("avx512f") && has_avx2_fma) {
+				return simd_level::avx512;
+			}
+			if (has_avx2_fma) {
+				return simd_level::avx2;
+			}
+			if (__builtin_cpu_supports("sse4.2")) {
+				return simd_level::sse4_2;
+			}
+#	endif
+			return simd_level::scalar;
+		}
+#else
+		static auto detect_simd_level() -> simd_level {
+			return simd_level::scalar;
+		}
+#endif
+
+		static auto get_kernel(const simd_level level) -> rescale_row_fn {
+			switch (level) {
+#if defined(IES_RESCALE_X86)
+			case simd_level::avx512:
+				return rescale_row_avx512;
+
+			case simd_level::avx2:
+				return rescale_row_avx2;
+
+			case simd_level::sse4_2:
+				return rescale_row_sse4_2;
+#endif
+			default:
+				return rescale_row_scalar;
+			}
+		}
+
+		static auto get_weighted_sum(const simd_level level) -> weighted_sum_fn {
+			switch (level) {
+#if defined(IES_RESCALE_X86)
+			case simd_level::avx512:
+				return weighted_sum_avx512;
+
+			case simd_level::avx2:
+				return weighted_sum_avx2;
+
+			case simd_level::sse4_2:
+				return weighted_sum_sse4_2;
+#endif
+			default:
+				return weighted_sum_scalar;
+			}
+		}
+
+		static auto active_level() -> std::atomic<simd_level>& {
+			static auto level = std::atomic<simd_level>{ supported_simd_level() };
+			return level;
+		}
+
+		auto get_rescale_row_kernel() -> rescale_row_fn {
+			return get_kernel(active_level().load(std::memory_order_relaxed));
+		}
+
+		auto get_weighted_sum_kernel() -> weighted_sum_fn {
+			return get_weighted_sum(active_level().load(std::memory_order_relaxed));
+		}
+	}
+
+	auto supported_simd_level() -> simd_level {
+		static const auto level = detail::detect_simd_level();
+		return level;
+	}
+
+	auto active_simd_level() -> simd_level {
+		return detail::active_level().load(std::memory_order_relaxed);
+	}
+
+	auto set_simd_level(const simd_level level) -> simd_level {
+		const auto clamped_level = std::min(level, supported_simd_level());
+		detail::active_level().store(clamped_level, std::memory_order_relaxed);
+		return clamped_level;
+	}
+
+} // namespace ies_rescale
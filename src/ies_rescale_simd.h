@@ -0,0 +1,79 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Internal header: the vectorized kernels used by the rescale and photometry functions, and the macros the kernels are compiled with.
+
+#ifndef IES_RESCALE_SIMD_H
+#define IES_RESCALE_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#	define IES_RESCALE_X86
+#	include <immintrin.h>
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#	endif
+#endif
+
+// MSVC allows using any intrinsics in any function, while GCC and Clang require the functions using them to be compiled for the respective target.
+#if defined(IES_RESCALE_X86) && (defined(__GNUC__) || defined(__clang__))
+#	define IES_RESCALE_TARGET(isa) __attribute__((target(isa)))
+#else
+#	define IES_RESCALE_TARGET(isa)
+#endif
+
+namespace ies_rescale {
+
+	namespace detail {
+		//! Rescale one row of candela values: every positive value is multiplied by the scale of its vertical angle, while the other values are left unchanged.
+		//! The vertical angles that had at least one positive value are flagged in #rescaled (all bits set), which is accumulated over all the rows of a profile.
+		//! \param[in]		candelas			The candela values to rescale
+		//! \param[out]	scaled_candelas		The rescaled candela values (may be the same array as #candelas)
+		//! \param[in]		scales				The per-vertical-angle candela scales
+		//! \param[in,out]	rescaled			The per-vertical-angle flags
+		//! \param[in]		size				The number of values in the row
+		using rescale_row_fn = void (*)(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size);
+
+		//! Get the rescale kernel for the currently active SIMD level
+		auto get_rescale_row_kernel() -> rescale_row_fn;
+
+		//! The scalar reference implementation of the rescale kernel
+		void rescale_row_scalar(const float* candelas, float* scaled_candelas, const float* scales, uint32_t* rescaled, const std::size_t size);
+
+		//! Compute the weighted sum of one row of candela values, i.e. the dot product of the values and the weights
+		//! \param[in]		values				The candela values
+		//! \param[in]		weights				The weights of the values
+		//! \param[in]		size				The number of values in the row
+		using weighted_sum_fn = float (*)(const float* values, const float* weights, const std::size_t size);
+
+		//! Get the weighted sum kernel for the currently active SIMD level
+		auto get_weighted_sum_kernel() -> weighted_sum_fn;
+
+		//! The scalar reference implementation of the weighted sum kernel
+		auto weighted_sum_scalar(const float* values, const float* weights, const std::size_t size) -> float;
+	}
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_SIMD_H
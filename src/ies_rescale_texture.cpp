@@ -0,0 +1,269 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cstring>
+
+#include "ies_rescale_texture.h"
+#include "ies_rescale_sampler.h"
+#include "ies_rescale_batch.h"
+
+namespace ies_rescale {
+
+	auto texel_size(const texel_format format) -> std::size_t {
+		switch (format) {
+		case texel_format::float32:
+			return 4;
+		case texel_format::float16:
+			return 2;
+		case texel_format::unorm8:
+			return 1;
+		}
+
+		return 0;
+	}
+
+	auto float_to_half(const float value) -> uint16_t {
+		auto bits = uint32_t{ 0 };
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+		const auto exponent = static_cast<int>((bits >> 23) & 0xFF);
+		auto mantissa = bits & 0x7FFFFF;
+
+		// Infinities and NaNs (keeping NaNs quiet)
+		if (exponent == 0xFF) {
+			return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 | (mantissa >> 13) : 0));
+		}
+
+		const auto half_exponent = exponent - 127 + 15;
+		if (half_exponent >= 31) {
+			return static_cast<uint16_t>(sign | 0x7C00);
+		}
+
+		if (half_exponent <= 0) {
+			// Subnormal half floats, or zero once the value is too small for them
+			if (half_exponent < -10) {
+				return sign;
+			}
+
+			mantissa |= 0x800000;
+			const auto shift = static_cast<uint32_t>(14 - half_exponent);
+			auto half_mantissa = mantissa >> shift;
+			const auto remainder = mantissa & ((1u << shift) - 1);
+			const auto halfway = 1u << (shift - 1);
+			if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+				++half_mantissa;
+			}
+			return static_cast<uint16_t>(sign | half_mantissa);
+		}
+
+		// A carry out of the mantissa rounds up into the exponent, which is still the correctly rounded result
+		auto half = static_cast<uint32_t>(sign | (half_exponent << 10) | (mantissa >> 13));
+		const auto remainder = mantissa & 0x1FFF;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+			++half;
+		}
+		return static_cast<uint16_t>(half);
+	}
+
+	auto half_to_float(const uint16_t value) -> float {
+		const auto sign = static_cast<uint32_t>(value & 0x8000) << 16;
+		auto exponent = static_cast<uint32_t>((value >> 10) & 0x1F);
+		auto mantissa = static_cast<uint32_t>(value & 0x3FF);
+
+		auto bits = uint32_t{ 0 };
+		if (exponent == 0x1F) {
+			bits = sign | 0x7F800000 | (mantissa << 13);
+		}
+		else if (exponent != 0) {
+			bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+		}
+		else if (mantissa != 0) {
+			// Normalize the subnormal half float
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400)) {
+				mantissa <<= 1;
+				--exponent;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+		else {
+			bits = sign;
+		}
+
+		auto result = 0.f;
+		std::memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	static void ie_store_texels(const float* values, const std::size_t count, const texel_format format, uint8_t* texels) {
+		switch (format) {
+		case texel_format::float32:
+			std::memcpy(texels, values, count * sizeof(float));
+			break;
+
+		case texel_format::float16:
+			for (auto i = std::size_t{ 0 }; i < count; ++i) {
+				const auto half = float_to_half(values[i]);
+				std::memcpy(texels + 2 * i, &half, sizeof(half));
+			}
+			break;
+
+		case texel_format::unorm8:
+			for (auto i = std::size_t{ 0 }; i < count; ++i) {
+				texels[i] = static_cast<uint8_t>(std::lround(std::min(std::max(values[i], 0.f), 1.f) * 255.f));
+			}
+			break;
+		}
+	}
+
+	// Evenly spaced angles from min to max, both included
+	static auto ie_texel_angles(const std::size_t count, const float min_angle, const float max_angle) -> std::vector<float> {
+		auto angles = std::vector<float>(count, min_angle);
+		for (auto i = std::size_t{ 1 }; i < count; ++i) {
+			angles[i] = min_angle + (max_angle - min_angle) * static_cast<float>(i) / static_cast<float>(count - 1);
+		}
+		return angles;
+	}
+
+	// Sample the rows of the texture (one per horizontal angle) on a thread pool, handing each row of scaled intensities over to #store_row
+	template <typename StoreRow>
+	static void ie_bake_rows(const candela_sampler& sampler, const std::vector<float>& vert_angles, const std::vector<float>& horz_angles, const float value_scale,
+		const std::size_t num_threads, const StoreRow& store_row) {
+		const auto threads = std::clamp<std::size_t>(num_threads > 0 ? num_threads : std::size_t{ std::thread::hardware_concurrency() }, 1, horz_angles.size());
+
+		// A few tasks per thread balance the load without making the tasks too small
+		const auto rows_per_task = std::max<std::size_t>(horz_angles.size() / (threads * 4), 1);
+
+		auto bake = [&](const std::size_t first_row, const std::size_t last_row) {
+			auto row_horz_angles = std::vector<float>(vert_angles.size());
+			auto values = std::vector<float>(vert_angles.size());
+			for (auto row = first_row; row < last_row; ++row) {
+				std::fill(row_horz_angles.begin(), row_horz_angles.end(), horz_angles[row]);
+				sampler.sample(vert_angles, row_horz_angles, values);
+				for (auto& value : values) {
+					value *= value_scale;
+				}
+				store_row(row, values);
+			}
+		};
+
+		if (threads == 1) {
+			bake(0, horz_angles.size());
+			return;
+		}
+
+		auto pool = work_stealing_pool{ threads };
+		for (auto first_row = std::size_t{ 0 }; first_row < horz_angles.size(); first_row += rows_per_task) {
+			pool.submit([&bake, &horz_angles, first_row, rows_per_task] {
+				bake(first_row, std::min(first_row + rows_per_task, horz_angles.size()));
+			});
+		}
+		pool.wait();
+	}
+
+	// Set up the sampler and the scale of a bake
+	static auto ie_prepare_bake(const IE_Data& data, const texture_options& options, baked_texture& texture, float& value_scale) -> std::optional<candela_sampler> {
+		if (options.width == 0 || options.height == 0) {
+			return {};
+		}
+
+		auto sampler = candela_sampler::create(data.photo);
+		if (!sampler) {
+			return {};
+		}
+
+		// The bilinear interpolation never exceeds the peak of the grid, so normalizing by it keeps the values in [0, 1]
+		const auto values = data.photo.candelas.values();
+		const auto peak = std::max(*std::max_element(values.begin(), values.end()) * data.lamp.multiplier, 0.f);
+		const auto normalize = (options.normalize || options.format == texel_format::unorm8) && peak > 0.f;
+
+		texture.format = options.format;
+		texture.scale = normalize ? peak : 1.f;
+		value_scale = normalize ? data.lamp.multiplier / peak : data.lamp.multiplier;
+
+		return sampler;
+	}
+
+	auto bake_texture(const IE_Data& data, const texture_options& options) -> std::optional<baked_texture> {
+		auto texture = baked_texture{};
+		auto value_scale = 1.f;
+		const auto sampler = ie_prepare_bake(data, options, texture, value_scale);
+		if (!sampler) {
+			return {};
+		}
+
+		texture.width = options.width;
+		texture.height = options.height;
+		texture.texels.resize(texture.height * texture.row_pitch());
+
+		const auto vert_angles = ie_texel_angles(options.width, options.vert_angle_min, options.vert_angle_max);
+		const auto horz_angles = ie_texel_angles(options.height, options.horz_angle_min, options.horz_angle_max);
+
+		ie_bake_rows(*sampler, vert_angles, horz_angles, value_scale, options.num_threads, [&texture](const std::size_t row, const std::vector<float>& values) {
+			ie_store_texels(values.data(), values.size(), texture.format, texture.texels.data() + row * texture.row_pitch());
+		});
+
+		return texture;
+	}
+
+	auto bake_radial_profile(const IE_Data& data, const texture_options& options) -> std::optional<baked_texture> {
+		auto texture = baked_texture{};
+		auto value_scale = 1.f;
+		const auto sampler = ie_prepare_bake(data, options, texture, value_scale);
+		if (!sampler) {
+			return {};
+		}
+
+		texture.width = options.width;
+		texture.height = 1;
+
+		const auto vert_angles = ie_texel_angles(options.width, options.vert_angle_min, options.vert_angle_max);
+		auto horz_angles = std::vector<float>(options.height);
+		for (auto i = std::size_t{ 0 }; i < horz_angles.size(); ++i) {
+			horz_angles[i] = options.horz_angle_min + (options.horz_angle_max - options.horz_angle_min) * (static_cast<float>(i) + 0.5f) / static_cast<float>(horz_angles.size());
+		}
+
+		// Bake all the rows before averaging them, so that the average doesn't depend on the order the threads finish in
+		auto rows = std::vector<float>(horz_angles.size() * vert_angles.size());
+		ie_bake_rows(*sampler, vert_angles, horz_angles, value_scale / static_cast<float>(horz_angles.size()), options.num_threads, [&rows](const std::size_t row, const std::vector<float>& values) {
+			std::copy(values.begin(), values.end(), rows.begin() + row * values.size());
+		});
+
+		auto average = std::vector<float>(vert_angles.size(), 0.f);
+		for (auto row = std::size_t{ 0 }; row < horz_angles.size(); ++row) {
+			for (auto i = std::size_t{ 0 }; i < average.size(); ++i) {
+				average[i] += rows[row * average.size() + i];
+			}
+		}
+
+		texture.texels.resize(texture.row_pitch());
+		ie_store_texels(average.data(), average.size(), texture.format, texture.texels.data());
+
+		return texture;
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,90 @@
+// MIT License
+//
+// Copyright(c) 2023 Lev Faynshteyn
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef IES_RESCALE_TEXTURE_H
+#define IES_RESCALE_TEXTURE_H
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! The texel formats of the baked textures
+	enum class texel_format {
+		float32,		// 32-bit floats
+		float16,		// IEEE 754 half floats
+		unorm8,			// 8-bit normalized integers (always normalized, see texture_options::normalize)
+	};
+
+	//! The size of a texel of the specified format in bytes
+	auto texel_size(const texel_format format) -> std::size_t;
+
+	//! Parameters of a texture bake
+	struct texture_options {
+		std::size_t width = 256;				// The number of texels along the vertical angles
+		std::size_t height = 256;				// The number of texels along the horizontal angles (or of horizontal angles averaged by a radial profile)
+		texel_format format = texel_format::float16;
+		bool normalize = true;					// Whether to divide the values by the peak intensity of the profile, so that they lie in [0, 1]
+		float vert_angle_min = 0.f;				// The vertical angles covered by the texture, from the first texel centre to the last one
+		float vert_angle_max = 180.f;
+		float horz_angle_min = 0.f;				// The horizontal angles covered by the texture, from the first texel centre to the last one
+		float horz_angle_max = 360.f;
+		std::size_t num_threads = 0;			// The number of threads baking the rows (0 means one per hardware thread)
+	};
+
+	//! A baked texture: row-major texels, one row per horizontal angle
+	struct baked_texture {
+		std::size_t width = 0;
+		std::size_t height = 0;
+		texel_format format = texel_format::float32;
+		float scale = 1.f;						// The intensity in candelas a texel value of 1 stands for (i.e. the peak intensity if normalized)
+		std::vector<uint8_t> texels;
+
+		auto row_pitch() const -> std::size_t { return width * texel_size(format); }
+		auto row(const std::size_t i) const -> const uint8_t* { return texels.data() + i * row_pitch(); }
+	};
+
+	//! Convert a float to an IEEE 754 half float (rounding to nearest even)
+	auto float_to_half(const float value) -> uint16_t;
+
+	//! Convert an IEEE 754 half float to a float
+	auto half_to_float(const uint16_t value) -> float;
+
+	//! Bake the intensities of a profile into a 2D lookup texture, with the vertical angles along the rows and the horizontal angles down the columns.
+	//! The profile is sampled bilinearly (see candela_sampler) at the texel centres, and the lamp multiplier is applied.
+	//! \param[in]		data							The IES data (e.g. the output of rescale_ies_data())
+	//! \param[in]		options							The bake parameters
+	//! \return			std::optional<baked_texture>	The texture on success or an empty object on failure (i.e. invalid data or options)
+	auto bake_texture(const IE_Data& data, const texture_options& options = {}) -> std::optional<baked_texture>;
+
+	//! Bake the intensities of a profile into a 1D radial profile along the vertical angles, i.e. a texture of one row, each texel of which
+	//! averages the intensities at options.height horizontal angles: the centres of equal sectors of [options.horz_angle_min, options.horz_angle_max].
+	auto bake_radial_profile(const IE_Data& data, const texture_options& options = {}) -> std::optional<baked_texture>;
+
+} // namespace ies_rescale
+
+#endif // IES_RESCALE_TEXTURE_H
@@ -0,0 +1,173 @@
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+#include "ies_profile_generator.h"
+
+namespace ies_rescale {
+
+	namespace {
+		// SplitMix64: a tiny, well-distributed and above all platform-independent generator (unlike the std distributions)
+		class splitmix64 {
+		public:
+			explicit splitmix64(const uint64_t seed) : state_(seed) {}
+
+			auto next() -> uint64_t {
+				auto z = (state_ += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				return z ^ (z >> 31);
+			}
+
+			//! A uniform value in [0, 1)
+			auto next_unit() -> double {
+				return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+			}
+
+		private:
+			uint64_t state_;
+		};
+
+		constexpr auto pi = 3.14159265358979323846;
+
+		// Round to a multiple of 0.01. The single float division makes the result the float closest to the 2-decimal value, which is exactly what parsing its text gives back.
+		auto quantize(const double value) -> float {
+			return static_cast<float>(std::llround(value * 100.0)) / 100.f;
+		}
+
+		// num_angles uniformly spaced angles from first to last (or just first, if there's a single one)
+		auto make_angles(const int num_angles, const double first, const double last) -> std::vector<float> {
+			auto angles = std::vector<float>(static_cast<std::size_t>(num_angles));
+			for (auto i = 0; i < num_angles; ++i) {
+				angles[i] = quantize(num_angles > 1 ? first + (last - first) * i / (num_angles - 1) : first);
+			}
+			return angles;
+		}
+	}
+
+	auto generate_ies_profile(const synthetic_profile_options& options) -> IE_Data {
+		assert(options.num_vert_angles > 0 && options.num_horz_angles > 0 && "The grid can't be empty");
+		assert(options.format != IE_Data::File::Format::IESNA_86 && "LM-63-1986 profiles don't round-trip");
+
+		auto random = splitmix64{ options.seed };
+
+		auto data = IE_Data{};
+		data.file.format = options.format;
+		data.labels = {
+			"[TEST] Synthetic profile " + std::to_string(options.num_vert_angles) + "x" + std::to_string(options.num_horz_angles) + ", seed " + std::to_string(options.seed),
+			"[MANUFAC] ies_rescale",
+			"[LUMCAT] SYNTH-" + std::to_string(static_cast<int>(options.gonio_type)),
+		};
+
+		data.lamp.num_lamps = 1;
+		data.lamp.lumens_lamp = quantize(1000.0 + 4000.0 * random.next_unit());
+		data.lamp.multiplier = 1.f;
+
+		switch (options.tilt) {
+		case synthetic_profile_options::tilt_mode::none:
+			data.lamp.tilt_fname = "NONE";
+			break;
+
+		case synthetic_profile_options::tilt_mode::include:
+			data.lamp.tilt_fname = "INCLUDE";
+			break;
+
+		case synthetic_profile_options::tilt_mode::file:
+			data.lamp.tilt_fname = options.tilt_fname;
+			break;
+		}
+
+		if (options.tilt != synthetic_profile_options::tilt_mode::none) {
+			// The lamp output drops off as the lamp is tilted away from its design position
+			data.lamp.tilt.orientation = options.tilt_orientation;
+			data.lamp.tilt.num_pairs = options.num_tilt_pairs;
+			data.lamp.tilt.angles = make_angles(options.num_tilt_pairs, 0.0, 90.0);
+			for (const auto angle : data.lamp.tilt.angles) {
+				data.lamp.tilt.mult_factors.push_back(quantize(1.0 - 0.3 * std::sin(angle * pi / 180.0)));
+			}
+		}
+
+		data.units = IE_Data::Units::Meters;
+		data.dim = { quantize(0.05 + 0.5 * random.next_unit()), quantize(0.05 + 0.5 * random.next_unit()), quantize(0.1 * random.next_unit()) };
+		data.elec = { 1.f, 1.f, quantize(5.0 + 95.0 * random.next_unit()) };
+
+		auto& photo = data.photo;
+		photo.gonio_type = options.gonio_type;
+		photo.num_vert_angles = options.num_vert_angles;
+		photo.num_horz_angles = options.num_horz_angles;
+
+		// The direction of the beam, i.e. the vertical angle of the peak intensity, and the angle at which it fades out
+		auto beam_angle = 0.0;
+		auto cutoff_angle = 0.0;
+		if (options.gonio_type == IE_Data::Photo::IE_Gonio_Type::Type_C) {
+			photo.vert_angles = make_angles(options.num_vert_angles, 0.0, 180.0);
+			photo.horz_angles = make_angles(options.num_horz_angles, 0.0, 360.0);
+			cutoff_angle = 120.0 + 40.0 * random.next_unit();
+		}
+		else {
+			// Types A and B measure from the horizontal plane, so a floodlight aims at 0 degrees
+			photo.vert_angles = make_angles(options.num_vert_angles, -90.0, 90.0);
+			photo.horz_angles = make_angles(options.num_horz_angles, -90.0, 90.0);
+			cutoff_angle = 60.0 + 25.0 * random.next_unit();
+		}
+
+		const auto peak = 500.0 + 9500.0 * random.next_unit();
+		const auto spread = 0.5 + random.next_unit();
+		const auto asymmetry = 0.3 * random.next_unit();
+
+		photo.candelas = candela_matrix(static_cast<std::size_t>(options.num_horz_angles), static_cast<std::size_t>(options.num_vert_angles), 0.f);
+		for (auto i = 0; i < options.num_horz_angles; ++i) {
+			const auto h = photo.horz_angles[i] * pi / 180.0;
+			auto row = photo.candelas[i];
+
+			for (auto j = 0; j < options.num_vert_angles; ++j) {
+				const auto offset = std::abs(photo.vert_angles[j] - beam_angle);
+				if (offset >= cutoff_angle) {
+					// Draw the noise anyway, so that every cell keeps the same noise value whatever the cutoff
+					random.next();
+					continue;
+				}
+
+				const auto falloff = std::pow(std::cos(0.5 * pi * offset / cutoff_angle), 1.0 + spread);
+				const auto noise = 1.0 + 0.02 * (random.next_unit() - 0.5);
+				row[j] = quantize(peak * falloff * (1.0 + asymmetry * std::cos(h)) * noise);
+			}
+		}
+
+		return data;
+	}
+
+	auto generate_tilt_text(const IE_Data::Lamp::Tilt& tilt) -> std::string {
+		// Serialize a profile with the tilt data included, and cut the tilt lines out of it
+		auto data = IE_Data{};
+		data.file.format = IE_Data::File::Format::IESNA_02;
+		data.lamp.tilt_fname = "INCLUDE";
+		data.lamp.tilt = tilt;
+
+		const auto buffer = convert_data_to_buffer(data);
+		const auto text = std::string(buffer->begin(), buffer->end());
+
+		const auto begin = text.find("TILT=INCLUDE\n") + 13;
+		auto end = begin;
+		for (auto line = 0; line < 4; ++line) {
+			end = text.find('\n', end) + 1;
+		}
+
+		return text.substr(begin, end - begin);
+	}
+
+	auto generate_ies_text(const IE_Data& data) -> std::string {
+		const auto buffer = convert_data_to_buffer(data);
+		auto text = std::string(buffer->begin(), buffer->end());
+
+		if (data.lamp.tilt_fname != "NONE" && data.lamp.tilt_fname != "INCLUDE") {
+			// Refer to the TILT file instead of including its content
+			const auto tilt_text = generate_tilt_text(data.lamp.tilt);
+			const auto begin = text.find("TILT=INCLUDE\n");
+			text.replace(begin, 13 + tilt_text.size(), "TILT=" + data.lamp.tilt_fname + "\n");
+		}
+
+		return text;
+	}
+
+} // namespace ies_rescale
@@ -0,0 +1,47 @@
+#ifndef IES_PROFILE_GENERATOR_H
+#define IES_PROFILE_GENERATOR_H
+
+#include <string>
+#include <cstdint>
+
+#include "ies_rescale.h"
+
+namespace ies_rescale {
+
+	//! Parameters of a synthetic IES profile
+	struct synthetic_profile_options {
+		//! How the TILT data is provided
+		enum class tilt_mode {
+			none,		// TILT=NONE
+			include,	// TILT=INCLUDE, followed by the TILT data
+			file,		// TILT=<tilt_fname>, with the TILT data in that file (see generate_tilt_text())
+		};
+
+		IE_Data::File::Format format = IE_Data::File::Format::IESNA_02;
+		IE_Data::Photo::IE_Gonio_Type gonio_type = IE_Data::Photo::IE_Gonio_Type::Type_C;
+		int num_vert_angles = 181;
+		int num_horz_angles = 361;
+
+		tilt_mode tilt = tilt_mode::none;
+		IE_Data::Lamp::Tilt::Orientation tilt_orientation = IE_Data::Lamp::Tilt::Orientation::LampVert;
+		int num_tilt_pairs = 7;
+		std::string tilt_fname = "synthetic_tilt.dat";
+
+		uint64_t seed = 0;	// Seeds the noise added to the candela values: the same options always generate the same profile
+	};
+
+	//! Generate a valid synthetic profile: a smooth beam with some noise over a uniform grid of the requested size, covering the full angle range of the goniometer type
+	//! (0-180 x 0-360 degrees for Type C and -90-90 x -90-90 degrees for Types A and B).
+	//! All the values are multiples of 0.01, so the profile survives a round trip through convert_data_to_buffer() and convert_stream_to_data() unchanged.
+	//! \note The LM-63-1986 format isn't supported, as the serializer writes an "IESNA86" line that parses back as a label.
+	auto generate_ies_profile(const synthetic_profile_options& options) -> IE_Data;
+
+	//! Generate the LM-63 text of the profile (unlike convert_data_to_buffer(), a TILT=<file> line is kept as is rather than replaced with the included data)
+	auto generate_ies_text(const IE_Data& data) -> std::string;
+
+	//! Generate the content of a TILT data file
+	auto generate_tilt_text(const IE_Data::Lamp::Tilt& tilt) -> std::string;
+
+} // namespace ies_rescale
+
+#endif // IES_PROFILE_GENERATOR_H
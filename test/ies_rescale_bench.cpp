@@ -0,0 +1,479 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+namespace fs = std::filesystem;
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <functional>
+#include <map>
+
+#include <benchmark/benchmark.h>
+
+#include "ies_rescale.h"
+#include "ies_rescale_binary.h"
+#include "ies_rescale_archive.h"
+#include "ies_rescale_profile_cache.h"
+#include "ies_rescale_sampler.h"
+#include "ies_rescale_texture.h"
+#include "ies_rescale_atlas.h"
+#include "ies_rescale_photometry.h"
+#include "ies_profile_generator.h"
+
+namespace {
+	const auto test_profiles_dir = std::string{ "../test/test_ies_profiles" };
+
+	// The loader that read_file_to_stream() used before switching to the mapped files: the file is pulled in
+	// one byte at a time through std::istream_iterator and then copied once more into the memstream.
+	auto read_file_to_stream_legacy(const std::string& fname) -> std::optional<ies_rescale::memstream> {
+		auto file_data = std::vector<uint8_t>{};
+		{
+			auto file = std::ifstream{ fname, std::ios::binary };
+			if (!file || !file.is_open()) {
+				return {};
+			}
+
+			file.unsetf(std::ios::skipws);
+
+			file.seekg(0, std::ios::end);
+			const auto file_size = file.tellg();
+			file.seekg(0, std::ios::beg);
+
+			file_data.reserve(file_size);
+			file_data.insert(file_data.begin(), std::istream_iterator<uint8_t>(file), std::istream_iterator<uint8_t>());
+		}
+
+		if (file_data.empty()) {
+			return {};
+		}
+
+		return std::optional<ies_rescale::memstream>{ file_data };
+	}
+
+	auto list_test_profiles() -> std::vector<fs::path> {
+		auto profiles = std::vector<fs::path>{};
+		for (const auto& entry : fs::directory_iterator(test_profiles_dir)) {
+			const auto fname = entry.path().stem().string();
+			if (entry.is_regular_file() && fname.find("_rescaled") == std::string::npos) {
+				profiles.push_back(entry.path());
+			}
+		}
+
+		std::sort(profiles.begin(), profiles.end());
+		return profiles;
+	}
+
+	void bm_read_file_legacy(benchmark::State& state, const std::string& fname) {
+		for (auto _ : state) {
+			auto stream = read_file_to_stream_legacy(fname);
+			benchmark::DoNotOptimize(stream);
+		}
+
+		state.SetBytesProcessed(state.iterations() * fs::file_size(fname));
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	void bm_read_file_to_stream(benchmark::State& state, const std::string& fname) {
+		for (auto _ : state) {
+			auto stream = ies_rescale::read_file_to_stream(fname);
+			benchmark::DoNotOptimize(stream);
+		}
+
+		state.SetBytesProcessed(state.iterations() * fs::file_size(fname));
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	auto read_file_content(const std::string& fname) -> std::string {
+		auto file = std::ifstream{ fname, std::ios::binary };
+		return std::string{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	}
+
+	auto load_profile(const std::string& fname) -> std::optional<ies_rescale::IE_Data> {
+		auto stream = ies_rescale::read_file_to_stream(fname);
+		return stream ? ies_rescale::convert_stream_to_data(*stream) : std::nullopt;
+	}
+
+	auto to_string(const ies_rescale::IE_Data& data) -> std::string {
+		const auto buffer = ies_rescale::convert_data_to_buffer(data);
+		return buffer ? std::string(buffer->begin(), buffer->end()) : std::string{};
+	}
+
+	void bm_convert_stream_to_data(benchmark::State& state, const std::string& content) {
+		auto num_candelas = std::size_t{ 0 };
+		for (auto _ : state) {
+			auto stream = ies_rescale::memstream{ std::string_view{ content } };
+			auto data = ies_rescale::convert_stream_to_data(stream);
+			num_candelas = data ? data->photo.candelas.values().size() : 0;
+			benchmark::DoNotOptimize(data);
+		}
+
+		state.SetBytesProcessed(state.iterations() * content.size());
+		state.SetItemsProcessed(state.iterations() * num_candelas);
+	}
+
+	void bm_rescale_ies_data(benchmark::State& state, const ies_rescale::IE_Data& data, const float rescale_cone_angle, const ies_rescale::rescale_mode mode) {
+		for (auto _ : state) {
+			auto scaled_data = ies_rescale::rescale_ies_data(data, rescale_cone_angle, mode);
+			benchmark::DoNotOptimize(scaled_data);
+		}
+
+		// The bytes are those of the candela values, which is where the work is
+		const auto num_candelas = data.photo.candelas.values().size();
+		state.SetBytesProcessed(state.iterations() * num_candelas * sizeof(float));
+		state.SetItemsProcessed(state.iterations() * num_candelas);
+	}
+
+	void bm_convert_data_to_buffer(benchmark::State& state, const ies_rescale::IE_Data& data) {
+		auto buffer_size = std::size_t{ 0 };
+		for (auto _ : state) {
+			auto buffer = ies_rescale::convert_data_to_buffer(data);
+			buffer_size = buffer->size();
+			benchmark::DoNotOptimize(buffer);
+		}
+
+		state.SetBytesProcessed(state.iterations() * buffer_size);
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	// Stream the profile to /dev/null, so that only the formatting and the write(2) calls are measured
+	void bm_write_ies(benchmark::State& state, const ies_rescale::IE_Data& data) {
+		auto null_file = std::ofstream{ fs::exists("/dev/null") ? "/dev/null" : "NUL", std::ios::binary };
+		auto sink = ies_rescale::ostream_sink{ null_file };
+
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(ies_rescale::write_ies(data, sink));
+		}
+
+		state.SetBytesProcessed(state.iterations() * to_string(data).size());
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	// The Type C profile with the specified number of vertical angles (and twice as many horizontal ones) for the scaling benchmarks, generated on first use
+	auto get_scaling_profile(const int num_vert_angles) -> const std::pair<ies_rescale::IE_Data, std::string>& {
+		static auto cache = std::map<int, std::pair<ies_rescale::IE_Data, std::string>>{};
+
+		auto it = cache.find(num_vert_angles);
+		if (it == cache.end()) {
+			// Keep only the profile being measured in memory, as the largest ones take hundreds of MB
+			cache.clear();
+
+			auto options = ies_rescale::synthetic_profile_options{};
+			options.num_vert_angles = num_vert_angles;
+			options.num_horz_angles = 2 * num_vert_angles - 1;
+			auto data = ies_rescale::generate_ies_profile(options);
+			auto text = to_string(data);
+			it = cache.emplace(num_vert_angles, std::make_pair(std::move(data), std::move(text))).first;
+		}
+
+		return it->second;
+	}
+
+	void bm_scaling_parse(benchmark::State& state) {
+		const auto& [data, text] = get_scaling_profile(static_cast<int>(state.range(0)));
+		for (auto _ : state) {
+			auto stream = ies_rescale::memstream{ std::string_view{ text } };
+			auto parsed_data = ies_rescale::convert_stream_to_data(stream);
+			benchmark::DoNotOptimize(parsed_data);
+		}
+
+		state.SetComplexityN(static_cast<int64_t>(data.photo.candelas.values().size()));
+		state.SetBytesProcessed(state.iterations() * text.size());
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	void bm_scaling_rescale(benchmark::State& state) {
+		const auto& data = get_scaling_profile(static_cast<int>(state.range(0))).first;
+		for (auto _ : state) {
+			auto scaled_data = ies_rescale::rescale_ies_data(data, 60.f);
+			benchmark::DoNotOptimize(scaled_data);
+		}
+
+		state.SetComplexityN(static_cast<int64_t>(data.photo.candelas.values().size()));
+		state.SetBytesProcessed(state.iterations() * data.photo.candelas.values().size() * sizeof(float));
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	void bm_scaling_serialize(benchmark::State& state) {
+		const auto& [data, text] = get_scaling_profile(static_cast<int>(state.range(0)));
+		for (auto _ : state) {
+			auto buffer = ies_rescale::convert_data_to_buffer(data);
+			benchmark::DoNotOptimize(buffer);
+		}
+
+		state.SetComplexityN(static_cast<int64_t>(data.photo.candelas.values().size()));
+		state.SetBytesProcessed(state.iterations() * text.size());
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	// Sweep the grid size from 10 degree steps up to 0.1 degree steps (1801 x 3601), fitting the time against the number of candela values to catch any super-linear behaviour
+	void register_scaling_benchmarks() {
+		for (const auto& [name, fn] : { std::pair{ "scaling/convert_stream_to_data", bm_scaling_parse }, std::pair{ "scaling/rescale_ies_data", bm_scaling_rescale }, std::pair{ "scaling/convert_data_to_buffer", bm_scaling_serialize } }) {
+			auto* benchmark = benchmark::RegisterBenchmark(name, fn);
+			for (const auto num_vert_angles : { 19, 37, 91, 181, 361, 721, 1801 }) {
+				benchmark->Arg(num_vert_angles);
+			}
+			benchmark->Complexity(benchmark::oN)->Unit(benchmark::kMillisecond);
+		}
+	}
+
+	// Validate a binary profile and view it in place, i.e. all the work a warm start does after mapping the file
+	void bm_binary_profile_view(benchmark::State& state, const std::vector<uint8_t>& binary) {
+		for (auto _ : state) {
+			auto view = ies_rescale::binary_profile_view::from_bytes(binary.data(), binary.size());
+			benchmark::DoNotOptimize(view);
+		}
+
+		state.SetBytesProcessed(state.iterations() * binary.size());
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	void bm_convert_binary_to_data(benchmark::State& state, const std::vector<uint8_t>& binary) {
+		for (auto _ : state) {
+			auto data = ies_rescale::convert_binary_to_data(binary.data(), binary.size());
+			benchmark::DoNotOptimize(data);
+		}
+
+		state.SetBytesProcessed(state.iterations() * binary.size());
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	// Get an archive of the specified number of small synthetic profiles, written to the temporary directory
+	auto get_archive(const std::size_t num_profiles) -> const ies_rescale::profile_archive& {
+		static auto cache = std::map<std::size_t, ies_rescale::profile_archive>{};
+
+		auto it = cache.find(num_profiles);
+		if (it == cache.end()) {
+			auto builder = ies_rescale::archive_builder{};
+			for (auto i = std::size_t{ 0 }; i < num_profiles; ++i) {
+				auto options = ies_rescale::synthetic_profile_options{};
+				options.num_vert_angles = 19;
+				options.num_horz_angles = 5;
+				options.seed = i;
+				builder.add("catalog/profile_" + std::to_string(i) + ".ies", ies_rescale::generate_ies_profile(options));
+			}
+
+			const auto archive_path = (fs::temp_directory_path() / ("ies_rescale_bench_" + std::to_string(num_profiles) + ".iesa")).string();
+			builder.write(archive_path);
+			it = cache.emplace(num_profiles, ies_rescale::profile_archive::open(archive_path).value()).first;
+			fs::remove(archive_path);
+		}
+
+		return it->second;
+	}
+
+	// Look up a profile by name in an archive and view it in place
+	void bm_archive_find_profile(benchmark::State& state) {
+		const auto num_profiles = static_cast<std::size_t>(state.range(0));
+		const auto& archive = get_archive(num_profiles);
+
+		auto names = std::vector<std::string>{};
+		for (auto i = std::size_t{ 0 }; i < 1024; ++i) {
+			names.push_back("catalog/profile_" + std::to_string((i * 7919) % num_profiles) + ".ies");
+		}
+
+		auto i = std::size_t{ 0 };
+		for (auto _ : state) {
+			auto view = archive.profile(names[i++ % names.size()]);
+			benchmark::DoNotOptimize(view);
+		}
+
+		state.SetComplexityN(static_cast<int64_t>(num_profiles));
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	void register_archive_benchmarks() {
+		auto* benchmark = benchmark::RegisterBenchmark("archive/find_profile", bm_archive_find_profile);
+		for (const auto num_profiles : { 64, 1024, 40960 }) {
+			benchmark->Arg(num_profiles);
+		}
+		benchmark->Complexity(benchmark::oLogN);
+	}
+
+	// Get a rescaled profile from a warm cache, i.e. the work a repeated request does instead of reading, parsing and rescaling the file
+	void bm_profile_cache_load_rescaled(benchmark::State& state, const std::string& fname) {
+		auto cache = ies_rescale::profile_cache{};
+		cache.load_rescaled(fname, 60.f);
+
+		for (auto _ : state) {
+			auto scaled_data = cache.load_rescaled(fname, 60.f);
+			benchmark::DoNotOptimize(scaled_data);
+		}
+
+		state.SetItemsProcessed(state.iterations());
+	}
+
+	// Sample a batch of pseudo-random directions over the whole sphere
+	void bm_candela_sampler(benchmark::State& state, const ies_rescale::IE_Data& data, const ies_rescale::simd_level level) {
+		const auto sampler = ies_rescale::candela_sampler::create(data.photo).value();
+
+		auto vert_angles = std::vector<float>(4096);
+		auto horz_angles = std::vector<float>(4096);
+		auto candelas = std::vector<float>(4096);
+		auto seed = uint32_t{ 1 };
+		for (auto i = std::size_t{ 0 }; i < vert_angles.size(); ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			vert_angles[i] = 180.f * static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+			seed = seed * 1664525u + 1013904223u;
+			horz_angles[i] = 360.f * static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+		}
+
+		const auto default_level = ies_rescale::active_simd_level();
+		if (ies_rescale::set_simd_level(level) != level) {
+			state.SkipWithError("The SIMD level isn't supported");
+		}
+
+		for (auto _ : state) {
+			sampler.sample(vert_angles, horz_angles, candelas);
+			benchmark::DoNotOptimize(candelas.data());
+		}
+
+		ies_rescale::set_simd_level(default_level);
+		state.SetItemsProcessed(state.iterations() * candelas.size());
+	}
+
+	// Bake a 256 x 256 half float lookup texture
+	void bm_bake_texture(benchmark::State& state, const ies_rescale::IE_Data& data, const std::size_t num_threads) {
+		auto options = ies_rescale::texture_options{};
+		options.num_threads = num_threads;
+
+		for (auto _ : state) {
+			auto texture = ies_rescale::bake_texture(data, options);
+			benchmark::DoNotOptimize(texture);
+		}
+
+		state.SetItemsProcessed(state.iterations() * options.width * options.height);
+	}
+
+	// Bake a library of profiles into a 64 x 64 float atlas
+	void bm_build_profile_atlas(benchmark::State& state, const std::vector<ies_rescale::IE_Data>& library, const std::vector<std::string>& names, const std::size_t num_threads) {
+		auto options = ies_rescale::texture_options{};
+		options.width = 64;
+		options.height = 64;
+		options.format = ies_rescale::texel_format::float32;
+		options.num_threads = num_threads;
+
+		for (auto _ : state) {
+			auto atlas = ies_rescale::build_profile_atlas(library, names, options);
+			benchmark::DoNotOptimize(atlas);
+		}
+
+		state.SetItemsProcessed(state.iterations() * library.size());
+	}
+
+	// Integrate the flux of a profile, including setting up the weights of its grid
+	void bm_luminous_flux(benchmark::State& state, const ies_rescale::IE_Data& data) {
+		for (auto _ : state) {
+			auto flux = ies_rescale::luminous_flux(data);
+			benchmark::DoNotOptimize(flux);
+		}
+
+		state.SetItemsProcessed(state.iterations() * data.photo.candelas.values().size());
+	}
+
+	// The cone angles and the modes the rescale benchmarks run with
+	constexpr float rescale_cone_angles[] = { 30.f, 90.f, 150.f };
+	constexpr std::pair<ies_rescale::rescale_mode, const char*> rescale_modes[] = {
+		{ ies_rescale::rescale_mode::foreshorten, "" },
+		{ ies_rescale::rescale_mode::preserve_intensity, "/preserve_intensity" },
+		{ ies_rescale::rescale_mode::preserve_flux, "/preserve_flux" },
+	};
+
+	// The profiles must outlive the benchmarks, which refer to them
+	auto profiles = std::vector<std::unique_ptr<const ies_rescale::IE_Data>>{};
+	auto binaries = std::vector<std::unique_ptr<const std::vector<uint8_t>>>{};
+
+	void register_profile_benchmarks(const std::string& name, const ies_rescale::IE_Data& data, const std::string& content) {
+		benchmark::RegisterBenchmark(("convert_stream_to_data/" + name).c_str(), bm_convert_stream_to_data, content);
+
+		binaries.push_back(std::make_unique<const std::vector<uint8_t>>(ies_rescale::convert_data_to_binary(data).value()));
+		benchmark::RegisterBenchmark(("binary_profile_view/" + name).c_str(), bm_binary_profile_view, std::cref(*binaries.back()));
+		benchmark::RegisterBenchmark(("convert_binary_to_data/" + name).c_str(), bm_convert_binary_to_data, std::cref(*binaries.back()));
+
+		for (const auto& [mode, mode_name] : rescale_modes) {
+			for (const auto rescale_cone_angle : rescale_cone_angles) {
+				const auto case_name = name + "/" + std::to_string(static_cast<int>(rescale_cone_angle)) + mode_name;
+				benchmark::RegisterBenchmark(("rescale_ies_data/" + case_name).c_str(), bm_rescale_ies_data, std::cref(data), rescale_cone_angle, mode);
+			}
+		}
+
+		benchmark::RegisterBenchmark(("convert_data_to_buffer/" + name).c_str(), bm_convert_data_to_buffer, std::cref(data));
+		benchmark::RegisterBenchmark(("write_ies/" + name).c_str(), bm_write_ies, std::cref(data));
+
+		for (const auto& [level_name, level] : { std::pair{ "scalar", ies_rescale::simd_level::scalar }, std::pair{ "avx2", ies_rescale::simd_level::avx2 } }) {
+			benchmark::RegisterBenchmark(("candela_sampler/" + name + "/" + level_name).c_str(), bm_candela_sampler, std::cref(data), level);
+		}
+
+		benchmark::RegisterBenchmark(("luminous_flux/" + name).c_str(), bm_luminous_flux, std::cref(data));
+
+		for (const auto num_threads : { 1, 0 }) {
+			benchmark::RegisterBenchmark(("bake_texture/" + name + (num_threads == 1 ? "/single_thread" : "")).c_str(), bm_bake_texture, std::cref(data), std::size_t(num_threads));
+		}
+	}
+
+	void register_benchmarks() {
+		for (const auto& path : list_test_profiles()) {
+			const auto fname = path.string();
+			const auto name = path.filename().string();
+
+			benchmark::RegisterBenchmark(("read_file_legacy/" + name).c_str(), bm_read_file_legacy, fname);
+			benchmark::RegisterBenchmark(("read_file_to_stream/" + name).c_str(), bm_read_file_to_stream, fname);
+
+			// The invalid profiles are only worth reading (and failing to parse)
+			auto data = load_profile(fname);
+			if (!data) {
+				benchmark::RegisterBenchmark(("convert_stream_to_data/" + name).c_str(), bm_convert_stream_to_data, read_file_content(fname));
+				continue;
+			}
+
+			profiles.push_back(std::make_unique<const ies_rescale::IE_Data>(std::move(*data)));
+			register_profile_benchmarks(name, *profiles.back(), read_file_content(fname));
+			benchmark::RegisterBenchmark(("profile_cache/load_rescaled/" + name).c_str(), bm_profile_cache_load_rescaled, fname);
+		}
+
+		// Synthetic grids: 1 and 0.5 degree steps over the full sphere
+		for (const auto& [num_vert_angles, num_horz_angles] : { std::pair{ 181, 361 }, std::pair{ 361, 721 } }) {
+			auto options = ies_rescale::synthetic_profile_options{};
+			options.num_vert_angles = num_vert_angles;
+			options.num_horz_angles = num_horz_angles;
+			profiles.push_back(std::make_unique<const ies_rescale::IE_Data>(ies_rescale::generate_ies_profile(options)));
+
+			const auto name = "synthetic_" + std::to_string(num_vert_angles) + "x" + std::to_string(num_horz_angles);
+			register_profile_benchmarks(name, *profiles.back(), to_string(*profiles.back()));
+		}
+
+		// A library of 1024 layers cycling through the profiles
+		auto library = std::vector<ies_rescale::IE_Data>{};
+		auto names = std::vector<std::string>{};
+		for (auto i = std::size_t{ 0 }; i < 1024; ++i) {
+			library.push_back(*profiles[i % profiles.size()]);
+			names.push_back("profile_" + std::to_string(i));
+		}
+		for (const auto num_threads : { 1, 0 }) {
+			benchmark::RegisterBenchmark(num_threads == 1 ? "build_profile_atlas/single_thread" : "build_profile_atlas", bm_build_profile_atlas, library, names, std::size_t(num_threads));
+		}
+
+		register_scaling_benchmarks();
+		register_archive_benchmarks();
+	}
+
+} // namespace
+
+auto main(int argc, char** argv) -> int {
+	std::cout << "ies_rescale v" << IES_RESCALE_VERSION << " benchmarks\n\n";
+
+	register_benchmarks();
+
+	::benchmark::Initialize(&argc, argv);
+	if (::benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+
+	::benchmark::RunSpecifiedBenchmarks();
+	::benchmark::Shutdown();
+
+	return 0;
+}
@@ -1,11 +1,32 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <string_view>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <cmath>
 
 #include <gtest/gtest.h>
 
 #include "ies_rescale.h"
+#include "ies_rescale_batch.h"
+#include "ies_rescale_pipeline.h"
+#include "ies_rescale_loader.h"
+#include "ies_rescale_binary.h"
+#include "ies_rescale_archive.h"
+#include "ies_rescale_result_cache.h"
+#include "ies_rescale_profile_cache.h"
+#include "ies_rescale_sampler.h"
+#include "ies_rescale_texture.h"
+#include "ies_rescale_atlas.h"
+#include "ies_rescale_photometry.h"
+#include "ies_profile_generator.h"
 
 namespace {
 	auto rescale_ies_file(const std::string_view fname_in, const std::string_view fname_out, const float rescale_cone_angle, const bool preserve_intensity) -> bool {
@@ -157,6 +178,1956 @@ namespace {
 
 	}
 
+	TEST(IesRescale, TestsOnMemory) {
+
+		using namespace ies_rescale;
+
+		const auto fname_in = std::string{ "../test/test_ies_profiles/Type C - 01.ies" };
+
+		auto ies_stream = read_file_to_stream(fname_in);
+		ASSERT_TRUE(ies_stream);
+		const auto photo_data = convert_stream_to_data(*ies_stream);
+		ASSERT_TRUE(photo_data);
+
+		auto file_content = std::string{};
+		{
+			auto file = std::ifstream{ fname_in, std::ios::binary };
+			auto oss = std::ostringstream{};
+			oss << file.rdbuf();
+			file_content = oss.str();
+		}
+
+		if (1) {
+			// Borrow the in-memory content
+			auto mem_stream = memstream{ std::string_view{ file_content } };
+			const auto mem_data = convert_stream_to_data(mem_stream);
+			ASSERT_TRUE(mem_data);
+			EXPECT_EQ(photo_data.value(), mem_data.value());
+		}
+
+		if (1) {
+			// Borrow the in-memory bytes
+			auto mem_stream = memstream{ file_content.data(), file_content.size() };
+			const auto mem_data = convert_stream_to_data(mem_stream);
+			ASSERT_TRUE(mem_data);
+			EXPECT_EQ(photo_data.value(), mem_data.value());
+		}
+
+		if (1) {
+			// Move the in-memory bytes into the stream
+			auto buffer = std::vector<uint8_t>(file_content.begin(), file_content.end());
+			auto mem_stream = memstream{ std::move(buffer) };
+			const auto mem_data = convert_stream_to_data(mem_stream);
+			ASSERT_TRUE(mem_data);
+			EXPECT_EQ(photo_data.value(), mem_data.value());
+		}
+
+		if (1) {
+			auto mem_stream = memstream{ std::string_view{} };
+			EXPECT_FALSE(convert_stream_to_data(mem_stream));
+		}
+	}
+
+	TEST(IesRescale, CandelaMatrix) {
+
+		using namespace ies_rescale;
+
+		const auto rows = std::vector<std::vector<float>>{ { 1.f, 2.f, 3.f }, { 4.f, 5.f, 6.f } };
+		auto candelas = candela_matrix{ rows };
+
+		EXPECT_EQ(candelas.num_rows(), 2u);
+		EXPECT_EQ(candelas.num_cols(), 3u);
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(candelas.data()) % candela_matrix::alignment, 0u);
+
+		// The rows are laid out back to back in a single allocation
+		EXPECT_EQ(candelas.row(1).data(), candelas.data() + 3);
+		EXPECT_EQ(candelas.values().size(), 6u);
+		EXPECT_EQ(candelas[1][2], 6.f);
+
+		candelas[0][1] = 7.f;
+		EXPECT_EQ(candelas.values()[1], 7.f);
+
+		candelas[0][1] = 2.f;
+		EXPECT_EQ(candelas.to_vectors(), rows);
+		EXPECT_EQ(candelas, candela_matrix{ candelas.to_vectors() });
+	}
+
+	TEST(IesRescale, RescaleTableCache) {
+
+		using namespace ies_rescale;
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 01.ies");
+		ASSERT_TRUE(ies_stream);
+		const auto photo_data = convert_stream_to_data(*ies_stream);
+		ASSERT_TRUE(photo_data);
+
+		auto cache = rescale_table_cache{};
+
+		// The tables are computed once and then reused
+		const auto scaled_data_1 = rescale_ies_data(*photo_data, 90.f, false, cache);
+		ASSERT_TRUE(scaled_data_1);
+		EXPECT_EQ(cache.size(), 1u);
+
+		const auto scaled_data_2 = rescale_ies_data(*photo_data, 90.f, false, cache);
+		ASSERT_TRUE(scaled_data_2);
+		EXPECT_EQ(cache.size(), 1u);
+		EXPECT_EQ(scaled_data_1.value(), scaled_data_2.value());
+		EXPECT_EQ(cache.get(photo_data->photo.vert_angles, 90.f, false), cache.get(photo_data->photo.vert_angles, 90.f, false));
+
+		// The cone angle and the mode are part of the key
+		EXPECT_TRUE(rescale_ies_data(*photo_data, 90.f, true, cache));
+		EXPECT_TRUE(rescale_ies_data(*photo_data, 45.f, false, cache));
+		EXPECT_EQ(cache.size(), 3u);
+
+		// Rescaling to the full 180 degree cone angle leaves the profile unchanged
+		const auto unscaled_data = rescale_ies_data(*photo_data, 180.f, false, cache);
+		ASSERT_TRUE(unscaled_data);
+		EXPECT_EQ(unscaled_data->photo.candelas, photo_data->photo.candelas);
+
+		cache.clear();
+		EXPECT_EQ(cache.size(), 0u);
+	}
+
+	TEST(IesRescale, SimdKernels) {
+
+		using namespace ies_rescale;
+
+		const auto default_level = active_simd_level();
+		EXPECT_EQ(default_level, supported_simd_level());
+
+		for (const auto* fname : { "../test/test_ies_profiles/Type C - 02.ies", "../test/test_ies_profiles/Type B - 03.ies" }) {
+			auto ies_stream = read_file_to_stream(fname);
+			ASSERT_TRUE(ies_stream);
+			const auto photo_data = convert_stream_to_data(*ies_stream);
+			ASSERT_TRUE(photo_data);
+
+			for (const auto preserve_intensity : { false, true }) {
+				EXPECT_EQ(set_simd_level(simd_level::scalar), simd_level::scalar);
+				const auto reference = rescale_ies_data(*photo_data, 75.f, preserve_intensity);
+				ASSERT_TRUE(reference);
+
+				// Every vectorized kernel must match the scalar reference exactly
+				for (const auto level : { simd_level::sse4_2, simd_level::avx2, simd_level::avx512 }) {
+					if (set_simd_level(level) != level) {
+						continue;
+					}
+
+					const auto scaled_data = rescale_ies_data(*photo_data, 75.f, preserve_intensity);
+					ASSERT_TRUE(scaled_data);
+					EXPECT_EQ(reference.value(), scaled_data.value());
+				}
+			}
+		}
+
+		set_simd_level(default_level);
+	}
+
+	TEST(IesRescale, RescaleBatch) {
+
+		using namespace ies_rescale;
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type B - 03.ies");
+		ASSERT_TRUE(ies_stream);
+		const auto photo_data = convert_stream_to_data(*ies_stream);
+		ASSERT_TRUE(photo_data);
+
+		const auto cone_angles = std::vector<float>{ 0.f, 5.f, 30.f, 90.f, 180.f };
+
+		for (const auto preserve_intensity : { false, true }) {
+			const auto batch = rescale_ies_data_batch(*photo_data, cone_angles, preserve_intensity);
+			ASSERT_TRUE(batch);
+			ASSERT_EQ(batch->size(), cone_angles.size());
+
+			// Every rescaled profile in the batch matches the one rescaled on its own
+			for (auto k = std::size_t{ 0 }; k < batch->size(); ++k) {
+				EXPECT_EQ(batch->cone_angle(k), cone_angles[k]);
+
+				const auto scaled_data = rescale_ies_data(*photo_data, cone_angles[k], preserve_intensity);
+				ASSERT_TRUE(scaled_data);
+				EXPECT_EQ(batch->make_data(k), scaled_data.value());
+				EXPECT_EQ(batch->candelas(k)[1][2], scaled_data->photo.candelas[1][2]);
+			}
+		}
+
+		const auto invalid_cone_angles = std::vector<float>{ 90.f, 181.f };
+		EXPECT_FALSE(rescale_ies_data_batch(*photo_data, invalid_cone_angles));
+
+		// NaN isn't a valid cone angle either, in any of the modes
+		const auto nan_cone_angles = std::vector<float>{ 90.f, NAN };
+		EXPECT_FALSE(rescale_ies_data_batch(*photo_data, nan_cone_angles));
+		for (const auto mode : { rescale_mode::foreshorten, rescale_mode::preserve_intensity, rescale_mode::preserve_flux }) {
+			EXPECT_FALSE(rescale_ies_data(*photo_data, NAN, mode));
+		}
+	}
+
+	TEST(IesRescale, RescaleInPlace) {
+
+		using namespace ies_rescale;
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 06.ies");
+		ASSERT_TRUE(ies_stream);
+		const auto photo_data = convert_stream_to_data(*ies_stream);
+		ASSERT_TRUE(photo_data);
+
+		for (const auto preserve_intensity : { false, true }) {
+			const auto reference = rescale_ies_data(*photo_data, 60.f, preserve_intensity);
+			ASSERT_TRUE(reference);
+
+			if (1) {
+				auto data = photo_data.value();
+				EXPECT_TRUE(rescale_ies_data_inplace(data, 60.f, preserve_intensity));
+				EXPECT_EQ(data, reference.value());
+			}
+
+			if (1) {
+				// The rvalue overload reuses the storage of the input
+				auto data = photo_data.value();
+				const auto* const candelas = data.photo.candelas.data();
+
+				const auto scaled_data = rescale_ies_data(std::move(data), 60.f, preserve_intensity);
+				ASSERT_TRUE(scaled_data);
+				EXPECT_EQ(scaled_data.value(), reference.value());
+				EXPECT_EQ(scaled_data->photo.candelas.data(), candelas);
+			}
+		}
+
+		if (1) {
+			auto data = photo_data.value();
+			EXPECT_FALSE(rescale_ies_data_inplace(data, 200.f));
+			EXPECT_EQ(data, photo_data.value());
+		}
+	}
+
+	TEST(IesRescale, StreamingWriter) {
+
+		using namespace ies_rescale;
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+		ASSERT_TRUE(ies_stream);
+		auto photo_data = convert_stream_to_data(*ies_stream);
+		ASSERT_TRUE(photo_data);
+
+		const auto buffer = convert_data_to_buffer(*photo_data);
+		ASSERT_TRUE(buffer);
+		const auto reference = std::string(buffer->begin(), buffer->end());
+
+		// Records the size of every write it receives
+		struct counting_sink : ies_sink {
+			auto write(const char* data, const std::size_t size) -> bool override {
+				content.append(data, size);
+				writes.push_back(size);
+				return true;
+			}
+
+			std::string content;
+			std::vector<std::size_t> writes;
+		};
+
+		// Fails every write
+		struct failing_sink : ies_sink {
+			auto write(const char*, const std::size_t) -> bool override {
+				return false;
+			}
+		};
+
+		if (1) {
+			auto oss = std::ostringstream{};
+			auto sink = ostream_sink{ oss };
+			EXPECT_TRUE(write_ies(*photo_data, sink));
+			EXPECT_EQ(oss.str(), reference);
+		}
+
+		if (1) {
+			// The output doesn't fit in the writer's buffer, so it is written in several bounded chunks
+			auto data = photo_data.value();
+			data.labels.insert(data.labels.end(), 1000, std::string(99, 'x'));
+
+			const auto data_buffer = convert_data_to_buffer(data);
+			ASSERT_TRUE(data_buffer);
+
+			auto sink = counting_sink{};
+			EXPECT_TRUE(write_ies(data, sink));
+			EXPECT_EQ(sink.content, std::string(data_buffer->begin(), data_buffer->end()));
+			EXPECT_GT(sink.writes.size(), 1u);
+			EXPECT_LE(*std::max_element(sink.writes.begin(), sink.writes.end()), std::size_t{ 64 * 1024 });
+		}
+
+		if (1) {
+			const auto fname_out = (fs::temp_directory_path() / "ies_rescale_streaming_writer.ies").string();
+			EXPECT_TRUE(write_ies_to_file(*photo_data, fname_out));
+
+			auto file = std::ifstream{ fname_out, std::ios::binary };
+			auto oss = std::ostringstream{};
+			oss << file.rdbuf();
+			file.close();
+			EXPECT_EQ(oss.str(), reference);
+
+			fs::remove(fname_out);
+		}
+
+		if (1) {
+			auto sink = failing_sink{};
+			EXPECT_FALSE(write_ies(*photo_data, sink));
+		}
+
+		if (1) {
+			// A label larger than the writer's buffer
+			auto data = photo_data.value();
+			data.labels.push_back(std::string(100000, 'x'));
+
+			auto sink = counting_sink{};
+			EXPECT_TRUE(write_ies(data, sink));
+			EXPECT_EQ(sink.content.size(), reference.size() + 100001);
+			EXPECT_NE(sink.content.find(data.labels.back() + "\n"), std::string::npos);
+		}
+
+		if (1) {
+			auto data = photo_data.value();
+			data.file.format = static_cast<IE_Data::File::Format>(-1);
+
+			auto sink = counting_sink{};
+			EXPECT_FALSE(write_ies(data, sink));
+			EXPECT_TRUE(sink.writes.empty());
+		}
+	}
+
+	TEST(IesRescale, WorkStealingPool) {
+
+		using namespace ies_rescale;
+
+		if (1) {
+			auto pool = work_stealing_pool{ 4 };
+			EXPECT_EQ(pool.num_threads(), 4u);
+
+			// Tasks submitted from the workers land in their own queues and get stolen by the idle ones
+			auto sum = std::atomic<int>{ 0 };
+			for (auto i = 1; i <= 100; ++i) {
+				pool.submit([&pool, &sum, i] {
+					for (auto j = 0; j < 10; ++j) {
+						pool.submit([&sum, i] { sum += i; });
+					}
+				});
+			}
+
+			pool.wait();
+			EXPECT_EQ(sum.load(), 10 * 5050);
+		}
+
+		if (1) {
+			auto pool = work_stealing_pool{ 2 };
+			auto count = std::atomic<int>{ 0 };
+			pool.submit([] { throw std::runtime_error{ "task failed" }; });
+			pool.submit([&count] { ++count; });
+
+			EXPECT_THROW(pool.wait(), std::runtime_error);
+			EXPECT_EQ(count.load(), 1);
+
+			// The pool remains usable afterwards
+			pool.submit([&count] { ++count; });
+			EXPECT_NO_THROW(pool.wait());
+			EXPECT_EQ(count.load(), 2);
+		}
+	}
+
+	TEST(IesRescale, BatchRescale) {
+
+		using namespace ies_rescale;
+
+		// Copy the test profiles into a temporary tree with a nested directory
+		const auto root = fs::temp_directory_path() / "ies_rescale_batch_test";
+		fs::remove_all(root);
+		fs::create_directories(root / "input" / "nested");
+
+		const auto profiles = find_ies_files("../test/test_ies_profiles", false, "_rescaled");
+		ASSERT_FALSE(profiles.empty());
+		for (auto i = std::size_t{ 0 }; i < profiles.size(); ++i) {
+			const auto dir = root / "input" / (i % 2 ? "nested" : "");
+			fs::copy_file(profiles[i], dir / fs::path{ profiles[i] }.filename());
+		}
+
+		EXPECT_EQ(find_ies_files((root / "input").string()).size(), profiles.size());
+		EXPECT_EQ(find_ies_files((root / "input").string(), false).size(), (profiles.size() + 1) / 2);
+
+		auto options = batch_options{};
+		options.rescale_cone_angle = 60.f;
+		options.output_dir = (root / "output").string();
+		options.num_threads = 3;
+
+		for (const auto pipelined : { false, true }) {
+			fs::remove_all(root / "output");
+			options.pipelined = pipelined;
+
+			const auto report = rescale_ies_directory((root / "input").string(), options);
+			ASSERT_TRUE(report);
+			EXPECT_EQ(report->num_files, profiles.size());
+			// The invalid and the truncated profiles
+			EXPECT_EQ(report->num_failed, 2u);
+			EXPECT_EQ(report->failed_files.size(), 2u);
+
+			// The outputs mirror the input tree and match the single-file functions
+			for (auto i = std::size_t{ 0 }; i < profiles.size(); ++i) {
+				const auto input_path = fs::path{ profiles[i] };
+				const auto output_path = root / "output" / (i % 2 ? "nested" : "") / (input_path.stem().string() + "_rescaled" + input_path.extension().string());
+
+				auto ies_stream = read_file_to_stream(profiles[i]);
+				ASSERT_TRUE(ies_stream);
+				const auto photo_data = convert_stream_to_data(*ies_stream);
+				if (!photo_data) {
+					EXPECT_FALSE(fs::exists(output_path));
+					continue;
+				}
+
+				const auto scaled_data = rescale_ies_data(*photo_data, options.rescale_cone_angle);
+				ASSERT_TRUE(scaled_data);
+				const auto buffer = convert_data_to_buffer(*scaled_data);
+				ASSERT_TRUE(buffer);
+
+				auto file = std::ifstream{ output_path, std::ios::binary };
+				auto oss = std::ostringstream{};
+				oss << file.rdbuf();
+				EXPECT_EQ(oss.str(), std::string(buffer->begin(), buffer->end())) << output_path;
+			}
+		}
+
+		if (1) {
+			// The pipeline reads the files through io_uring where available, and maps them on the reader threads otherwise, with the same outputs
+			const auto files = find_ies_files((root / "input").string());
+			auto reference = std::vector<std::string>{};
+			for (const auto allow_io_uring : { true, false }) {
+				fs::remove_all(root / "output");
+				auto stage_options = pipeline_options{};
+				stage_options.allow_io_uring = allow_io_uring;
+				stage_options.queue_capacity = 4;
+
+				const auto report = rescale_ies_files_pipelined(files, (root / "input").string(), options, stage_options);
+				EXPECT_EQ(report.num_files, files.size());
+				EXPECT_EQ(report.num_failed, 2u);
+
+				auto outputs = std::vector<std::string>{};
+				for (const auto& output : find_ies_files((root / "output").string())) {
+					auto stream = read_file_to_stream(output);
+					ASSERT_TRUE(stream);
+					outputs.emplace_back(stream->unread());
+				}
+				if (allow_io_uring) {
+					reference = std::move(outputs);
+				}
+				else {
+					EXPECT_EQ(outputs, reference);
+				}
+			}
+		}
+
+		if (1) {
+			// Writing next to the inputs, and then once more: the outputs of the first run are not picked up as inputs by the second one
+			options.output_dir.clear();
+			const auto first_report = rescale_ies_directory((root / "input").string(), options);
+			ASSERT_TRUE(first_report);
+			const auto second_report = rescale_ies_directory((root / "input").string(), options);
+			ASSERT_TRUE(second_report);
+			EXPECT_EQ(first_report->num_files, second_report->num_files);
+		}
+
+		EXPECT_FALSE(rescale_ies_directory((root / "missing").string(), options));
+
+		fs::remove_all(root);
+	}
+
+	TEST(IesRescale, BoundedQueue) {
+
+		using namespace ies_rescale;
+
+		if (1) {
+			auto queue = bounded_queue<int>{ 3 };
+			EXPECT_EQ(queue.capacity(), 4u);
+
+			for (auto i = 0; i < 4; ++i) {
+				EXPECT_TRUE(queue.try_push(i));
+			}
+			auto value = 42;
+			EXPECT_FALSE(queue.try_push(value));
+			EXPECT_EQ(value, 42);
+
+			for (auto i = 0; i < 4; ++i) {
+				EXPECT_TRUE(queue.try_pop(value));
+				EXPECT_EQ(value, i);
+			}
+			EXPECT_FALSE(queue.try_pop(value));
+		}
+
+		if (1) {
+			// Several producers and consumers going through a queue much smaller than the number of values
+			auto queue = bounded_queue<std::unique_ptr<int>>{ 8 };
+			constexpr auto num_values = 10000;
+
+			auto sum = std::atomic<long long>{ 0 };
+			auto count = std::atomic<int>{ 0 };
+			auto consumers = std::vector<std::thread>{};
+			for (auto t = 0; t < 3; ++t) {
+				consumers.emplace_back([&queue, &sum, &count] {
+					auto value = std::unique_ptr<int>{};
+					while (queue.pop(value)) {
+						sum += *value;
+						++count;
+					}
+				});
+			}
+
+			auto producers = std::vector<std::thread>{};
+			for (auto t = 0; t < 2; ++t) {
+				producers.emplace_back([&queue, t] {
+					for (auto i = t; i < num_values; i += 2) {
+						queue.push(std::make_unique<int>(i));
+					}
+				});
+			}
+
+			for (auto& producer : producers) {
+				producer.join();
+			}
+			queue.close();
+			for (auto& consumer : consumers) {
+				consumer.join();
+			}
+
+			EXPECT_EQ(count.load(), num_values);
+			EXPECT_EQ(sum.load(), static_cast<long long>(num_values) * (num_values - 1) / 2);
+		}
+	}
+
+	TEST(IesRescale, BulkLoad) {
+
+		using namespace ies_rescale;
+
+		// Every test profile several times over, so that the io_uring slots get recycled, plus a missing file
+		auto paths = std::vector<std::string>{};
+		const auto profiles = find_ies_files("../test/test_ies_profiles", false, "_rescaled");
+		for (auto k = 0; k < 8; ++k) {
+			paths.insert(paths.end(), profiles.begin(), profiles.end());
+		}
+		paths.push_back("../test/test_ies_profiles/Missing Profile.ies");
+
+		auto expected = std::vector<std::optional<IE_Data>>{};
+		for (const auto& path : paths) {
+			auto ies_stream = read_file_to_stream(path);
+			expected.push_back(ies_stream ? convert_stream_to_data(*ies_stream) : std::nullopt);
+		}
+
+		for (const auto allow_io_uring : { true, false }) {
+			for (const auto queue_depth : { 1, 4, 64 }) {
+				auto options = bulk_load_options{};
+				options.allow_io_uring = allow_io_uring;
+				options.queue_depth = queue_depth;
+				options.num_threads = 3;
+
+				auto mutex = std::mutex{};
+				auto loaded = std::vector<std::optional<IE_Data>>(paths.size());
+				auto num_calls = std::vector<int>(paths.size(), 0);
+
+				const auto backend = bulk_load_profiles(paths, [&](const std::size_t index, std::optional<IE_Data>&& data) {
+					auto lock = std::lock_guard<std::mutex>{ mutex };
+					loaded[index] = std::move(data);
+					++num_calls[index];
+				}, options);
+
+				EXPECT_EQ(backend, allow_io_uring && io_uring_available() ? bulk_load_backend::io_uring : bulk_load_backend::thread_pool);
+				EXPECT_TRUE(std::all_of(num_calls.begin(), num_calls.end(), [](const int n) { return n == 1; }));
+				EXPECT_EQ(loaded, expected);
+			}
+		}
+	}
+
+	TEST(IesRescale, ProfileGenerator) {
+
+		using namespace ies_rescale;
+
+		using tilt_mode = synthetic_profile_options::tilt_mode;
+		const auto gonio_types = { IE_Data::Photo::IE_Gonio_Type::Type_A, IE_Data::Photo::IE_Gonio_Type::Type_B, IE_Data::Photo::IE_Gonio_Type::Type_C };
+		const auto formats = { IE_Data::File::Format::IESNA_91, IE_Data::File::Format::IESNA_95, IE_Data::File::Format::IESNA_02 };
+
+		const auto tilt_path = fs::temp_directory_path() / "ies_rescale_synthetic_tilt.dat";
+
+		for (const auto gonio_type : gonio_types) {
+			for (const auto tilt : { tilt_mode::none, tilt_mode::include, tilt_mode::file }) {
+				for (const auto format : formats) {
+					auto options = synthetic_profile_options{};
+					options.gonio_type = gonio_type;
+					options.format = format;
+					options.tilt = tilt;
+					options.tilt_orientation = IE_Data::Lamp::Tilt::Orientation::LampTilt;
+					options.tilt_fname = tilt_path.string();
+					options.num_vert_angles = 37;
+					options.num_horz_angles = 19;
+					options.seed = 42;
+
+					const auto data = generate_ies_profile(options);
+					EXPECT_EQ(data.photo.candelas.num_rows(), 19u);
+					EXPECT_EQ(data.photo.candelas.num_cols(), 37u);
+
+					if (tilt == tilt_mode::file) {
+						auto tilt_file = std::ofstream{ tilt_path, std::ios::binary };
+						tilt_file << generate_tilt_text(data.lamp.tilt);
+					}
+
+					// The generated text parses back into exactly the same data
+					const auto text = generate_ies_text(data);
+					EXPECT_NE(text.find("TILT=" + data.lamp.tilt_fname + "\n"), std::string::npos);
+
+					auto stream = memstream{ std::string_view{ text } };
+					const auto parsed_data = convert_stream_to_data(stream);
+					ASSERT_TRUE(parsed_data);
+					EXPECT_EQ(parsed_data.value(), data);
+
+					EXPECT_TRUE(rescale_ies_data(data, 45.f));
+					EXPECT_TRUE(rescale_ies_data(data, 45.f, true));
+				}
+			}
+		}
+
+		fs::remove(tilt_path);
+
+		if (1) {
+			// Deterministic for a given seed
+			auto options = synthetic_profile_options{};
+			options.num_vert_angles = 91;
+			options.num_horz_angles = 13;
+			EXPECT_EQ(generate_ies_profile(options), generate_ies_profile(options));
+
+			auto other_options = options;
+			other_options.seed = 1;
+			EXPECT_NE(generate_ies_profile(options), generate_ies_profile(other_options));
+		}
+
+		if (1) {
+			// Degenerate grids
+			auto options = synthetic_profile_options{};
+			options.num_vert_angles = 2;
+			options.num_horz_angles = 1;
+			const auto data = generate_ies_profile(options);
+			EXPECT_EQ(data.photo.horz_angles, std::vector<float>{ 0.f });
+
+			const auto text = generate_ies_text(data);
+			auto stream = memstream{ std::string_view{ text } };
+			const auto parsed_data = convert_stream_to_data(stream);
+			ASSERT_TRUE(parsed_data);
+			EXPECT_EQ(parsed_data.value(), data);
+		}
+	}
+
+	TEST(IesRescale, BinaryFormat) {
+
+		using namespace ies_rescale;
+
+		// Every valid test profile, plus a synthetic one with included TILT data
+		auto profiles = std::vector<IE_Data>{};
+		for (const auto& fname : find_ies_files("../test/test_ies_profiles", false, "_rescaled")) {
+			auto ies_stream = read_file_to_stream(fname);
+			ASSERT_TRUE(ies_stream);
+			if (auto data = convert_stream_to_data(*ies_stream)) {
+				profiles.push_back(std::move(*data));
+			}
+		}
+
+		auto options = synthetic_profile_options{};
+		options.tilt = synthetic_profile_options::tilt_mode::include;
+		profiles.push_back(generate_ies_profile(options));
+
+		for (const auto& data : profiles) {
+			const auto binary = convert_data_to_binary(data);
+			ASSERT_TRUE(binary);
+
+			const auto view = binary_profile_view::from_bytes(binary->data(), binary->size());
+			ASSERT_TRUE(view);
+
+			// The arrays are read in place
+			EXPECT_EQ(view->num_labels(), data.labels.size());
+			EXPECT_EQ(view->tilt_fname(), data.lamp.tilt_fname);
+			EXPECT_EQ(view->candelas().num_rows(), data.photo.candelas.num_rows());
+			EXPECT_EQ(view->candelas().num_cols(), data.photo.candelas.num_cols());
+			EXPECT_EQ(reinterpret_cast<const uint8_t*>(view->candelas().data()) - binary->data(), static_cast<std::ptrdiff_t>(view->header().candelas_offset));
+			EXPECT_EQ(view->header().candelas_offset % candela_matrix::alignment, 0u);
+			EXPECT_TRUE(std::equal(view->vert_angles().begin(), view->vert_angles().end(), data.photo.vert_angles.begin(), data.photo.vert_angles.end()));
+
+			EXPECT_EQ(view->to_data(), data);
+			EXPECT_EQ(convert_binary_to_data(binary->data(), binary->size()).value(), data);
+		}
+
+		if (1) {
+			// Round trip through files
+			const auto binary_path = (fs::temp_directory_path() / "ies_rescale_binary_test.iesb").string();
+			const auto ies_path = (fs::temp_directory_path() / "ies_rescale_binary_test.ies").string();
+			const auto fname = std::string{ "../test/test_ies_profiles/Type C - 02.ies" };
+
+			auto reference_stream = read_file_to_stream(fname);
+			ASSERT_TRUE(reference_stream);
+			const auto reference_data = convert_stream_to_data(*reference_stream);
+			ASSERT_TRUE(reference_data);
+
+			EXPECT_TRUE(convert_ies_file_to_binary(fname, binary_path));
+			const auto profile = binary_profile::open(binary_path);
+			ASSERT_TRUE(profile);
+			EXPECT_EQ(profile->view().to_data(), reference_data.value());
+
+			EXPECT_TRUE(convert_binary_file_to_ies(binary_path, ies_path));
+			auto ies_stream = read_file_to_stream(ies_path);
+			ASSERT_TRUE(ies_stream);
+			EXPECT_EQ(convert_stream_to_data(*ies_stream).value(), reference_data.value());
+
+			EXPECT_FALSE(binary_profile::open(fname));
+			EXPECT_FALSE(convert_binary_file_to_ies(fname, ies_path));
+
+			fs::remove(binary_path);
+			fs::remove(ies_path);
+		}
+
+		if (1) {
+			// Corrupted or inconsistent data is rejected
+			const auto binary = convert_data_to_binary(profiles.front());
+			ASSERT_TRUE(binary);
+
+			EXPECT_FALSE(binary_profile_view::from_bytes(binary->data(), binary->size() - 1));
+			EXPECT_FALSE(binary_profile_view::from_bytes(binary->data(), 16));
+			EXPECT_FALSE(binary_profile_view::from_bytes(nullptr, 0));
+
+			auto bad_magic = *binary;
+			bad_magic[0] ^= 0xFF;
+			EXPECT_FALSE(binary_profile_view::from_bytes(bad_magic.data(), bad_magic.size()));
+
+			auto bad_version = *binary;
+			bad_version[4] += 1;
+			EXPECT_FALSE(binary_profile_view::from_bytes(bad_version.data(), bad_version.size()));
+
+			auto bad_candelas = *binary;
+			auto header = binary_header{};
+			std::memcpy(&header, bad_candelas.data(), sizeof(header));
+			header.num_horz_angles += 1000;
+			std::memcpy(bad_candelas.data(), &header, sizeof(header));
+			EXPECT_FALSE(binary_profile_view::from_bytes(bad_candelas.data(), bad_candelas.size()));
+
+			auto inconsistent_data = profiles.front();
+			inconsistent_data.photo.num_vert_angles += 1;
+			EXPECT_FALSE(convert_data_to_binary(inconsistent_data));
+		}
+	}
+
+	TEST(IesRescale, ProfileArchive) {
+
+		using namespace ies_rescale;
+
+		// Synthetic profiles, added out of name order, two of which have the same content
+		auto builder = archive_builder{};
+		auto profiles = std::vector<std::pair<std::string, IE_Data>>{};
+		for (auto i = 0; i < 20; ++i) {
+			auto options = synthetic_profile_options{};
+			options.num_vert_angles = 19 + i;
+			options.num_horz_angles = 1 + i % 5;
+			options.seed = static_cast<uint64_t>(i % 19);
+			profiles.emplace_back("dir_" + std::to_string(i % 3) + "/profile_" + std::to_string(19 - i) + ".ies", generate_ies_profile(options));
+		}
+		profiles.back().second = profiles.front().second;
+
+		for (const auto& [name, data] : profiles) {
+			EXPECT_TRUE(builder.add(name, data));
+		}
+		EXPECT_FALSE(builder.add(profiles.front().first, profiles.front().second));
+		EXPECT_EQ(builder.size(), profiles.size());
+
+		const auto archive_path = (fs::temp_directory_path() / "ies_rescale_archive_test.iesa").string();
+		ASSERT_TRUE(builder.write(archive_path));
+
+		if (1) {
+			// The file matches the in-memory archive
+			auto archive_stream = read_file_to_stream(archive_path);
+			ASSERT_TRUE(archive_stream);
+			const auto content = std::string{ std::istreambuf_iterator<char>(*archive_stream), std::istreambuf_iterator<char>() };
+			const auto built = builder.build();
+			EXPECT_TRUE(std::equal(content.begin(), content.end(), built.begin(), built.end(), [](const char a, const uint8_t b) { return static_cast<uint8_t>(a) == b; }));
+		}
+
+		if (1) {
+			const auto archive = profile_archive::open(archive_path);
+			ASSERT_TRUE(archive);
+			EXPECT_EQ(archive->size(), profiles.size());
+
+			// The entries are sorted by name
+			for (auto i = std::size_t{ 1 }; i < archive->size(); ++i) {
+				EXPECT_LT(archive->name(i - 1), archive->name(i));
+			}
+
+			for (const auto& [name, data] : profiles) {
+				const auto i = archive->find(name);
+				ASSERT_TRUE(i);
+				EXPECT_EQ(archive->name(*i), name);
+
+				const auto view = archive->profile(name);
+				ASSERT_TRUE(view);
+				EXPECT_EQ(view->to_data(), data);
+				EXPECT_EQ(reinterpret_cast<std::uintptr_t>(view->candelas().data()) % candela_matrix::alignment, 0u);
+
+				// Profiles with the same content are found by hash as the first of them
+				const auto binary = convert_data_to_binary(data);
+				ASSERT_TRUE(binary);
+				const auto hash = hash_bytes(binary->data(), binary->size());
+				EXPECT_EQ(archive->content_hash(*i), hash);
+
+				const auto by_hash = archive->find_by_hash(hash);
+				ASSERT_TRUE(by_hash);
+				EXPECT_EQ(archive->content_hash(*by_hash), hash);
+				EXPECT_LE(*by_hash, *i);
+			}
+
+			EXPECT_FALSE(archive->find("dir_0/missing.ies"));
+			EXPECT_FALSE(archive->find(""));
+			EXPECT_FALSE(archive->profile("zzz"));
+			EXPECT_FALSE(archive->find_by_hash(0));
+		}
+
+		if (1) {
+			// Empty archives are valid
+			const auto empty = archive_builder{}.build();
+			ASSERT_TRUE(write_buffer_to_file(empty, archive_path));
+			const auto archive = profile_archive::open(archive_path);
+			ASSERT_TRUE(archive);
+			EXPECT_EQ(archive->size(), 0u);
+			EXPECT_FALSE(archive->find("profile_0.ies"));
+		}
+
+		if (1) {
+			// Corrupted archives are rejected
+			auto truncated = builder.build();
+			truncated.resize(truncated.size() - 1);
+			ASSERT_TRUE(write_buffer_to_file(truncated, archive_path));
+			EXPECT_FALSE(profile_archive::open(archive_path));
+
+			auto bad_magic = builder.build();
+			bad_magic[0] ^= 0xFF;
+			ASSERT_TRUE(write_buffer_to_file(bad_magic, archive_path));
+			EXPECT_FALSE(profile_archive::open(archive_path));
+
+			// A corrupted entry only affects that entry
+			auto bad_entry = builder.build();
+			auto header = archive_header{};
+			std::memcpy(&header, bad_entry.data(), sizeof(header));
+			auto entry = archive_entry{};
+			std::memcpy(&entry, bad_entry.data() + header.entries_offset, sizeof(entry));
+			entry.profile_size += 1;
+			std::memcpy(bad_entry.data() + header.entries_offset, &entry, sizeof(entry));
+			ASSERT_TRUE(write_buffer_to_file(bad_entry, archive_path));
+
+			const auto archive = profile_archive::open(archive_path);
+			ASSERT_TRUE(archive);
+			EXPECT_FALSE(archive->profile(0));
+			EXPECT_TRUE(archive->profile(1));
+		}
+
+		if (1) {
+			// Archive a whole directory
+			const auto count = create_profile_archive("../test/test_ies_profiles", archive_path, false);
+			ASSERT_TRUE(count);
+
+			const auto archive = profile_archive::open(archive_path);
+			ASSERT_TRUE(archive);
+			EXPECT_EQ(archive->size(), *count);
+			EXPECT_FALSE(archive->find("Invalid Profile - 01.ies"));
+
+			const auto view = archive->profile("Type C - 02.ies");
+			ASSERT_TRUE(view);
+			auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+			ASSERT_TRUE(ies_stream);
+			EXPECT_EQ(view->to_data(), convert_stream_to_data(*ies_stream).value());
+
+			EXPECT_FALSE(create_profile_archive("../test/missing_directory", archive_path));
+		}
+
+		fs::remove(archive_path);
+	}
+
+	TEST(IesRescale, ResultCache) {
+
+		using namespace ies_rescale;
+
+		const auto root = fs::temp_directory_path() / "ies_rescale_result_cache_test";
+		fs::remove_all(root);
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+		ASSERT_TRUE(ies_stream);
+		const auto input = std::string{ ies_stream->unread() };
+
+		if (1) {
+			// The keys depend on the input and on all the parameters
+			const auto key = result_cache_key::make(input.data(), input.size(), 60.f, false);
+			EXPECT_EQ(key, result_cache_key::make(input.data(), input.size(), 60.f, false));
+			EXPECT_NE(key, result_cache_key::make(input.data(), input.size(), 61.f, false));
+			EXPECT_NE(key, result_cache_key::make(input.data(), input.size(), 60.f, true));
+
+			// The flag overload matches the corresponding modes, and every mode has its own key
+			EXPECT_EQ(key, result_cache_key::make(input.data(), input.size(), 60.f, rescale_mode::foreshorten));
+			EXPECT_EQ(result_cache_key::make(input.data(), input.size(), 60.f, true), result_cache_key::make(input.data(), input.size(), 60.f, rescale_mode::preserve_intensity));
+			EXPECT_NE(key, result_cache_key::make(input.data(), input.size(), 60.f, rescale_mode::preserve_flux));
+			EXPECT_NE(result_cache_key::make(input.data(), input.size(), 60.f, true), result_cache_key::make(input.data(), input.size(), 60.f, rescale_mode::preserve_flux));
+			EXPECT_EQ(result_cache_key::make(input.data(), input.size(), 0.f, false), result_cache_key::make(input.data(), input.size(), -0.f, false));
+			EXPECT_NE(key, result_cache_key::make(input.data(), input.size() - 1, 60.f, false));
+			EXPECT_EQ(key.to_string().size(), 32u);
+			EXPECT_EQ(key.to_string().find_first_not_of("0123456789abcdef"), std::string::npos);
+		}
+
+		if (1) {
+			auto cache = result_cache{ (root / "basic").string() };
+			const auto key = result_cache_key::make(input.data(), input.size(), 60.f, false);
+			const auto bytes = std::vector<uint8_t>(input.begin(), input.end());
+
+			EXPECT_FALSE(cache.get(key));
+			EXPECT_TRUE(cache.put(key, bytes));
+			EXPECT_EQ(cache.get(key).value(), bytes);
+			EXPECT_EQ(cache.num_hits(), 1u);
+			EXPECT_EQ(cache.num_misses(), 1u);
+
+			// Another instance (e.g. another process) sees the entry
+			auto other_cache = result_cache{ (root / "basic").string() };
+			EXPECT_EQ(other_cache.get(key).value(), bytes);
+
+			// Corrupted entries are misses, and are removed
+			const auto entry_path = root / "basic" / key.to_string().substr(0, 2) / (key.to_string() + ".iesr");
+			ASSERT_TRUE(fs::exists(entry_path));
+			{
+				auto file = std::fstream{ entry_path, std::ios::binary | std::ios::in | std::ios::out };
+				file.seekp(-1, std::ios::end);
+				file.put('#');
+			}
+			EXPECT_FALSE(cache.get(key));
+			EXPECT_FALSE(fs::exists(entry_path));
+
+			EXPECT_TRUE(cache.put(key, bytes));
+			cache.clear();
+			EXPECT_FALSE(cache.get(key));
+		}
+
+		if (1) {
+			// The rescaled results match the uncached ones, and are only computed once
+			auto cache = result_cache{ (root / "rescale").string() };
+			const auto reference = convert_data_to_buffer(rescale_ies_data(convert_stream_to_data(*ies_stream).value(), 60.f, true).value());
+			ASSERT_TRUE(reference);
+
+			for (auto i = 0; i < 2; ++i) {
+				EXPECT_EQ(rescale_ies_buffer_cached(cache, input.data(), input.size(), 60.f, true).value(), *reference);
+			}
+			EXPECT_EQ(cache.num_hits(), 1u);
+			EXPECT_EQ(cache.num_misses(), 1u);
+
+			const auto invalid = std::string{ "IESNA:LM-63-2002\nTILT=NONE\n" };
+			EXPECT_FALSE(rescale_ies_buffer_cached(cache, invalid.data(), invalid.size(), 60.f));
+		}
+
+		if (1) {
+			// Editing the TILT data file of a TILT=<file> profile doesn't serve the stale result
+			auto cache = result_cache{ (root / "tilt").string() };
+			const auto tilt_path = root / "tilt.dat";
+
+			auto options = synthetic_profile_options{};
+			options.tilt = synthetic_profile_options::tilt_mode::file;
+			options.tilt_fname = tilt_path.string();
+			options.num_vert_angles = 37;
+			options.num_horz_angles = 19;
+
+			auto data = generate_ies_profile(options);
+			const auto text = generate_ies_text(data);
+
+			const auto write_tilt = [&]() {
+				auto tilt_file = std::ofstream{ tilt_path, std::ios::binary };
+				tilt_file << generate_tilt_text(data.lamp.tilt);
+			};
+
+			write_tilt();
+			const auto bytes = rescale_ies_buffer_cached(cache, text.data(), text.size(), 60.f);
+			ASSERT_TRUE(bytes);
+			EXPECT_EQ(rescale_ies_buffer_cached(cache, text.data(), text.size(), 60.f).value(), *bytes);
+			EXPECT_EQ(cache.num_hits(), 1u);
+
+			data.lamp.tilt.mult_factors.back() /= 2.f;
+			write_tilt();
+			const auto edited_bytes = rescale_ies_buffer_cached(cache, text.data(), text.size(), 60.f);
+			ASSERT_TRUE(edited_bytes);
+			EXPECT_NE(*edited_bytes, *bytes);
+			EXPECT_EQ(cache.num_hits(), 1u);
+			EXPECT_EQ(cache.num_misses(), 2u);
+
+			// A missing TILT data file fails the rescale rather than hitting the cache
+			fs::remove(tilt_path);
+			EXPECT_FALSE(rescale_ies_buffer_cached(cache, text.data(), text.size(), 60.f));
+		}
+
+		if (1) {
+			// Eviction removes the least recently used entries until the cache is back under 90% of its bound
+			auto options = result_cache_options{};
+			options.max_size = 100 * 1024;
+			options.scan_interval = ~uint64_t{ 0 };
+			auto cache = result_cache{ (root / "eviction").string(), options };
+
+			const auto bytes = std::vector<uint8_t>(10 * 1024 - sizeof(result_cache_entry_header), 0x5A);
+			auto keys = std::vector<result_cache_key>{};
+			const auto now = fs::file_time_type::clock::now();
+			for (auto i = 0; i < 12; ++i) {
+				keys.push_back(result_cache_key::make(&i, sizeof(i), 90.f, false));
+				ASSERT_TRUE(cache.put(keys.back(), bytes));
+
+				// Entry i was last accessed i minutes after entry 0
+				const auto name = keys.back().to_string();
+				fs::last_write_time(root / "eviction" / name.substr(0, 2) / (name + ".iesr"), now - std::chrono::hours{ 1 } + std::chrono::minutes{ i });
+			}
+
+			// Accessing the oldest entry makes it the most recently used one
+			EXPECT_TRUE(cache.get(keys[0]));
+
+			EXPECT_EQ(cache.evict(), 3u);
+			EXPECT_EQ(cache.num_evictions(), 3u);
+			EXPECT_TRUE(cache.get(keys[0]));
+			for (auto i = 1; i < 12; ++i) {
+				EXPECT_EQ(cache.get(keys[i]).has_value(), i > 3) << i;
+			}
+
+			EXPECT_EQ(cache.evict(), 0u);
+		}
+
+		if (1) {
+			// Concurrent readers and writers of the same entries only ever see complete entries
+			auto options = result_cache_options{};
+			options.max_size = 64 * 1024;
+			auto cache = result_cache{ (root / "concurrent").string(), options };
+
+			auto failed = std::atomic<bool>{ false };
+			auto threads = std::vector<std::thread>{};
+			for (auto t = 0; t < 4; ++t) {
+				threads.emplace_back([&cache, &failed] {
+					for (auto i = 0; i < 200; ++i) {
+						const auto id = i % 16;
+						const auto key = result_cache_key::make(&id, sizeof(id), 90.f, false);
+						const auto bytes = std::vector<uint8_t>(1024 * (id + 1), static_cast<uint8_t>(id));
+						if (const auto cached = cache.get(key)) {
+							failed = failed || *cached != bytes;
+						}
+						else {
+							cache.put(key, bytes);
+						}
+					}
+				});
+			}
+
+			for (auto& thread : threads) {
+				thread.join();
+			}
+
+			EXPECT_FALSE(failed);
+			EXPECT_GT(cache.num_evictions(), 0u);
+		}
+
+		if (1) {
+			// Batches through the cache write the same outputs
+			auto options = batch_options{};
+			options.rescale_cone_angle = 60.f;
+			options.output_dir = (root / "output").string();
+			options.cache_dir = (root / "batch").string();
+			options.num_threads = 2;
+
+			for (auto i = 0; i < 2; ++i) {
+				const auto report = rescale_ies_directory("../test/test_ies_profiles", options);
+				ASSERT_TRUE(report);
+				EXPECT_EQ(report->num_failed, 2u);
+			}
+
+			const auto output = (root / "output" / "Type C - 02_rescaled.ies").string();
+			EXPECT_TRUE(ies_rescale::rescale_ies_file("../test/test_ies_profiles/Type C - 02.ies", (root / "reference.ies").string(), 60.f));
+			auto output_stream = read_file_to_stream(output);
+			auto reference_stream = read_file_to_stream((root / "reference.ies").string());
+			ASSERT_TRUE(output_stream && reference_stream);
+			EXPECT_EQ(output_stream->unread(), reference_stream->unread());
+
+			// The pipelined mode doesn't go through the cache, so the combination is rejected rather than ignored
+			options.pipelined = true;
+			EXPECT_FALSE(rescale_ies_directory("../test/test_ies_profiles", options));
+		}
+
+		fs::remove_all(root);
+	}
+
+	TEST(IesRescale, ProfileCache) {
+
+		using namespace ies_rescale;
+
+		if (1) {
+			// A single shard evicts in LRU order
+			auto lru = detail::sharded_lru<int, std::shared_ptr<int>>{ 100, 1 };
+			for (auto i = 0; i < 4; ++i) {
+				lru.put(i, std::make_shared<int>(i), 30);
+			}
+			EXPECT_EQ(lru.size(), 3u);
+			EXPECT_EQ(lru.charge(), 90u);
+			EXPECT_EQ(lru.num_evictions(), 1u);
+			EXPECT_FALSE(lru.get(0));
+
+			// Getting a value makes it the most recently used one
+			EXPECT_EQ(*lru.get(1), 1);
+			lru.put(4, std::make_shared<int>(4), 30);
+			EXPECT_TRUE(lru.get(1));
+			EXPECT_FALSE(lru.get(2));
+
+			// The value that is already cached is kept
+			const auto cached = lru.get(3);
+			EXPECT_EQ(lru.put(3, std::make_shared<int>(-3), 30), cached);
+
+			// Values larger than the budget of a shard are returned but not cached
+			EXPECT_EQ(*lru.put(5, std::make_shared<int>(5), 101), 5);
+			EXPECT_FALSE(lru.get(5));
+
+			lru.erase(1);
+			EXPECT_FALSE(lru.get(1));
+			EXPECT_EQ(lru.charge(), 60u);
+
+			lru.clear();
+			EXPECT_EQ(lru.size(), 0u);
+			EXPECT_EQ(lru.charge(), 0u);
+		}
+
+		const auto root = fs::temp_directory_path() / "ies_rescale_profile_cache_test";
+		fs::remove_all(root);
+		fs::create_directories(root);
+
+		const auto fname = (root / "profile.ies").string();
+		const auto copy_fname = (root / "copy.ies").string();
+		fs::copy_file("../test/test_ies_profiles/Type C - 02.ies", fname);
+		fs::copy_file("../test/test_ies_profiles/Type C - 02.ies", copy_fname);
+
+		auto ies_stream = read_file_to_stream(fname);
+		ASSERT_TRUE(ies_stream);
+		const auto reference_data = convert_stream_to_data(*ies_stream).value();
+		const auto reference_scaled_data = rescale_ies_data(reference_data, 60.f, true).value();
+
+		if (1) {
+			auto cache = profile_cache{};
+
+			const auto profile = cache.load(fname);
+			ASSERT_TRUE(profile);
+			EXPECT_EQ(*profile.data, reference_data);
+			EXPECT_EQ(cache.load(fname).data, profile.data);
+
+			const auto scaled_data = cache.rescale(profile, 60.f, true);
+			ASSERT_TRUE(scaled_data);
+			EXPECT_EQ(*scaled_data, reference_scaled_data);
+			EXPECT_EQ(cache.rescale(profile, 60.f, true), scaled_data);
+			EXPECT_NE(cache.rescale(profile, 60.f, false), scaled_data);
+
+			// Identical files under different paths get their own rescaled profiles, named after them
+			const auto copy_scaled_data = cache.load_rescaled(copy_fname, 60.f, true);
+			ASSERT_TRUE(copy_scaled_data);
+			EXPECT_NE(copy_scaled_data, scaled_data);
+			EXPECT_EQ(*copy_scaled_data, *scaled_data);
+			EXPECT_EQ(copy_scaled_data->file.name, copy_fname);
+			EXPECT_EQ(scaled_data->file.name, fname);
+
+			auto stats = cache.stats();
+			EXPECT_EQ(stats.parsed_hits, 1u);
+			EXPECT_EQ(stats.parsed_misses, 2u);
+			EXPECT_EQ(stats.rescaled_hits, 1u);
+			EXPECT_EQ(stats.rescaled_misses, 3u);
+			EXPECT_EQ(stats.num_entries, 5u);
+			EXPECT_GT(stats.memory_usage, memory_usage(reference_data));
+
+			// Modified files are parsed again
+			fs::last_write_time(fname, fs::last_write_time(fname) + std::chrono::seconds{ 10 });
+			const auto reloaded_profile = cache.load(fname);
+			ASSERT_TRUE(reloaded_profile);
+			EXPECT_NE(reloaded_profile.data, profile.data);
+			EXPECT_EQ(*reloaded_profile.data, reference_data);
+			EXPECT_EQ(cache.stats().parsed_misses, 3u);
+
+			// Failures aren't cached
+			EXPECT_FALSE(cache.load((root / "missing.ies").string()));
+			EXPECT_FALSE(cache.load("../test/test_ies_profiles/Invalid Profile - 01.ies"));
+			EXPECT_FALSE(cache.rescale(cached_profile{}, 60.f));
+			EXPECT_FALSE(cache.rescale(profile, -1.f));
+
+			// The flux preserving results are cached separately from the other modes
+			const auto flux_scaled_data = cache.rescale(profile, 60.f, rescale_mode::preserve_flux);
+			ASSERT_TRUE(flux_scaled_data);
+			EXPECT_EQ(*flux_scaled_data, rescale_ies_data(reference_data, 60.f, rescale_mode::preserve_flux).value());
+			EXPECT_EQ(cache.load_rescaled(fname, 60.f, rescale_mode::preserve_flux), flux_scaled_data);
+			EXPECT_NE(cache.rescale(profile, 60.f, rescale_mode::foreshorten), flux_scaled_data);
+			EXPECT_EQ(cache.rescale(profile, 60.f, rescale_mode::preserve_intensity), cache.rescale(profile, 60.f, true));
+
+			// -0 and +0 are the same key
+			const auto zero_scaled_data = cache.rescale(profile, 0.f);
+			ASSERT_TRUE(zero_scaled_data);
+			EXPECT_EQ(cache.rescale(profile, -0.f), zero_scaled_data);
+
+			cache.clear();
+			EXPECT_EQ(cache.stats().num_entries, 0u);
+			EXPECT_EQ(cache.stats().memory_usage, 0u);
+
+			// The profiles handed out remain valid
+			EXPECT_EQ(*scaled_data, reference_scaled_data);
+		}
+
+		if (1) {
+			// Profiles with TILT=<file> are parsed again when their TILT data file changes
+			auto cache = profile_cache{};
+			const auto tilt_fname = (root / "tilt.dat").string();
+			const auto tilt_profile_fname = (root / "tilt.ies").string();
+
+			auto options = synthetic_profile_options{};
+			options.tilt = synthetic_profile_options::tilt_mode::file;
+			options.tilt_fname = tilt_fname;
+			options.num_vert_angles = 37;
+			options.num_horz_angles = 19;
+
+			auto data = generate_ies_profile(options);
+			{
+				auto file = std::ofstream{ tilt_profile_fname, std::ios::binary };
+				file << generate_ies_text(data);
+			}
+
+			const auto write_tilt = [&]() {
+				auto tilt_file = std::ofstream{ tilt_fname, std::ios::binary };
+				tilt_file << generate_tilt_text(data.lamp.tilt);
+			};
+
+			write_tilt();
+			const auto profile = cache.load(tilt_profile_fname);
+			ASSERT_TRUE(profile);
+			EXPECT_EQ(profile.data->lamp.tilt, data.lamp.tilt);
+			EXPECT_EQ(cache.load(tilt_profile_fname).data, profile.data);
+			const auto scaled_data = cache.rescale(profile, 60.f);
+			ASSERT_TRUE(scaled_data);
+
+			data.lamp.tilt.mult_factors.back() /= 2.f;
+			write_tilt();
+			fs::last_write_time(tilt_fname, fs::last_write_time(tilt_fname) + std::chrono::seconds{ 10 });
+
+			const auto reloaded_profile = cache.load(tilt_profile_fname);
+			ASSERT_TRUE(reloaded_profile);
+			EXPECT_EQ(reloaded_profile.data->lamp.tilt, data.lamp.tilt);
+			EXPECT_NE(reloaded_profile.content_hash, profile.content_hash);
+			const auto reloaded_scaled_data = cache.rescale(reloaded_profile, 60.f);
+			ASSERT_TRUE(reloaded_scaled_data);
+			EXPECT_EQ(reloaded_scaled_data->lamp.tilt, data.lamp.tilt);
+
+			const auto stats = cache.stats();
+			EXPECT_EQ(stats.parsed_hits, 1u);
+			EXPECT_EQ(stats.parsed_misses, 2u);
+			EXPECT_EQ(stats.rescaled_misses, 2u);
+
+			// A missing TILT data file fails the load
+			fs::remove(tilt_fname);
+			EXPECT_FALSE(cache.load(tilt_profile_fname));
+		}
+
+		if (1) {
+			// The memory budget bounds the cached profiles
+			auto options = profile_cache_options{};
+			options.memory_budget = memory_usage(reference_data) * 5;
+			options.num_shards = 1;
+			auto cache = profile_cache{ options };
+
+			for (auto angle = 10; angle <= 170; angle += 10) {
+				EXPECT_TRUE(cache.load_rescaled(fname, static_cast<float>(angle)));
+			}
+
+			const auto stats = cache.stats();
+			EXPECT_GT(stats.num_evictions, 0u);
+			EXPECT_LE(stats.memory_usage, options.memory_budget);
+		}
+
+		if (1) {
+			// Concurrent users all get the same profiles
+			auto cache = profile_cache{};
+			auto failed = std::atomic<bool>{ false };
+			auto threads = std::vector<std::thread>{};
+			for (auto t = 0; t < 4; ++t) {
+				threads.emplace_back([&] {
+					for (auto i = 0; i < 50; ++i) {
+						const auto scaled_data = cache.load_rescaled(i % 2 ? fname : copy_fname, 60.f, true);
+						failed = failed || !scaled_data || *scaled_data != reference_scaled_data;
+					}
+				});
+			}
+
+			for (auto& thread : threads) {
+				thread.join();
+			}
+
+			EXPECT_FALSE(failed);
+			const auto stats = cache.stats();
+			EXPECT_EQ(stats.parsed_hits + stats.parsed_misses, 200u);
+			EXPECT_EQ(stats.rescaled_hits + stats.rescaled_misses, 200u);
+		}
+
+		fs::remove_all(root);
+	}
+
+	TEST(IesRescale, CandelaSampler) {
+
+		using namespace ies_rescale;
+		using lookup = detail::sampler_axis::lookup;
+
+		// A grid of candela values that are a bilinear function of the angles, which the sampler must reproduce everywhere
+		auto make_photo = [](const IE_Data::Photo::IE_Gonio_Type gonio_type, const std::vector<float>& vert_angles, const std::vector<float>& horz_angles) {
+			auto photo = IE_Data::Photo{};
+			photo.gonio_type = gonio_type;
+			photo.num_vert_angles = static_cast<int>(vert_angles.size());
+			photo.num_horz_angles = static_cast<int>(horz_angles.size());
+			photo.vert_angles = vert_angles;
+			photo.horz_angles = horz_angles;
+			photo.candelas = candela_matrix(horz_angles.size(), vert_angles.size(), 0.f);
+			for (auto i = std::size_t{ 0 }; i < horz_angles.size(); ++i) {
+				for (auto j = std::size_t{ 0 }; j < vert_angles.size(); ++j) {
+					photo.candelas[i][j] = 1000.f + 2.f * vert_angles[j] + 3.f * std::abs(horz_angles[i]) + 0.01f * vert_angles[j] * std::abs(horz_angles[i]);
+				}
+			}
+			return photo;
+		};
+
+		auto expected = [](const float v, const float h) {
+			return 1000.f + 2.f * v + 3.f * h + 0.01f * v * h;
+		};
+
+		if (1) {
+			// Uniform, bucketed and searched axes
+			const auto uniform = make_photo(IE_Data::Photo::Type_C, { 0.f, 10.f, 20.f, 30.f, 40.f, 50.f, 60.f, 70.f, 80.f, 90.f }, { 0.f, 45.f, 90.f });
+			const auto nonuniform = make_photo(IE_Data::Photo::Type_C, { 0.f, 2.5f, 5.f, 10.f, 20.f, 40.f, 90.f }, { 0.f, 30.f, 90.f });
+			const auto repeated = make_photo(IE_Data::Photo::Type_C, { 0.f, 10.f, 10.f, 90.f }, { 0.f, 90.f });
+
+			const auto uniform_sampler = candela_sampler::create(uniform);
+			const auto nonuniform_sampler = candela_sampler::create(nonuniform);
+			const auto repeated_sampler = candela_sampler::create(repeated);
+			ASSERT_TRUE(uniform_sampler && nonuniform_sampler && repeated_sampler);
+
+			EXPECT_EQ(uniform_sampler->vert_lookup(), lookup::uniform);
+			EXPECT_EQ(uniform_sampler->horz_lookup(), lookup::uniform);
+			EXPECT_EQ(nonuniform_sampler->vert_lookup(), lookup::buckets);
+			EXPECT_EQ(nonuniform_sampler->horz_lookup(), lookup::buckets);
+			EXPECT_EQ(repeated_sampler->vert_lookup(), lookup::search);
+
+			for (const auto* sampler : { &*uniform_sampler, &*nonuniform_sampler }) {
+				for (auto v = 0.f; v <= 90.f; v += 1.25f) {
+					for (auto h = 0.f; h <= 90.f; h += 3.75f) {
+						EXPECT_NEAR(sampler->sample(v, h), expected(v, h), 1e-2f) << v << " " << h;
+					}
+				}
+			}
+
+			// The searched axis is only bilinear between its distinct angles
+			EXPECT_NEAR(repeated_sampler->sample(5.f, 45.f), expected(5.f, 45.f), 1e-2f);
+			EXPECT_NEAR(repeated_sampler->sample(50.f, 45.f), expected(50.f, 45.f), 1e-2f);
+		}
+
+		if (1) {
+			// The symmetries of the horizontal ranges
+			const auto vert_angles = std::vector<float>{ 0.f, 30.f, 60.f, 90.f, 120.f, 150.f, 180.f };
+
+			const auto quadrant = candela_sampler::create(make_photo(IE_Data::Photo::Type_C, vert_angles, { 0.f, 30.f, 60.f, 90.f }));
+			ASSERT_TRUE(quadrant);
+			EXPECT_EQ(quadrant->horz_folding(), detail::horz_symmetry::quadrant);
+			for (const auto h : { 150.f, 210.f, 330.f, -30.f, 390.f }) {
+				EXPECT_NEAR(quadrant->sample(45.f, h), quadrant->sample(45.f, 30.f), 1e-3f) << h;
+			}
+
+			const auto bilateral = candela_sampler::create(make_photo(IE_Data::Photo::Type_C, vert_angles, { 0.f, 45.f, 90.f, 135.f, 180.f }));
+			ASSERT_TRUE(bilateral);
+			EXPECT_EQ(bilateral->horz_folding(), detail::horz_symmetry::bilateral_0_180);
+			EXPECT_NEAR(bilateral->sample(45.f, 260.f), bilateral->sample(45.f, 100.f), 1e-3f);
+			EXPECT_NEAR(bilateral->sample(45.f, 100.f), expected(45.f, 100.f), 1e-2f);
+
+			const auto bilateral_90_270 = candela_sampler::create(make_photo(IE_Data::Photo::Type_C, vert_angles, { 90.f, 180.f, 270.f }));
+			ASSERT_TRUE(bilateral_90_270);
+			EXPECT_EQ(bilateral_90_270->horz_folding(), detail::horz_symmetry::bilateral_90_270);
+			EXPECT_NEAR(bilateral_90_270->sample(45.f, 45.f), bilateral_90_270->sample(45.f, 135.f), 1e-3f);
+			EXPECT_NEAR(bilateral_90_270->sample(45.f, 300.f), bilateral_90_270->sample(45.f, 240.f), 1e-3f);
+
+			// The circle is closed between the last plane and the first one
+			auto open_circle = make_photo(IE_Data::Photo::Type_C, vert_angles, { 0.f, 90.f, 180.f, 270.f });
+			const auto full = candela_sampler::create(open_circle);
+			ASSERT_TRUE(full);
+			EXPECT_EQ(full->horz_folding(), detail::horz_symmetry::full);
+			EXPECT_NEAR(full->sample(60.f, 315.f), 0.5f * (open_circle.candelas[3][2] + open_circle.candelas[0][2]), 1e-3f);
+			EXPECT_NEAR(full->sample(60.f, -45.f), full->sample(60.f, 315.f), 1e-3f);
+
+			const auto rotational = candela_sampler::create(make_photo(IE_Data::Photo::Type_C, vert_angles, { 0.f }));
+			ASSERT_TRUE(rotational);
+			EXPECT_EQ(rotational->horz_folding(), detail::horz_symmetry::rotational);
+			for (const auto h : { 0.f, 45.f, 200.f, -10.f }) {
+				EXPECT_NEAR(rotational->sample(75.f, h), expected(75.f, 0.f), 1e-2f);
+			}
+
+			// Types A and B starting at 0 are mirrored in both directions
+			const auto type_b = candela_sampler::create(make_photo(IE_Data::Photo::Type_B, { 0.f, 45.f, 90.f }, { 0.f, 45.f, 90.f }));
+			ASSERT_TRUE(type_b);
+			EXPECT_EQ(type_b->horz_folding(), detail::horz_symmetry::mirror);
+			EXPECT_NEAR(type_b->sample(-30.f, -60.f), type_b->sample(30.f, 60.f), 1e-3f);
+		}
+
+		if (1) {
+			// The directions outside of the vertical range have no intensity
+			const auto sampler = candela_sampler::create(make_photo(IE_Data::Photo::Type_C, { 0.f, 45.f, 90.f }, { 0.f }));
+			ASSERT_TRUE(sampler);
+			EXPECT_GT(sampler->sample(90.f, 0.f), 0.f);
+			EXPECT_EQ(sampler->sample(90.5f, 0.f), 0.f);
+			EXPECT_EQ(sampler->sample(-1.f, 0.f), 0.f);
+			EXPECT_EQ(sampler->sample(std::numeric_limits<float>::quiet_NaN(), 0.f), 0.f);
+		}
+
+		if (1) {
+			// Inconsistent grids are rejected
+			auto unsorted = make_photo(IE_Data::Photo::Type_C, { 0.f, 45.f, 90.f }, { 0.f, 90.f });
+			std::swap(unsorted.vert_angles[0], unsorted.vert_angles[1]);
+			EXPECT_FALSE(candela_sampler::create(unsorted));
+
+			auto mismatched = make_photo(IE_Data::Photo::Type_C, { 0.f, 45.f, 90.f }, { 0.f, 90.f });
+			mismatched.horz_angles.push_back(180.f);
+			EXPECT_FALSE(candela_sampler::create(mismatched));
+
+			EXPECT_FALSE(candela_sampler::create(IE_Data::Photo{}));
+		}
+
+		// The test profiles: exact at the grid nodes, and the batches match the single samples at every SIMD level
+		auto profiles = std::vector<IE_Data::Photo>{};
+		for (const auto& fname : find_ies_files("../test/test_ies_profiles", false, "_rescaled")) {
+			auto ies_stream = read_file_to_stream(fname);
+			ASSERT_TRUE(ies_stream);
+			if (auto data = convert_stream_to_data(*ies_stream)) {
+				profiles.push_back(std::move(data->photo));
+			}
+		}
+		profiles.push_back(make_photo(IE_Data::Photo::Type_C, { 0.f, 2.5f, 5.f, 10.f, 20.f, 40.f, 90.f }, { 0.f, 10.f, 30.f, 90.f }));
+		profiles.push_back(make_photo(IE_Data::Photo::Type_C, { 0.f, 10.f, 10.f, 90.f }, { 0.f, 90.f }));
+
+		auto vert_angles = std::vector<float>{};
+		auto horz_angles = std::vector<float>{};
+		auto state = uint32_t{ 12345 };
+		auto random = [&state](const float low, const float high) {
+			state = state * 1664525u + 1013904223u;
+			return low + (high - low) * static_cast<float>(state >> 8) / static_cast<float>(1u << 24);
+		};
+		for (auto i = 0; i < 1003; ++i) {
+			vert_angles.push_back(random(-100.f, 200.f));
+			horz_angles.push_back(random(-400.f, 400.f));
+		}
+
+		const auto default_level = active_simd_level();
+		for (const auto& photo : profiles) {
+			const auto sampler = candela_sampler::create(photo);
+			ASSERT_TRUE(sampler);
+
+			const auto max_candela = *std::max_element(photo.candelas.values().begin(), photo.candelas.values().end());
+			const auto tolerance = 1e-5f * std::max(max_candela, 1.f);
+
+			for (auto i = std::size_t{ 0 }; i < photo.horz_angles.size(); ++i) {
+				for (auto j = std::size_t{ 0 }; j < photo.vert_angles.size(); ++j) {
+					// The repeated angles are ambiguous
+					if ((j > 0 && photo.vert_angles[j] == photo.vert_angles[j - 1]) || (j + 1 < photo.vert_angles.size() && photo.vert_angles[j] == photo.vert_angles[j + 1])) {
+						continue;
+					}
+					EXPECT_NEAR(sampler->sample(photo.vert_angles[j], photo.horz_angles[i]), photo.candelas[i][j], tolerance);
+				}
+			}
+
+			auto reference = std::vector<float>(vert_angles.size());
+			for (auto i = std::size_t{ 0 }; i < vert_angles.size(); ++i) {
+				reference[i] = sampler->sample(vert_angles[i], horz_angles[i]);
+			}
+
+			for (const auto level : { simd_level::scalar, simd_level::sse4_2, simd_level::avx2, simd_level::avx512 }) {
+				if (set_simd_level(level) != level) {
+					continue;
+				}
+
+				auto candelas = std::vector<float>(vert_angles.size(), -1.f);
+				sampler->sample(vert_angles, horz_angles, candelas);
+				for (auto i = std::size_t{ 0 }; i < candelas.size(); ++i) {
+					EXPECT_NEAR(candelas[i], reference[i], tolerance) << vert_angles[i] << " " << horz_angles[i];
+				}
+			}
+		}
+
+		set_simd_level(default_level);
+	}
+
+	TEST(IesRescale, TextureBaker) {
+
+		using namespace ies_rescale;
+
+		if (1) {
+			// Half floats
+			EXPECT_EQ(float_to_half(1.f), 0x3C00);
+			EXPECT_EQ(float_to_half(-2.f), 0xC000);
+			EXPECT_EQ(float_to_half(0.1f), 0x2E66);
+			EXPECT_EQ(float_to_half(65504.f), 0x7BFF);
+			EXPECT_EQ(float_to_half(65520.f), 0x7C00);
+			EXPECT_EQ(float_to_half(5.9604645e-8f), 0x0001);
+			EXPECT_EQ(float_to_half(1e-9f), 0x0000);
+			EXPECT_EQ(float_to_half(1.f + 1.f / 2048.f), 0x3C00);	// Ties round to even
+			EXPECT_EQ(float_to_half(1.f + 3.f / 2048.f), 0x3C02);
+
+			for (auto i = 0u; i <= 0xFFFFu; ++i) {
+				const auto half = static_cast<uint16_t>(i);
+				const auto value = half_to_float(half);
+				if (std::isnan(value)) {
+					EXPECT_TRUE(std::isnan(half_to_float(float_to_half(value))));
+				}
+				else {
+					EXPECT_EQ(float_to_half(value), half) << i;
+				}
+			}
+		}
+
+		auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+		ASSERT_TRUE(ies_stream);
+		auto data = convert_stream_to_data(*ies_stream).value();
+		data.lamp.multiplier = 2.f;
+
+		const auto sampler = candela_sampler::create(data.photo);
+		ASSERT_TRUE(sampler);
+		const auto values = data.photo.candelas.values();
+		const auto peak = *std::max_element(values.begin(), values.end()) * data.lamp.multiplier;
+
+		auto texel = [](const baked_texture& texture, const std::size_t x, const std::size_t y) {
+			const auto* p = texture.row(y) + x * texel_size(texture.format);
+			auto value = 0.f;
+			switch (texture.format) {
+			case texel_format::float32:
+				std::memcpy(&value, p, sizeof(value));
+				break;
+			case texel_format::float16: {
+				auto half = uint16_t{ 0 };
+				std::memcpy(&half, p, sizeof(half));
+				value = half_to_float(half);
+				break;
+			}
+			case texel_format::unorm8:
+				value = *p / 255.f;
+				break;
+			}
+			return value * texture.scale;
+		};
+
+		auto options = texture_options{};
+		options.width = 91;
+		options.height = 37;
+		options.format = texel_format::float32;
+		options.normalize = false;
+
+		if (1) {
+			// The texels are the intensities at their centres
+			const auto texture = bake_texture(data, options);
+			ASSERT_TRUE(texture);
+			EXPECT_EQ(texture->width, 91u);
+			EXPECT_EQ(texture->height, 37u);
+			EXPECT_EQ(texture->scale, 1.f);
+			EXPECT_EQ(texture->texels.size(), 91u * 37u * 4u);
+
+			for (auto y = std::size_t{ 0 }; y < texture->height; ++y) {
+				for (auto x = std::size_t{ 0 }; x < texture->width; ++x) {
+					const auto expected = sampler->sample(2.f * x, 10.f * y) * data.lamp.multiplier;
+					EXPECT_NEAR(texel(*texture, x, y), expected, 1e-5f * peak) << x << " " << y;
+				}
+			}
+
+			// Normalized and quantized textures, baked on several threads
+			for (const auto format : { texel_format::float32, texel_format::float16, texel_format::unorm8 }) {
+				auto normalized_options = options;
+				normalized_options.normalize = true;
+				normalized_options.format = format;
+				normalized_options.num_threads = 4;
+
+				const auto normalized = bake_texture(data, normalized_options);
+				ASSERT_TRUE(normalized);
+				EXPECT_EQ(normalized->scale, peak);
+				EXPECT_EQ(normalized->texels.size(), 91u * 37u * texel_size(format));
+
+				const auto tolerance = format == texel_format::unorm8 ? peak / 255.f : format == texel_format::float16 ? peak / 1024.f : 1e-5f * peak;
+				for (auto y = std::size_t{ 0 }; y < texture->height; ++y) {
+					for (auto x = std::size_t{ 0 }; x < texture->width; ++x) {
+						EXPECT_NEAR(texel(*normalized, x, y), texel(*texture, x, y), tolerance);
+					}
+				}
+
+				normalized_options.num_threads = 1;
+				EXPECT_EQ(bake_texture(data, normalized_options)->texels, normalized->texels);
+			}
+		}
+
+		if (1) {
+			// The radial profile of a rotationally symmetric profile is any of its rows
+			auto symmetric_data = data;
+			symmetric_data.photo.num_horz_angles = 1;
+			symmetric_data.photo.horz_angles = { 0.f };
+			symmetric_data.photo.candelas = candela_matrix(1, data.photo.vert_angles.size(), 0.f);
+			std::copy(data.photo.candelas[0].begin(), data.photo.candelas[0].end(), symmetric_data.photo.candelas[0].begin());
+
+			const auto texture = bake_texture(symmetric_data, options);
+			const auto radial = bake_radial_profile(symmetric_data, options);
+			ASSERT_TRUE(texture && radial);
+			EXPECT_EQ(radial->height, 1u);
+			for (auto x = std::size_t{ 0 }; x < radial->width; ++x) {
+				EXPECT_NEAR(texel(*radial, x, 0), texel(*texture, x, 5), 1e-5f * peak);
+			}
+
+			// Otherwise it averages the horizontal angles
+			auto radial_options = options;
+			radial_options.height = 8;
+			radial_options.num_threads = 3;
+			const auto average = bake_radial_profile(data, radial_options);
+			ASSERT_TRUE(average);
+			for (auto x = std::size_t{ 0 }; x < average->width; x += 10) {
+				auto sum = 0.f;
+				for (auto i = 0; i < 8; ++i) {
+					sum += sampler->sample(2.f * x, 45.f * (i + 0.5f)) * data.lamp.multiplier;
+				}
+				EXPECT_NEAR(texel(*average, x, 0), sum / 8.f, 1e-5f * peak);
+			}
+		}
+
+		if (1) {
+			auto invalid_options = options;
+			invalid_options.width = 0;
+			EXPECT_FALSE(bake_texture(data, invalid_options));
+			EXPECT_FALSE(bake_radial_profile(data, invalid_options));
+
+			auto invalid_data = data;
+			invalid_data.photo.vert_angles.pop_back();
+			EXPECT_FALSE(bake_texture(invalid_data, options));
+		}
+	}
+
+	TEST(IesRescale, AtlasBuilder) {
+
+		using namespace ies_rescale;
+
+		auto profiles = std::vector<IE_Data>{};
+		auto names = std::vector<std::string>{};
+		for (const auto* name : { "Type C - 02", "Type C - 01", "Type B - 03", "Type B - 01" }) {
+			auto ies_stream = read_file_to_stream(std::string{ "../test/test_ies_profiles/" } + name + ".ies");
+			ASSERT_TRUE(ies_stream);
+			profiles.push_back(convert_stream_to_data(*ies_stream).value());
+			names.push_back(name);
+		}
+
+		// A profile that can't be baked gets an empty layer
+		profiles.push_back(IE_Data{});
+		names.push_back("Invalid");
+
+		auto options = texture_options{};
+		options.width = 33;
+		options.height = 17;
+		options.format = texel_format::float32;
+		options.num_threads = 3;
+
+		const auto atlas = build_profile_atlas(profiles, names, options);
+		ASSERT_TRUE(atlas);
+		ASSERT_EQ(atlas->index.num_layers(), profiles.size());
+		EXPECT_EQ(atlas->layer_size(), 33u * 17u * sizeof(float));
+		EXPECT_EQ(atlas->texels.size(), profiles.size() * atlas->layer_size());
+
+		if (1) {
+			// Every layer matches a single bake of its profile
+			for (auto i = std::size_t{ 0 }; i + 1 < profiles.size(); ++i) {
+				const auto texture = bake_texture(profiles[i], options);
+				ASSERT_TRUE(texture);
+				EXPECT_EQ(atlas->index.scales[i], texture->scale);
+				EXPECT_EQ(std::memcmp(atlas->layer(i), texture->texels.data(), atlas->layer_size()), 0) << names[i];
+				EXPECT_EQ(atlas->index.find(names[i]), i);
+			}
+
+			EXPECT_EQ(atlas->index.scales.back(), 0.f);
+			const auto* last = atlas->layer(profiles.size() - 1);
+			EXPECT_TRUE(std::all_of(last, last + atlas->layer_size(), [](const uint8_t byte) { return byte == 0; }));
+			EXPECT_FALSE(atlas->index.find("Type C - 03"));
+		}
+
+		if (1) {
+			// Mismatched and duplicate names
+			EXPECT_FALSE(build_profile_atlas(profiles, std::vector<std::string>(2, "Name"), options));
+			auto duplicates = names;
+			duplicates[1] = duplicates[0];
+			EXPECT_FALSE(build_profile_atlas(profiles, duplicates, options));
+		}
+
+		if (1) {
+			const auto texels_path = (fs::temp_directory_path() / "ies_rescale_atlas_test.bin").string();
+			const auto index_path = (fs::temp_directory_path() / "ies_rescale_atlas_test.iesx").string();
+			ASSERT_TRUE(write_profile_atlas(*atlas, texels_path, index_path));
+
+			EXPECT_EQ(fs::file_size(texels_path), atlas->texels.size());
+
+			const auto index = read_atlas_index(index_path);
+			ASSERT_TRUE(index);
+			EXPECT_EQ(index->width, 33u);
+			EXPECT_EQ(index->height, 17u);
+			EXPECT_EQ(index->format, texel_format::float32);
+			EXPECT_EQ(index->names(), atlas->index.names());
+			EXPECT_EQ(index->scales, atlas->index.scales);
+			for (auto i = std::size_t{ 0 }; i < names.size(); ++i) {
+				EXPECT_EQ(index->find(names[i]), i);
+			}
+
+			// Setting the names of an index keeps the lookup in sync
+			auto edited_index = *index;
+			edited_index.set_names({ "b", "c", "a" });
+			EXPECT_EQ(edited_index.find("a"), 2u);
+			EXPECT_EQ(edited_index.find("b"), 0u);
+			EXPECT_FALSE(edited_index.find(names[0]));
+			EXPECT_EQ(edited_index.sorted_layers(), (std::vector<uint32_t>{ 2, 0, 1 }));
+
+			// Corrupted indexes are rejected
+			auto buffer = convert_atlas_index_to_buffer(*index);
+			EXPECT_FALSE(convert_buffer_to_atlas_index(buffer.data(), buffer.size() - 1));
+			buffer[sizeof(atlas_index_header) + names.size() * sizeof(float)] = 0xFF;
+			EXPECT_FALSE(convert_buffer_to_atlas_index(buffer.data(), buffer.size()));
+
+			fs::remove(texels_path);
+			fs::remove(index_path);
+		}
+	}
+
+	TEST(IesRescale, Photometry) {
+
+		using namespace ies_rescale;
+
+		constexpr auto pi = 3.14159265358979323846f;
+
+		// A profile over uniform angle grids with the candela values given by a function of the angles (in degrees)
+		auto make_profile = [](const IE_Data::Photo::IE_Gonio_Type gonio_type, const float vert_min, const float vert_max, const int num_vert_angles,
+			const float horz_min, const float horz_max, const int num_horz_angles, auto candela) {
+			auto options = synthetic_profile_options{};
+			options.gonio_type = gonio_type;
+			options.num_vert_angles = num_vert_angles;
+			options.num_horz_angles = num_horz_angles;
+			auto data = generate_ies_profile(options);
+			data.lamp.multiplier = 1.f;
+
+			auto& photo = data.photo;
+			for (auto j = 0; j < num_vert_angles; ++j) {
+				photo.vert_angles[j] = num_vert_angles > 1 ? vert_min + (vert_max - vert_min) * j / (num_vert_angles - 1) : vert_min;
+			}
+			for (auto i = 0; i < num_horz_angles; ++i) {
+				photo.horz_angles[i] = num_horz_angles > 1 ? horz_min + (horz_max - horz_min) * i / (num_horz_angles - 1) : horz_min;
+			}
+			for (auto i = 0; i < num_horz_angles; ++i) {
+				for (auto j = 0; j < num_vert_angles; ++j) {
+					photo.candelas[i][j] = candela(photo.vert_angles[j], photo.horz_angles[i]);
+				}
+			}
+			return data;
+		};
+
+		auto isotropic = [](float, float) { return 1.f; };
+		auto lambertian = [](const float v, float) { return v < 90.f ? std::cos(v * pi / 180.f) : 0.f; };
+
+		for (const auto rule : { integration_rule::trapezoid, integration_rule::simpson }) {
+			const auto tolerance = rule == integration_rule::simpson ? 1e-4f : 2e-3f;
+
+			// An isotropic source of 1 cd emits 4 pi lumens, whatever the symmetries of the grid
+			for (const auto& [horz_max, num_horz_angles] : { std::pair{ 0.f, 1 }, std::pair{ 90.f, 10 }, std::pair{ 180.f, 19 }, std::pair{ 360.f, 37 }, std::pair{ 350.f, 36 } }) {
+				const auto data = make_profile(IE_Data::Photo::Type_C, 0.f, 180.f, 37, 0.f, horz_max, num_horz_angles, isotropic);
+				EXPECT_NEAR(luminous_flux(data, rule).value(), 4.f * pi, 4.f * pi * tolerance) << horz_max;
+			}
+
+			if (1) {
+				// Types A and B, over the full range and mirrored
+				const auto full = make_profile(IE_Data::Photo::Type_B, -90.f, 90.f, 37, -90.f, 90.f, 37, isotropic);
+				EXPECT_NEAR(luminous_flux(full, rule).value(), 2.f * pi, 2.f * pi * tolerance);
+				const auto mirrored = make_profile(IE_Data::Photo::Type_A, 0.f, 90.f, 19, 0.f, 90.f, 19, isotropic);
+				EXPECT_NEAR(luminous_flux(mirrored, rule).value(), 2.f * pi, 2.f * pi * tolerance);
+			}
+
+			if (1) {
+				// A Lambertian downlight of 1 cd emits pi lumens, with an odd number of vertical intervals and the multiplier applied
+				auto data = make_profile(IE_Data::Photo::Type_C, 0.f, 90.f, 30, 0.f, 0.f, 1, lambertian);
+				data.lamp.multiplier = 2.f;
+				EXPECT_NEAR(luminous_flux(data, rule).value(), 2.f * pi, 2.f * pi * tolerance);
+			}
+
+			if (1) {
+				// The zones partition the flux
+				const auto data = make_profile(IE_Data::Photo::Type_C, 0.f, 180.f, 181, 0.f, 90.f, 19, isotropic);
+				auto options = photometry_options{};
+				options.rule = rule;
+				const auto zones = zonal_lumens(data, options).value();
+				ASSERT_EQ(zones.size(), 18u);
+
+				auto sum = 0.f;
+				for (const auto& zone : zones) {
+					const auto expected = 2.f * pi * (std::cos(zone.vert_angle_min * pi / 180.f) - std::cos(zone.vert_angle_max * pi / 180.f));
+					EXPECT_NEAR(zone.lumens, expected, 1e-3f) << zone.vert_angle_min;
+					sum += zone.lumens;
+				}
+				EXPECT_NEAR(sum, 4.f * pi, 1e-3f);
+
+				// Zones that don't line up with the grid
+				options.zone_width = 25.f;
+				const auto wide_zones = zonal_lumens(data, options).value();
+				ASSERT_EQ(wide_zones.size(), 8u);
+				EXPECT_EQ(wide_zones.back().vert_angle_max, 180.f);
+				EXPECT_NEAR(wide_zones[1].lumens, 2.f * pi * (std::cos(25.f * pi / 180.f) - std::cos(50.f * pi / 180.f)), 1e-3f);
+			}
+
+			if (1) {
+				// Type B zones cover [-90, 90], with the lower half mirrored
+				const auto data = make_profile(IE_Data::Photo::Type_B, 0.f, 90.f, 19, -90.f, 90.f, 19, isotropic);
+				auto options = photometry_options{};
+				options.rule = rule;
+				options.zone_width = 30.f;
+				const auto zones = zonal_lumens(data, options).value();
+				ASSERT_EQ(zones.size(), 6u);
+				EXPECT_EQ(zones.front().vert_angle_min, -90.f);
+				EXPECT_NEAR(zones.front().lumens, zones.back().lumens, 1e-4f);
+			}
+		}
+
+		if (1) {
+			// The vectorized kernels add up to the scalar one
+			const auto data = make_profile(IE_Data::Photo::Type_C, 0.f, 180.f, 181, 0.f, 360.f, 361, [](const float v, const float h) {
+				return 100.f + 50.f * std::cos(v * pi / 90.f) * std::sin(h * pi / 180.f);
+			});
+
+			const auto default_level = active_simd_level();
+			set_simd_level(simd_level::scalar);
+			const auto scalar_flux = luminous_flux(data).value();
+			for (const auto level : { simd_level::sse4_2, simd_level::avx2, simd_level::avx512 }) {
+				set_simd_level(level);
+				EXPECT_NEAR(luminous_flux(data).value(), scalar_flux, scalar_flux * 1e-5f) << static_cast<int>(level);
+			}
+			set_simd_level(default_level);
+		}
+
+		if (1) {
+			// The summary of a real profile, and its flux through a rescale
+			auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+			ASSERT_TRUE(ies_stream);
+			const auto data = convert_stream_to_data(*ies_stream).value();
+
+			const auto summary = calc_photometry(data).value();
+			EXPECT_GT(summary.total_lumens, 0.f);
+			if (data.lamp.lumens_lamp > 0.f) {
+				EXPECT_EQ(summary.lamp_lumens, data.lamp.lumens_lamp * data.lamp.num_lamps);
+				ASSERT_TRUE(summary.efficiency);
+				EXPECT_NEAR(*summary.efficiency, summary.total_lumens / summary.lamp_lumens, 1e-6f);
+			}
+			else {
+				EXPECT_FALSE(summary.efficiency);
+			}
+
+			auto zone_sum = 0.f;
+			for (const auto& zone : summary.zones) {
+				zone_sum += zone.lumens;
+			}
+			EXPECT_NEAR(zone_sum, summary.total_lumens, summary.total_lumens * 1e-2f);
+
+			auto rescaled = ies_rescale::rescale_ies_data(data, 45.f).value();
+			const auto ratio = flux_ratio(data, rescaled).value();
+			EXPECT_GT(ratio, 0.f);
+			EXPECT_LT(ratio, 1.f);
+
+			// Preserving the intensities makes the vertical angles very uneven, which mustn't make the weights negative
+			const auto preserved_ratio = flux_ratio(data, ies_rescale::rescale_ies_data(data, 45.f, true).value()).value();
+			EXPECT_GT(preserved_ratio, 0.f);
+			EXPECT_LT(preserved_ratio, 1.f);
+
+			EXPECT_TRUE(renormalize_flux(rescaled, summary.total_lumens));
+			EXPECT_NEAR(luminous_flux(rescaled).value(), summary.total_lumens, summary.total_lumens * 1e-5f);
+
+			// In bulk
+			auto profiles = std::vector<IE_Data>{ ies_rescale::rescale_ies_data(data, 30.f).value(), ies_rescale::rescale_ies_data(data, 60.f).value(), IE_Data{} };
+			const auto originals = std::vector<IE_Data>{ data, data, data };
+			EXPECT_EQ(renormalize_flux(profiles, originals), 2u);
+			EXPECT_NEAR(flux_ratio(data, profiles[0]).value(), 1.f, 1e-5f);
+			EXPECT_NEAR(flux_ratio(data, profiles[1]).value(), 1.f, 1e-5f);
+		}
+
+		if (1) {
+			// Invalid data
+			EXPECT_FALSE(luminous_flux(IE_Data{}));
+			auto data = make_profile(IE_Data::Photo::Type_C, 0.f, 180.f, 19, 0.f, 360.f, 5, isotropic);
+			auto options = photometry_options{};
+			options.zone_width = 0.f;
+			EXPECT_FALSE(zonal_lumens(data, options));
+			std::swap(data.photo.vert_angles[0], data.photo.vert_angles[1]);
+			EXPECT_FALSE(luminous_flux(data));
+			data = make_profile(IE_Data::Photo::Type_C, 0.f, 180.f, 19, 0.f, 360.f, 5, [](float, float) { return 0.f; });
+			EXPECT_FALSE(renormalize_flux(data, 1000.f));
+		}
+	}
+
+	TEST(IesRescale, RescaleModes) {
+
+		using namespace ies_rescale;
+
+		auto num_checked = 0;
+		for (const auto& entry : fs::directory_iterator("../test/test_ies_profiles")) {
+			const auto fname = entry.path().string();
+			if (fname.find("_rescaled") != std::string::npos) {
+				continue;
+			}
+
+			auto ies_stream = read_file_to_stream(fname);
+			if (!ies_stream) {
+				continue;
+			}
+			const auto data = convert_stream_to_data(*ies_stream);
+			if (!data) {
+				continue;
+			}
+
+			const auto original_flux = luminous_flux(*data);
+			ASSERT_TRUE(original_flux) << fname;
+
+			for (const auto rescale_cone_angle : { 30.f, 90.f, 150.f, 180.f }) {
+				const auto foreshortened = ies_rescale::rescale_ies_data(*data, rescale_cone_angle, rescale_mode::foreshorten);
+				if (!foreshortened) {
+					continue;
+				}
+
+				// The first two modes are the ones of the preserve_intensity flag
+				EXPECT_EQ(*foreshortened, ies_rescale::rescale_ies_data(*data, rescale_cone_angle, false).value());
+				EXPECT_EQ(ies_rescale::rescale_ies_data(*data, rescale_cone_angle, rescale_mode::preserve_intensity).value(), ies_rescale::rescale_ies_data(*data, rescale_cone_angle, true).value());
+
+				// Preserving the flux foreshortens the profile, and only changes the multiplier on top of it
+				auto preserved = ies_rescale::rescale_ies_data(*data, rescale_cone_angle, rescale_mode::preserve_flux);
+				ASSERT_TRUE(preserved) << fname;
+				EXPECT_EQ(preserved->photo, foreshortened->photo);
+				EXPECT_NEAR(luminous_flux(*preserved).value(), *original_flux, *original_flux * 1e-4f) << fname << " " << rescale_cone_angle;
+				if (rescale_cone_angle == 180.f) {
+					EXPECT_NEAR(preserved->lamp.multiplier, data->lamp.multiplier, data->lamp.multiplier * 1e-5f);
+				}
+
+				preserved->lamp.multiplier = foreshortened->lamp.multiplier;
+				EXPECT_EQ(*preserved, *foreshortened);
+				++num_checked;
+			}
+		}
+		EXPECT_GT(num_checked, 0);
+
+		if (1) {
+			auto ies_stream = read_file_to_stream("../test/test_ies_profiles/Type C - 02.ies");
+			ASSERT_TRUE(ies_stream);
+			const auto data = convert_stream_to_data(*ies_stream).value();
+
+			// In place and from a moved profile
+			auto inplace = data;
+			EXPECT_TRUE(rescale_ies_data_inplace(inplace, 60.f, rescale_mode::preserve_flux));
+			auto moved = data;
+			EXPECT_EQ(ies_rescale::rescale_ies_data(std::move(moved), 60.f, rescale_mode::preserve_flux).value(), inplace);
+
+			// A cone angle of 0 leaves nowhere for the flux to go
+			EXPECT_TRUE(ies_rescale::rescale_ies_data(data, 0.f, rescale_mode::foreshorten));
+			EXPECT_FALSE(ies_rescale::rescale_ies_data(data, 0.f, rescale_mode::preserve_flux));
+
+			// The vertical angles of rescaled profiles can be out of order, which the profiles are left unchanged for
+			auto rescaled = ies_rescale::rescale_ies_data(data, 45.f).value();
+			ASSERT_FALSE(std::is_sorted(rescaled.photo.vert_angles.begin(), rescaled.photo.vert_angles.end()));
+			const auto copy = rescaled;
+			EXPECT_FALSE(rescale_ies_data_inplace(rescaled, 90.f, rescale_mode::preserve_flux));
+			EXPECT_EQ(rescaled, copy);
+		}
+	}
+
 } // namespace
 
 auto main(int argc, char** argv) -> int {
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "ies_rescale_batch.h"
+
+namespace {
+	void print_usage() {
+		std::cout <<
+			"Usage: ies_rescale_batch <input_dir> [options]\n"
+			"\n"
+			"Rescales all the IES profiles found in <input_dir> in parallel.\n"
+			"\n"
+			"Options:\n"
+			"  --angle <degrees>       The cone angle to rescale the profiles to, between 0 and 180 (default: 90)\n"
+			"  --preserve-intensity    Preserve the intensity values of the original profiles\n"
+			"  --preserve-flux         Preserve the total flux of the original profiles through the lamp multiplier\n"
+			"  --output <dir>          Write the rescaled profiles to <dir>, mirroring the input tree (default: next to the input files)\n"
+			"  --suffix <suffix>       Appended to the output file names (default: _rescaled)\n"
+			"  --threads <count>       The number of worker threads (default: one per hardware thread)\n"
+			"  --no-recursive          Don't walk the subdirectories of <input_dir>\n"
+			"  --pipeline              Run the reads, parsing, rescaling, serialization and writes as separate pipelined stages (not with --cache)\n"
+			"  --cache <dir>           Look the results up in and store them to a persistent cache in <dir>, shared with other runs\n"
+			"  --help                  Print this message\n";
+	}
+
+	auto parse_number(const std::string_view s, std::size_t& value) -> bool {
+		const auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+		return ec == std::errc{} && p == s.data() + s.size();
+	}
+
+	auto parse_number(const char* s, float& value) -> bool {
+#if defined(__cpp_lib_to_chars)
+		const auto last = s + std::strlen(s);
+		const auto [p, ec] = std::from_chars(s, last, value);
+		return ec == std::errc{} && p == last;
+#else
+		// The standard library lacks the floating point std::from_chars overloads (e.g. older libc++), so fall back to strtof()
+		auto p_end = static_cast<char*>(nullptr);
+		errno = 0;
+		value = std::strtof(s, &p_end);
+		return p_end != s && *p_end == '\0' && errno != ERANGE;
+#endif
+	}
+}
+
+auto main(int argc, char** argv) -> int {
+	std::cout << "ies_rescale v" << IES_RESCALE_VERSION << " batch rescaler\n\n";
+
+	auto input_dir = std::string{};
+	auto options = ies_rescale::batch_options{};
+
+	for (auto i = 1; i < argc; ++i) {
+		const auto arg = std::string_view{ argv[i] };
+		const auto has_value = i + 1 < argc;
+
+		if (arg == "--help" || arg == "-h") {
+			print_usage();
+			return 0;
+		}
+		else if (arg == "--angle" && has_value) {
+			if (!parse_number(argv[++i], options.rescale_cone_angle) || !(options.rescale_cone_angle >= 0.f && options.rescale_cone_angle <= 180.f)) {
+				std::cerr << "Invalid cone angle " << argv[i] << " (expected degrees between 0 and 180)\n";
+				return 1;
+			}
+		}
+		else if (arg == "--preserve-intensity") {
+			options.mode = ies_rescale::rescale_mode::preserve_intensity;
+		}
+		else if (arg == "--preserve-flux") {
+			options.mode = ies_rescale::rescale_mode::preserve_flux;
+		}
+		else if (arg == "--output" && has_value) {
+			options.output_dir = argv[++i];
+		}
+		else if (arg == "--suffix" && has_value) {
+			options.output_suffix = argv[++i];
+		}
+		else if (arg == "--threads" && has_value) {
+			if (!parse_number(argv[++i], options.num_threads)) {
+				std::cerr << "Invalid thread count " << argv[i] << "\n";
+				return 1;
+			}
+		}
+		else if (arg == "--no-recursive") {
+			options.recursive = false;
+		}
+		else if (arg == "--pipeline") {
+			options.pipelined = true;
+		}
+		else if (arg == "--cache" && has_value) {
+			options.cache_dir = argv[++i];
+		}
+		else if (input_dir.empty() && !arg.empty() && arg[0] != '-') {
+			input_dir = arg;
+		}
+		else {
+			std::cerr << "Unexpected argument " << arg << "\n\n";
+			print_usage();
+			return 1;
+		}
+	}
+
+	if (input_dir.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	if (options.pipelined && !options.cache_dir.empty()) {
+		std::cerr << "--pipeline can't be combined with --cache\n";
+		return 1;
+	}
+
+	const auto report = ies_rescale::rescale_ies_directory(input_dir, options);
+	if (!report) {
+		return 1;
+	}
+
+	for (const auto& fname : report->failed_files) {
+		std::cerr << "Failed to rescale " << fname << "\n";
+	}
+
+	std::cout << "Rescaled " << report->num_succeeded() << " of " << report->num_files << " profiles in " << report->seconds << " s ("
+		<< report->files_per_second() << " files/s)\n";
+
+	return report->num_failed == 0 ? 0 : 2;
+}